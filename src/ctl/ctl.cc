@@ -0,0 +1,142 @@
+/*
+ * File:   ctl.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file ctl.cc
+ * @brief Control client for Skyld AV.
+ *
+ * The command given on the command line is sent to the control socket of
+ * the daemon. The output of the command is printed to stdout, or to stderr
+ * if the command failed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "config.h"
+#include "ctl.h"
+
+/**
+ * @brief Prints help message and exits.
+ */
+static void help() {
+    printf("%s", HELP_TEXT);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Shows version information and exits.
+ */
+static void version() {
+    printf("Skyld AV, version %s\n", VERSION);
+    printf("%s", VERSION_TEXT);
+    exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[]) {
+    const char *socketPath = CONTROL_SOCKET;
+    struct sockaddr_un addr;
+    std::string command;
+    std::string response;
+    char buf[4096];
+    ssize_t len;
+    size_t pos;
+    int fd;
+    int i;
+
+    // Analyze command line options.
+    for (i = 1; i < argc && *argv[i] == '-'; i++) {
+        char *opt;
+
+        opt = argv[i] + 1;
+        if (*opt == '-') {
+            opt++;
+        }
+        switch (*opt) {
+            case 's':
+                if (++i >= argc) {
+                    help();
+                }
+                socketPath = argv[i];
+                break;
+            case 'v':
+                version();
+                break;
+            default:
+                help();
+        }
+    }
+    if (i >= argc) {
+        help();
+    }
+    for (; i < argc; i++) {
+        if (!command.empty()) {
+            command += " ";
+        }
+        command += argv[i];
+    }
+    command += "\n";
+
+    if (strlen(socketPath) >= sizeof (addr.sun_path)) {
+        fprintf(stderr, "Socket path '%s' is too long.\n", socketPath);
+        return EXIT_FAILURE;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof (addr))) {
+        fprintf(stderr, "Cannot connect to '%s': %s\n", socketPath,
+                strerror(errno));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    if (send(fd, command.data(), command.size(), MSG_NOSIGNAL)
+            != (ssize_t) command.size()) {
+        perror("send");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    while ((len = read(fd, buf, sizeof (buf))) > 0) {
+        response.append(buf, len);
+    }
+    close(fd);
+
+    // The first line is the status.
+    pos = response.find('\n');
+    if (pos == std::string::npos) {
+        fprintf(stderr, "No answer received.\n");
+        return EXIT_FAILURE;
+    }
+    if (response.compare(0, pos, "OK")) {
+        fprintf(stderr, "%s", response.c_str() + pos + 1);
+        return EXIT_FAILURE;
+    }
+    printf("%s", response.c_str() + pos + 1);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+/*
+ * File:   ctl.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file ctl.h
+ * @brief Control client for Skyld AV.
+ */
+
+#ifndef CTL_H
+#define	CTL_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+const char *CONTROL_SOCKET = "/run/skyldav/control.sock";
+
+const char *HELP_TEXT =
+    "Usage: skyldavctl [OPTION] COMMAND\n"
+    "Control client for Skyld AV on access virus scanner.\n\n"
+    "  -h               help\n"
+    "  -s <socket>      control socket, default /run/skyldav/control.sock\n"
+    "  -v               version\n\n"
+    "Commands:\n"
+    "  cache dump [FILE]        save the scan cache\n"
+    "  cache flush [PATH]       flush the scan cache, only for the device\n"
+    "                           of PATH if given\n"
+    "  exclude add PATH         exclude a path from scanning\n"
+    "  exclude list             list the excluded paths\n"
+    "  exclude remove PATH      scan an excluded path again\n"
+    "  reload-config            apply CACHE_MAX_SIZE, CLEAN_CACHE_ON_UPDATE,\n"
+    "                           EXCLUDE_PATH, and THREADS from the\n"
+    "                           configuration file\n"
+    "  reload-db                load updated virus databases\n"
+    "  stats                    show statistics\n"
+    "  threads [set N]          show or set the number of scan threads\n"
+    "  trace on|off             log the response to each file access\n\n"
+    "Licensed under the Apache License, Version 2.0.\n"
+    "Report errors to\n"
+    "Heinrich Schuchardt <xypron.glpk@gmx.de>\n";
+
+const char *VERSION_TEXT =
+    "Control client for Skyld AV on access virus scanner.\n\n"
+    "Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>\n\n"
+    "Licensed under the Apache License, Version 2.0 (the\n"
+    "\"License\"); you may not use this file except in compliance\n"
+    "with the License. You may obtain a copy of the License at\n\n"
+    "    http://www.apache.org/licenses/LICENSE-2.0\n\n"
+    "Unless required by applicable law or agreed to in writing,\n"
+    "software distributed under the License is distributed on an\n"
+    "\"AS IS\" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,\n"
+    "either express or implied. See the License for the specific\n"
+    "language governing permissions and limitations under the\n"
+    "License.\n";
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CTL_H */
@@ -0,0 +1,406 @@
+/*
+ * File:   BlocklistEngine.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file BlocklistEngine.cc
+ * @brief Blocks files by their SHA-256 digest.
+ */
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "BlocklistEngine.h"
+#include "Messaging.h"
+
+/**
+ * @brief Name reported for files found in the blocklist.
+ */
+#define SKYLD_BLOCKLIST_NAME "Skyldav.Blocklist.SHA256"
+
+/**
+ * @brief Size of the buffer for hashing files read via the file descriptor.
+ */
+#define SKYLD_HASH_BUFFER 65536
+
+/**
+ * @brief Number of index entries, one per value of the leading two bytes.
+ */
+#define SKYLD_INDEX_SIZE 65536
+
+/**
+ * @brief Sorted table of digests.
+ *
+ * The digests follow the structure in the same memory mapping.
+ */
+struct Table {
+    /**
+     * @brief Size of the memory mapping.
+     */
+    size_t mapSize;
+    /**
+     * @brief Number of digests.
+     */
+    size_t count;
+    /**
+     * @brief Position of the first digest for each value of the leading
+     * two bytes, followed by the number of digests.
+     */
+    uint32_t index[SKYLD_INDEX_SIZE + 1];
+};
+
+/**
+ * @brief Gets the digests of a table.
+ *
+ * @param t table
+ * @return digests
+ */
+static const unsigned char *digestsOf(const struct Table *t) {
+    return (const unsigned char *) (t + 1);
+}
+
+/**
+ * @brief Looks up a digest in a table.
+ *
+ * @param t table
+ * @param digest digest
+ * @return 1 if found
+ */
+static int contains(const struct Table *t, const unsigned char *digest) {
+    const unsigned char *digests = digestsOf(t);
+    unsigned int prefix = digest[0] << 8 | digest[1];
+    uint32_t low = t->index[prefix];
+    uint32_t high = t->index[prefix + 1];
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = memcmp(digests + (size_t) mid * SHA256_DIGEST_SIZE, digest,
+                         SHA256_DIGEST_SIZE);
+
+        if (cmp == 0) {
+            return 1;
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates the engine.
+ *
+ * @param e environment
+ */
+BlocklistEngine::BlocklistEngine(Environment *e)
+: ScanEngine("SHA-256 blocklist") {
+    env = e;
+    // Remember the status of the files before they are read.
+    changed();
+}
+
+/**
+ * @brief Checks if a blocklist file has changed.
+ *
+ * @return 0 = unchanged, 1 = changed
+ */
+int BlocklistEngine::changed() {
+    StringSet *files = env->getHashBlocklists();
+    StringSet::iterator it;
+    int ret = 0;
+
+    for (it = files->begin(); it != files->end(); ++it) {
+        struct stat statbuf;
+        FileState state;
+        FileState &old = states[**it];
+
+        memset(&state, 0, sizeof (state));
+        if (!stat((*it)->c_str(), &statbuf)) {
+            state.dev = statbuf.st_dev;
+            state.ino = statbuf.st_ino;
+            state.size = statbuf.st_size;
+            state.mtime = statbuf.st_mtim;
+        }
+        if (memcmp(&state, &old, sizeof (state))) {
+            old = state;
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Reads the blocklists into a new table.
+ *
+ * @return table
+ */
+void *BlocklistEngine::create() {
+    StringSet *files = env->getHashBlocklists();
+    StringSet::iterator it;
+    std::vector<Digest> digests;
+    std::stringstream msg;
+    struct Table *t;
+    size_t mapSize;
+    size_t i;
+    unsigned int prefix;
+
+    for (it = files->begin(); it != files->end(); ++it) {
+        if (readList(**it, digests)) {
+            throw FAILURE;
+        }
+    }
+    std::sort(digests.begin(), digests.end());
+    digests.erase(std::unique(digests.begin(), digests.end()),
+                  digests.end());
+    if (digests.size() > UINT32_MAX) {
+        Messaging::message(Messaging::ERROR, "Too many blocklist entries.");
+        throw FAILURE;
+    }
+
+    mapSize = sizeof (struct Table) + digests.size() * SHA256_DIGEST_SIZE;
+    t = (struct Table *) mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (t == MAP_FAILED) {
+        Messaging::error("mmap");
+        throw FAILURE;
+    }
+    t->mapSize = mapSize;
+    t->count = digests.size();
+    prefix = 0;
+    for (i = 0; i < digests.size(); i++) {
+        unsigned int p = digests[i].bytes[0] << 8 | digests[i].bytes[1];
+
+        while (prefix <= p) {
+            t->index[prefix++] = (uint32_t) i;
+        }
+        memcpy((unsigned char *) digestsOf(t) + i * SHA256_DIGEST_SIZE,
+               digests[i].bytes, SHA256_DIGEST_SIZE);
+    }
+    while (prefix <= SKYLD_INDEX_SIZE) {
+        t->index[prefix++] = (uint32_t) digests.size();
+    }
+    // The table is not changed anymore.
+    mprotect(t, mapSize, PROT_READ);
+
+    msg << "SHA-256 blocklist with " << t->count << " digests loaded";
+    if (Sha256::isAccelerated()) {
+        msg << ", using SHA instructions";
+    }
+    msg << ".";
+    Messaging::message(Messaging::INFORMATION, msg.str());
+    return t;
+}
+
+/**
+ * @brief Destroys a table.
+ *
+ * @param db table
+ */
+void BlocklistEngine::destroy(void *db) {
+    struct Table *t = (struct Table *) db;
+
+    munmap(t, t->mapSize);
+}
+
+/**
+ * @brief Gets the directories to watch for database updates.
+ *
+ * @param dirs receives the directories of the blocklist files
+ */
+void BlocklistEngine::getDirectories(std::vector<std::string> &dirs) {
+    StringSet *files = env->getHashBlocklists();
+    StringSet::iterator it;
+
+    for (it = files->begin(); it != files->end(); ++it) {
+        size_t pos = (*it)->rfind('/');
+        std::string dir;
+
+        if (pos == std::string::npos) {
+            dir = ".";
+        } else if (pos == 0) {
+            dir = "/";
+        } else {
+            dir = (*it)->substr(0, pos);
+        }
+        if (std::find(dirs.begin(), dirs.end(), dir) == dirs.end()) {
+            dirs.push_back(dir);
+        }
+    }
+}
+
+/**
+ * @brief Calculates the digest of a file.
+ *
+ * @param job file to be scanned
+ * @param digest receives the digest
+ * @return success = 0
+ */
+int BlocklistEngine::hashFile(const struct ScanJob *job,
+                              unsigned char *digest) {
+    Sha256 sha;
+    char *buf;
+    off_t pos = 0;
+
+    if (job->data != NULL) {
+        Sha256::hash(job->data, job->size, digest);
+        // Zeros read from a truncated mapping give a wrong digest.
+        return job->map != NULL && job->map->isTruncated();
+    }
+    buf = (char *) malloc(SKYLD_HASH_BUFFER);
+    if (buf == NULL) {
+        return 1;
+    }
+    while (1) {
+        ssize_t len;
+
+        len = pread(job->fd, buf, SKYLD_HASH_BUFFER, pos);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            free(buf);
+            return 1;
+        }
+        if (len == 0) {
+            break;
+        }
+        sha.update(buf, len);
+        pos += len;
+    }
+    free(buf);
+    sha.final(digest);
+    return 0;
+}
+
+/**
+ * @brief Reads the digests of a blocklist file.
+ *
+ * @param filename blocklist file
+ * @param digests receives the digests
+ * @return success = 0
+ */
+int BlocklistEngine::readList(const std::string &filename,
+                              std::vector<Digest> &digests) {
+    std::ifstream file(filename.c_str());
+    std::string line;
+    unsigned long invalid = 0;
+
+    if (!file.is_open()) {
+        Messaging::message(Messaging::ERROR,
+                           "Cannot open blocklist \"" + filename + "\".");
+        return 1;
+    }
+    while (std::getline(file, line)) {
+        Digest digest;
+        size_t start;
+        size_t i;
+
+        start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        for (i = 0; i < 2 * SHA256_DIGEST_SIZE; i++) {
+            if (start + i >= line.size() || !isxdigit(line[start + i])) {
+                break;
+            }
+        }
+        if (i < 2 * SHA256_DIGEST_SIZE || (start + i < line.size()
+                                           && isalnum(line[start + i]))) {
+            invalid++;
+            continue;
+        }
+        for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+            std::string byte = line.substr(start + 2 * i, 2);
+
+            digest.bytes[i] = (unsigned char) strtoul(byte.c_str(), NULL,
+                                                      16);
+        }
+        digests.push_back(digest);
+    }
+    if (file.bad()) {
+        Messaging::message(Messaging::ERROR,
+                           "Cannot read blocklist \"" + filename + "\".");
+        return 1;
+    }
+    if (invalid) {
+        std::stringstream msg;
+
+        msg << "Blocklist \"" << filename << "\": " << invalid
+            << " invalid lines ignored.";
+        Messaging::message(Messaging::WARNING, msg.str());
+    }
+    return 0;
+}
+
+/**
+ * @brief Looks up the digest of a file.
+ *
+ * Partial scans are not judged, as the digest requires the whole file.
+ *
+ * @param db table
+ * @param job file to be scanned
+ * @param virname receives the name of the match
+ * @return VIRUS if the digest is blocked, else NONE
+ */
+int BlocklistEngine::scanWith(void *db, const struct ScanJob *job,
+                              std::string &virname) {
+    const struct Table *t = (const struct Table *) db;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+
+    if (t->count == 0 || job->partial || hashFile(job, digest)) {
+        return NONE;
+    }
+    if (!contains(t, digest)) {
+        return NONE;
+    }
+    virname = SKYLD_BLOCKLIST_NAME;
+    return VIRUS;
+}
+
+/**
+ * @brief Gets the version of a table.
+ *
+ * The version is derived from the digests, so that unchanged lists keep
+ * their version.
+ *
+ * @param db table
+ * @return version, 0 for an empty table
+ */
+unsigned int BlocklistEngine::version(void *db) {
+    const struct Table *t = (const struct Table *) db;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+
+    if (t->count == 0) {
+        return 0;
+    }
+    Sha256::hash(digestsOf(t), t->count * SHA256_DIGEST_SIZE, digest);
+    return (unsigned int) digest[0] << 24 | digest[1] << 16
+            | digest[2] << 8 | digest[3];
+}
+
+/**
+ * @brief Releases the table.
+ */
+BlocklistEngine::~BlocklistEngine() {
+    unload();
+}
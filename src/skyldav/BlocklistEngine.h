@@ -0,0 +1,122 @@
+/*
+ * File:   BlocklistEngine.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file BlocklistEngine.h
+ * @brief Blocks files by their SHA-256 digest.
+ */
+#ifndef BLOCKLISTENGINE_H
+#define	BLOCKLISTENGINE_H
+
+#include <map>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "Environment.h"
+#include "ScanEngine.h"
+#include "Sha256.h"
+
+/**
+ * @brief Blocks files by their SHA-256 digest.
+ *
+ * The digests are read from the files configured with HASH_BLOCKLIST, one
+ * digest in hexadecimal notation per line. Anything following the digest
+ * on a line, e.g. the file name in the output of sha256sum, is ignored as
+ * are empty lines and lines starting with '#'.
+ *
+ * The database is a sorted table of the digests in a read-only memory
+ * mapping, indexed by the leading two bytes of the digests. A file is
+ * either found in the table, or the engine gives no verdict.
+ */
+class BlocklistEngine : public ScanEngine {
+public:
+    BlocklistEngine(Environment *);
+    virtual void getDirectories(std::vector<std::string> &);
+    virtual ~BlocklistEngine();
+protected:
+    virtual int changed();
+    virtual void *create();
+    virtual void destroy(void *db);
+    virtual int scanWith(void *db, const struct ScanJob *,
+                         std::string &virname);
+    virtual unsigned int version(void *db);
+private:
+    /**
+     * @brief Digest as read from a blocklist.
+     */
+    struct Digest {
+        /**
+         * @brief Bytes of the digest.
+         */
+        unsigned char bytes[SHA256_DIGEST_SIZE];
+
+        /**
+         * @brief Compares two digests.
+         * @param other right digest
+         * @return this digest is less than the other one
+         */
+        bool operator<(const Digest &other) const {
+            return memcmp(bytes, other.bytes, sizeof (bytes)) < 0;
+        }
+
+        /**
+         * @brief Compares two digests.
+         * @param other right digest
+         * @return the digests are equal
+         */
+        bool operator==(const Digest &other) const {
+            return !memcmp(bytes, other.bytes, sizeof (bytes));
+        }
+    };
+
+    /**
+     * @brief Status of a blocklist file.
+     */
+    struct FileState {
+        /**
+         * @brief Device.
+         */
+        dev_t dev;
+        /**
+         * @brief Inode.
+         */
+        ino_t ino;
+        /**
+         * @brief Size.
+         */
+        off_t size;
+        /**
+         * @brief Last modification.
+         */
+        struct timespec mtime;
+    };
+
+    /**
+     * @brief Environment.
+     */
+    Environment *env;
+    /**
+     * @brief Status of the blocklist files when last checked.
+     */
+    std::map<std::string, FileState> states;
+
+    int hashFile(const struct ScanJob *, unsigned char *digest);
+    static int readList(const std::string &, std::vector<Digest> &);
+};
+
+#endif	/* BLOCKLISTENGINE_H */
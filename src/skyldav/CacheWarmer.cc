@@ -0,0 +1,305 @@
+/*
+ * File:   CacheWarmer.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file CacheWarmer.cc
+ * @brief Fills the scan cache in the background.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iomanip>
+#include <sched.h>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+#include "CacheWarmer.h"
+#include "Messaging.h"
+
+/**
+ * @brief Maximum size of files scanned for warming the cache.
+ */
+#define SKYLD_WARM_MAX_SIZE 0x4000000
+
+/**
+ * @brief I/O priority class idle, see linux/ioprio.h.
+ */
+#define SKYLD_IOPRIO_CLASS_IDLE 3
+
+/**
+ * @brief Shift of the I/O priority class, see linux/ioprio.h.
+ */
+#define SKYLD_IOPRIO_CLASS_SHIFT 13
+
+/**
+ * @brief ioprio_set() for a single thread, see linux/ioprio.h.
+ */
+#define SKYLD_IOPRIO_WHO_PROCESS 1
+
+/**
+ * @brief Creates the cache warmer and starts the warmer thread.
+ *
+ * @param env environment
+ * @param vs virus scanner
+ * @param threadPool thread pool handling scan requests
+ * @param paths files to be scanned first in the given order
+ */
+CacheWarmer::CacheWarmer(Environment *env, VirusScan *vs,
+                         ThreadPool *threadPool,
+                         const std::vector<std::string> &paths) {
+    e = env;
+    hotFiles = paths;
+    virusScan = vs;
+    tp = threadPool;
+    files = 0;
+    cached = 0;
+    hits = 0;
+    misses = 0;
+    status = RUNNING;
+    started = 0;
+    if (pthread_create(&thread, NULL, run, this)) {
+        Messaging::message(Messaging::ERROR,
+                           "Cannot create thread for warming the cache.");
+        status = STOPPED;
+        return;
+    }
+    started = 1;
+    pthread_setname_np(thread, "skyldav-w");
+}
+
+/**
+ * @brief Waits while scan requests are queued.
+ */
+void CacheWarmer::pause() {
+    struct timespec interval = {
+        0,
+        10000000
+    };
+
+    while (status == RUNNING && tp->getWorklistSize() > 0) {
+        nanosleep(&interval, NULL);
+    }
+}
+
+/**
+ * @brief Warms the cache for a directory tree.
+ *
+ * Symbolic links inside the tree are not followed.
+ *
+ * @param path file or directory
+ */
+void CacheWarmer::walk(const char *path) {
+    std::vector<std::string> stack;
+    char *absolute;
+
+    absolute = realpath(path, NULL);
+    if (absolute == NULL) {
+        Messaging::error(std::string("Cannot access '") + path + "'");
+        return;
+    }
+    stack.push_back(absolute);
+    free(absolute);
+
+    while (status == RUNNING && !stack.empty()) {
+        std::string dir = stack.back();
+        std::string prefix;
+        DIR *dp;
+        struct dirent *entry;
+
+        stack.pop_back();
+        if (e->isExcluded(dir + "/")) {
+            continue;
+        }
+        dp = opendir(dir.c_str());
+        if (dp == NULL) {
+            if (errno == ENOTDIR) {
+                // A file was configured.
+                warmFile(AT_FDCWD, dir.c_str());
+            }
+            continue;
+        }
+        prefix = dir;
+        if (*prefix.rbegin() != '/') {
+            prefix += "/";
+        }
+        while (status == RUNNING && (entry = readdir(dp))) {
+            unsigned char type = entry->d_type;
+
+            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+                continue;
+            }
+            if (type == DT_UNKNOWN) {
+                struct stat statbuf;
+
+                if (fstatat(dirfd(dp), entry->d_name, &statbuf,
+                            AT_SYMLINK_NOFOLLOW)) {
+                    continue;
+                }
+                if (S_ISDIR(statbuf.st_mode)) {
+                    type = DT_DIR;
+                } else if (S_ISREG(statbuf.st_mode)) {
+                    type = DT_REG;
+                }
+            }
+            if (type == DT_DIR) {
+                stack.push_back(prefix + entry->d_name);
+            } else if (type == DT_REG
+                       && !e->isExcluded(prefix + entry->d_name)) {
+                pause();
+                warmFile(dirfd(dp), entry->d_name);
+            }
+        }
+        closedir(dp);
+    }
+}
+
+/**
+ * @brief Scans a file unless it is cached.
+ *
+ * @param dirfd directory file descriptor or AT_FDCWD
+ * @param name file name relative to the directory
+ */
+void CacheWarmer::warmFile(const int dirfd, const char *name) {
+    int fd;
+    int flags = O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_NONBLOCK | O_CLOEXEC;
+    struct stat statbuf;
+
+    // Do not change the access time.
+    fd = openat(dirfd, name, flags | O_NOATIME);
+    if (fd == -1 && errno == EPERM) {
+        fd = openat(dirfd, name, flags);
+    }
+    if (fd == -1) {
+        return;
+    }
+    if (0 == fstat(fd, &statbuf) && S_ISREG(statbuf.st_mode)
+            && statbuf.st_size <= SKYLD_WARM_MAX_SIZE) {
+        if (e->getScanCache()->isCached(&statbuf)) {
+            cached++;
+        } else {
+            switch (virusScan->scan(fd)) {
+                case VirusScan::SCANOK:
+                    e->getScanCache()->add(&statbuf, FAN_ALLOW, 1);
+                    files++;
+                    break;
+                case VirusScan::SCANSKIPPED:
+                    // No database loaded.
+                    break;
+                default:
+                    e->getScanCache()->add(&statbuf, FAN_DENY, 1);
+                    files++;
+            }
+        }
+    }
+    close(fd);
+}
+
+/**
+ * @brief Warmer thread.
+ *
+ * @param cacheWarmer cache warmer
+ * @return NULL
+ */
+void *CacheWarmer::run(void *cacheWarmer) {
+    CacheWarmer *cw = static_cast<CacheWarmer *> (cacheWarmer);
+    StringSet::iterator pos;
+    std::vector<std::string>::iterator file;
+    struct sched_param param;
+    struct timespec start;
+    struct timespec end;
+    unsigned long long h;
+    unsigned long long m;
+
+    // Only use spare CPU and I/O capacity.
+    memset(&param, 0, sizeof (param));
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param)) {
+        Messaging::message(Messaging::WARNING, "Cannot set idle "
+                           "scheduling for warming the cache.");
+    }
+    if (syscall(SYS_ioprio_set, SKYLD_IOPRIO_WHO_PROCESS, 0,
+                SKYLD_IOPRIO_CLASS_IDLE << SKYLD_IOPRIO_CLASS_SHIFT)) {
+        Messaging::error("Cannot set I/O priority for warming the cache");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cw->e->getScanCache()->getStatistics(&h, &m);
+    for (file = cw->hotFiles.begin();
+            file != cw->hotFiles.end() && cw->status == RUNNING; ++file) {
+        if (!cw->e->isExcluded(*file)) {
+            cw->pause();
+            cw->warmFile(AT_FDCWD, file->c_str());
+        }
+    }
+    for (pos = cw->e->getWarmPaths()->begin();
+            pos != cw->e->getWarmPaths()->end() && cw->status == RUNNING;
+            ++pos) {
+        cw->walk((*pos)->c_str());
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    cw->e->getScanCache()->getStatistics(&cw->hits, &cw->misses);
+
+    if (cw->status == RUNNING) {
+        std::stringstream msg;
+
+        h = cw->hits - h;
+        m = cw->misses - m;
+        msg << "Cache warmed in " << std::fixed << std::setprecision(1)
+            << (end.tv_sec - start.tv_sec)
+            + (end.tv_nsec - start.tv_nsec) / 1000000000.
+            << " s, files scanned " << cw->files
+            << ", already cached " << cw->cached
+            << ". Cache hit rate during warm-up "
+            << (h + m ? 100 * h / (h + m) : 0) << " %.";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+    cw->status = STOPPED;
+    return NULL;
+}
+
+/**
+ * @brief Stops the warmer thread.
+ */
+CacheWarmer::~CacheWarmer() {
+    int completed = status == STOPPED;
+
+    if (!started) {
+        return;
+    }
+    if (status != STOPPED) {
+        status = STOPPING;
+    }
+    pthread_join(thread, NULL);
+    if (completed) {
+        std::stringstream msg;
+        unsigned long long h;
+        unsigned long long m;
+
+        e->getScanCache()->getStatistics(&h, &m);
+        h -= hits;
+        m -= misses;
+        msg << "Cache hit rate after warm-up "
+            << (h + m ? 100 * h / (h + m) : 0) << " %.";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+}
@@ -0,0 +1,111 @@
+/*
+ * File:   CacheWarmer.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file CacheWarmer.h
+ * @brief Fills the scan cache in the background.
+ */
+#ifndef CACHEWARMER_H
+#define	CACHEWARMER_H
+
+#include <pthread.h>
+#include <string>
+#include <time.h>
+#include <vector>
+#include "Environment.h"
+#include "ThreadPool.h"
+#include "VirusScan.h"
+
+/**
+ * @brief Fills the scan cache in the background.
+ *
+ * A thread with idle CPU and I/O priority scans a list of files in the
+ * given order, then walks the configured warm paths. Files already cached
+ * are skipped. The thread pauses while scan requests are waiting in the
+ * thread pool.
+ */
+class CacheWarmer {
+public:
+    CacheWarmer(Environment *, VirusScan *, ThreadPool *,
+                const std::vector<std::string> &);
+    virtual ~CacheWarmer();
+private:
+    /**
+     * @brief Status of the warmer thread.
+     */
+    enum Status {
+        RUNNING,
+        STOPPING,
+        STOPPED
+    };
+
+    /**
+     * @brief Environment.
+     */
+    Environment *e;
+    /**
+     * @brief Virus scanner.
+     */
+    VirusScan *virusScan;
+    /**
+     * @brief Thread pool handling scan requests.
+     */
+    ThreadPool *tp;
+    /**
+     * @brief Files to be scanned before the warm paths.
+     */
+    std::vector<std::string> hotFiles;
+    /**
+     * @brief Warmer thread.
+     */
+    pthread_t thread;
+    /**
+     * @brief Status of the warmer thread.
+     */
+    volatile enum Status status;
+    /**
+     * @brief The warmer thread has been created.
+     */
+    int started;
+    /**
+     * @brief Number of files scanned.
+     */
+    unsigned long long files;
+    /**
+     * @brief Number of files already cached.
+     */
+    unsigned long long cached;
+    /**
+     * @brief Cache hits when warming was completed.
+     */
+    unsigned long long hits;
+    /**
+     * @brief Cache misses when warming was completed.
+     */
+    unsigned long long misses;
+
+    void pause();
+    void walk(const char *);
+    void warmFile(const int dirfd, const char *name);
+    static void *run(void *);
+
+    // Do not allow copying.
+    CacheWarmer(const CacheWarmer&);
+};
+
+#endif	/* CACHEWARMER_H */
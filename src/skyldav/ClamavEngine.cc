@@ -0,0 +1,414 @@
+/*
+ * File:   ClamavEngine.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ClamavEngine.cc
+ * @brief Scans files with libclamav.
+ */
+#include <cstring>
+#include <ctime>
+#include <malloc.h>
+#include <sstream>
+#include <unistd.h>
+#include "ClamavEngine.h"
+#include "Messaging.h"
+
+/**
+ * @brief Initializes libclamav.
+ *
+ * @param e environment
+ */
+ClamavEngine::ClamavEngine(Environment *e) : ScanEngine("ClamAV") {
+    int ret;
+
+    env = e;
+    ret = cl_init(CL_INIT_DEFAULT);
+    if (ret != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "cl_init() error: " << cl_strerror(ret);
+        Messaging::message(Messaging::ERROR, msg.str());
+        throw FAILURE;
+    }
+    memset(&dbstat, 0, sizeof (struct cl_stat));
+    cl_statinidir(cl_retdbdir(), &dbstat);
+}
+
+/**
+ * @brief Checks if the database has changed.
+ *
+ * @return 0 = unchanged, 1 = changed
+ */
+int ClamavEngine::changed() {
+    int ret = 0;
+    if (cl_statchkdir(&dbstat) == 1) {
+        ret = 1;
+        cl_statfree(&dbstat);
+        cl_statinidir(cl_retdbdir(), &dbstat);
+    }
+    return ret;
+}
+
+/**
+ * @brief Creates a new virus scan engine.
+ *
+ * The scan workers are started after the engine is compiled, so that they
+ * share its memory.
+ *
+ * @return database
+ */
+void *ClamavEngine::create() {
+    int ret;
+    unsigned int sigs;
+    cl_engine *e;
+    Database *db;
+
+    Messaging::message(Messaging::DEBUG, "Loading virus database");
+    e = cl_engine_new();
+    if (e == NULL) {
+        Messaging::message(Messaging::ERROR,
+                           "Can't create new virus scan engine.");
+        throw FAILURE;
+    }
+    setLimits(e);
+    // sigs must be zero before calling cl_load.
+    sigs = 0;
+    ret = cl_load(cl_retdbdir(), e, &sigs, CL_DB_STDOPT);
+    if (ret != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "cl_retdbdir() error: " << cl_strerror(ret);
+        Messaging::message(Messaging::ERROR, msg.str());
+        cl_engine_free(e);
+        throw FAILURE;
+    } else {
+        std::stringstream msg;
+        msg << sigs << "  signatures loaded";
+        Messaging::message(Messaging::DEBUG, msg.str());
+    }
+    if ((ret = cl_engine_compile(e)) != CL_SUCCESS) {
+        std::stringstream msg;
+        msg << "cl_engine_compile() error: " << cl_strerror(ret);
+        Messaging::message(Messaging::ERROR, msg.str());
+        cl_engine_free(e);
+        throw FAILURE;
+    }
+    do {
+        int err;
+        time_t db_time;
+        uint version;
+        std::stringstream msg;
+        char buffer[80];
+        struct tm *timeinfo;
+        version = (uint) cl_engine_get_num(e, CL_ENGINE_DB_VERSION, &err);
+        if (err != CL_SUCCESS) {
+            break;
+        }
+        db_time = (time_t) cl_engine_get_num(e, CL_ENGINE_DB_TIME, &err);
+        if (err != CL_SUCCESS) {
+            break;
+        }
+        timeinfo = gmtime(&db_time);
+        strftime(buffer, sizeof (buffer), "%F %T UTC", timeinfo);
+        msg << "ClamAV database version " << version << ", " << buffer;
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    } while (0);
+    db = new Database();
+    db->e = e;
+    db->owner = this;
+    db->workers = NULL;
+    if (env->getScanWorkers()) {
+        try {
+            db->workers = new ScanWorkers(env, scanInWorker, db);
+        } catch (ScanWorkers::Status &ex) {
+            Messaging::message(Messaging::ERROR,
+                               "Cannot start scan workers, scanning in "
+                               "process.");
+        }
+    }
+    return db;
+}
+
+/**
+ * Destroys virus scan engine.
+ * @param db database
+ */
+void ClamavEngine::destroy(void *db) {
+    Database *d = (Database *) db;
+    int ret;
+
+    delete d->workers;
+    ret = cl_engine_free(d->e);
+    if (ret != 0) {
+        std::stringstream msg;
+        msg << "cl_engine_free() error: " << cl_strerror(ret);
+        Messaging::message(Messaging::ERROR, msg.str());
+    }
+    delete d;
+}
+
+/**
+ * @brief Gets the directories to watch for database updates.
+ *
+ * @param dirs receives the ClamAV database directory
+ */
+void ClamavEngine::getDirectories(std::vector<std::string> &dirs) {
+    dirs.push_back(cl_retdbdir());
+}
+
+/**
+ * @brief Scans the content of a file in memory.
+ *
+ * If a mapped file is truncated during the scan, the zeros read instead of
+ * the lost content could hide a virus. The file is scanned again via the
+ * file descriptor then.
+ *
+ * @param fd file descriptor
+ * @param data content of the file
+ * @param size size of the content
+ * @param map memory mapping of the file, NULL if read into a buffer
+ * @param virname receives the name of the virus found
+ * @param e engine
+ * @param options scan options
+ * @return ClamAV return code
+ */
+int ClamavEngine::scanMemory(const int fd, const char *data,
+                             const size_t size, FileMap *map,
+                             const char **virname,
+                             const struct cl_engine *e,
+                             struct cl_scan_options *options) {
+    cl_fmap_t *fmap;
+    int ret;
+
+    fmap = cl_fmap_open_memory(data, size);
+    if (fmap == NULL) {
+        return cl_scandesc(fd, NULL, virname, NULL, e, options);
+    }
+    ret = cl_scanmap_callback(fmap, NULL, virname, NULL, e, options, NULL);
+    cl_fmap_close(fmap);
+    if (map != NULL && map->isTruncated()) {
+        Messaging::message(Messaging::DEBUG,
+                           "File truncated while scanning, rescanning.");
+        ret = cl_scandesc(fd, NULL, virname, NULL, e, options);
+    }
+    return ret;
+}
+
+/**
+ * @brief Scans the head and the tail of a file.
+ *
+ * @param job file to be scanned
+ * @param virname receives the name of the virus found
+ * @param e engine
+ * @param options scan options
+ * @return ClamAV return code
+ */
+int ClamavEngine::scanPartial(const struct ScanJob *job, const char **virname,
+                              const struct cl_engine *e,
+                              struct cl_scan_options *options) {
+    size_t bytes = env->getPartialScanBytes();
+    off_t offset[2] = {0, job->size - (off_t) bytes};
+    char *buf = NULL;
+    int ret = CL_CLEAN;
+    int i;
+
+    if (job->data == NULL) {
+        buf = (char *) malloc(bytes);
+        if (buf == NULL) {
+            return cl_scandesc(job->fd, NULL, virname, NULL, e, options);
+        }
+    }
+    for (i = 0; i < 2 && ret != CL_VIRUS; i++) {
+        const char *part;
+        ssize_t len;
+
+        if (job->data != NULL) {
+            part = job->data + offset[i];
+            len = bytes;
+        } else {
+            part = buf;
+            len = pread(job->fd, buf, bytes, offset[i]);
+        }
+        if (len > 0) {
+            ret = scanMemory(job->fd, part, len, job->map, virname, e,
+                             options);
+        }
+    }
+    free(buf);
+    return ret;
+}
+
+/**
+ * @brief Scans a file with an engine.
+ *
+ * @param e engine
+ * @param job file to be scanned
+ * @param parseOptions parse options of the scan profile
+ * @param virname receives the name of the virus found
+ * @return ClamAV return code
+ */
+int ClamavEngine::scanDatabase(const struct cl_engine *e,
+                               const struct ScanJob *job,
+                               const unsigned int parseOptions,
+                               const char **virname) {
+    struct cl_scan_options options;
+
+    memset(&options, 0, sizeof (options));
+    options.parse = parseOptions;
+    // Report exceeded limits as heuristic match. Other heuristic alerts
+    // stay disabled.
+    options.heuristic = CL_SCAN_HEURISTIC_EXCEEDS_MAX;
+
+    if (job->partial) {
+        return scanPartial(job, virname, e, &options);
+    } else if (job->data != NULL) {
+        return scanMemory(job->fd, job->data, job->size, job->map, virname,
+                          e, &options);
+    }
+    return cl_scandesc(job->fd, NULL, virname, NULL, e, &options);
+}
+
+/**
+ * @brief Scans a file in a scan worker process.
+ *
+ * @param db database
+ * @param job file to be scanned
+ * @param parseOptions parse options of the scan profile
+ * @param virname receives the name of the virus found
+ * @return ClamAV return code
+ */
+int ClamavEngine::scanInWorker(void *db, const struct ScanJob *job,
+                               unsigned int parseOptions,
+                               const char **virname) {
+    Database *d = (Database *) db;
+
+    return d->owner->scanDatabase(d->e, job, parseOptions, virname);
+}
+
+/**
+ * @brief Scans a file.
+ *
+ * Exceeded scan limits are reported as heuristic match. Scan errors are
+ * logged and the file is considered clean. If a scan worker crashes or
+ * times out, the scan has failed and its result must not be cached.
+ *
+ * If no scan worker can be started, the file is scanned in process.
+ *
+ * @param db database
+ * @param job file to be scanned
+ * @param virname receives the name of the virus found
+ * @return verdict
+ */
+int ClamavEngine::scanWith(void *db, const struct ScanJob *job,
+                           std::string &virname) {
+    Database *d = (Database *) db;
+    unsigned int parseOptions = job->profile->getParseOptions();
+    const char *name = NULL;
+    std::string workerName;
+    int ret;
+
+    if (d->workers == NULL) {
+        ret = scanDatabase(d->e, job, parseOptions, &name);
+    } else {
+        switch (d->workers->scan(job, parseOptions, &ret, workerName)) {
+            case ScanWorkers::DONE:
+                name = workerName.c_str();
+                break;
+            case ScanWorkers::FAILED:
+                return FAILED;
+            default:
+                ret = scanDatabase(d->e, job, parseOptions, &name);
+                break;
+        }
+    }
+    switch (ret) {
+        case CL_CLEAN:
+            return CLEAN;
+        case CL_VIRUS:
+            // The name is owned by the engine.
+            virname = name;
+            return VIRUS;
+        default:
+            std::stringstream msg;
+            msg << "cl_scandesc() error: " << cl_strerror(ret);
+            Messaging::message(Messaging::ERROR, msg.str());
+            return CLEAN;
+    }
+}
+
+/**
+ * @brief Sets the configured scan limits of an engine.
+ *
+ * Limits not configured keep the ClamAV defaults.
+ *
+ * @param e virus scan engine
+ */
+void ClamavEngine::setLimits(struct cl_engine *e) {
+    const struct {
+        enum cl_engine_field field;
+        long long value;
+        const char *name;
+    } limits[] = {
+        {CL_ENGINE_MAX_FILESIZE, (long long) env->getMaxFileSize(),
+         "MAX_FILESIZE"},
+        {CL_ENGINE_MAX_RECURSION, env->getMaxRecursion(), "MAX_RECURSION"},
+        {CL_ENGINE_MAX_SCANSIZE, (long long) env->getMaxScanSize(),
+         "MAX_SCANSIZE"},
+        {CL_ENGINE_MAX_SCANTIME, env->getMaxScanTime(), "MAX_SCANTIME"}
+    };
+    unsigned int i;
+
+    for (i = 0; i < sizeof (limits) / sizeof (limits[0]); i++) {
+        int ret;
+
+        if (limits[i].value == 0) {
+            continue;
+        }
+        ret = cl_engine_set_num(e, limits[i].field, limits[i].value);
+        if (ret != CL_SUCCESS) {
+            std::stringstream msg;
+            msg << "Cannot set " << limits[i].name << ": "
+                << cl_strerror(ret);
+            Messaging::message(Messaging::WARNING, msg.str());
+        }
+    }
+}
+
+/**
+ * @brief Gets the version of a database.
+ *
+ * @param db database
+ * @return database version, 0 if unknown
+ */
+unsigned int ClamavEngine::version(void *db) {
+    int err;
+    unsigned int version;
+
+    version = (unsigned int) cl_engine_get_num(((Database *) db)->e,
+                                               CL_ENGINE_DB_VERSION, &err);
+    if (err != CL_SUCCESS) {
+        version = 0;
+    }
+    return version;
+}
+
+/**
+ * @brief Releases the database and the database status.
+ */
+ClamavEngine::~ClamavEngine() {
+    unload();
+    cl_statfree(&dbstat);
+}
@@ -0,0 +1,90 @@
+/*
+ * File:   ClamavEngine.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ClamavEngine.h
+ * @brief Scans files with libclamav.
+ */
+#ifndef CLAMAVENGINE_H
+#define	CLAMAVENGINE_H
+
+#include <clamav.h>
+#include "Environment.h"
+#include "ScanEngine.h"
+#include "ScanWorkers.h"
+
+/**
+ * @brief Scans files with libclamav.
+ *
+ * The database is a compiled ClamAV engine loaded from the ClamAV database
+ * directory. If scan workers are configured, each database gets its own
+ * worker processes, forked after compiling the engine.
+ */
+class ClamavEngine : public ScanEngine {
+public:
+    ClamavEngine(Environment *);
+    virtual void getDirectories(std::vector<std::string> &);
+    virtual ~ClamavEngine();
+protected:
+    virtual int changed();
+    virtual void *create();
+    virtual void destroy(void *db);
+    virtual int scanWith(void *db, const struct ScanJob *,
+                         std::string &virname);
+    virtual unsigned int version(void *db);
+private:
+    /**
+     * @brief Database.
+     */
+    struct Database {
+        /**
+         * @brief Compiled engine.
+         */
+        struct cl_engine *e;
+        /**
+         * @brief Engine owning the database.
+         */
+        ClamavEngine *owner;
+        /**
+         * @brief Worker processes, NULL if scanning in process.
+         */
+        ScanWorkers *workers;
+    };
+
+    /**
+     * @brief Environment.
+     */
+    Environment *env;
+    /**
+     * @brief Structure indicating if the database has changed.
+     */
+    struct cl_stat dbstat;
+
+    int scanDatabase(const struct cl_engine *, const struct ScanJob *,
+                     const unsigned int parseOptions, const char **virname);
+    static int scanInWorker(void *db, const struct ScanJob *,
+                            unsigned int parseOptions, const char **virname);
+    int scanMemory(const int fd, const char *data, const size_t size,
+                   FileMap *, const char **virname, const struct cl_engine *,
+                   struct cl_scan_options *);
+    int scanPartial(const struct ScanJob *, const char **virname,
+                    const struct cl_engine *, struct cl_scan_options *);
+    void setLimits(struct cl_engine *);
+};
+
+#endif	/* CLAMAVENGINE_H */
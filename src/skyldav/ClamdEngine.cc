@@ -0,0 +1,669 @@
+/*
+ * File:   ClamdEngine.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ClamdEngine.cc
+ * @brief Scans files with clamd.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ClamdEngine.h"
+#include "Messaging.h"
+
+/**
+ * @brief Time in milliseconds to wait for a reply of clamd.
+ */
+#define SKYLD_CLAMD_TIMEOUT 300000
+
+/**
+ * @brief Maximum size of a chunk sent with INSTREAM.
+ */
+#define SKYLD_CLAMD_CHUNK 1048576
+
+/**
+ * @brief Creates the engine.
+ *
+ * @param e environment
+ */
+ClamdEngine::ClamdEngine(Environment *e) : ScanEngine("clamd") {
+    env = e;
+    lastVersion = 0;
+    down = 0;
+    pthread_mutex_init(&mutexDown, NULL);
+}
+
+/**
+ * @brief Checks if clamd reports a new database version.
+ *
+ * @return 0 = unchanged, 1 = changed
+ */
+int ClamdEngine::changed() {
+    unsigned int v;
+
+    v = queryVersion();
+    if (v == 0 || v == lastVersion) {
+        return 0;
+    }
+    lastVersion = v;
+    return 1;
+}
+
+/**
+ * @brief Sends a command on a new connection outside of a session.
+ *
+ * @param cmd command
+ * @param reply receives the reply
+ * @return success = 0
+ */
+int ClamdEngine::command(const char *cmd, std::string &reply) {
+    std::string req = std::string("z") + cmd;
+    char buf[256];
+    int fd;
+
+    fd = connectSocket();
+    if (fd == -1) {
+        return 1;
+    }
+    if (writeAll(fd, req.c_str(), req.size() + 1)) {
+        close(fd);
+        return 1;
+    }
+    reply.clear();
+    while (1) {
+        struct pollfd pfd;
+        ssize_t len;
+        size_t end;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, SKYLD_CLAMD_TIMEOUT) <= 0) {
+            break;
+        }
+        len = recv(fd, buf, sizeof (buf), 0);
+        if (len <= 0) {
+            break;
+        }
+        reply.append(buf, len);
+        end = reply.find('\0');
+        if (end != std::string::npos) {
+            reply.resize(end);
+            close(fd);
+            return 0;
+        }
+    }
+    close(fd);
+    return 1;
+}
+
+/**
+ * @brief Connects to the socket of clamd.
+ *
+ * @return socket, -1 if clamd cannot be reached
+ */
+int ClamdEngine::connectSocket() {
+    struct sockaddr_un addr;
+    const std::string &path = env->getClamdSocket();
+    int fd;
+
+    if (path.size() >= sizeof (addr.sun_path)) {
+        setDown(1);
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        Messaging::error("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    if (connect(fd, (struct sockaddr *) &addr, sizeof (addr))) {
+        close(fd);
+        setDown(1);
+        return -1;
+    }
+    setDown(0);
+    return fd;
+}
+
+/**
+ * @brief Creates a pool of connections.
+ *
+ * The connections are opened when first used.
+ *
+ * @return pool
+ */
+void *ClamdEngine::create() {
+    Pool *pool = new Pool();
+    std::stringstream msg;
+    unsigned int i;
+
+    pool->requests = 0;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool->version = lastVersion = queryVersion();
+    for (i = 0; i < env->getClamdConnections(); i++) {
+        Connection *c = new Connection();
+
+        c->fd = -1;
+        c->lastId = 0;
+        c->reading = 0;
+        pthread_mutex_init(&c->mutexSend, NULL);
+        pthread_mutex_init(&c->mutex, NULL);
+        pthread_cond_init(&c->cond, NULL);
+        pool->connections.push_back(c);
+    }
+    if (pool->version) {
+        msg << "Using clamd at " << env->getClamdSocket()
+            << ", database version " << pool->version << ".";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+    return pool;
+}
+
+/**
+ * @brief Closes the connections of a pool and deletes it.
+ *
+ * @param db pool
+ */
+void ClamdEngine::destroy(void *db) {
+    Pool *pool = (Pool *) db;
+    std::vector<Connection *>::iterator it;
+
+    for (it = pool->connections.begin(); it != pool->connections.end();
+            ++it) {
+        Connection *c = *it;
+
+        if (c->fd != -1) {
+            writeAll(c->fd, "zEND", 5);
+            close(c->fd);
+        }
+        pthread_cond_destroy(&c->cond);
+        pthread_mutex_destroy(&c->mutex);
+        pthread_mutex_destroy(&c->mutexSend);
+        delete c;
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    delete pool;
+}
+
+/**
+ * @brief Closes a lost connection and fails the requests awaiting a reply.
+ *
+ * If a thread is reading replies, the socket is only shut down. The reading
+ * thread fails the connection then. Both mutexes of the connection must be
+ * held.
+ *
+ * @param c connection
+ */
+void ClamdEngine::fail(Connection *c) {
+    std::map<unsigned long, Reply *>::iterator it;
+
+    if (c->fd != -1) {
+        if (c->reading) {
+            shutdown(c->fd, SHUT_RDWR);
+            return;
+        }
+        close(c->fd);
+        c->fd = -1;
+    }
+    for (it = c->pending.begin(); it != c->pending.end(); ++it) {
+        it->second->status = -1;
+    }
+    c->pending.clear();
+    c->received.clear();
+    pthread_cond_broadcast(&c->cond);
+}
+
+/**
+ * @brief Gets the directories to watch for database updates.
+ *
+ * clamd reloads its database itself. New versions are detected when
+ * polling, so no directory is added.
+ */
+void ClamdEngine::getDirectories(std::vector<std::string> &) {
+}
+
+/**
+ * @brief Checks if clamd answers.
+ *
+ * @return 1 if clamd answers PING
+ */
+int ClamdEngine::isAvailable() {
+    std::string reply;
+
+    return !command("PING", reply) && reply == "PONG";
+}
+
+/**
+ * @brief Converts the reply to a scan request.
+ *
+ * Errors are logged and the file is considered clean.
+ *
+ * @param text reply, e.g. "fd[10]: Eicar-Signature FOUND"
+ * @param virname receives the name of the virus found
+ * @return verdict
+ */
+int ClamdEngine::parseReply(const std::string &text, std::string &virname) {
+    static const std::string found = " FOUND";
+    static const std::string ok = ": OK";
+    size_t pos;
+
+    if (text.size() > found.size()
+            && !text.compare(text.size() - found.size(), found.size(),
+                             found)) {
+        pos = text.rfind(": ", text.size() - found.size());
+        if (pos != std::string::npos) {
+            virname = text.substr(pos + 2,
+                                  text.size() - found.size() - pos - 2);
+            return VIRUS;
+        }
+    }
+    if (text.size() >= ok.size()
+            && !text.compare(text.size() - ok.size(), ok.size(), ok)) {
+        return CLEAN;
+    }
+    Messaging::message(Messaging::ERROR, "clamd error: " + text);
+    return CLEAN;
+}
+
+/**
+ * @brief Queries the database version of clamd.
+ *
+ * @return version, 0 if unknown
+ */
+unsigned int ClamdEngine::queryVersion() {
+    std::string reply;
+    size_t pos;
+
+    // e.g. "ClamAV 0.103.8/26870/Sat Apr  1 07:48:18 2023"
+    if (command("VERSION", reply)) {
+        return 0;
+    }
+    pos = reply.find('/');
+    if (pos == std::string::npos) {
+        return 0;
+    }
+    return (unsigned int) strtoul(reply.c_str() + pos + 1, NULL, 10);
+}
+
+/**
+ * @brief Reads the next reply of a session.
+ *
+ * Only one thread reads from a connection at a time.
+ *
+ * @param c connection
+ * @param id receives the request number
+ * @param text receives the reply without the request number
+ * @return success = 0
+ */
+int ClamdEngine::readReply(Connection *c, unsigned long *id,
+                           std::string &text) {
+    char buf[4096];
+
+    while (1) {
+        struct pollfd pfd;
+        size_t end;
+        ssize_t len;
+        char *tail;
+
+        end = c->received.find('\0');
+        if (end != std::string::npos) {
+            std::string line = c->received.substr(0, end);
+
+            c->received.erase(0, end + 1);
+            // e.g. "1: fd[10]: OK"
+            *id = strtoul(line.c_str(), &tail, 10);
+            if (tail == line.c_str() || strncmp(tail, ": ", 2)) {
+                Messaging::message(Messaging::ERROR,
+                                   "clamd error: " + line);
+                return 1;
+            }
+            text = tail + 2;
+            return 0;
+        }
+        pfd.fd = c->fd;
+        pfd.events = POLLIN;
+        len = poll(&pfd, 1, SKYLD_CLAMD_TIMEOUT);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            Messaging::message(Messaging::ERROR, "No reply from clamd.");
+            return 1;
+        }
+        len = recv(c->fd, buf, sizeof (buf), 0);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            return 1;
+        }
+        c->received.append(buf, len);
+    }
+}
+
+/**
+ * @brief Sends a scan request and waits for the reply.
+ *
+ * The connections of the pool are used in turn. If the connection is lost,
+ * e.g. because clamd closed an idle session, the request is repeated once
+ * on a new connection.
+ *
+ * @param pool connection pool
+ * @param job file to be scanned
+ * @param data data to be sent with INSTREAM, NULL to send the file
+ * descriptor with FILDES
+ * @param len number of bytes of data
+ * @param reply receives the reply
+ * @return success = 0
+ */
+int ClamdEngine::request(Pool *pool, const struct ScanJob *job,
+                         const char *data, const size_t len,
+                         std::string &reply) {
+    Connection *c;
+    int attempt;
+
+    pthread_mutex_lock(&pool->mutex);
+    c = pool->connections[pool->requests++ % pool->connections.size()];
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (attempt = 0; attempt < 2; attempt++) {
+        Reply r;
+
+        r.status = 0;
+        if (sendRequest(c, job, data, len, &r)) {
+            return 1;
+        }
+        if (!waitReply(c, &r)) {
+            reply = r.text;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Scans a file.
+ *
+ * If clamd cannot be reached, the engine is unavailable.
+ *
+ * @param db connection pool
+ * @param job file to be scanned
+ * @param virname receives the name of the virus found
+ * @return verdict
+ */
+int ClamdEngine::scanWith(void *db, const struct ScanJob *job,
+                          std::string &virname) {
+    Pool *pool = (Pool *) db;
+    std::string reply;
+    size_t bytes = env->getPartialScanBytes();
+    off_t offset[2] = {0, job->size - (off_t) bytes};
+    char *buf = NULL;
+    int ret = CLEAN;
+    int i;
+
+    if (!job->partial) {
+        if (request(pool, job, NULL, 0, reply)) {
+            return UNAVAILABLE;
+        }
+        return parseReply(reply, virname);
+    }
+    // Send the head and the tail of the file.
+    if (job->data == NULL) {
+        buf = (char *) malloc(bytes);
+        if (buf == NULL) {
+            return UNAVAILABLE;
+        }
+    }
+    for (i = 0; i < 2 && ret == CLEAN; i++) {
+        const char *part;
+        ssize_t len;
+
+        if (job->data != NULL) {
+            part = job->data + offset[i];
+            len = bytes;
+        } else {
+            part = buf;
+            len = pread(job->fd, buf, bytes, offset[i]);
+        }
+        if (len <= 0) {
+            continue;
+        }
+        if (request(pool, job, part, len, reply)) {
+            ret = UNAVAILABLE;
+        } else {
+            ret = parseReply(reply, virname);
+        }
+    }
+    free(buf);
+    return ret;
+}
+
+/**
+ * @brief Sends a scan request.
+ *
+ * A new session is started if the connection is closed.
+ *
+ * @param c connection
+ * @param job file to be scanned
+ * @param data data to be sent with INSTREAM, NULL to send the file
+ * descriptor with FILDES
+ * @param len number of bytes of data
+ * @param r reply to be filled when received
+ * @return success = 0, 1 if clamd cannot be reached
+ */
+int ClamdEngine::sendRequest(Connection *c, const struct ScanJob *job,
+                             const char *data, const size_t len, Reply *r) {
+    int ok;
+
+    pthread_mutex_lock(&c->mutexSend);
+    pthread_mutex_lock(&c->mutex);
+    if (c->fd == -1) {
+        c->fd = connectSocket();
+        if (c->fd == -1) {
+            pthread_mutex_unlock(&c->mutex);
+            pthread_mutex_unlock(&c->mutexSend);
+            return 1;
+        }
+        c->lastId = 0;
+        c->received.clear();
+        if (writeAll(c->fd, "zIDSESSION", 11)) {
+            close(c->fd);
+            c->fd = -1;
+            pthread_mutex_unlock(&c->mutex);
+            pthread_mutex_unlock(&c->mutexSend);
+            return 1;
+        }
+    }
+    // Requests are numbered in the order of sending.
+    c->pending[++c->lastId] = r;
+    pthread_mutex_unlock(&c->mutex);
+
+    if (data == NULL) {
+        struct msghdr msg;
+        struct iovec iov;
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof (int))];
+        } control;
+        struct cmsghdr *cmsg;
+        char dummy = 0;
+
+        // The file descriptor is passed with a single byte.
+        memset(&msg, 0, sizeof (msg));
+        memset(&control, 0, sizeof (control));
+        iov.iov_base = &dummy;
+        iov.iov_len = 1;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof (control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof (int));
+        memcpy(CMSG_DATA(cmsg), &job->fd, sizeof (int));
+        ok = !writeAll(c->fd, "zFILDES", 8)
+             && sendmsg(c->fd, &msg, MSG_NOSIGNAL) == 1;
+    } else {
+        size_t pos;
+        uint32_t chunk;
+
+        ok = !writeAll(c->fd, "zINSTREAM", 10);
+        for (pos = 0; ok && pos < len; pos += chunk) {
+            uint32_t size;
+
+            chunk = len - pos < SKYLD_CLAMD_CHUNK ? len - pos
+                    : SKYLD_CLAMD_CHUNK;
+            size = htonl(chunk);
+            ok = !writeAll(c->fd, (const char *) &size, sizeof (size))
+                 && !writeAll(c->fd, data + pos, chunk);
+        }
+        chunk = 0;
+        ok = ok && !writeAll(c->fd, (const char *) &chunk, sizeof (chunk));
+    }
+    if (!ok) {
+        pthread_mutex_lock(&c->mutex);
+        fail(c);
+        pthread_mutex_unlock(&c->mutex);
+    }
+    pthread_mutex_unlock(&c->mutexSend);
+    return 0;
+}
+
+/**
+ * @brief Logs when clamd becomes unreachable or reachable again.
+ *
+ * @param value 1 if clamd cannot be reached
+ */
+void ClamdEngine::setDown(const int value) {
+    pthread_mutex_lock(&mutexDown);
+    if (down != value) {
+        down = value;
+        if (down) {
+            char errbuf[256];
+            std::stringstream msg;
+
+            msg << "Cannot connect to clamd at " << env->getClamdSocket()
+                << ": " << strerror_r(errno, errbuf, sizeof (errbuf));
+            Messaging::message(Messaging::WARNING, msg.str());
+        } else {
+            Messaging::message(Messaging::INFORMATION,
+                               "Connected to clamd at "
+                               + env->getClamdSocket() + ".");
+        }
+    }
+    pthread_mutex_unlock(&mutexDown);
+}
+
+/**
+ * @brief Waits for the reply to a request.
+ *
+ * The waiting threads take turns in reading the replies of the session and
+ * handing them to the threads that sent the requests.
+ *
+ * @param c connection
+ * @param r reply
+ * @return success = 0, 1 if the connection was lost
+ */
+int ClamdEngine::waitReply(Connection *c, Reply *r) {
+    pthread_mutex_lock(&c->mutex);
+    while (r->status == 0) {
+        std::map<unsigned long, Reply *>::iterator it;
+        unsigned long id;
+        std::string text;
+
+        if (c->reading) {
+            pthread_cond_wait(&c->cond, &c->mutex);
+            continue;
+        }
+        c->reading = 1;
+        pthread_mutex_unlock(&c->mutex);
+        if (readReply(c, &id, text)) {
+            // Stop senders blocked on the socket.
+            shutdown(c->fd, SHUT_RDWR);
+            pthread_mutex_lock(&c->mutexSend);
+            pthread_mutex_lock(&c->mutex);
+            c->reading = 0;
+            fail(c);
+            pthread_mutex_unlock(&c->mutexSend);
+            continue;
+        }
+        pthread_mutex_lock(&c->mutex);
+        c->reading = 0;
+        it = c->pending.find(id);
+        if (it != c->pending.end()) {
+            it->second->text = text;
+            it->second->status = 1;
+            c->pending.erase(it);
+        }
+        pthread_cond_broadcast(&c->cond);
+    }
+    pthread_mutex_unlock(&c->mutex);
+    return r->status != 1;
+}
+
+/**
+ * @brief Gets the database version of a pool.
+ *
+ * @param db pool
+ * @return version reported by clamd, 0 if unknown
+ */
+unsigned int ClamdEngine::version(void *db) {
+    return ((Pool *) db)->version;
+}
+
+/**
+ * @brief Writes data to a socket.
+ *
+ * @param fd socket
+ * @param data data
+ * @param len number of bytes
+ * @return success = 0
+ */
+int ClamdEngine::writeAll(const int fd, const char *data, size_t len) {
+    while (len) {
+        ssize_t ret;
+
+        ret = send(fd, data, len, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes the connections.
+ */
+ClamdEngine::~ClamdEngine() {
+    unload();
+    pthread_mutex_destroy(&mutexDown);
+}
@@ -0,0 +1,167 @@
+/*
+ * File:   ClamdEngine.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ClamdEngine.h
+ * @brief Scans files with clamd.
+ */
+#ifndef CLAMDENGINE_H
+#define	CLAMDENGINE_H
+
+#include <map>
+#include <pthread.h>
+#include "Environment.h"
+#include "ScanEngine.h"
+
+/**
+ * @brief Scans files with clamd.
+ *
+ * The engine keeps a pool of connections to the UNIX socket of clamd. Each
+ * connection is a session started with IDSESSION, so that several scanning
+ * threads can send requests over the same connection and the replies are
+ * matched by their request number.
+ *
+ * Files are passed with FILDES, i.e. the file descriptor is sent to clamd
+ * which reads the file itself. The head and the tail of partially scanned
+ * files are sent with INSTREAM.
+ *
+ * The database is the connection pool together with the database version
+ * reported by clamd. It is replaced when clamd reports a new version. If
+ * clamd cannot be reached, the engine is unavailable.
+ */
+class ClamdEngine : public ScanEngine {
+public:
+    ClamdEngine(Environment *);
+    virtual void getDirectories(std::vector<std::string> &);
+    int isAvailable();
+    virtual ~ClamdEngine();
+protected:
+    virtual int changed();
+    virtual void *create();
+    virtual void destroy(void *db);
+    virtual int scanWith(void *db, const struct ScanJob *,
+                         std::string &virname);
+    virtual unsigned int version(void *db);
+private:
+    /**
+     * @brief Reply to a request.
+     */
+    struct Reply {
+        /**
+         * @brief Status: 0 = pending, 1 = received, -1 = connection lost.
+         */
+        int status;
+        /**
+         * @brief Reply without the request number.
+         */
+        std::string text;
+    };
+
+    /**
+     * @brief Connection to clamd.
+     */
+    struct Connection {
+        /**
+         * @brief Socket, -1 if not connected.
+         */
+        int fd;
+        /**
+         * @brief Number of the last request sent in the session.
+         */
+        unsigned long lastId;
+        /**
+         * @brief A thread is reading replies.
+         */
+        int reading;
+        /**
+         * @brief Replies awaited by request number.
+         */
+        std::map<unsigned long, Reply *> pending;
+        /**
+         * @brief Received bytes not yet forming a complete reply.
+         */
+        std::string received;
+        /**
+         * @brief Mutex for sending requests. It is locked before mutex.
+         */
+        pthread_mutex_t mutexSend;
+        /**
+         * @brief Mutex for accessing the connection.
+         */
+        pthread_mutex_t mutex;
+        /**
+         * @brief Signals received replies and the end of reading.
+         */
+        pthread_cond_t cond;
+    };
+
+    /**
+     * @brief Connection pool.
+     */
+    struct Pool {
+        /**
+         * @brief Connections.
+         */
+        std::vector<Connection *> connections;
+        /**
+         * @brief Number of requests, used for selecting a connection.
+         */
+        unsigned long requests;
+        /**
+         * @brief Mutex for accessing requests.
+         */
+        pthread_mutex_t mutex;
+        /**
+         * @brief Database version reported by clamd, 0 if unknown.
+         */
+        unsigned int version;
+    };
+
+    /**
+     * @brief Environment.
+     */
+    Environment *env;
+    /**
+     * @brief Database version reported by clamd when last checked.
+     */
+    unsigned int lastVersion;
+    /**
+     * @brief clamd could not be reached.
+     */
+    int down;
+    /**
+     * @brief Mutex for accessing down.
+     */
+    pthread_mutex_t mutexDown;
+
+    int command(const char *cmd, std::string &reply);
+    int connectSocket();
+    void fail(Connection *);
+    int parseReply(const std::string &, std::string &virname);
+    unsigned int queryVersion();
+    int readReply(Connection *, unsigned long *id, std::string &text);
+    int request(Pool *, const struct ScanJob *, const char *data,
+                const size_t len, std::string &reply);
+    int sendRequest(Connection *, const struct ScanJob *, const char *data,
+                    const size_t len, Reply *);
+    void setDown(const int);
+    int waitReply(Connection *, Reply *);
+    static int writeAll(const int fd, const char *data, size_t len);
+};
+
+#endif	/* CLAMDENGINE_H */
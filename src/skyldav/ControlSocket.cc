@@ -0,0 +1,241 @@
+/*
+ * File:   ControlSocket.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ControlSocket.cc
+ * @brief Accepts control commands on a UNIX socket.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ControlSocket.h"
+#include "Messaging.h"
+
+/**
+ * @brief Creates the socket and starts serving it.
+ *
+ * @param path path of the UNIX socket
+ * @param handler function executing the commands
+ * @param context context passed to the handler
+ */
+ControlSocket::ControlSocket(const std::string &path, Handler handler,
+                             void *context) {
+    this->path = path;
+    this->handler = handler;
+    this->context = context;
+    listenFd = -1;
+
+    if (openSocket()) {
+        throw FAILURE;
+    }
+    if (pipe2(stopPipe, O_CLOEXEC | O_NONBLOCK)) {
+        Messaging::error("ControlSocket, pipe2");
+        close(listenFd);
+        unlink(path.c_str());
+        throw FAILURE;
+    }
+    if (pthread_create(&thread, NULL, run, this)) {
+        Messaging::error("ControlSocket, pthread_create");
+        close(stopPipe[0]);
+        close(stopPipe[1]);
+        close(listenFd);
+        unlink(path.c_str());
+        throw FAILURE;
+    }
+    pthread_setname_np(thread, "skyldav-c");
+}
+
+/**
+ * @brief Executes the command of a client.
+ *
+ * @param fd connection
+ */
+void ControlSocket::answer(const int fd) {
+    std::stringstream out;
+    std::vector<std::string> args;
+    std::string line;
+    std::string response;
+    struct ucred cred;
+    socklen_t credlen = sizeof (cred);
+    struct pollfd pfd;
+    char buf[256];
+    size_t pos;
+    int ret = 1;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen)
+            || cred.uid != geteuid()) {
+        Messaging::message(Messaging::WARNING,
+                           "Control command of other user refused.");
+        return;
+    }
+
+    // Read the command up to the end of the line.
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (line.size() < SKYLD_CONTROL_MAX_COMMAND
+            && line.find('\n') == std::string::npos
+            && poll(&pfd, 1, SKYLD_CONTROL_TIMEOUT) == 1) {
+        ssize_t len;
+
+        len = read(fd, buf, sizeof (buf));
+        if (len <= 0) {
+            break;
+        }
+        line.append(buf, len);
+    }
+    pos = line.find('\n');
+    if (pos != std::string::npos) {
+        line.erase(pos);
+    }
+    split(line, args);
+    if (args.empty()) {
+        out << "No command given.\n";
+    } else {
+        Messaging::message(Messaging::INFORMATION,
+                           "Control command: " + line);
+        ret = handler(context, args, out);
+    }
+    response = (ret ? "ERROR\n" : "OK\n") + out.str();
+    for (pos = 0; pos < response.size();) {
+        ssize_t len;
+
+        len = send(fd, response.data() + pos, response.size() - pos,
+                   MSG_NOSIGNAL);
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            break;
+        }
+        pos += len;
+    }
+}
+
+/**
+ * @brief Opens the listening socket.
+ *
+ * A socket left over from a previous run is replaced. Only the owner may
+ * connect.
+ *
+ * @return success = 0
+ */
+int ControlSocket::openSocket() {
+    struct sockaddr_un addr;
+
+    if (path.size() >= sizeof (addr.sun_path)) {
+        Messaging::message(Messaging::ERROR,
+                           "Control socket path '" + path + "' is too long.");
+        return 1;
+    }
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd == -1) {
+        Messaging::error("socket");
+        return 1;
+    }
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(listenFd, (struct sockaddr *) &addr, sizeof (addr))
+            || chmod(path.c_str(), S_IRUSR | S_IWUSR)
+            || listen(listenFd, 4)) {
+        Messaging::error("Cannot listen on control socket '" + path + "'");
+        close(listenFd);
+        unlink(path.c_str());
+        listenFd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Serves the socket until stopped.
+ *
+ * @param obj control socket
+ * @return return value
+ */
+void *ControlSocket::run(void *obj) {
+    ControlSocket *cs = (ControlSocket *) obj;
+    struct pollfd fds[2];
+
+    fds[0].fd = cs->stopPipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = cs->listenFd;
+    fds[1].events = POLLIN;
+    for (;;) {
+        int ret;
+
+        ret = poll(fds, 2, -1);
+        if (ret == -1 && errno != EINTR) {
+            Messaging::error("ControlSocket, poll");
+            break;
+        }
+        if (ret <= 0) {
+            continue;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            int fd;
+
+            fd = accept4(cs->listenFd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd != -1) {
+                cs->answer(fd);
+                close(fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Splits a command into words separated by blanks.
+ *
+ * @param line command
+ * @param args receives the words
+ */
+void ControlSocket::split(const std::string &line,
+                          std::vector<std::string> &args) {
+    std::stringstream ss(line);
+    std::string word;
+
+    while (ss >> word) {
+        args.push_back(word);
+    }
+}
+
+/**
+ * @brief Stops serving the socket and removes it.
+ */
+ControlSocket::~ControlSocket() {
+    if (write(stopPipe[1], "", 1) != 1) {
+        Messaging::error("Cannot stop control socket");
+    }
+    pthread_join(thread, NULL);
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+    close(listenFd);
+    unlink(path.c_str());
+}
@@ -0,0 +1,114 @@
+/*
+ * File:   ControlSocket.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ControlSocket.h
+ * @brief Accepts control commands on a UNIX socket.
+ */
+#ifndef CONTROLSOCKET_H
+#define	CONTROLSOCKET_H
+
+#include <ostream>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Maximum length of a command in bytes.
+ */
+#define SKYLD_CONTROL_MAX_COMMAND 4096
+
+/**
+ * @brief Time in milliseconds to wait for the command of a client.
+ */
+#define SKYLD_CONTROL_TIMEOUT 1000
+
+/**
+ * @brief Accepts control commands on a UNIX socket.
+ *
+ * A client sends one command per connection as a line of words separated
+ * by blanks. The first line of the answer is either OK or ERROR, followed
+ * by the output of the command. The connection is closed afterwards.
+ *
+ * Only clients with the same user ID as the daemon are served. The
+ * commands are executed one after the other in the thread of the socket.
+ */
+class ControlSocket {
+public:
+
+    /**
+     * @brief Exception status.
+     */
+    enum Status {
+        /**
+         * @brief The socket cannot be served.
+         */
+        FAILURE = 1
+    };
+
+    /**
+     * @brief Function executing a command.
+     *
+     * @param context context passed to the constructor
+     * @param args words of the command
+     * @param out receives the output
+     * @return success = 0
+     */
+    typedef int (*Handler)(void *context,
+                           const std::vector<std::string> &args,
+                           std::ostream &out);
+
+    ControlSocket(const std::string &path, Handler, void *context);
+    static void split(const std::string &line,
+                      std::vector<std::string> &args);
+    ~ControlSocket();
+private:
+    /**
+     * @brief Path of the UNIX socket.
+     */
+    std::string path;
+    /**
+     * @brief Function executing the commands.
+     */
+    Handler handler;
+    /**
+     * @brief Context of the handler.
+     */
+    void *context;
+    /**
+     * @brief Listening socket.
+     */
+    int listenFd;
+    /**
+     * @brief Pipe for stopping the thread.
+     */
+    int stopPipe[2];
+    /**
+     * @brief Serving thread.
+     */
+    pthread_t thread;
+
+    void answer(const int fd);
+    int openSocket();
+    static void *run(void *);
+
+    // Do not allow copying.
+    ControlSocket(const ControlSocket&);
+};
+
+#endif	/* CONTROLSOCKET_H */
@@ -0,0 +1,446 @@
+/*
+ * File:   ElfDependencies.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file ElfDependencies.cc
+ * @brief Resolve shared libraries needed by ELF files.
+ */
+#include <elf.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ElfDependencies.h"
+
+/**
+ * @brief Configuration file of the dynamic loader.
+ */
+#define SKYLD_LDSOCONF "/etc/ld.so.conf"
+
+/**
+ * @brief Maximum nesting of include statements in ld.so.conf.
+ */
+#define SKYLD_LDSOCONF_DEPTH 4
+
+/**
+ * @brief Maximum number of program headers or dynamic entries evaluated.
+ */
+#define SKYLD_ELF_MAX_ENTRIES 4096
+
+/**
+ * @brief Maximum size of the dynamic string table evaluated.
+ */
+#define SKYLD_ELF_MAX_STRTAB 0x100000
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#define SKYLD_ELFDATA ELFDATA2LSB
+#else
+#define SKYLD_ELFDATA ELFDATA2MSB
+#endif
+
+/**
+ * @brief Reads the dynamic section of an ELF file.
+ *
+ * @param fd file descriptor
+ * @param ehdr ELF header
+ * @param executablesOnly only accept files with a program interpreter
+ * @param needed receives the names of the needed libraries
+ * @param rpath receives DT_RPATH
+ * @param runpath receives DT_RUNPATH
+ * @return success = 0
+ */
+template<class Ehdr, class Phdr, class Dyn>
+static int readDynamic(const int fd, const Ehdr *ehdr,
+                       const int executablesOnly,
+                       std::vector<std::string> &needed,
+                       std::string &rpath, std::string &runpath) {
+    std::vector<Phdr> phdr;
+    std::vector<Dyn> dyn;
+    std::vector<unsigned long> offsets;
+    std::vector<char> strtab;
+    const Phdr *dynamic = NULL;
+    int interp = 0;
+    unsigned long strtabAddr = 0;
+    unsigned long strtabSize = 0;
+    unsigned long strtabOffset = 0;
+    long rpathOffset = -1;
+    long runpathOffset = -1;
+    ssize_t size;
+    size_t i;
+    size_t n;
+
+    if (ehdr->e_phentsize != sizeof (Phdr) || ehdr->e_phnum == 0
+            || ehdr->e_phnum > SKYLD_ELF_MAX_ENTRIES) {
+        return 1;
+    }
+
+    // Read the program headers.
+    phdr.resize(ehdr->e_phnum);
+    size = sizeof (Phdr) * ehdr->e_phnum;
+    if (pread(fd, &phdr[0], size, ehdr->e_phoff) != size) {
+        return 1;
+    }
+    for (i = 0; i < phdr.size(); i++) {
+        if (phdr[i].p_type == PT_DYNAMIC) {
+            dynamic = &phdr[i];
+        } else if (phdr[i].p_type == PT_INTERP) {
+            interp = 1;
+        }
+    }
+    if (dynamic == NULL || (executablesOnly && !interp)) {
+        return 1;
+    }
+
+    // Read the dynamic section.
+    n = dynamic->p_filesz / sizeof (Dyn);
+    if (n == 0 || n > SKYLD_ELF_MAX_ENTRIES) {
+        return 1;
+    }
+    dyn.resize(n);
+    size = sizeof (Dyn) * n;
+    if (pread(fd, &dyn[0], size, dynamic->p_offset) != size) {
+        return 1;
+    }
+    for (i = 0; i < n && dyn[i].d_tag != DT_NULL; i++) {
+        switch (dyn[i].d_tag) {
+            case DT_NEEDED:
+                offsets.push_back(dyn[i].d_un.d_val);
+                break;
+            case DT_STRTAB:
+                strtabAddr = dyn[i].d_un.d_ptr;
+                break;
+            case DT_STRSZ:
+                strtabSize = dyn[i].d_un.d_val;
+                break;
+            case DT_RPATH:
+                rpathOffset = dyn[i].d_un.d_val;
+                break;
+            case DT_RUNPATH:
+                runpathOffset = dyn[i].d_un.d_val;
+                break;
+        }
+    }
+    if (strtabSize == 0 || strtabSize > SKYLD_ELF_MAX_STRTAB) {
+        return 1;
+    }
+
+    // Convert the address of the string table to a file offset.
+    for (i = 0; i < phdr.size(); i++) {
+        if (phdr[i].p_type == PT_LOAD && phdr[i].p_vaddr <= strtabAddr
+                && strtabAddr < phdr[i].p_vaddr + phdr[i].p_filesz) {
+            strtabOffset = strtabAddr - phdr[i].p_vaddr + phdr[i].p_offset;
+            break;
+        }
+    }
+    if (i == phdr.size()) {
+        return 1;
+    }
+
+    // Read the string table.
+    strtab.resize(strtabSize + 1);
+    size = strtabSize;
+    if (pread(fd, &strtab[0], size, strtabOffset) != size) {
+        return 1;
+    }
+    strtab[strtabSize] = '\0';
+
+    for (i = 0; i < offsets.size(); i++) {
+        if (offsets[i] < strtabSize) {
+            needed.push_back(&strtab[offsets[i]]);
+        }
+    }
+    if (rpathOffset >= 0 && (unsigned long) rpathOffset < strtabSize) {
+        rpath = &strtab[rpathOffset];
+    }
+    if (runpathOffset >= 0 && (unsigned long) runpathOffset < strtabSize) {
+        runpath = &strtab[runpathOffset];
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates a resolver for shared library dependencies.
+ *
+ * The search directories are read from /etc/ld.so.conf.
+ */
+ElfDependencies::ElfDependencies() {
+    parseConfiguration(SKYLD_LDSOCONF, 0);
+    // Default directories of the dynamic loader.
+    addSearchDir("/lib64");
+    addSearchDir("/usr/lib64");
+    addSearchDir("/lib");
+    addSearchDir("/usr/lib");
+}
+
+/**
+ * @brief Adds a directory to the library search path.
+ *
+ * @param dir directory
+ */
+void ElfDependencies::addSearchDir(const std::string &dir) {
+    std::vector<std::string>::iterator pos;
+
+    if (dir.empty()) {
+        return;
+    }
+    for (pos = searchDirs.begin(); pos != searchDirs.end(); ++pos) {
+        if (*pos == dir) {
+            return;
+        }
+    }
+    searchDirs.push_back(dir);
+}
+
+/**
+ * @brief Opens the shared libraries needed by an ELF file.
+ *
+ * @param fd file descriptor of the ELF file
+ * @param origin directory of the ELF file, used for $ORIGIN
+ * @param executablesOnly only consider files with a program interpreter
+ * @param fds receives the file descriptors of the libraries found, the
+ * caller has to close them
+ * @return 0 if the file is a dynamically linked ELF file
+ */
+int ElfDependencies::getDependencies(const int fd, const std::string &origin,
+                                     const int executablesOnly,
+                                     std::vector<int> &fds) {
+    union {
+        unsigned char ident[EI_NIDENT];
+        Elf32_Ehdr ehdr32;
+        Elf64_Ehdr ehdr64;
+    } header;
+    std::vector<std::string> needed;
+    std::vector<std::string> dirs;
+    std::vector<std::string>::iterator name;
+    std::vector<std::string>::iterator dir;
+    std::string rpath;
+    std::string runpath;
+    unsigned int machine;
+    int ret;
+
+    memset(&header, 0, sizeof (header));
+    if (pread(fd, &header, sizeof (header), 0) < (ssize_t) sizeof (Elf32_Ehdr)
+            || memcmp(header.ident, ELFMAG, SELFMAG)
+            || header.ident[EI_DATA] != SKYLD_ELFDATA) {
+        return 1;
+    }
+    if (header.ident[EI_CLASS] == ELFCLASS32) {
+        machine = header.ehdr32.e_machine;
+        ret = readDynamic<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(
+                  fd, &header.ehdr32, executablesOnly, needed, rpath, runpath);
+    } else if (header.ident[EI_CLASS] == ELFCLASS64) {
+        machine = header.ehdr64.e_machine;
+        ret = readDynamic<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(
+                  fd, &header.ehdr64, executablesOnly, needed, rpath, runpath);
+    } else {
+        return 1;
+    }
+    if (ret) {
+        return ret;
+    }
+
+    // DT_RPATH is ignored if DT_RUNPATH is present.
+    if (runpath.empty()) {
+        splitPath(rpath, origin, dirs);
+    }
+    splitPath(runpath, origin, dirs);
+    dirs.insert(dirs.end(), searchDirs.begin(), searchDirs.end());
+
+    for (name = needed.begin(); name != needed.end(); ++name) {
+        if (name->find('/') != std::string::npos) {
+            continue;
+        }
+        for (dir = dirs.begin(); dir != dirs.end(); ++dir) {
+            int lfd = openLibrary(*dir + "/" + *name,
+                                  header.ident[EI_CLASS], machine);
+            if (lfd >= 0) {
+                fds.push_back(lfd);
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Opens a library if it matches the ELF class and machine.
+ *
+ * The path is taken from the scanned file and may point anywhere. Only
+ * regular files are opened, so that FIFOs cannot block and devices are not
+ * touched.
+ *
+ * @param path path of the library
+ * @param elfClass ELF class
+ * @param machine machine
+ * @return file descriptor or -1
+ */
+int ElfDependencies::openLibrary(const std::string &path,
+                                 const unsigned char elfClass,
+                                 const unsigned int machine) {
+    Elf32_Ehdr ehdr;
+    struct stat before;
+    struct stat after;
+    char *real;
+    int fd;
+
+    // Resolve symbolic links, e.g. libc.so.6, without opening the file.
+    real = realpath(path.c_str(), NULL);
+    if (real == NULL) {
+        return -1;
+    }
+    if (stat(real, &before) || !S_ISREG(before.st_mode)) {
+        free(real);
+        return -1;
+    }
+    fd = open(real, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NOFOLLOW
+              | O_NONBLOCK);
+    free(real);
+    if (fd == -1) {
+        return -1;
+    }
+    // The file might have been replaced after stat().
+    if (fstat(fd, &after) || !S_ISREG(after.st_mode)
+            || after.st_dev != before.st_dev
+            || after.st_ino != before.st_ino) {
+        close(fd);
+        return -1;
+    }
+    // e_machine is at the same offset for both ELF classes.
+    if (pread(fd, &ehdr, sizeof (ehdr), 0) != sizeof (ehdr)
+            || memcmp(ehdr.e_ident, ELFMAG, SELFMAG)
+            || ehdr.e_ident[EI_CLASS] != elfClass
+            || ehdr.e_machine != machine) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Reads library directories from a configuration file.
+ *
+ * @param filename configuration file, e.g. /etc/ld.so.conf
+ * @param depth nesting level of include statements
+ */
+void ElfDependencies::parseConfiguration(const char *filename, int depth) {
+    FILE *file;
+    char line[PATH_MAX + 16];
+    std::string dirname = filename;
+
+    if (depth > SKYLD_LDSOCONF_DEPTH) {
+        return;
+    }
+    dirname = dirname.substr(0, dirname.rfind('/') + 1);
+
+    file = fopen(filename, "r");
+    if (file == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof (line), file)) {
+        char *pos;
+        char *end;
+
+        // Remove comments and surrounding white space.
+        pos = strchr(line, '#');
+        if (pos) {
+            *pos = '\0';
+        }
+        for (pos = line; *pos == ' ' || *pos == '\t'; pos++) {
+        }
+        for (end = pos + strlen(pos); end > pos && end[-1] <= ' '; end--) {
+        }
+        *end = '\0';
+        if (*pos == '\0') {
+            continue;
+        }
+        if (!strncmp(pos, "include", 7) && (pos[7] == ' ' || pos[7] == '\t')) {
+            std::string pattern;
+            glob_t globbuf;
+            size_t i;
+
+            for (pos += 7; *pos == ' ' || *pos == '\t'; pos++) {
+            }
+            pattern = pos;
+            if (pattern[0] != '/') {
+                pattern = dirname + pattern;
+            }
+            if (0 == glob(pattern.c_str(), 0, NULL, &globbuf)) {
+                for (i = 0; i < globbuf.gl_pathc; i++) {
+                    parseConfiguration(globbuf.gl_pathv[i], depth + 1);
+                }
+            }
+            globfree(&globbuf);
+        } else if (*pos == '/') {
+            // Drop obsolete type suffix, e.g. "/usr/lib=libc5".
+            end = strpbrk(pos, " \t=:,");
+            if (end) {
+                *end = '\0';
+            }
+            addSearchDir(pos);
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Splits a colon separated search path.
+ *
+ * @param path search path, e.g. DT_RUNPATH
+ * @param origin value for $ORIGIN
+ * @param dirs receives the directories
+ */
+void ElfDependencies::splitPath(const std::string &path,
+                                const std::string &origin,
+                                std::vector<std::string> &dirs) {
+    size_t start = 0;
+    size_t end;
+
+    while (start < path.size()) {
+        std::string dir;
+        size_t pos;
+
+        end = path.find(':', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        dir = path.substr(start, end - start);
+        start = end + 1;
+
+        if ((pos = dir.find("${ORIGIN}")) != std::string::npos) {
+            dir.replace(pos, 9, origin);
+        } else if ((pos = dir.find("$ORIGIN")) != std::string::npos) {
+            dir.replace(pos, 7, origin);
+        }
+        // $LIB and $PLATFORM are not supported.
+        if (!dir.empty() && dir.find('$') == std::string::npos) {
+            dirs.push_back(dir);
+        }
+    }
+}
+
+/**
+ * @brief Deletes the resolver.
+ */
+ElfDependencies::~ElfDependencies() {
+}
@@ -0,0 +1,63 @@
+/*
+ * File:   ElfDependencies.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file ElfDependencies.h
+ * @brief Resolve shared libraries needed by ELF files.
+ */
+#ifndef ELFDEPENDENCIES_H
+#define	ELFDEPENDENCIES_H
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Resolves the shared libraries needed by ELF files.
+ *
+ * <p>The DT_NEEDED entries of the dynamic section are resolved like the
+ * dynamic loader does: DT_RPATH (if there is no DT_RUNPATH), DT_RUNPATH,
+ * the directories listed in /etc/ld.so.conf, and the default library
+ * directories. Only libraries with the same ELF class and machine as the
+ * needing file are accepted.</p>
+ */
+class ElfDependencies {
+public:
+    ElfDependencies();
+    int getDependencies(const int fd, const std::string &origin,
+                        const int executablesOnly, std::vector<int> &fds);
+    virtual ~ElfDependencies();
+private:
+    /**
+     * @brief Library search directories of the dynamic loader.
+     */
+    std::vector<std::string> searchDirs;
+
+    void addSearchDir(const std::string &);
+    int openLibrary(const std::string &, const unsigned char,
+                    const unsigned int);
+    void parseConfiguration(const char *, int);
+    static void splitPath(const std::string &, const std::string &,
+                          std::vector<std::string> &);
+
+    // Do not allow copying.
+    ElfDependencies(const ElfDependencies&);
+};
+
+#endif	/* ELFDEPENDENCIES_H */
+
@@ -21,20 +21,76 @@
  * @file Environment.cc
  * @brief Envronment.
  */
+#include <sched.h>
 #include "Environment.h"
 
 /**
  * @brief Creates a new environment.
  */
 Environment::Environment() {
-    excludepath = new StringSet();
+    settings = new Settings();
+    settingsEpoch = 0;
+    settingsReaders[0] = 0;
+    settingsReaders[1] = 0;
+    pthread_mutex_init(&mutexSettings, NULL);
     localfs = new StringSet();
     nomarkfs = new StringSet();
     nomarkmnt = new StringSet();
+    warmpaths = new StringSet();
+    partialpaths = new StringSet();
+    hashblocklists = new StringSet();
     scache = new ScanCache(this);
-    nThreads = 4;
-    cacheMaxSize = 500000;
-    cleanCacheOnUpdate = 1;
+    scanProfiles = new ScanProfiles();
+    prefilter = new Prefilter(scanProfiles);
+    clamdConnections = 4;
+    hotFilesCount = 1024;
+    maxFileSize = 0;
+    maxRecursion = 0;
+    maxScanSize = 0;
+    maxScanTime = 0;
+    prefetchLibraries = 1;
+    reloadInPlace = 0;
+    scanIo = SCAN_IO_READ;
+    scanWorkers = 0;
+    scanWorkerTimeout = 120;
+    prefetchSiblings = 64;
+    partialScanSize = 0;
+    partialScanBytes = 1048576;
+    readaheadFile = 4194304;
+    readaheadTotal = 67108864;
+    startupPolicy = STARTUP_WAIT;
+    startupBlockTimeout = 10;
+    uringBuffers = 64;
+    uringBufferSize = 4194304;
+}
+
+/**
+ * @brief Adds a path that shall not be scanned.
+ *
+ * A missing trailing path separator is appended. The path may be added
+ * while files are scanned.
+ *
+ * @param path directory path
+ */
+void Environment::addExcludePath(const char *path) {
+    Settings *s;
+
+    s = beginChange();
+    s->addExcludePath(path);
+    publish(s);
+}
+
+/**
+ * @brief Starts a change of the settings.
+ *
+ * Locks the settings against concurrent changes. The change must be ended
+ * by calling publish().
+ *
+ * @return copy of the current settings to be changed
+ */
+Settings *Environment::beginChange() {
+    pthread_mutex_lock(&mutexSettings);
+    return new Settings(*settings);
 }
 
 /**
@@ -44,16 +100,120 @@ Environment::Environment() {
  * @return cache shall be cleaned on update
  */
 int Environment::isCleanCacheOnUpdate() {
-    return cleanCacheOnUpdate;
+    int idx = lockSettings();
+    int ret = settings->isCleanCacheOnUpdate();
+
+    unlockSettings(idx);
+    return ret;
+}
+
+/**
+ * @brief Checks if a file is in an exclude path.
+ *
+ * @param path absolute file path, directories with trailing separator
+ * @return 1 if in exclude path
+ */
+int Environment::isExcluded(const std::string &path) {
+    int idx = lockSettings();
+    int ret = settings->isExcluded(path);
+
+    unlockSettings(idx);
+    return ret;
+}
+
+/**
+ * @brief Determines if the shared libraries needed by a scanned executable
+ * shall be scanned speculatively.
+ *
+ * @return libraries shall be prefetched
+ */
+int Environment::isPrefetchLibraries() {
+    return prefetchLibraries;
+}
+
+/**
+ * @brief Determines if the virus scan engine shall be replaced in place.
+ *
+ * Scanning is paused while the engine is replaced in place. Otherwise the
+ * new engine is loaded in the background, temporarily needing memory for
+ * two engines.
+ *
+ * @return engine shall be replaced in place
+ */
+int Environment::isReloadInPlace() {
+    return reloadInPlace;
+}
+
+/**
+ * @brief Gets the classification of files before scanning.
+ *
+ * @return prefilter
+ */
+Prefilter *Environment::getPrefilter() {
+    return prefilter;
+}
+
+/**
+ * @brief Gets the scan profiles.
+ *
+ * @return scan profiles
+ */
+ScanProfiles *Environment::getScanProfiles() {
+    return scanProfiles;
+}
+
+/**
+ * @brief Checks if large files in a path may be scanned partially.
+ *
+ * @param path absolute file path
+ * @return 1 if no paths are configured or the file is in one of them
+ */
+int Environment::isPartialScanPath(const std::string &path) {
+    StringSet::iterator pos;
+
+    if (partialpaths->begin() == partialpaths->end()) {
+        return 1;
+    }
+    for (pos = partialpaths->begin(); pos != partialpaths->end(); ++pos) {
+        std::string *str = *pos;
+
+        if (0 == path.compare(0, str->size(), *str)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Gets the paths that shall not be scanned.
+ *
+ * @param paths receives the paths not to be scanned
+ */
+void Environment::getExcludePaths(std::vector<std::string> &paths) {
+    int idx = lockSettings();
+    const std::vector<std::string> &cur = settings->getExcludePaths();
+
+    paths.insert(paths.end(), cur.begin(), cur.end());
+    unlockSettings(idx);
 }
 
 /**
- * @brief Gets the set of paths that shall not be scanned.
+ * @brief Gets the set of paths in which large files may be scanned
+ * partially.
  *
- * @return paths no to be scanned
+ * @return paths, empty = all paths
  */
-StringSet *Environment::getExcludePaths() {
-    return excludepath;
+StringSet *Environment::getPartialScanPaths() {
+    return partialpaths;
+}
+
+/**
+ * @brief Gets the files with SHA-256 digests of files to be blocked.
+ *
+ * @return blocklist files
+ */
+StringSet *Environment::getHashBlocklists() {
+    return hashblocklists;
 }
 
 /**
@@ -74,6 +234,15 @@ StringSet *Environment::getNoMarkMounts() {
     return nomarkmnt;
 }
 
+/**
+ * @brief Gets the paths to be scanned in the background at startup.
+ *
+ * @return paths to warm the cache for
+ */
+StringSet *Environment::getWarmPaths() {
+    return warmpaths;
+}
+
 /**
  * @brief Gets the list of file systems considered local.
  * This list can be used to decide if scan results shall be cached.
@@ -84,13 +253,62 @@ StringSet *Environment::getLocalFileSystems() {
     return localfs;
 }
 
+/**
+ * @brief Gets the file used to persist the cache with scan results.
+ *
+ * @return path of the cache file, empty if the cache is not persisted
+ */
+const std::string &Environment::getCacheFile() {
+    return cacheFile;
+}
+
 /**
  * @brief Gets the maximum number of entries in the cache with scan results.
  *
  * @return maximum cache size
  */
 unsigned int Environment::getCacheMaxSize() {
-    return cacheMaxSize;
+    int idx = lockSettings();
+    unsigned int ret = settings->getCacheMaxSize();
+
+    unlockSettings(idx);
+    return ret;
+}
+
+/**
+ * @brief Gets the number of connections to clamd.
+ *
+ * @return number of connections
+ */
+unsigned int Environment::getClamdConnections() {
+    return clamdConnections;
+}
+
+/**
+ * @brief Gets the UNIX socket of clamd.
+ *
+ * @return path of the socket, empty if files are scanned in process
+ */
+const std::string &Environment::getClamdSocket() {
+    return clamdSocket;
+}
+
+/**
+ * @brief Gets the UNIX socket for control commands.
+ *
+ * @return path of the socket, empty if not served
+ */
+const std::string &Environment::getControlSocket() {
+    return controlSocket;
+}
+
+/**
+ * @brief Sets the file used to persist the cache with scan results.
+ *
+ * @param path path of the cache file, empty if the cache is not persisted
+ */
+void Environment::setCacheFile(const char *path) {
+    cacheFile = path;
 }
 
 /**
@@ -99,7 +317,325 @@ unsigned int Environment::getCacheMaxSize() {
  * @param size maximum cache size
  */
 void Environment::setCacheMaxSize(unsigned int size) {
-    cacheMaxSize = size;
+    Settings *s;
+
+    s = beginChange();
+    s->setCacheMaxSize(size);
+    publish(s);
+}
+
+/**
+ * @brief Sets the number of connections to clamd.
+ *
+ * @param count number of connections
+ */
+void Environment::setClamdConnections(unsigned int count) {
+    clamdConnections = count;
+}
+
+/**
+ * @brief Sets the UNIX socket of clamd.
+ *
+ * @param path path of the socket, empty to scan files in process
+ */
+void Environment::setClamdSocket(const char *path) {
+    clamdSocket = path;
+}
+
+/**
+ * @brief Sets the UNIX socket for control commands.
+ *
+ * @param path path of the socket, empty if not served
+ */
+void Environment::setControlSocket(const char *path) {
+    controlSocket = path;
+}
+
+/**
+ * @brief Gets the file for the list of most often opened files.
+ *
+ * @return path of the file, empty if the list is not kept
+ */
+const std::string &Environment::getHotFiles() {
+    return hotFiles;
+}
+
+/**
+ * @brief Gets the maximum number of entries in the list of most often opened
+ * files.
+ *
+ * @return maximum number of entries
+ */
+unsigned int Environment::getHotFilesCount() {
+    return hotFilesCount;
+}
+
+/**
+ * @brief Gets the maximum size of a file to be scanned.
+ *
+ * @return size in bytes, 0 = ClamAV default
+ */
+unsigned long long Environment::getMaxFileSize() {
+    return maxFileSize;
+}
+
+/**
+ * @brief Gets the maximum nesting depth of archives.
+ *
+ * @return depth, 0 = ClamAV default
+ */
+unsigned int Environment::getMaxRecursion() {
+    return maxRecursion;
+}
+
+/**
+ * @brief Gets the maximum amount of data scanned per file.
+ *
+ * @return size in bytes, 0 = ClamAV default
+ */
+unsigned long long Environment::getMaxScanSize() {
+    return maxScanSize;
+}
+
+/**
+ * @brief Gets the maximum time for scanning a file.
+ *
+ * @return time in milliseconds, 0 = ClamAV default
+ */
+unsigned int Environment::getMaxScanTime() {
+    return maxScanTime;
+}
+
+/**
+ * @brief Gets the file to which metrics are written periodically.
+ *
+ * @return path of the file, empty if not written
+ */
+const std::string &Environment::getMetricsFile() {
+    return metricsFile;
+}
+
+/**
+ * @brief Gets the UNIX socket serving the metrics.
+ *
+ * @return path of the socket, empty if not served
+ */
+const std::string &Environment::getMetricsSocket() {
+    return metricsSocket;
+}
+
+/**
+ * @brief Gets the number of bytes scanned at the head and at the tail of a
+ * file in a partial scan.
+ *
+ * @return number of bytes
+ */
+unsigned long long Environment::getPartialScanBytes() {
+    return partialScanBytes;
+}
+
+/**
+ * @brief Gets the minimum size of files answered after a partial scan.
+ *
+ * @return size in bytes, 0 = disabled
+ */
+unsigned long long Environment::getPartialScanSize() {
+    return partialScanSize;
+}
+
+/**
+ * @brief Gets the maximum number of files of a directory to be scanned
+ * speculatively after repeated cache misses in the directory.
+ *
+ * @return maximum number of files, 0 = disabled
+ */
+unsigned int Environment::getPrefetchSiblings() {
+    return prefetchSiblings;
+}
+
+/**
+ * @brief Gets the maximum number of bytes read ahead per queued file.
+ *
+ * @return size in bytes, 0 = disabled
+ */
+unsigned long long Environment::getReadaheadFile() {
+    return readaheadFile;
+}
+
+/**
+ * @brief Gets the maximum number of bytes read ahead for all queued files.
+ *
+ * @return size in bytes
+ */
+unsigned long long Environment::getReadaheadTotal() {
+    return readaheadTotal;
+}
+
+/**
+ * @brief Gets how files are read for scanning.
+ *
+ * @return reading of files
+ */
+enum Environment::ScanIo Environment::getScanIo() {
+    return scanIo;
+}
+
+/**
+ * @brief Gets the number of scan worker processes.
+ *
+ * @return number of processes, 0 = scan in process
+ */
+unsigned int Environment::getScanWorkers() {
+    return scanWorkers;
+}
+
+/**
+ * @brief Gets the time to wait for a scan worker before replacing it.
+ *
+ * @return time in seconds
+ */
+unsigned int Environment::getScanWorkerTimeout() {
+    return scanWorkerTimeout;
+}
+
+/**
+ * @brief Gets the time after the start during which access is delayed while
+ * the virus database is loaded.
+ *
+ * @return time in seconds
+ */
+unsigned int Environment::getStartupBlockTimeout() {
+    return startupBlockTimeout;
+}
+
+/**
+ * @brief Gets the handling of files opened while the virus database is
+ * loaded at startup.
+ *
+ * @return startup policy
+ */
+enum Environment::StartupPolicy Environment::getStartupPolicy() {
+    return startupPolicy;
+}
+
+/**
+ * @brief Gets the shared memory file for live statistics.
+ *
+ * @return path of the file, empty if statistics are not published
+ */
+const std::string &Environment::getStatsFile() {
+    return statsFile;
+}
+
+/**
+ * @brief Gets the number of buffers for reading files with io_uring.
+ *
+ * @return number of buffers
+ */
+unsigned int Environment::getUringBuffers() {
+    return uringBuffers;
+}
+
+/**
+ * @brief Gets the size of the buffers for reading files with io_uring.
+ *
+ * @return size in bytes
+ */
+unsigned long long Environment::getUringBufferSize() {
+    return uringBufferSize;
+}
+
+/**
+ * @brief Sets the file for the list of most often opened files.
+ *
+ * @param path path of the file, empty if the list is not kept
+ */
+void Environment::setHotFiles(const char *path) {
+    hotFiles = path;
+}
+
+/**
+ * @brief Sets the maximum number of entries in the list of most often opened
+ * files.
+ *
+ * @param n maximum number of entries
+ */
+void Environment::setHotFilesCount(unsigned int n) {
+    hotFilesCount = n;
+}
+
+/**
+ * @brief Sets the number of bytes scanned at the head and at the tail of a
+ * file in a partial scan.
+ *
+ * @param value number of bytes
+ */
+void Environment::setPartialScanBytes(unsigned long long value) {
+    partialScanBytes = value;
+}
+
+/**
+ * @brief Sets the minimum size of files answered after a partial scan.
+ *
+ * @param value size in bytes, 0 = disabled
+ */
+void Environment::setPartialScanSize(unsigned long long value) {
+    partialScanSize = value;
+}
+
+/**
+ * @brief Sets the maximum number of files of a directory to be scanned
+ * speculatively after repeated cache misses in the directory.
+ *
+ * @param n maximum number of files, 0 = disabled
+ */
+void Environment::setPrefetchSiblings(unsigned int n) {
+    prefetchSiblings = n;
+}
+
+/**
+ * @brief Sets the maximum number of bytes read ahead per queued file.
+ *
+ * @param value size in bytes, 0 = disabled
+ */
+void Environment::setReadaheadFile(unsigned long long value) {
+    readaheadFile = value;
+}
+
+/**
+ * @brief Sets the maximum number of bytes read ahead for all queued files.
+ *
+ * @param value size in bytes
+ */
+void Environment::setReadaheadTotal(unsigned long long value) {
+    readaheadTotal = value;
+}
+
+/**
+ * @brief Sets how files are read for scanning.
+ *
+ * @param value reading of files
+ */
+void Environment::setScanIo(enum ScanIo value) {
+    scanIo = value;
+}
+
+/**
+ * @brief Sets the number of scan worker processes.
+ *
+ * @param count number of processes, 0 = scan in process
+ */
+void Environment::setScanWorkers(unsigned int count) {
+    scanWorkers = count;
+}
+
+/**
+ * @brief Sets the time to wait for a scan worker before replacing it.
+ *
+ * @param seconds time in seconds
+ */
+void Environment::setScanWorkerTimeout(unsigned int seconds) {
+    scanWorkerTimeout = seconds;
 }
 
 /**
@@ -117,7 +653,41 @@ ScanCache *Environment::getScanCache() {
  * @return number of threads
  */
 int Environment::getNumberOfThreads() {
-    return nThreads;
+    int idx = lockSettings();
+    int ret = settings->getNumberOfThreads();
+
+    unlockSettings(idx);
+    return ret;
+}
+
+/**
+ * @brief Gets a copy of the current settings that can be changed while
+ * files are scanned.
+ *
+ * @param value receives the settings
+ */
+void Environment::getSettings(Settings &value) {
+    int idx = lockSettings();
+
+    value = *settings;
+    unlockSettings(idx);
+}
+
+/**
+ * @brief Enters a section reading the current settings.
+ *
+ * No lock is taken. The reader is counted for the current epoch, so that a
+ * change of the settings waits before deleting the snapshot read. The
+ * section must be short and left with unlockSettings().
+ *
+ * @return index of the counter to pass to unlockSettings()
+ */
+int Environment::lockSettings() {
+    int idx;
+
+    idx = __atomic_load_n(&settingsEpoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_add_fetch(&settingsReaders[idx], 1, __ATOMIC_SEQ_CST);
+    return idx;
 }
 
 /**
@@ -127,7 +697,181 @@ int Environment::getNumberOfThreads() {
  * @param value cache shall be cleaned on update
  */
 void Environment::setCleanCacheOnUpdate(int value) {
-    cleanCacheOnUpdate = value;
+    Settings *s;
+
+    s = beginChange();
+    s->setCleanCacheOnUpdate(value);
+    publish(s);
+}
+
+/**
+ * @brief Sets if the shared libraries needed by a scanned executable shall be
+ * scanned speculatively.
+ *
+ * @param value libraries shall be prefetched
+ */
+void Environment::setPrefetchLibraries(int value) {
+    prefetchLibraries = value;
+}
+
+/**
+ * @brief Sets the maximum size of a file to be scanned.
+ *
+ * @param value size in bytes, 0 = ClamAV default
+ */
+void Environment::setMaxFileSize(unsigned long long value) {
+    maxFileSize = value;
+}
+
+/**
+ * @brief Sets the maximum nesting depth of archives.
+ *
+ * @param value depth, 0 = ClamAV default
+ */
+void Environment::setMaxRecursion(unsigned int value) {
+    maxRecursion = value;
+}
+
+/**
+ * @brief Sets the maximum amount of data scanned per file.
+ *
+ * @param value size in bytes, 0 = ClamAV default
+ */
+void Environment::setMaxScanSize(unsigned long long value) {
+    maxScanSize = value;
+}
+
+/**
+ * @brief Sets the maximum time for scanning a file.
+ *
+ * @param value time in milliseconds, 0 = ClamAV default
+ */
+void Environment::setMaxScanTime(unsigned int value) {
+    maxScanTime = value;
+}
+
+/**
+ * @brief Sets the file to which metrics are written periodically.
+ *
+ * @param path path of the file, empty if not written
+ */
+void Environment::setMetricsFile(const char *path) {
+    metricsFile = path;
+}
+
+/**
+ * @brief Sets the UNIX socket serving the metrics.
+ *
+ * @param path path of the socket, empty if not served
+ */
+void Environment::setMetricsSocket(const char *path) {
+    metricsSocket = path;
+}
+
+/**
+ * @brief Sets if the virus scan engine shall be replaced in place.
+ *
+ * @param value engine shall be replaced in place
+ */
+void Environment::setReloadInPlace(int value) {
+    reloadInPlace = value;
+}
+
+/**
+ * @brief Sets the time after the start during which access is delayed while
+ * the virus database is loaded.
+ *
+ * @param value time in seconds
+ */
+void Environment::setStartupBlockTimeout(unsigned int value) {
+    startupBlockTimeout = value;
+}
+
+/**
+ * @brief Sets the handling of files opened while the virus database is
+ * loaded at startup.
+ *
+ * @param value startup policy
+ */
+void Environment::setStartupPolicy(enum StartupPolicy value) {
+    startupPolicy = value;
+}
+
+/**
+ * @brief Sets the shared memory file for live statistics.
+ *
+ * @param path path of the file, empty if statistics are not published
+ */
+void Environment::setStatsFile(const char *path) {
+    statsFile = path;
+}
+
+/**
+ * @brief Sets the number of buffers for reading files with io_uring.
+ *
+ * @param n number of buffers
+ */
+void Environment::setUringBuffers(unsigned int n) {
+    uringBuffers = n;
+}
+
+/**
+ * @brief Sets the size of the buffers for reading files with io_uring.
+ *
+ * @param value size in bytes
+ */
+void Environment::setUringBufferSize(unsigned long long value) {
+    uringBufferSize = value;
+}
+
+/**
+ * @brief Removes a path that shall not be scanned.
+ *
+ * A missing trailing path separator is appended. The path may be removed
+ * while files are scanned.
+ *
+ * @param path directory path
+ * @return 1 if the path was removed
+ */
+int Environment::removeExcludePath(const char *path) {
+    Settings *s;
+
+    s = beginChange();
+    if (!s->removeExcludePath(path)) {
+        pthread_mutex_unlock(&mutexSettings);
+        delete s;
+        return 0;
+    }
+    publish(s);
+    return 1;
+}
+
+/**
+ * @brief Publishes changed settings.
+ *
+ * The previous settings are deleted after all readers that may have seen
+ * them have left their sections. Readers starting later see the new
+ * settings.
+ *
+ * @param s settings created by beginChange()
+ */
+void Environment::publish(Settings *s) {
+    Settings *old = settings;
+    int i;
+
+    __atomic_store_n(&settings, s, __ATOMIC_SEQ_CST);
+    // Switch the epoch twice, so that readers which read the epoch before
+    // the first switch but registered after it are waited for, too.
+    for (i = 0; i < 2; i++) {
+        int idx;
+
+        idx = __atomic_fetch_add(&settingsEpoch, 1, __ATOMIC_SEQ_CST) & 1;
+        while (__atomic_load_n(&settingsReaders[idx], __ATOMIC_SEQ_CST)) {
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&mutexSettings);
+    delete old;
 }
 
 /**
@@ -136,7 +880,33 @@ void Environment::setCleanCacheOnUpdate(int value) {
  * @param n number of threads
  */
 void Environment::setNumberOfThreads(int n) {
-    nThreads = n;
+    Settings *s;
+
+    s = beginChange();
+    s->setNumberOfThreads(n);
+    publish(s);
+}
+
+/**
+ * @brief Replaces all settings that can be changed while files are scanned.
+ *
+ * @param value new settings
+ */
+void Environment::setSettings(const Settings &value) {
+    Settings *s;
+
+    s = beginChange();
+    *s = value;
+    publish(s);
+}
+
+/**
+ * @brief Leaves a section reading the current settings.
+ *
+ * @param idx value returned by lockSettings()
+ */
+void Environment::unlockSettings(const int idx) {
+    __atomic_sub_fetch(&settingsReaders[idx], 1, __ATOMIC_SEQ_CST);
 }
 
 /**
@@ -144,8 +914,14 @@ void Environment::setNumberOfThreads(int n) {
  */
 Environment::~Environment() {
     delete localfs;
-    delete excludepath;
+    delete settings;
+    pthread_mutex_destroy(&mutexSettings);
     delete nomarkfs;
     delete nomarkmnt;
+    delete warmpaths;
+    delete partialpaths;
+    delete hashblocklists;
     delete scache;
+    delete prefilter;
+    delete scanProfiles;
 }
@@ -24,8 +24,14 @@
 #ifndef ENVIRONMENT_H
 #define	ENVIRONMENT_H
 
+#include <pthread.h>
 #include <set>
+#include <string>
+#include <vector>
 #include "ScanCache.h"
+#include "Prefilter.h"
+#include "ScanProfiles.h"
+#include "Settings.h"
 #include "StringSet.h"
 
 class ScanCache;
@@ -37,24 +43,147 @@ class ScanCache;
 
 class Environment {
 public:
+
+    /**
+     * @brief Handling of files opened while the virus database is loaded at
+     * startup.
+     */
+    enum StartupPolicy {
+        /**
+         * @brief Start monitoring after the database has been loaded.
+         */
+        STARTUP_WAIT = 0,
+        /**
+         * @brief Allow access and scan the files when the database is loaded.
+         */
+        STARTUP_ALLOW = 1,
+        /**
+         * @brief Delay access until the database is loaded or the block
+         * timeout has passed, then allow as for STARTUP_ALLOW.
+         */
+        STARTUP_BLOCK = 2
+    };
+
+    /**
+     * @brief Reading of files for scanning.
+     */
+    enum ScanIo {
+        /**
+         * @brief ClamAV reads the file via the file descriptor.
+         */
+        SCAN_IO_READ = 0,
+        /**
+         * @brief Large files are scanned through a memory mapping.
+         */
+        SCAN_IO_MMAP = 1,
+        /**
+         * @brief Files are read with io_uring into buffers before being
+         * passed to the scanning threads.
+         */
+        SCAN_IO_URING = 2
+    };
+
     Environment();
+    void addExcludePath(const char *);
     int isCleanCacheOnUpdate();
-    StringSet *getExcludePaths();
+    int isExcluded(const std::string &);
+    int isPartialScanPath(const std::string &);
+    int isPrefetchLibraries();
+    int isReloadInPlace();
+    void getExcludePaths(std::vector<std::string> &);
+    StringSet *getHashBlocklists();
     StringSet *getLocalFileSystems();
     StringSet *getNoMarkFileSystems();
     StringSet *getNoMarkMounts();
+    StringSet *getPartialScanPaths();
+    StringSet *getWarmPaths();
+    const std::string &getCacheFile();
     unsigned int getCacheMaxSize();
+    unsigned int getClamdConnections();
+    const std::string &getClamdSocket();
+    const std::string &getControlSocket();
+    const std::string &getHotFiles();
+    unsigned int getHotFilesCount();
+    unsigned long long getMaxFileSize();
+    unsigned int getMaxRecursion();
+    unsigned long long getMaxScanSize();
+    unsigned int getMaxScanTime();
+    const std::string &getMetricsFile();
+    const std::string &getMetricsSocket();
+    unsigned long long getPartialScanBytes();
+    unsigned long long getPartialScanSize();
+    unsigned int getPrefetchSiblings();
+    unsigned long long getReadaheadFile();
+    unsigned long long getReadaheadTotal();
+    enum ScanIo getScanIo();
+    unsigned int getScanWorkers();
+    unsigned int getScanWorkerTimeout();
+    unsigned int getStartupBlockTimeout();
+    unsigned int getUringBuffers();
+    unsigned long long getUringBufferSize();
+    enum StartupPolicy getStartupPolicy();
+    const std::string &getStatsFile();
+    void setCacheFile(const char *);
     void setCacheMaxSize(unsigned int);
+    void setClamdConnections(unsigned int);
+    void setClamdSocket(const char *);
+    void setControlSocket(const char *);
+    void setHotFiles(const char *);
+    void setHotFilesCount(unsigned int);
+    void setMaxFileSize(unsigned long long);
+    void setMaxRecursion(unsigned int);
+    void setMaxScanSize(unsigned long long);
+    void setMaxScanTime(unsigned int);
+    void setMetricsFile(const char *);
+    void setMetricsSocket(const char *);
     void setCleanCacheOnUpdate(int);
+    void setPartialScanBytes(unsigned long long);
+    void setPartialScanSize(unsigned long long);
+    void setPrefetchSiblings(unsigned int);
+    void setPrefetchLibraries(int);
+    void setReadaheadFile(unsigned long long);
+    void setReadaheadTotal(unsigned long long);
+    void setScanIo(enum ScanIo);
+    void setScanWorkers(unsigned int);
+    void setScanWorkerTimeout(unsigned int);
+    void setReloadInPlace(int);
+    void setStartupBlockTimeout(unsigned int);
+    void setStartupPolicy(enum StartupPolicy);
+    void setStatsFile(const char *);
+    void setUringBuffers(unsigned int);
+    void setUringBufferSize(unsigned long long);
     ScanCache *getScanCache();
+    Prefilter *getPrefilter();
+    ScanProfiles *getScanProfiles();
     int getNumberOfThreads();
+    void getSettings(Settings &);
+    int removeExcludePath(const char *);
     void setNumberOfThreads(int);
+    void setSettings(const Settings &);
     virtual ~Environment();
 private:
+    Settings *beginChange();
+    int lockSettings();
+    void publish(Settings *);
+    void unlockSettings(const int);
+
+    /**
+     * @brief Current settings that can be changed while files are scanned.
+     */
+    Settings *settings;
+    /**
+     * @brief Mutex serializing changes of the settings.
+     */
+    pthread_mutex_t mutexSettings;
+    /**
+     * @brief Epoch of the settings, incremented twice per change.
+     */
+    unsigned int settingsEpoch;
     /**
-     * @brief Paths to be excluded from scanning.
+     * @brief Number of threads reading the settings, per parity of the
+     * epoch.
      */
-    StringSet *excludepath;
+    int settingsReaders[2];
     /**
      * @brief File systems for local drives.
      */
@@ -68,21 +197,151 @@ private:
      */
     StringSet *nomarkmnt;
     /**
-     * @brief Number of threads for virus scanning.
+     * @brief Paths to be scanned in the background at startup.
+     */
+    StringSet *warmpaths;
+    /**
+     * @brief Paths in which large files may be scanned partially, empty =
+     * all paths.
+     */
+    StringSet *partialpaths;
+    /**
+     * @brief Files with SHA-256 digests of files to be blocked.
      */
-    int nThreads;
+    StringSet *hashblocklists;
     /**
      * @brief Cache for scan results.
      */
     ScanCache *scache;
     /**
-     * @brief Maximum cache size.
+     * @brief File for persisting the cache, empty if not persisted.
+     */
+    std::string cacheFile;
+    /**
+     * @brief Number of connections to clamd.
+     */
+    unsigned int clamdConnections;
+    /**
+     * @brief UNIX socket of clamd, empty if scanning in process.
+     */
+    std::string clamdSocket;
+    /**
+     * @brief UNIX socket for control commands, empty if not served.
+     */
+    std::string controlSocket;
+    /**
+     * @brief File for the list of most often opened files, empty if the
+     * list is not kept.
+     */
+    std::string hotFiles;
+    /**
+     * @brief Maximum number of entries in the list of most often opened
+     * files.
+     */
+    unsigned int hotFilesCount;
+    /**
+     * @brief Maximum size of a file to be scanned, 0 = ClamAV default.
+     */
+    unsigned long long maxFileSize;
+    /**
+     * @brief Maximum nesting depth of archives, 0 = ClamAV default.
+     */
+    unsigned int maxRecursion;
+    /**
+     * @brief Maximum amount of data scanned per file, 0 = ClamAV default.
+     */
+    unsigned long long maxScanSize;
+    /**
+     * @brief Maximum time in milliseconds for scanning a file,
+     * 0 = ClamAV default.
+     */
+    unsigned int maxScanTime;
+    /**
+     * @brief File for the textfile collector of node_exporter, empty if
+     * not written.
+     */
+    std::string metricsFile;
+    /**
+     * @brief UNIX socket serving the metrics, empty if not served.
+     */
+    std::string metricsSocket;
+    /**
+     * @brief Scan profiles and the rules selecting them.
+     */
+    ScanProfiles *scanProfiles;
+    /**
+     * @brief Classification of files before scanning.
+     */
+    Prefilter *prefilter;
+    /**
+     * @brief Replace the virus scan engine in place instead of loading the
+     * new engine in the background.
+     */
+    int reloadInPlace;
+    /**
+     * @brief Reading of files for scanning.
+     */
+    enum ScanIo scanIo;
+    /**
+     * @brief Number of scan worker processes, 0 = scan in process.
+     */
+    unsigned int scanWorkers;
+    /**
+     * @brief Time in seconds to wait for a scan worker.
+     */
+    unsigned int scanWorkerTimeout;
+    /**
+     * @brief Prefetch the shared libraries needed by scanned executables.
+     */
+    int prefetchLibraries;
+    /**
+     * @brief Maximum number of files of a directory to be scanned
+     * speculatively after repeated cache misses in the directory.
+     */
+    unsigned int prefetchSiblings;
+    /**
+     * @brief Minimum size of files answered after a partial scan,
+     * 0 = disabled.
+     */
+    unsigned long long partialScanSize;
+    /**
+     * @brief Number of bytes scanned at the head and at the tail of a file
+     * in a partial scan.
+     */
+    unsigned long long partialScanBytes;
+    /**
+     * @brief Maximum number of bytes read ahead per queued file,
+     * 0 = disabled.
+     */
+    unsigned long long readaheadFile;
+    /**
+     * @brief Maximum number of bytes read ahead for all queued files.
+     */
+    unsigned long long readaheadTotal;
+    /**
+     * @brief Handling of files opened while the virus database is loaded.
+     */
+    enum StartupPolicy startupPolicy;
+    /**
+     * @brief Time in seconds after the start during which access is delayed
+     * with policy STARTUP_BLOCK.
+     */
+    unsigned int startupBlockTimeout;
+    /**
+     * @brief Shared memory file for live statistics, empty if not
+     * published.
+     */
+    std::string statsFile;
+    /**
+     * @brief Number of buffers for reading files with io_uring, which is
+     * the maximum number of reads in flight.
      */
-    unsigned int cacheMaxSize;
+    unsigned int uringBuffers;
     /**
-     * @brief Clean cache when the virus scanner receives a new pattern file.
+     * @brief Size of the buffers for reading files with io_uring. Larger
+     * files are read by the scanning threads.
      */
-    int cleanCacheOnUpdate;
+    unsigned long long uringBufferSize;
 
     // Do not allow copy.
     Environment(const Environment&);
@@ -21,8 +21,10 @@
  * @file FanotifyPolling.cc
  * @brief Poll fanotify events.
  */
+#include <dirent.h>
 #include <errno.h>
-#include <linux/fcntl.h>
+#include <fcntl.h>
+#include <iomanip>
 #include <linux/limits.h>
 #include <malloc.h>
 #include <poll.h>
@@ -35,12 +37,61 @@
 #include <sys/fanotify.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 #include "FanotifyPolling.h"
 #include "Messaging.h"
+#include "ScanWorkers.h"
 
 #define SKYLD_POLLFANOTIFY_BUFLEN 4096
 
+/**
+ * @brief Time window for coalescing cache invalidations in milliseconds.
+ */
+#define SKYLD_COALESCE_WINDOW 50
+
+/**
+ * @brief Maximum number of files queued for speculative scanning.
+ */
+#define SKYLD_PREFETCH_MAX 256
+
+/**
+ * @brief Maximum size of files scanned speculatively.
+ */
+#define SKYLD_PREFETCH_MAX_SIZE 0x4000000
+
+/**
+ * @brief Maximum number of full scans queued after partial scans.
+ */
+#define SKYLD_FULL_SCAN_MAX 64
+
+/**
+ * @brief Number of cache misses in a directory to trigger prefetching.
+ */
+#define SKYLD_SIBLING_MISSES 3
+
+/**
+ * @brief Time window in seconds for counting cache misses in a directory.
+ */
+#define SKYLD_SIBLING_WINDOW 2
+
+/**
+ * @brief Minimum time in seconds between prefetching the same directory.
+ */
+#define SKYLD_SIBLING_COOLDOWN 300
+
+/**
+ * @brief Interval in seconds for saving the list of most often opened files.
+ */
+#define SKYLD_HOT_FILES_INTERVAL 600
+
+/**
+ * @brief Maximum number of files kept for scanning after the virus database
+ * has been loaded.
+ */
+#define SKYLD_DEFERRED_MAX 4096
+
 /**
  * @brief Thread listening to fanotify events.
  *
@@ -85,15 +136,28 @@ void *FanotifyPolling::run(void *obj) {
          */
         int ret;
         char errbuf[256];
+        long timeout;
         // Poll for 1 s. Then recheck status.
-        ret = poll(&fds, nfds, 1000);
+        // Wake up earlier if cache invalidations are pending.
+        timeout = fp->coalescer->getTimeout();
+        if (timeout < 0 || timeout > 1000) {
+            timeout = 1000;
+        }
+        ret = poll(&fds, nfds, (int) timeout);
         if (ret > 0) {
             if (fds.revents & POLLIN) {
                 for (;;) {
+                    struct timespec start;
+                    struct timespec received;
+
+                    clock_gettime(CLOCK_MONOTONIC, &start);
                     ret = read(fp->fd, (void *) &buf,
                                SKYLD_POLLFANOTIFY_BUFLEN);
                     if (ret > 0) {
-                        fp->handleFanotifyEvents(&buf, ret);
+                        clock_gettime(CLOCK_MONOTONIC, &received);
+                        fp->latency->record(LatencyStats::READ, 0, &start,
+                                            &received);
+                        fp->handleFanotifyEvents(&buf, ret, &received);
                         break;
                     } else if (ret < 0) {
                         if (errno & (EINTR | EAGAIN | ETXTBSY | EWOULDBLOCK)) {
@@ -123,6 +187,11 @@ void *FanotifyPolling::run(void *obj) {
                 return NULL;
             }
         }
+        fp->coalescer->flushExpired();
+        fp->saveHotFiles();
+        if (fp->startup == PROTECTING && fp->virusScan->isReady()) {
+            fp->queueStartService();
+        }
     }
     Messaging::message(Messaging::DEBUG, "Fanotiy thread stopped.");
     fp->status = SUCCESS;
@@ -130,38 +199,723 @@ void *FanotifyPolling::run(void *obj) {
 }
 
 /**
- * @brief Check if file is in exclude path.
+ * @brief Classifies a file for which a permission event was received.
+ *
+ * Only leading bytes already in the page cache are used, so that the
+ * fanotify thread does not wait for I/O. Otherwise the file is classified
+ * when it is scanned.
+ *
+ * @param fd file descriptor
+ * @param statbuf file status
+ * @param priority receives the priority for scanning the file
+ * @return 1 if the file shall not be scanned
+ */
+int FanotifyPolling::classifyFile(const int fd, const struct stat *statbuf,
+                                  enum ThreadPool::Priority *priority) {
+    char head[SKYLD_PREFILTER_HEAD];
+    struct iovec iov;
+    ssize_t len = -1;
+    enum Prefilter::Class cls;
+    ScanProfile *profile;
+
+    *priority = ThreadPool::DEMAND;
+    iov.iov_base = head;
+    iov.iov_len = sizeof (head);
+#ifdef RWF_NOWAIT
+    len = preadv2(fd, &iov, 1, 0, RWF_NOWAIT);
+#endif
+    if (len < 0) {
+        return 0;
+    }
+    cls = Prefilter::classify(head, len);
+    switch (e->getPrefilter()->getAction(cls, &profile)) {
+        case Prefilter::SKIP:
+            e->getPrefilter()->count(cls, Prefilter::SKIP, statbuf->st_size,
+                                     0);
+            return 1;
+        case Prefilter::FAST:
+            // Scanning with a cheaper profile completes quickly.
+            *priority = ThreadPool::QUICK;
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Keeps a file allowed without scan for scanning after the virus
+ * database has been loaded.
+ *
+ * @param fd file descriptor, not closed by this function
+ */
+void FanotifyPolling::deferScan(const int fd) {
+    pthread_mutex_lock(&mutex_prefetch);
+    unscanned++;
+    if (deferring && deferred.size() < SKYLD_DEFERRED_MAX) {
+        int dupfd;
+
+        dupfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (dupfd != -1) {
+            deferred.push_back(dupfd);
+        }
+    }
+    pthread_mutex_unlock(&mutex_prefetch);
+}
+
+/**
+ * @brief Gets the latencies of the stages of answering file accesses.
+ *
+ * @return latency statistics
+ */
+LatencyStats *FanotifyPolling::getLatencyStats() {
+    return latency;
+}
+
+/**
+ * @brief Gets the time since the start.
+ *
+ * @return time in seconds
+ */
+double FanotifyPolling::getStartupTime() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - startTime.tv_sec)
+           + (now.tv_nsec - startTime.tv_nsec) / 1000000000.;
+}
+
+/**
+ * @brief Periodically saves the list of most often opened files.
+ *
+ * Called by the fanotify thread. A copy of the list is handed over to a
+ * worker thread, which writes the file with priority IDLE, so that scans
+ * are not delayed. If the previous copy is still being written, the
+ * hand-over is retried later. If it is still queued, it is replaced. The
+ * counts are halved after copying, so that the list follows changes in
+ * usage.
+ */
+void FanotifyPolling::saveHotFiles() {
+    struct timespec now;
+    struct ScanTask *task;
+    int queued;
+
+    if (hotFiles == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - hotFilesSaved < SKYLD_HOT_FILES_INTERVAL) {
+        return;
+    }
+    if (pthread_mutex_trylock(&mutex_hotFiles)) {
+        return;
+    }
+    task = NULL;
+    queued = hotListPending;
+    if (!queued) {
+        task = (struct ScanTask *) malloc(sizeof (struct ScanTask));
+        if (task == NULL) {
+            pthread_mutex_unlock(&mutex_hotFiles);
+            return;
+        }
+    }
+    hotList.clear();
+    hotFiles->getList(hotList);
+    hotListPending = 1;
+    pthread_mutex_unlock(&mutex_hotFiles);
+    hotFiles->age();
+    hotFilesSaved = now.tv_sec;
+
+    if (task != NULL) {
+        memset(task, 0, sizeof (struct ScanTask));
+        task->fp = this;
+        task->type = SAVE_HOT_FILES;
+        task->metadata.fd = -1;
+        tp->add((void *) task, ThreadPool::IDLE);
+    }
+}
+
+/**
+ * @brief Writes the list of most often opened files handed over by
+ * saveHotFiles().
+ */
+void FanotifyPolling::writeHotFiles() {
+    pthread_mutex_lock(&mutex_hotFiles);
+    if (hotListPending) {
+        HotFiles::save(e->getHotFiles().c_str(), hotList);
+        hotList.clear();
+        hotListPending = 0;
+    }
+    pthread_mutex_unlock(&mutex_hotFiles);
+}
+
+/**
+ * @brief Gets the absolute path of an open file.
  *
  * @param fd file descriptor
- * @return 1 if in exclude path.
+ * @return path, empty if unknown
  */
-int FanotifyPolling::exclude(const int fd) {
+std::string FanotifyPolling::getPath(const int fd) {
     int path_len;
+    char link[32];
     char path[PATH_MAX + 1];
-    StringSet *exclude;
-    StringSet::iterator pos;
-    std::string fname;
 
-    // Get absolute file path.
-    snprintf(path, sizeof (path), "/proc/self/fd/%d", fd);
-    path_len = readlink(path, path, sizeof (path) - 1);
+    snprintf(link, sizeof (link), "/proc/self/fd/%d", fd);
+    path_len = readlink(link, path, sizeof (path) - 1);
     if (path_len < 0) {
         path_len = 0;
     }
     path[path_len] = '\0';
-    fname = path;
+    return path;
+}
 
-    // Search in exclude paths.
-    exclude = e->getExcludePaths();
+/**
+ * @brief Collects the values for the statistics segment.
+ *
+ * @param obj fanotify polling object
+ * @param values receives the values
+ */
+void FanotifyPolling::collectStatistics(void *obj,
+                                        struct StatsValues *values) {
+    FanotifyPolling *fp = (FanotifyPolling *) obj;
+    ScanCache *cache = fp->e->getScanCache();
+    unsigned long long hits;
+    unsigned long long misses;
 
-    for (pos = exclude->begin(); pos != exclude->end(); ++pos) {
-        std::string *str = *pos;
+    values->events = __atomic_load_n(&fp->events, __ATOMIC_RELAXED);
+    values->scans = __atomic_load_n(&fp->scans, __ATOMIC_RELAXED);
+    values->bytesScanned = __atomic_load_n(&fp->bytesScanned,
+                                           __ATOMIC_RELAXED);
+    values->denies = __atomic_load_n(&fp->denies, __ATOMIC_RELAXED);
+    cache->getStatistics(&hits, &misses);
+    values->cacheHits = hits;
+    values->cacheMisses = misses;
+    values->cacheEvictions = cache->getEvictions();
+    values->cacheSize = cache->getSize();
+    values->queueDepth = fp->tp->getWorklistSize();
+    values->idleQueueDepth = fp->tp->getIdleWorklistSize();
+    values->busyWorkers = fp->tp->getBusyCount();
+    values->workers = fp->e->getNumberOfThreads();
+    values->dbVersion = fp->virusScan->getDatabaseVersion();
+}
 
-        if (0 == fname.compare(0, str->size(), *str)) {
-            return 1;
+/**
+ * @brief Gets the values published in the statistics segment.
+ *
+ * @param values receives the values
+ */
+void FanotifyPolling::getStatistics(struct StatsValues *values) {
+    memset(values, 0, sizeof (struct StatsValues));
+    collectStatistics(this, values);
+}
+
+/**
+ * @brief Renders the metrics in the Prometheus text format.
+ *
+ * Only counters that can be read without locking are used, so that
+ * scraping does not delay the handling of fanotify events.
+ *
+ * @param obj fanotify polling object
+ * @param out receives the metrics
+ */
+void FanotifyPolling::renderMetrics(void *obj, std::ostream &out) {
+    FanotifyPolling *fp = (FanotifyPolling *) obj;
+    ScanCache *cache = fp->e->getScanCache();
+    const std::vector<ScanEngine *> &engines =
+        fp->virusScan->getEngines();
+    std::vector<ScanEngine *>::const_iterator it;
+    unsigned long long hits;
+    unsigned long long misses;
+
+    MetricsExporter::writeMetric(out, "skyldav_fanotify_events_total",
+                                 "counter", "Fanotify events received.",
+                                 __atomic_load_n(&fp->events,
+                                                 __ATOMIC_RELAXED));
+    MetricsExporter::writeMetric(out, "skyldav_scans_total", "counter",
+                                 "Files scanned.",
+                                 __atomic_load_n(&fp->scans,
+                                                 __ATOMIC_RELAXED));
+    MetricsExporter::writeMetric(out, "skyldav_scanned_bytes_total",
+                                 "counter", "Bytes of files scanned.",
+                                 __atomic_load_n(&fp->bytesScanned,
+                                                 __ATOMIC_RELAXED));
+    MetricsExporter::writeMetric(out, "skyldav_denies_total", "counter",
+                                 "Accesses denied.",
+                                 __atomic_load_n(&fp->denies,
+                                                 __ATOMIC_RELAXED));
+    cache->getStatistics(&hits, &misses);
+    MetricsExporter::writeMetric(out, "skyldav_cache_hits_total", "counter",
+                                 "Scan cache hits.", hits);
+    MetricsExporter::writeMetric(out, "skyldav_cache_misses_total",
+                                 "counter", "Scan cache misses.", misses);
+    MetricsExporter::writeMetric(out, "skyldav_cache_evictions_total",
+                                 "counter", "Scan cache evictions.",
+                                 cache->getEvictions());
+    MetricsExporter::writeMetric(out, "skyldav_cache_entries", "gauge",
+                                 "Files in the scan cache.",
+                                 cache->getSize());
+    MetricsExporter::writeMetric(out, "skyldav_queue_depth", "gauge",
+                                 "Scans waiting for a worker thread.",
+                                 fp->tp->getWorklistSize());
+    MetricsExporter::writeMetric(out, "skyldav_idle_queue_depth", "gauge",
+                                 "Speculative scans waiting for an idle "
+                                 "worker thread.",
+                                 fp->tp->getIdleWorklistSize());
+    MetricsExporter::writeMetric(out, "skyldav_busy_threads", "gauge",
+                                 "Worker threads scanning.",
+                                 fp->tp->getBusyCount());
+    MetricsExporter::writeMetric(out, "skyldav_threads", "gauge",
+                                 "Worker threads.",
+                                 fp->e->getNumberOfThreads());
+
+    out << "# HELP skyldav_engine_database_version Version of the loaded "
+        "database, 0 if none.\n"
+        << "# TYPE skyldav_engine_database_version gauge\n";
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        out << "skyldav_engine_database_version{engine=\""
+            << MetricsExporter::escape((*it)->getName()) << "\"} "
+            << (*it)->getVersion() << "\n";
+    }
+    out << "# HELP skyldav_engine_loads_total Databases loaded.\n"
+        << "# TYPE skyldav_engine_loads_total counter\n";
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        out << "skyldav_engine_loads_total{engine=\""
+            << MetricsExporter::escape((*it)->getName()) << "\"} "
+            << (*it)->getLoads() << "\n";
+    }
+    out << "# HELP skyldav_engine_load_failures_total Databases that could "
+        "not be loaded.\n"
+        << "# TYPE skyldav_engine_load_failures_total counter\n";
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        out << "skyldav_engine_load_failures_total{engine=\""
+            << MetricsExporter::escape((*it)->getName()) << "\"} "
+            << (*it)->getFailures() << "\n";
+    }
+
+    fp->latency->writeMetrics(out);
+}
+
+/**
+ * @brief Counts a scanned file for the statistics.
+ *
+ * @param result result of the scan
+ * @param size size of the file
+ */
+void FanotifyPolling::countScan(const int result, const off_t size) {
+    if (result != VirusScan::SCANSKIPPED) {
+        __atomic_add_fetch(&scans, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&bytesScanned, size, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Queues a file for speculative scanning.
+ *
+ * Files already cached or queued are skipped. With priority IDLE large files
+ * are skipped, too, and the number of queued files is limited.
+ *
+ * @param fd file descriptor, closed by this function or by the scan task
+ * @param priority priority of the scan task
+ * @return 1 if queued
+ */
+int FanotifyPolling::prefetch(const int fd,
+                              const enum ThreadPool::Priority priority) {
+    struct stat statbuf;
+    struct ScanTask *task;
+    int queued = 0;
+
+    if (status == RUNNING && 0 == fstat(fd, &statbuf)
+            && S_ISREG(statbuf.st_mode)
+            && (priority == ThreadPool::DEMAND
+                || statbuf.st_size <= SKYLD_PREFETCH_MAX_SIZE)
+            && !e->getScanCache()->isCached(&statbuf)) {
+        pthread_mutex_lock(&mutex_prefetch);
+        if ((priority == ThreadPool::DEMAND
+                || prefetching.size() < SKYLD_PREFETCH_MAX)
+                && prefetching.insert(
+                    FileId(statbuf.st_dev, statbuf.st_ino)).second) {
+            queued = 1;
         }
+        pthread_mutex_unlock(&mutex_prefetch);
+    }
+    if (!queued) {
+        close(fd);
+        return 0;
+    }
+    task = (struct ScanTask *) malloc(sizeof (struct ScanTask));
+    if (task == NULL) {
+        Messaging::message(Messaging::ERROR, "Out of memory\n");
+        pthread_mutex_lock(&mutex_prefetch);
+        prefetching.erase(FileId(statbuf.st_dev, statbuf.st_ino));
+        pthread_mutex_unlock(&mutex_prefetch);
+        close(fd);
+        return 0;
+    }
+    memset(task, 0, sizeof (struct ScanTask));
+    task->fp = this;
+    task->type = PREFETCH;
+    task->metadata.fd = fd;
+    task->metadata.pid = getpid();
+    tp->add((void *) task, priority);
+    return 1;
+}
+
+/**
+ * @brief Queues a file allowed after a partial scan for a full scan.
+ *
+ * The full scan runs with priority IDLE. It uses the slot reserved by
+ * reserveFullScan(). If it cannot be queued, the provisional cache entry is
+ * removed, so that the file is scanned again on the next access.
+ *
+ * @param fd file descriptor, duplicated for the scan task
+ */
+void FanotifyPolling::queueFullScan(const int fd) {
+    struct ScanTask *task;
+    struct stat statbuf;
+    int dupfd;
+
+    pthread_mutex_lock(&mutex_prefetch);
+    partialScans++;
+    pthread_mutex_unlock(&mutex_prefetch);
+    task = NULL;
+    dupfd = dup(fd);
+    if (dupfd == -1) {
+        Messaging::error("queueFullScan, dup");
+    } else {
+        task = (struct ScanTask *) malloc(sizeof (struct ScanTask));
+        if (task == NULL) {
+            Messaging::message(Messaging::ERROR, "Out of memory\n");
+            close(dupfd);
+        }
+    }
+    if (task == NULL) {
+        if (0 == fstat(fd, &statbuf)) {
+            e->getScanCache()->remove(&statbuf);
+        }
+        releaseFullScan();
+        return;
+    }
+    memset(task, 0, sizeof (struct ScanTask));
+    task->fp = this;
+    task->type = FULL_SCAN;
+    task->metadata.fd = dupfd;
+    task->metadata.pid = getpid();
+    tp->add((void *) task, ThreadPool::IDLE);
+}
+
+/**
+ * @brief Queues the regular files of a directory for speculative scanning.
+ *
+ * At most getPrefetchSiblings() files are queued.
+ *
+ * @param path directory
+ */
+void FanotifyPolling::prefetchDirectory(const char *path) {
+    DIR *dir;
+    struct dirent *entry;
+    unsigned int count = 0;
+    unsigned int budget = e->getPrefetchSiblings();
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    while (count < budget && status == RUNNING && (entry = readdir(dir))) {
+        int fd;
+
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat statbuf;
+            // Do not open devices or FIFOs.
+            if (fstatat(dirfd(dir), entry->d_name, &statbuf,
+                        AT_SYMLINK_NOFOLLOW) || !S_ISREG(statbuf.st_mode)) {
+                continue;
+            }
+        } else if (entry->d_type != DT_REG) {
+            continue;
+        }
+        fd = openat(dirfd(dir), entry->d_name,
+                    O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+        if (fd != -1) {
+            count += prefetch(fd);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Queues the shared libraries needed by an ELF file for speculative
+ * scanning.
+ *
+ * @param fd file descriptor of the ELF file
+ * @param path absolute path of the ELF file
+ * @param executablesOnly only consider files with a program interpreter
+ */
+void FanotifyPolling::prefetchLibraries(const int fd, const std::string &path,
+                                        const int executablesOnly) {
+    std::vector<int> fds;
+    std::vector<int>::iterator pos;
+    std::string origin;
+    size_t slash;
+
+    slash = path.rfind('/');
+    origin = slash == std::string::npos ? "" : path.substr(0, slash);
+    if (elfDependencies->getDependencies(fd, origin, executablesOnly, fds)) {
+        return;
+    }
+    for (pos = fds.begin(); pos != fds.end(); ++pos) {
+        prefetch(*pos);
+    }
+}
+
+/**
+ * @brief Queues a directory for speculative scanning of its files.
+ *
+ * @param path directory
+ */
+void FanotifyPolling::queueDirectory(const std::string &path) {
+    struct ScanTask *task;
+
+    if (e->isExcluded(path + "/")) {
+        return;
+    }
+    task = (struct ScanTask *) malloc(sizeof (struct ScanTask));
+    if (task == NULL) {
+        Messaging::message(Messaging::ERROR, "Out of memory\n");
+        return;
+    }
+    memset(task, 0, sizeof (struct ScanTask));
+    task->path = strdup(path.c_str());
+    if (task->path == NULL) {
+        Messaging::message(Messaging::ERROR, "Out of memory\n");
+        free(task);
+        return;
+    }
+    task->fp = this;
+    task->type = PREFETCH_DIRECTORY;
+    task->metadata.fd = -1;
+    task->metadata.pid = getpid();
+    tp->add((void *) task, ThreadPool::IDLE);
+}
+
+/**
+ * @brief Queues completing the startup after the virus database has been
+ * loaded.
+ *
+ * The startup is completed by a scan thread, so that fanotify events are
+ * handled meanwhile.
+ */
+void FanotifyPolling::queueStartService() {
+    struct ScanTask *task;
+
+    pthread_mutex_lock(&mutex_startup);
+    if (startup != PROTECTING) {
+        pthread_mutex_unlock(&mutex_startup);
+        return;
+    }
+    startup = LOADED;
+    pthread_mutex_unlock(&mutex_startup);
+
+    task = (struct ScanTask *) malloc(sizeof (struct ScanTask));
+    if (task == NULL) {
+        Messaging::message(Messaging::ERROR, "Out of memory\n");
+        startService();
+        return;
+    }
+    memset(task, 0, sizeof (struct ScanTask));
+    task->fp = this;
+    task->type = START_SERVICE;
+    task->metadata.fd = -1;
+    task->metadata.pid = getpid();
+    tp->add((void *) task, ThreadPool::DEMAND);
+}
+
+/**
+ * @brief Completes the startup after the virus database has been loaded.
+ *
+ * The cache is restored, the files allowed without scan during the startup
+ * are queued for scanning, and warming the cache is started.
+ */
+void FanotifyPolling::startService() {
+    std::vector<int> files;
+    std::vector<int>::iterator pos;
+    unsigned int queued = 0;
+    std::stringstream msg;
+
+    pthread_mutex_lock(&mutex_startup);
+    if (startup != LOADED) {
+        pthread_mutex_unlock(&mutex_startup);
+        return;
+    }
+
+    // Restore the scan results of a previous run. Marking the mounts has
+    // cleared the cache.
+    if (!e->getCacheFile().empty()) {
+        e->getScanCache()->load(e->getCacheFile().c_str(),
+                                virusScan->getDatabaseVersion());
+    }
+
+    // Scan the files allowed while the database was loaded.
+    pthread_mutex_lock(&mutex_prefetch);
+    deferring = 0;
+    files.swap(deferred);
+    pthread_mutex_unlock(&mutex_prefetch);
+    for (pos = files.begin(); pos != files.end(); ++pos) {
+        queued += prefetch(*pos, ThreadPool::DEMAND);
+    }
+
+    if (!e->getWarmPaths()->empty() || !hotPaths.empty()) {
+        warmer = new CacheWarmer(e, virusScan, tp, hotPaths);
+    }
+    startup = SERVING;
+    pthread_mutex_unlock(&mutex_startup);
+
+    msg << "Full service after " << std::fixed << std::setprecision(1)
+        << getStartupTime() << " s.";
+    if (unscanned) {
+        msg << " Files allowed without scan " << unscanned
+            << ", queued for scanning " << queued << ".";
+    }
+    Messaging::message(Messaging::INFORMATION, msg.str());
+}
+
+/**
+ * @brief Queues files likely to be opened next for speculative scanning.
+ *
+ * @param fd file descriptor of a file scanned on demand
+ * @param path absolute path of the file
+ * @param response fanotify response for the file
+ */
+void FanotifyPolling::prefetchRelated(const int fd, const std::string &path,
+                                      const unsigned int response) {
+    if (elfDependencies && response == FAN_ALLOW) {
+        // Scan the libraries the dynamic loader will open next.
+        prefetchLibraries(fd, path, 1);
+    }
+    if (missTracker) {
+        size_t slash = path.rfind('/');
+        if (slash != std::string::npos) {
+            std::string dir = slash ? path.substr(0, slash) : "/";
+            // Scan the siblings after repeated cache misses.
+            if (missTracker->add(dir)) {
+                queueDirectory(dir);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Scans a file speculatively and adds the result to the cache.
+ *
+ * @param fd file descriptor
+ */
+void FanotifyPolling::scanSpeculative(const int fd) {
+    struct stat statbuf;
+    std::string path;
+    int ret;
+
+    if (fstat(fd, &statbuf)) {
+        return;
+    }
+    if (status == RUNNING) {
+        path = getPath(fd);
+    }
+    if (status == RUNNING && !e->isExcluded(path)
+            && !e->getScanCache()->isCached(&statbuf)) {
+        ret = virusScan->scan(fd);
+        countScan(ret, statbuf.st_size);
+        switch (ret) {
+            case VirusScan::SCANOK:
+                e->getScanCache()->add(&statbuf, FAN_ALLOW, 1);
+                // Libraries may need further libraries.
+                if (elfDependencies) {
+                    prefetchLibraries(fd, path, 0);
+                }
+                break;
+            case VirusScan::SCANSKIPPED:
+                break;
+            default:
+                e->getScanCache()->add(&statbuf, FAN_DENY, 1);
+        }
+    }
+    pthread_mutex_lock(&mutex_prefetch);
+    prefetching.erase(FileId(statbuf.st_dev, statbuf.st_ino));
+    pthread_mutex_unlock(&mutex_prefetch);
+}
+
+/**
+ * @brief Releases a slot reserved by reserveFullScan().
+ */
+void FanotifyPolling::releaseFullScan() {
+    __atomic_sub_fetch(&fullScansPending, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Reserves a slot for a full scan before a file is scanned
+ * partially.
+ *
+ * No slot is available if the thread pool leaves no thread for IDLE items
+ * while scan requests are waiting, or if SKYLD_FULL_SCAN_MAX full scans are
+ * pending. The file is then scanned fully on demand.
+ *
+ * @return 1 if a slot was reserved
+ */
+int FanotifyPolling::reserveFullScan() {
+    if (tp->getMaxIdle() == 0) {
+        return 0;
+    }
+    if (__atomic_add_fetch(&fullScansPending, 1, __ATOMIC_RELAXED)
+            > SKYLD_FULL_SCAN_MAX) {
+        releaseFullScan();
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Scans a file fully after it was allowed by a partial scan.
+ *
+ * The provisional cache entry is replaced by the result. If a virus is
+ * found, an alert is raised as the file has already been accessed. When
+ * the service is stopping, the file is not scanned and the provisional
+ * entry is removed.
+ *
+ * @param fd file descriptor
+ */
+void FanotifyPolling::scanFull(const int fd) {
+    struct stat statbuf;
+    int ret;
+
+    if (fstat(fd, &statbuf)) {
+        return;
+    }
+    if (status != RUNNING) {
+        // Do not keep the provisional entry of the partial scan.
+        e->getScanCache()->remove(&statbuf);
+        return;
+    }
+    ret = virusScan->scan(fd);
+    countScan(ret, statbuf.st_size);
+    if (ret == VirusScan::SCANSKIPPED) {
+        // Scan again on the next access.
+        e->getScanCache()->remove(&statbuf);
+        return;
+    }
+    pthread_mutex_lock(&mutex_prefetch);
+    fullScans++;
+    if (ret == VirusScan::SCANVIRUS) {
+        lateDetections++;
+    }
+    pthread_mutex_unlock(&mutex_prefetch);
+    if (ret == VirusScan::SCANOK) {
+        e->getScanCache()->add(&statbuf, FAN_ALLOW);
+    } else {
+        std::stringstream msg;
+
+        e->getScanCache()->add(&statbuf, FAN_DENY);
+        msg << "Virus found by full scan of file \"" << getPath(fd)
+            << "\" after access was allowed by a partial scan.";
+        Messaging::message(Messaging::ERROR, msg.str());
     }
-    return 0;
 }
 
 /**
@@ -172,10 +926,35 @@ void* FanotifyPolling::scanFile(void *workitem) {
     struct fanotify_response response;
     pid_t pid;
     struct stat statbuf;
+    int scanned = 0;
+    int skipped = 0;
+    int partial = 0;
 
-    if (task->metadata.mask & FAN_ALL_PERM_EVENTS) {
+    if (task->type == START_SERVICE) {
+        task->fp->startService();
+    } else if (task->type == PREFETCH) {
+        task->fp->scanSpeculative(task->metadata.fd);
+    } else if (task->type == PREFETCH_DIRECTORY) {
+        task->fp->prefetchDirectory(task->path);
+    } else if (task->type == FULL_SCAN) {
+        task->fp->scanFull(task->metadata.fd);
+        task->fp->releaseFullScan();
+    } else if (task->type == SAVE_HOT_FILES) {
+        task->fp->writeHotFiles();
+    } else if (task->metadata.mask & FAN_ALL_PERM_EVENTS) {
         int ret;
+        int reserved;
+        struct timespec dequeued;
+        struct timespec start;
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &dequeued);
+        task->fp->readahead->release(task->readahead);
         ret = fstat(task->metadata.fd, &statbuf);
+        if (ret != -1) {
+            task->fp->latency->record(LatencyStats::QUEUE, statbuf.st_dev,
+                                      &task->queued, &dequeued);
+        }
         if (ret == -1) {
             char errbuf[256];
             std::stringstream msg;
@@ -183,29 +962,98 @@ void* FanotifyPolling::scanFile(void *workitem) {
                 << strerror_r(errno, errbuf, sizeof (errbuf));
             Messaging::message(Messaging::ERROR, msg.str());
         } else {
+            std::string path;
             response.fd = task->metadata.fd;
+            if (S_ISREG(statbuf.st_mode)) {
+                path = getPath(task->metadata.fd);
+            }
             // For same process always allow.
             pid = getpid();
-            if (pid == task->metadata.pid) {
+            if (pid == task->metadata.pid
+                    || ScanWorkers::isWorker(task->metadata.pid)) {
                 // for Skyld AV process always allow.
                 response.response = FAN_ALLOW;
             } else if (!S_ISREG(statbuf.st_mode)) {
                 // For directories always allow.
                 response.response = FAN_ALLOW;
-            } else if (task->fp->exclude(task->metadata.fd)) {
+            } else if (task->fp->isExcluded(path, statbuf.st_dev)) {
                 // In exclude path.
                 response.response = FAN_ALLOW;
-            } else if (task->fp->virusScan->scan(task->metadata.fd)
-                       == VirusScan::SCANOK) {
-                // No virus found.
-                response.response = FAN_ALLOW;
             } else {
-                response.response = FAN_DENY;
+                if (task->fp->startup == PROTECTING
+                        && task->fp->e->getStartupPolicy()
+                        == Environment::STARTUP_BLOCK) {
+                    // Delay access while the database is loaded.
+                    task->fp->virusScan->waitReady(&task->fp->blockDeadline);
+                }
+                reserved = task->fp->reserveFullScan();
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                ret = task->fp->virusScan->scan(task->metadata.fd, task->data,
+                                                task->size, reserved);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                if (reserved && ret != VirusScan::SCANPARTIAL) {
+                    task->fp->releaseFullScan();
+                }
+                task->fp->latency->record(LatencyStats::SCAN, statbuf.st_dev,
+                                          &start, &end);
+                task->fp->countScan(ret, statbuf.st_size);
+                if (task->data == NULL) {
+                    task->fp->readahead->count(task->readahead, &task->queued,
+                                               &dequeued, &start, &end);
+                }
+                switch (ret) {
+                    case VirusScan::SCANOK:
+                        // No virus found.
+                        response.response = FAN_ALLOW;
+                        scanned = 1;
+                        break;
+                    case VirusScan::SCANSKIPPED:
+                        // No database loaded or the scan failed. Do not cache
+                        // the response.
+                        response.response = FAN_ALLOW;
+                        skipped = 1;
+                        task->fp->deferScan(task->metadata.fd);
+                        break;
+                    case VirusScan::SCANPARTIAL:
+                        // Allow now and scan the whole file in the
+                        // background.
+                        response.response = FAN_ALLOW;
+                        scanned = 1;
+                        partial = 1;
+                        break;
+                    default:
+                        response.response = FAN_DENY;
+                        scanned = 1;
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (partial) {
+                task->fp->e->getScanCache()->add(&statbuf, FAN_ALLOW, 0, 1);
+                task->fp->writeResponse(response, 0);
+            } else {
+                task->fp->writeResponse(response, !skipped);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            task->fp->latency->record(LatencyStats::RESPONSE, statbuf.st_dev,
+                                      &start, &end);
+            task->fp->latency->record(LatencyStats::TOTAL, statbuf.st_dev,
+                                      &task->received, &end);
+            if (partial) {
+                task->fp->queueFullScan(task->metadata.fd);
+            }
+            if (scanned) {
+                task->fp->prefetchRelated(task->metadata.fd, path,
+                                          response.response);
             }
-            task->fp->writeResponse(response, 1);
         }
     }
-    close(task->metadata.fd);
+    if (task->data != NULL) {
+        task->fp->reader->release(task->data);
+    }
+    if (task->metadata.fd >= 0) {
+        close(task->metadata.fd);
+    }
+    free(task->path);
     free(task);
 
     fflush(stdout);
@@ -213,14 +1061,50 @@ void* FanotifyPolling::scanFile(void *workitem) {
     return NULL;
 }
 
+/**
+ * @brief Queues a file read with io_uring for scanning.
+ *
+ * @param item scan task
+ * @param data content of the file, NULL if the file could not be read
+ * @param size size of the content
+ */
+void FanotifyPolling::readComplete(void *item, char *data, size_t size) {
+    struct ScanTask *task = (struct ScanTask *) item;
+
+    task->data = data;
+    task->size = size;
+    task->fp->tp->add(item, task->priority);
+}
+
+/**
+ * @brief Checks if a file is in the exclude paths and records the duration.
+ *
+ * @param path path of the file
+ * @param dev device of the file
+ * @return file is excluded
+ */
+int FanotifyPolling::isExcluded(const std::string &path, const dev_t dev) {
+    struct timespec start;
+    struct timespec end;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = e->isExcluded(path);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    latency->record(LatencyStats::EXCLUDE, dev, &start, &end);
+    return ret;
+}
+
 /**
  * @brief Handle fanotify events.
  *
  * @param buf buffer with events
  * @param len length of the buffer
+ * @param received time when the event was read (CLOCK_MONOTONIC)
  */
 void FanotifyPolling::handleFanotifyEvent(
-    const struct fanotify_event_metadata *metadata) {
+    const struct fanotify_event_metadata *metadata,
+    const struct timespec *received) {
 
     int ret;
     pid_t pid;
@@ -230,8 +1114,15 @@ void FanotifyPolling::handleFanotifyEvent(
         .response = FAN_DENY,
     };
     int tobeclosed = 1;
+    enum ThreadPool::Priority priority = ThreadPool::DEMAND;
+    struct timespec start;
+    struct timespec end;
 
+    // Only this thread writes the counter.
+    __atomic_store_n(&events, events + 1, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &start);
     ret = fstat(metadata->fd, &statbuf);
+    clock_gettime(CLOCK_MONOTONIC, &end);
     if (ret == -1) {
         std::stringstream msg;
         char errbuf[256];
@@ -240,11 +1131,19 @@ void FanotifyPolling::handleFanotifyEvent(
         Messaging::message(Messaging::ERROR, msg.str());
         ret = writeResponse(response, 0);
     } else {
+        unsigned int invalidate = 0;
         if (metadata->mask & FAN_CLOSE_WRITE) {
-            e->getScanCache()->remove(&statbuf);
+            invalidate |= InvalidationCoalescer::CLOSE_WRITE;
         }
-        if (metadata->mask & FAN_MODIFY) {
-            if (S_ISREG(statbuf.st_mode)) {
+        if ((metadata->mask & FAN_MODIFY) && S_ISREG(statbuf.st_mode)) {
+            invalidate |= InvalidationCoalescer::MODIFY;
+        }
+        if (invalidate) {
+            unsigned int pending;
+            // Invalidate the cache entry after the coalescing window.
+            pending = coalescer->add(&statbuf, invalidate);
+            if ((invalidate & InvalidationCoalescer::MODIFY)
+                    && !(pending & InvalidationCoalescer::MODIFY)) {
                 // It is a file. Do not receive further MODIFY events.
                 ret = fanotify_mark(fd, FAN_MARK_ADD
                                     | FAN_MARK_IGNORED_MASK
@@ -253,20 +1152,21 @@ void FanotifyPolling::handleFanotifyEvent(
                 if (ret == -1) {
                     perror("analyze: fanotify_mark");
                 }
-                e->getScanCache()->remove(&statbuf);
             }
         }
         if (metadata->mask & FAN_OPEN_PERM) {
             response.fd = metadata->fd;
             response.response = FAN_ALLOW;
             pid = getpid();
-            if (pid == metadata->pid) {
+            if (pid == metadata->pid || ScanWorkers::isWorker(metadata->pid)) {
                 // for Skyld AV process always allow.
                 ret = writeResponse(response, 0);
             } else if (!S_ISREG(statbuf.st_mode)) {
                 // For directories always allow.
                 ret = writeResponse(response, 0);
             } else {
+                latency->record(LatencyStats::FSTAT, statbuf.st_dev, &start,
+                                &end);
                 // It is a file. Unignore it.
                 ret = fanotify_mark(fd, FAN_MARK_REMOVE |
                                     FAN_MARK_IGNORED_MASK, FAN_MODIFY, metadata->fd,
@@ -278,8 +1178,31 @@ void FanotifyPolling::handleFanotifyEvent(
                         << strerror_r(errno, errbuf, sizeof (errbuf));
                     Messaging::message(Messaging::ERROR, msg.str());
                 }
+                // Learn which files are opened most often.
+                if (hotFiles && hotFiles->add(&statbuf)) {
+                    hotFiles->setPath(&statbuf, getPath(metadata->fd));
+                }
+                // Apply pending invalidations before consulting the cache.
+                if (coalescer->isPending(&statbuf)) {
+                    coalescer->flush();
+                }
+                clock_gettime(CLOCK_MONOTONIC, &start);
                 response.response = e->getScanCache()->get(&statbuf);
-                if (response.response == ScanCache::CACHE_MISS) {
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                latency->record(LatencyStats::CACHE, statbuf.st_dev, &start,
+                                &end);
+                if (response.response == ScanCache::CACHE_MISS
+                        && classifyFile(metadata->fd, &statbuf, &priority)) {
+                    // Files of this class are not scanned.
+                    response.response = FAN_ALLOW;
+                    clock_gettime(CLOCK_MONOTONIC, &start);
+                    writeResponse(response, 1);
+                    clock_gettime(CLOCK_MONOTONIC, &end);
+                    latency->record(LatencyStats::RESPONSE, statbuf.st_dev,
+                                    &start, &end);
+                    latency->record(LatencyStats::TOTAL, statbuf.st_dev,
+                                    received, &end);
+                } else if (response.response == ScanCache::CACHE_MISS) {
                     struct ScanTask *task;
                     task = (struct ScanTask *) malloc(sizeof (struct ScanTask));
                     if (task == NULL) {
@@ -291,10 +1214,36 @@ void FanotifyPolling::handleFanotifyEvent(
                         tobeclosed = 0;
                         task->metadata = *metadata;
                         task->fp = this;
-                        tp->add((void *) task);
+                        task->type = PERMISSION;
+                        task->path = NULL;
+                        task->data = NULL;
+                        task->size = 0;
+                        task->priority = priority;
+                        task->readahead = 0;
+                        task->received = *received;
+                        clock_gettime(CLOCK_MONOTONIC, &task->queued);
+                        start = task->queued;
+                        if (reader == NULL || reader->submit(metadata->fd,
+                                statbuf.st_size, task)) {
+                            // Overlap reading the file with waiting in the
+                            // queue.
+                            task->readahead = readahead->start(metadata->fd,
+                                                               statbuf.st_size);
+                            tp->add((void *) task, priority);
+                        }
+                        // The task may already be completed.
+                        clock_gettime(CLOCK_MONOTONIC, &end);
+                        latency->record(LatencyStats::ENQUEUE,
+                                        statbuf.st_dev, &start, &end);
                     }
                 } else {
+                    clock_gettime(CLOCK_MONOTONIC, &start);
                     writeResponse(response, 0);
+                    clock_gettime(CLOCK_MONOTONIC, &end);
+                    latency->record(LatencyStats::RESPONSE, statbuf.st_dev,
+                                    &start, &end);
+                    latency->record(LatencyStats::TOTAL, statbuf.st_dev,
+                                    received, &end);
                 }
             }
         } // FAN_OPEN_PERM
@@ -311,8 +1260,10 @@ void FanotifyPolling::handleFanotifyEvent(
  *
  * @param buf buffer with events
  * @param len length of the buffer
+ * @param received time when the events were read (CLOCK_MONOTONIC)
  */
-void FanotifyPolling::handleFanotifyEvents(const void *buf, int len) {
+void FanotifyPolling::handleFanotifyEvents(const void *buf, int len,
+        const struct timespec *received) {
     const struct fanotify_event_metadata *metadata =
         (const struct fanotify_event_metadata *) buf;
 
@@ -321,7 +1272,7 @@ void FanotifyPolling::handleFanotifyEvents(const void *buf, int len) {
             Messaging::message(Messaging::ERROR,
                                "Received FAN_NOFD from fanotiy.");
         } else {
-            handleFanotifyEvent(metadata);
+            handleFanotifyEvent(metadata, received);
         }
         metadata = FAN_EVENT_NEXT(metadata, len);
     }
@@ -342,9 +1293,28 @@ FanotifyPolling::FanotifyPolling(Environment * env) {
     e = env;
 
     status = INITIAL;
+    startup = STARTING;
+    warmer = NULL;
+    unscanned = 0;
+    partialScans = 0;
+    fullScans = 0;
+    fullScansPending = 0;
+    lateDetections = 0;
+    events = 0;
+    scans = 0;
+    bytesScanned = 0;
+    denies = 0;
+    stats = NULL;
+    metrics = NULL;
+    trace = 0;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    clock_gettime(CLOCK_REALTIME, &blockDeadline);
+    blockDeadline.tv_sec += e->getStartupBlockTimeout();
+    // Monitor files while the virus database is loaded in the background.
+    deferring = e->getStartupPolicy() != Environment::STARTUP_WAIT;
 
     try {
-        virusScan = new VirusScan(e);
+        virusScan = new VirusScan(e, deferring);
     } catch (enum VirusScan::Status e) {
         Messaging::message(Messaging::ERROR, "Loading database failed.\n");
         throw FAILURE;
@@ -359,8 +1329,96 @@ FanotifyPolling::FanotifyPolling(Environment * env) {
         throw FAILURE;
     }
 
+    ret = pthread_mutex_init(&mutex_prefetch, NULL);
+    if (ret != 0) {
+        std::stringstream msg;
+        msg << "Failure to intialize mutex: "
+            << strerror_r(errno, errbuf, sizeof (errbuf));
+        Messaging::message(Messaging::ERROR, msg.str());
+        throw FAILURE;
+    }
+
+    ret = pthread_mutex_init(&mutex_startup, NULL);
+    if (ret != 0) {
+        std::stringstream msg;
+        msg << "Failure to intialize mutex: "
+            << strerror_r(errno, errbuf, sizeof (errbuf));
+        Messaging::message(Messaging::ERROR, msg.str());
+        throw FAILURE;
+    }
+
+    ret = pthread_mutex_init(&mutex_hotFiles, NULL);
+    if (ret != 0) {
+        std::stringstream msg;
+        msg << "Failure to intialize mutex: "
+            << strerror_r(errno, errbuf, sizeof (errbuf));
+        Messaging::message(Messaging::ERROR, msg.str());
+        throw FAILURE;
+    }
+
+    if (e->isPrefetchLibraries()) {
+        elfDependencies = new ElfDependencies();
+    } else {
+        elfDependencies = NULL;
+    }
+    if (e->getPrefetchSiblings() > 0) {
+        missTracker = new MissTracker(SKYLD_SIBLING_MISSES,
+                                      SKYLD_SIBLING_WINDOW,
+                                      SKYLD_SIBLING_COOLDOWN);
+    } else {
+        missTracker = NULL;
+    }
+
     tp = new ThreadPool(e->getNumberOfThreads(), scanFile);
 
+    // Load the files opened most often in previous runs.
+    hotListPending = 0;
+    if (e->getHotFiles().empty()) {
+        hotFiles = NULL;
+    } else {
+        struct timespec now;
+
+        hotFiles = new HotFiles(e->getHotFilesCount());
+        hotFiles->load(e->getHotFiles().c_str(), hotPaths);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        hotFilesSaved = now.tv_sec;
+    }
+
+    coalescer = new InvalidationCoalescer(e->getScanCache(),
+                                          SKYLD_COALESCE_WINDOW);
+    latency = new LatencyStats();
+    readahead = new Readahead(e->getReadaheadFile(), e->getReadaheadTotal());
+    reader = NULL;
+    if (e->getScanIo() == Environment::SCAN_IO_URING) {
+        try {
+            reader = new UringReader(e->getUringBuffers(),
+                                     e->getUringBufferSize(), readComplete);
+        } catch (UringReader::Status ex) {
+            Messaging::message(Messaging::WARNING,
+                               "Files are read by the scanning threads.");
+        }
+    }
+
+    if (!e->getStatsFile().empty()) {
+        try {
+            stats = new StatsSegment(e->getStatsFile(), collectStatistics,
+                                     this);
+        } catch (StatsSegment::Status ex) {
+            Messaging::message(Messaging::WARNING,
+                               "Statistics are not published.");
+        }
+    }
+    if (!e->getMetricsSocket().empty() || !e->getMetricsFile().empty()) {
+        try {
+            metrics = new MetricsExporter(e->getMetricsSocket(),
+                                          e->getMetricsFile(), renderMetrics,
+                                          this);
+        } catch (MetricsExporter::Status ex) {
+            Messaging::message(Messaging::WARNING,
+                               "Metrics are not exported.");
+        }
+    }
+
     ret = fanotifyOpen();
     if (ret != 0) {
         throw FAILURE;
@@ -389,6 +1447,26 @@ FanotifyPolling::FanotifyPolling(Environment * env) {
     } catch (MountPolling::Status e) {
         throw FAILURE;
     }
+
+    {
+        std::stringstream msg;
+
+        msg << "Protection started after " << std::fixed
+            << std::setprecision(1) << getStartupTime() << " s.";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+
+    pthread_mutex_lock(&mutex_startup);
+    if (deferring) {
+        // The fanotify thread completes the startup when the database is
+        // loaded.
+        startup = PROTECTING;
+        pthread_mutex_unlock(&mutex_startup);
+    } else {
+        startup = LOADED;
+        pthread_mutex_unlock(&mutex_startup);
+        startService();
+    }
 }
 
 /**
@@ -398,12 +1476,23 @@ FanotifyPolling::~FanotifyPolling() {
     void *result;
     int ret;
     char errbuf[256];
+    std::vector<int>::iterator pos;
 
     if (status != RUNNING) {
         Messaging::message(Messaging::ERROR, "Polling not started.\n");
         return;
     }
 
+    // Do not complete the startup any longer.
+    pthread_mutex_lock(&mutex_startup);
+    startup = SHUTDOWN;
+    pthread_mutex_unlock(&mutex_startup);
+
+    // Stop warming the cache.
+    if (warmer) {
+        delete warmer;
+    }
+
     // Stop the mount polling thread.
     if (mp) {
         delete mp;
@@ -425,9 +1514,63 @@ FanotifyPolling::~FanotifyPolling() {
     // Close the fanotify file descriptor.
     fanotifyClose();
 
+    if (hotFiles) {
+        // A copy still queued for saving is outdated.
+        pthread_mutex_lock(&mutex_hotFiles);
+        hotListPending = 0;
+        hotFiles->save(e->getHotFiles().c_str());
+        pthread_mutex_unlock(&mutex_hotFiles);
+        delete hotFiles;
+    }
+
+    // Apply pending cache invalidations.
+    delete coalescer;
+
+    // Pass the files being read to the thread pool.
+    if (reader) {
+        reader->stop();
+    }
+
+    // Stop publishing statistics before the thread pool is deleted.
+    if (stats) {
+        delete stats;
+    }
+    if (metrics) {
+        delete metrics;
+    }
+
     // Delete thread pool.
     delete tp;
 
+    if (partialScans) {
+        std::stringstream msg;
+        msg << "Files allowed after partial scan " << partialScans
+            << ", full scans completed " << fullScans
+            << ", viruses found by full scans " << lateDetections << ".";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+
+    latency->log(0);
+    delete latency;
+    delete readahead;
+    if (reader) {
+        delete reader;
+    }
+
+    if (elfDependencies) {
+        delete elfDependencies;
+    }
+    if (missTracker) {
+        delete missTracker;
+    }
+    // Close the files not scanned after startup.
+    for (pos = deferred.begin(); pos != deferred.end(); ++pos) {
+        close(*pos);
+    }
+    pthread_mutex_destroy(&mutex_hotFiles);
+    pthread_mutex_destroy(&mutex_prefetch);
+    pthread_mutex_destroy(&mutex_startup);
+
     // Destroy the mutex.
     if (pthread_mutex_destroy(&mutex_response)) {
         std::stringstream msg;
@@ -436,6 +1579,11 @@ FanotifyPolling::~FanotifyPolling() {
         Messaging::message(Messaging::ERROR, msg.str());
     }
 
+    // Persist the scan results.
+    if (!e->getCacheFile().empty()) {
+        saveCache(e->getCacheFile().c_str());
+    }
+
     // Unload the virus scanner.
     try {
         delete virusScan;
@@ -445,6 +1593,48 @@ FanotifyPolling::~FanotifyPolling() {
     }
 }
 
+/**
+ * @brief Requests the virus scanner to load the databases which have
+ * changed.
+ */
+void FanotifyPolling::requestDatabaseReload() {
+    virusScan->requestReload();
+}
+
+/**
+ * @brief Saves the scan cache to a file.
+ *
+ * @param filename cache file
+ * @return success = 0
+ */
+int FanotifyPolling::saveCache(const char *filename) {
+    return e->getScanCache()->save(filename,
+                                   virusScan->getDatabaseVersion());
+}
+
+/**
+ * @brief Changes the number of threads for scanning.
+ *
+ * Queued files and the scan cache are kept.
+ *
+ * @param nThreads number of threads
+ * @return number of threads after limiting
+ */
+int FanotifyPolling::setNumberOfThreads(int nThreads) {
+    nThreads = tp->setThreadCount(nThreads);
+    e->setNumberOfThreads(nThreads);
+    return nThreads;
+}
+
+/**
+ * @brief Switches logging the response to each file access on or off.
+ *
+ * @param value 1 = on, 0 = off
+ */
+void FanotifyPolling::setTrace(const int value) {
+    __atomic_store_n(&trace, value, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief Writes fanotify response
  * @param response response
@@ -466,7 +1656,14 @@ int FanotifyPolling::writeResponse(const struct fanotify_response response,
         }
     }
 
-    if (response.response == FAN_DENY && response.fd >= FAN_NOFD) {
+    if (response.response == FAN_DENY) {
+        __atomic_add_fetch(&denies, 1, __ATOMIC_RELAXED);
+    }
+    if ((response.response == FAN_DENY
+            ? Messaging::isEnabled(Messaging::WARNING)
+            : __atomic_load_n(&trace, __ATOMIC_RELAXED)
+            && Messaging::isEnabled(Messaging::INFORMATION))
+            && response.fd >= FAN_NOFD) {
         char path[PATH_MAX];
         int path_len;
         sprintf(path, "/proc/self/fd/%d", response.fd);
@@ -474,8 +1671,14 @@ int FanotifyPolling::writeResponse(const struct fanotify_response response,
         if (path_len > 0) {
             path[path_len] = '\0';
             std::stringstream msg;
-            msg << "Access to file \"" << path << "\" denied.";
-            Messaging::message(Messaging::WARNING, msg.str());
+            if (response.response == FAN_DENY) {
+                msg << "Access to file \"" << path << "\" denied.";
+                Messaging::message(Messaging::WARNING, msg.str());
+            } else {
+                msg << "Access to file \"" << path << "\" allowed"
+                    << (doBuffer ? " after scan." : ".");
+                Messaging::message(Messaging::INFORMATION, msg.str());
+            }
         }
     }
 
@@ -27,10 +27,24 @@
 
 #include <sys/fanotify.h>
 #include <pthread.h>
+#include <set>
+#include <string>
+#include <time.h>
+#include <vector>
+#include "CacheWarmer.h"
+#include "ElfDependencies.h"
+#include "HotFiles.h"
 #include "Environment.h"
+#include "InvalidationCoalescer.h"
+#include "LatencyStats.h"
+#include "MetricsExporter.h"
+#include "MissTracker.h"
 #include "MountPolling.h"
+#include "Readahead.h"
+#include "StatsSegment.h"
 #include "StringSet.h"
 #include "ThreadPool.h"
+#include "UringReader.h"
 #include "VirusScan.h"
 
 #ifdef	__cplusplus
@@ -53,9 +67,43 @@ public:
 
     FanotifyPolling(Environment *);
     ~FanotifyPolling();
+    LatencyStats *getLatencyStats();
+    void getStatistics(struct StatsValues *values);
     static int markMount(int fd, const char *mount);
+    void requestDatabaseReload();
+    int saveCache(const char *filename);
+    int setNumberOfThreads(int nThreads);
+    void setTrace(const int value);
     static int unmarkMount(int fd, const char *mount);
 private:
+
+    /**
+     * @brief Startup state.
+     */
+    enum Startup {
+        /**
+         * @brief Files are not yet monitored.
+         */
+        STARTING = 0,
+        /**
+         * @brief Files are monitored while the virus database is loaded.
+         */
+        PROTECTING = 1,
+        /**
+         * @brief The virus database is loaded, the startup is being
+         * completed.
+         */
+        LOADED = 2,
+        /**
+         * @brief The startup is completed.
+         */
+        SERVING = 3,
+        /**
+         * @brief Shutting down.
+         */
+        SHUTDOWN = 4
+    };
+
     /**
      * @brief Environment
      */
@@ -88,6 +136,176 @@ private:
      * Virus scanner.
      */
     VirusScan *virusScan;
+    /**
+     * @brief Coalescer for cache invalidations.
+     */
+    InvalidationCoalescer *coalescer;
+    /**
+     * @brief Latencies of the stages of answering file accesses.
+     */
+    LatencyStats *latency;
+    /**
+     * @brief Reads queued files ahead of their scan.
+     */
+    Readahead *readahead;
+    /**
+     * @brief Reads files with io_uring before scanning, NULL if files are
+     * read by the scanning threads.
+     */
+    UringReader *reader;
+    /**
+     * @brief Resolver for shared libraries, NULL if prefetching is disabled.
+     */
+    ElfDependencies *elfDependencies;
+    /**
+     * @brief Tracker of cache misses per directory, NULL if disabled.
+     */
+    MissTracker *missTracker;
+    /**
+     * @brief Warms the cache at startup, NULL if no warm paths are set.
+     */
+    CacheWarmer *warmer;
+    /**
+     * @brief Most often opened files, NULL if HOT_FILES is not set.
+     */
+    HotFiles *hotFiles;
+    /**
+     * @brief Time when the list of most often opened files was saved.
+     */
+    time_t hotFilesSaved;
+    /**
+     * @brief Most often opened files handed over for saving.
+     */
+    HotFiles::List hotList;
+    /**
+     * @brief hotList is waiting to be saved.
+     */
+    int hotListPending;
+    /**
+     * @brief Mutex for handing over and saving the list of most often
+     * opened files.
+     */
+    pthread_mutex_t mutex_hotFiles;
+    /**
+     * @brief Files queued for speculative scanning.
+     */
+    std::set<FileId> prefetching;
+    /**
+     * @brief Mutex for accessing the files queued for speculative scanning,
+     * the files to be scanned after startup, and the counters of partial
+     * scans.
+     */
+    pthread_mutex_t mutex_prefetch;
+    /**
+     * @brief Startup state.
+     */
+    enum Startup startup;
+    /**
+     * @brief Mutex for changing the startup state.
+     */
+    pthread_mutex_t mutex_startup;
+    /**
+     * @brief Files allowed without scan while the virus database is loaded
+     * are collected for scanning afterwards.
+     */
+    int deferring;
+    /**
+     * @brief Duplicated file descriptors of files to be scanned after the
+     * virus database has been loaded.
+     */
+    std::vector<int> deferred;
+    /**
+     * @brief Number of files allowed without scan.
+     */
+    unsigned long long unscanned;
+    /**
+     * @brief Number of files allowed after a partial scan.
+     */
+    unsigned long long partialScans;
+    /**
+     * @brief Number of full scans completed after a partial scan.
+     */
+    unsigned long long fullScans;
+    /**
+     * @brief Number of full scans reserved or queued, but not completed.
+     */
+    int fullScansPending;
+    /**
+     * @brief Number of viruses found by full scans after a partial scan.
+     */
+    unsigned long long lateDetections;
+    /**
+     * @brief Number of fanotify events received.
+     */
+    unsigned long long events;
+    /**
+     * @brief Number of files scanned.
+     */
+    unsigned long long scans;
+    /**
+     * @brief Number of bytes of the files scanned.
+     */
+    unsigned long long bytesScanned;
+    /**
+     * @brief Number of accesses denied.
+     */
+    unsigned long long denies;
+    /**
+     * @brief Shared memory segment with live statistics, NULL if not
+     * published.
+     */
+    StatsSegment *stats;
+    /**
+     * @brief Exporter of metrics, NULL if not exported.
+     */
+    MetricsExporter *metrics;
+    /**
+     * @brief Log the response to each file access.
+     */
+    int trace;
+    /**
+     * @brief Files opened most often in previous runs.
+     */
+    std::vector<std::string> hotPaths;
+    /**
+     * @brief Start time (CLOCK_MONOTONIC).
+     */
+    struct timespec startTime;
+    /**
+     * @brief End of delaying access at startup (CLOCK_REALTIME).
+     */
+    struct timespec blockDeadline;
+
+    /**
+     * @brief Type of scan task.
+     */
+    enum TaskType {
+        /**
+         * @brief Answer a fanotify permission event.
+         */
+        PERMISSION = 0,
+        /**
+         * @brief Speculative scan to fill the cache.
+         */
+        PREFETCH = 1,
+        /**
+         * @brief Queue the files of a directory for speculative scanning.
+         */
+        PREFETCH_DIRECTORY = 2,
+        /**
+         * @brief Complete the startup after the virus database has been
+         * loaded.
+         */
+        START_SERVICE = 3,
+        /**
+         * @brief Scan a file fully after a partial scan.
+         */
+        FULL_SCAN = 4,
+        /**
+         * @brief Save the list of most often opened files.
+         */
+        SAVE_HOT_FILES = 5
+    };
 
     /**
      * @brief Scan task.
@@ -97,20 +315,80 @@ private:
          * @brief fanotify polling object
          */
         FanotifyPolling *fp;
+        /**
+         * @brief type of task
+         */
+        enum TaskType type;
         /**
          * @brief fanotify metadata
          */
         struct fanotify_event_metadata metadata;
+        /**
+         * @brief directory path for PREFETCH_DIRECTORY, else NULL
+         */
+        char *path;
+        /**
+         * @brief time when the event was read (CLOCK_MONOTONIC)
+         */
+        struct timespec received;
+        /**
+         * @brief time when the task was queued (CLOCK_MONOTONIC)
+         */
+        struct timespec queued;
+        /**
+         * @brief number of bytes read ahead
+         */
+        size_t readahead;
+        /**
+         * @brief content of the file read with io_uring, else NULL
+         */
+        char *data;
+        /**
+         * @brief size of the content
+         */
+        size_t size;
+        /**
+         * @brief priority of the scan task
+         */
+        enum ThreadPool::Priority priority;
     };
 
     typedef void (*skyld_pollfanotifycallbackptr)(const int fd,
             const void *buf, int len);
 
     static void *run(void *);
-    int exclude(const int fd);
+    static std::string getPath(const int fd);
+    static void collectStatistics(void *obj, struct StatsValues *values);
+    void countScan(const int result, const off_t size);
+    static void renderMetrics(void *obj, std::ostream &out);
+    int classifyFile(const int fd, const struct stat *statbuf,
+                     enum ThreadPool::Priority *priority);
+    void deferScan(const int fd);
+    double getStartupTime();
+    void saveHotFiles();
+    void writeHotFiles();
+    int prefetch(const int fd,
+                 const enum ThreadPool::Priority priority = ThreadPool::IDLE);
+    void prefetchDirectory(const char *path);
+    void prefetchLibraries(const int fd, const std::string &path,
+                           const int executablesOnly);
+    void prefetchRelated(const int fd, const std::string &path,
+                         const unsigned int response);
+    void queueDirectory(const std::string &path);
+    void queueFullScan(const int fd);
+    void releaseFullScan();
+    int reserveFullScan();
+    void queueStartService();
+    void startService();
+    void scanFull(const int fd);
+    void scanSpeculative(const int fd);
+    static void readComplete(void *item, char *data, size_t size);
     static void *scanFile(void *workitem);
-    void handleFanotifyEvents(const void *buf, int len);
-    void handleFanotifyEvent(const struct fanotify_event_metadata *);
+    void handleFanotifyEvents(const void *buf, int len,
+                              const struct timespec *received);
+    void handleFanotifyEvent(const struct fanotify_event_metadata *,
+                             const struct timespec *received);
+    int isExcluded(const std::string &path, const dev_t dev);
     int writeResponse(const struct fanotify_response, int);
     int fanotifyOpen();
     int fanotifyClose();
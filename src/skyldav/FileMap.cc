@@ -0,0 +1,146 @@
+/*
+ * File:   FileMap.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file FileMap.cc
+ * @brief Maps a file into memory for reading it once.
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "FileMap.h"
+#include "Messaging.h"
+
+/**
+ * @brief Innermost mapping of the current thread.
+ */
+static __thread FileMap *current = NULL;
+
+/**
+ * @brief Installs the signal handler once.
+ */
+static pthread_once_t handlerOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Maps a file into memory.
+ *
+ * @param fd file descriptor
+ * @param size size of the file, must be positive
+ */
+FileMap::FileMap(const int fd, const off_t size) {
+    long pageSize = sysconf(_SC_PAGESIZE);
+    void *addr;
+
+    pthread_once(&handlerOnce, installHandler);
+    this->size = size;
+    length = (this->size + pageSize - 1) & ~(pageSize - 1);
+    truncated = 0;
+    posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+    addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw FAILURE;
+    }
+    data = (char *) addr;
+    madvise(data, length, MADV_SEQUENTIAL);
+    madvise(data, length, MADV_WILLNEED);
+    previous = current;
+    current = this;
+}
+
+/**
+ * @brief Gets the content of the file.
+ *
+ * @return start of the mapping
+ */
+const char *FileMap::getData() {
+    return data;
+}
+
+/**
+ * @brief Gets the size of the file when it was mapped.
+ *
+ * @return size
+ */
+size_t FileMap::getSize() {
+    return size;
+}
+
+/**
+ * @brief Replaces pages beyond the end of a truncated file by zero pages.
+ *
+ * Signals not caused by a mapping of the current thread terminate the
+ * process as before.
+ *
+ * @param info signal information
+ */
+void FileMap::handler(int, siginfo_t *info, void *) {
+    FileMap *map;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    char *page;
+
+    page = (char *) ((uintptr_t) info->si_addr & ~(pageSize - 1));
+    for (map = current; map; map = map->previous) {
+        if (page >= map->data && page < map->data + map->length) {
+            break;
+        }
+    }
+    if (map == NULL || mmap(page, pageSize, PROT_READ,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        // The faulting access is repeated with the default action.
+        signal(SIGBUS, SIG_DFL);
+        return;
+    }
+    map->truncated = 1;
+}
+
+/**
+ * @brief Installs the handler for SIGBUS.
+ */
+void FileMap::installHandler() {
+    struct sigaction act;
+
+    act.sa_sigaction = handler;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_SIGINFO;
+    if (sigaction(SIGBUS, &act, NULL)) {
+        Messaging::error("FileMap, sigaction");
+    }
+}
+
+/**
+ * @brief Checks if the file was truncated while being read.
+ *
+ * The content read beyond the new end of the file consists of zeros.
+ *
+ * @return file was truncated
+ */
+int FileMap::isTruncated() {
+    return truncated;
+}
+
+/**
+ * @brief Unmaps the file.
+ */
+FileMap::~FileMap() {
+    current = previous;
+    munmap(data, length);
+}
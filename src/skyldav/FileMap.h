@@ -0,0 +1,89 @@
+/*
+ * File:   FileMap.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file FileMap.h
+ * @brief Maps a file into memory for reading it once.
+ */
+#ifndef FILEMAP_H
+#define	FILEMAP_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief Maps a file into memory for reading it once.
+ *
+ * The kernel is advised to read the file sequentially and ahead. All stages
+ * needing the content of the file use the same mapping, so that the file
+ * is read from storage only once.
+ *
+ * If the file is truncated while mapped, accessing the pages beyond the new
+ * end of the file would raise SIGBUS. The signal handler replaces these
+ * pages by zero pages and marks the mapping as truncated. A mapping may only
+ * be accessed by the thread which created it.
+ */
+class FileMap {
+public:
+
+    /**
+     * @brief Status of the file map.
+     */
+    enum Status {
+        /**
+         * @brief The file could not be mapped.
+         */
+        FAILURE = 1
+    };
+
+    FileMap(const int fd, const off_t size);
+    const char *getData();
+    size_t getSize();
+    int isTruncated();
+    virtual ~FileMap();
+private:
+    /**
+     * @brief Start of the mapping.
+     */
+    char *data;
+    /**
+     * @brief Size of the file when mapped.
+     */
+    size_t size;
+    /**
+     * @brief Size of the mapping rounded up to full pages.
+     */
+    size_t length;
+    /**
+     * @brief Mapping of the enclosing scope of the same thread.
+     */
+    FileMap *previous;
+    /**
+     * @brief Pages were accessed beyond the end of the truncated file.
+     */
+    volatile int truncated;
+
+    static void handler(int, siginfo_t *, void *);
+    static void installHandler();
+
+    // Do not allow copying.
+    FileMap(const FileMap&);
+};
+
+#endif	/* FILEMAP_H */
@@ -0,0 +1,345 @@
+/*
+ * File:   HotFiles.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file HotFiles.cc
+ * @brief Learns which files are opened most often.
+ */
+#include <algorithm>
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "HotFiles.h"
+#include "Messaging.h"
+
+/**
+ * @brief Number of rows of the count-min sketch.
+ */
+#define SKYLD_SKETCH_DEPTH 4
+
+/**
+ * @brief Number of counters per row of the count-min sketch.
+ */
+#define SKYLD_SKETCH_WIDTH 16384
+
+/**
+ * @brief Creates an empty list of often opened files.
+ *
+ * @param n maximum number of files in the list
+ */
+HotFiles::HotFiles(const unsigned int n) {
+    size = n;
+    threshold = 0;
+    sketch = new uint32_t[SKYLD_SKETCH_DEPTH * SKYLD_SKETCH_WIDTH];
+    memset(sketch, 0,
+           SKYLD_SKETCH_DEPTH * SKYLD_SKETCH_WIDTH * sizeof (uint32_t));
+}
+
+/**
+ * @brief Records the opening of a file.
+ *
+ * @param stat file status as returned by fstat()
+ * @return 1 if the path of the file shall be provided via setPath()
+ */
+int HotFiles::add(const struct stat *stat) {
+    FileId id(stat->st_dev, stat->st_ino);
+    std::map<FileId, HotFile>::iterator it;
+    uint32_t count;
+
+    count = increment(id, 1);
+    it = top.find(id);
+    if (it != top.end()) {
+        it->second.count = count;
+        return it->second.path.empty();
+    }
+    insert(id, count);
+    return top.count(id);
+}
+
+/**
+ * @brief Halves all counts, so that recent opens weigh more.
+ */
+void HotFiles::age() {
+    std::map<FileId, HotFile>::iterator it;
+    unsigned int i;
+
+    for (i = 0; i < SKYLD_SKETCH_DEPTH * SKYLD_SKETCH_WIDTH; i++) {
+        sketch[i] >>= 1;
+    }
+    for (it = top.begin(); it != top.end(); ++it) {
+        it->second.count >>= 1;
+    }
+    threshold >>= 1;
+}
+
+/**
+ * @brief Gets the files in the list whose path is known.
+ *
+ * @param entries receives counts and paths in no particular order
+ */
+void HotFiles::getList(List &entries) {
+    std::map<FileId, HotFile>::iterator it;
+
+    for (it = top.begin(); it != top.end(); ++it) {
+        if (!it->second.path.empty()) {
+            entries.push_back(std::make_pair(it->second.count,
+                                             it->second.path));
+        }
+    }
+}
+
+/**
+ * @brief Calculates the column of a file in a row of the sketch.
+ *
+ * @param id device ID and inode number
+ * @param row row of the sketch
+ * @return hash value
+ */
+uint64_t HotFiles::hash(const FileId &id, const unsigned int row) {
+    uint64_t x;
+
+    x = ((uint64_t) id.first * 0x9e3779b97f4a7c15ULL) ^ (uint64_t) id.second;
+    x += (row + 1) * 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Increments the count of a file in the sketch.
+ *
+ * Only the smallest counters are incremented (conservative update).
+ *
+ * @param id device ID and inode number
+ * @param n increment
+ * @return estimated count
+ */
+uint32_t HotFiles::increment(const FileId &id, const uint32_t n) {
+    uint32_t *counter[SKYLD_SKETCH_DEPTH];
+    uint32_t min = UINT32_MAX;
+    uint32_t count;
+    unsigned int row;
+
+    for (row = 0; row < SKYLD_SKETCH_DEPTH; row++) {
+        counter[row] = sketch + row * SKYLD_SKETCH_WIDTH
+                       + hash(id, row) % SKYLD_SKETCH_WIDTH;
+        if (*counter[row] < min) {
+            min = *counter[row];
+        }
+    }
+    count = min > UINT32_MAX - n ? UINT32_MAX : min + n;
+    for (row = 0; row < SKYLD_SKETCH_DEPTH; row++) {
+        if (*counter[row] < count) {
+            *counter[row] = count;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Inserts a file into the list if its count is high enough.
+ *
+ * @param id device ID and inode number
+ * @param count estimated count
+ */
+void HotFiles::insert(const FileId &id, const uint32_t count) {
+    std::map<FileId, HotFile>::iterator it;
+    std::map<FileId, HotFile>::iterator min;
+
+    if (top.size() >= size) {
+        if (size == 0 || count <= threshold) {
+            return;
+        }
+        // Find the entry with the smallest count.
+        min = top.begin();
+        for (it = top.begin(); it != top.end(); ++it) {
+            if (it->second.count < min->second.count) {
+                min = it;
+            }
+        }
+        if (count <= min->second.count) {
+            threshold = min->second.count;
+            return;
+        }
+        top.erase(min);
+    }
+    top[id].count = count;
+    if (top.size() >= size) {
+        threshold = count;
+        for (it = top.begin(); it != top.end(); ++it) {
+            if (it->second.count < threshold) {
+                threshold = it->second.count;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Loads a list written by save().
+ *
+ * The counts are added to the sketch.
+ *
+ * @param filename file name
+ * @param paths receives the paths in descending order of the counts
+ * @return number of files loaded, -1 on error
+ */
+int HotFiles::load(const char *filename, std::vector<std::string> &paths) {
+    std::ifstream file;
+    std::string line;
+    int ret = 0;
+
+    file.open(filename);
+    if (!file.is_open()) {
+        if (errno != ENOENT) {
+            Messaging::error(std::string("Cannot open hot file list '")
+                             + filename + "'");
+            return -1;
+        }
+        return 0;
+    }
+    while (std::getline(file, line)) {
+        std::istringstream ss(line);
+        std::string path;
+        uint32_t count;
+        struct stat statbuf;
+        FileId id;
+
+        ss >> count;
+        if (ss.fail() || ss.get() != ' ') {
+            continue;
+        }
+        std::getline(ss, path);
+        if (path.empty() || stat(path.c_str(), &statbuf)
+                || !S_ISREG(statbuf.st_mode)) {
+            continue;
+        }
+        id = FileId(statbuf.st_dev, statbuf.st_ino);
+        insert(id, increment(id, count));
+        if (top.count(id)) {
+            top[id].path = path;
+        }
+        paths.push_back(path);
+        ret++;
+    }
+    return ret;
+}
+
+/**
+ * @brief Compares two entries by count.
+ *
+ * @param a first entry
+ * @param b second entry
+ * @return a has a higher count than b
+ */
+static bool higherCount(const std::pair<uint32_t, std::string> &a,
+                        const std::pair<uint32_t, std::string> &b) {
+    return a.first > b.first;
+}
+
+/**
+ * @brief Saves the list in descending order of the counts.
+ *
+ * Each line contains the count and the path separated by a space. The file
+ * is replaced atomically.
+ *
+ * @param filename file name
+ * @return success = 0
+ */
+int HotFiles::save(const char *filename) {
+    List entries;
+
+    getList(entries);
+    return save(filename, entries);
+}
+
+/**
+ * @brief Saves a list obtained by getList() in descending order of the
+ * counts.
+ *
+ * The list is sorted. No instance is accessed, so the list can be saved by
+ * another thread than the one recording the opens.
+ *
+ * @param filename file name
+ * @param entries counts and paths
+ * @return success = 0
+ */
+int HotFiles::save(const char *filename, List &entries) {
+    List::iterator pos;
+    std::string tmpname;
+    FILE *file;
+    int ret = 0;
+
+    std::stable_sort(entries.begin(), entries.end(), higherCount);
+
+    tmpname = std::string(filename) + ".tmp";
+    file = fopen(tmpname.c_str(), "we");
+    if (file == NULL) {
+        Messaging::error("Cannot create hot file list '" + tmpname + "'");
+        return 1;
+    }
+    for (pos = entries.begin(); pos != entries.end(); ++pos) {
+        if (fprintf(file, "%u %s\n", pos->first, pos->second.c_str()) < 0) {
+            ret = 1;
+            break;
+        }
+    }
+    if (fclose(file)) {
+        ret = 1;
+    }
+    if (ret == 0 && rename(tmpname.c_str(), filename)) {
+        ret = 1;
+    }
+    if (ret) {
+        Messaging::error(std::string("Cannot write hot file list '")
+                         + filename + "'");
+        unlink(tmpname.c_str());
+    }
+    return ret;
+}
+
+/**
+ * @brief Sets the path of a file in the list.
+ *
+ * @param stat file status as returned by fstat()
+ * @param path absolute path
+ */
+void HotFiles::setPath(const struct stat *stat, const std::string &path) {
+    std::map<FileId, HotFile>::iterator it;
+
+    it = top.find(FileId(stat->st_dev, stat->st_ino));
+    if (it == top.end()) {
+        return;
+    }
+    if (path.empty() || path.find('\n') != std::string::npos
+            || path[0] != '/') {
+        // The path cannot be saved.
+        top.erase(it);
+    } else {
+        it->second.path = path;
+    }
+}
+
+/**
+ * @brief Deletes the list.
+ */
+HotFiles::~HotFiles() {
+    delete[] sketch;
+}
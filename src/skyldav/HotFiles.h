@@ -0,0 +1,98 @@
+/*
+ * File:   HotFiles.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file HotFiles.h
+ * @brief Learns which files are opened most often.
+ */
+#ifndef HOTFILES_H
+#define	HOTFILES_H
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include "ScanCache.h"
+
+/**
+ * @brief Learns which files are opened most often.
+ *
+ * The number of opens per file is estimated with a count-min sketch. The
+ * paths of the files with the highest estimates are kept in a list of
+ * limited size, which can be saved and loaded again at the next start.
+ *
+ * The class is not thread safe.
+ */
+class HotFiles {
+public:
+    /**
+     * @brief Counts and paths of files.
+     */
+    typedef std::vector<std::pair<uint32_t, std::string> > List;
+
+    HotFiles(const unsigned int size);
+    int add(const struct stat *);
+    void age();
+    void getList(List &);
+    int load(const char *, std::vector<std::string> &);
+    int save(const char *);
+    static int save(const char *, List &);
+    void setPath(const struct stat *, const std::string &);
+    virtual ~HotFiles();
+private:
+    /**
+     * @brief Entry of the list of most often opened files.
+     */
+    struct HotFile {
+        /**
+         * @brief Absolute path, empty if not yet known.
+         */
+        std::string path;
+        /**
+         * @brief Estimated number of opens.
+         */
+        uint32_t count;
+    };
+
+    /**
+     * @brief Counters of the sketch, depth rows of width counters.
+     */
+    uint32_t *sketch;
+    /**
+     * @brief Most often opened files.
+     */
+    std::map<FileId, HotFile> top;
+    /**
+     * @brief Maximum number of entries in top.
+     */
+    unsigned int size;
+    /**
+     * @brief Lower bound of the smallest count in top if top is full.
+     */
+    uint32_t threshold;
+
+    uint32_t increment(const FileId &, const uint32_t);
+    static uint64_t hash(const FileId &, const unsigned int row);
+    void insert(const FileId &, const uint32_t);
+
+    // Do not allow copying.
+    HotFiles(const HotFiles&);
+};
+
+#endif	/* HOTFILES_H */
@@ -0,0 +1,168 @@
+/*
+ * File:   InvalidationCoalescer.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file InvalidationCoalescer.cc
+ * @brief Coalesces cache invalidations caused by file modifications.
+ */
+#include <sstream>
+#include <vector>
+#include "InvalidationCoalescer.h"
+#include "Messaging.h"
+
+/**
+ * @brief Creates a coalescer for cache invalidations.
+ *
+ * @param c cache to be invalidated
+ * @param w time window in milliseconds
+ */
+InvalidationCoalescer::InvalidationCoalescer(ScanCache *c, const long w) {
+    cache = c;
+    window = w;
+    invalidations = 0;
+    duplicates = 0;
+    first.tv_sec = 0;
+    first.tv_nsec = 0;
+}
+
+/**
+ * @brief Adds an invalidation.
+ *
+ * @param stat file status as returned by fstat()
+ * @param type event type (CLOSE_WRITE, MODIFY)
+ * @return event types already pending for the file
+ */
+unsigned int InvalidationCoalescer::add(const struct stat *stat,
+                                        const unsigned int type) {
+    std::map<FileId, unsigned int>::iterator it;
+    unsigned int ret;
+
+    if (pending.empty()) {
+        clock_gettime(CLOCK_MONOTONIC, &first);
+    }
+    it = pending.find(FileId(stat->st_dev, stat->st_ino));
+    if (it == pending.end()) {
+        pending[FileId(stat->st_dev, stat->st_ino)] = type;
+        ret = 0;
+    } else {
+        ret = it->second;
+        it->second |= type;
+        duplicates++;
+    }
+    return ret;
+}
+
+/**
+ * @brief Gets the milliseconds elapsed since the first pending invalidation.
+ *
+ * @return elapsed time
+ */
+long InvalidationCoalescer::elapsed() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - first.tv_sec) * 1000
+           + (now.tv_nsec - first.tv_nsec) / 1000000;
+}
+
+/**
+ * @brief Applies all pending invalidations to the cache.
+ */
+void InvalidationCoalescer::flush() {
+    std::map<FileId, unsigned int>::iterator it;
+    std::vector<FileId> ids;
+
+    if (pending.empty()) {
+        return;
+    }
+    ids.reserve(pending.size());
+    for (it = pending.begin(); it != pending.end(); ++it) {
+        ids.push_back(it->first);
+    }
+    cache->remove(ids);
+    invalidations += ids.size();
+    pending.clear();
+}
+
+/**
+ * @brief Applies the pending invalidations if the time window has elapsed.
+ */
+void InvalidationCoalescer::flushExpired() {
+    if (!pending.empty() && elapsed() >= window) {
+        flush();
+    }
+}
+
+/**
+ * @brief Gets the number of duplicate invalidations dropped.
+ *
+ * @return number of duplicates
+ */
+unsigned long long InvalidationCoalescer::getDuplicates() {
+    return duplicates;
+}
+
+/**
+ * @brief Gets the number of invalidations applied to the cache.
+ *
+ * @return number of invalidations
+ */
+unsigned long long InvalidationCoalescer::getInvalidations() {
+    return invalidations;
+}
+
+/**
+ * @brief Gets the time until the pending invalidations have to be applied.
+ *
+ * @return time in milliseconds, -1 if nothing is pending
+ */
+long InvalidationCoalescer::getTimeout() {
+    long ret;
+
+    if (pending.empty()) {
+        return -1;
+    }
+    ret = window - elapsed();
+    if (ret < 0) {
+        ret = 0;
+    }
+    return ret;
+}
+
+/**
+ * @brief Checks if an invalidation is pending for a file.
+ *
+ * @param stat file status as returned by fstat()
+ * @return 1 if pending
+ */
+int InvalidationCoalescer::isPending(const struct stat *stat) {
+    return pending.count(FileId(stat->st_dev, stat->st_ino)) ? 1 : 0;
+}
+
+/**
+ * @brief Applies pending invalidations and deletes the coalescer.
+ */
+InvalidationCoalescer::~InvalidationCoalescer() {
+    std::stringstream msg;
+
+    flush();
+    msg << "Cache invalidations " << invalidations
+        << ", coalesced duplicates " << duplicates << ".";
+    Messaging::message(Messaging::INFORMATION, msg.str());
+}
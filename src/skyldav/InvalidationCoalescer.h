@@ -0,0 +1,99 @@
+/*
+ * File:   InvalidationCoalescer.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file InvalidationCoalescer.h
+ * @brief Coalesces cache invalidations caused by file modifications.
+ */
+#ifndef INVALIDATIONCOALESCER_H
+#define	INVALIDATIONCOALESCER_H
+
+#include <map>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include "ScanCache.h"
+
+/**
+ * @brief Coalesces cache invalidations caused by file modifications.
+ *
+ * <p>Files that are written continuously (log files, databases) cause a
+ * stream of FAN_MODIFY and FAN_CLOSE_WRITE events. Instead of removing the
+ * cache entry for each event the invalidations are collected and applied
+ * to the cache in one batch when the time window has elapsed. Duplicate
+ * invalidations of the same file within the window are dropped.</p>
+ * <p>Before the cache is consulted for a file with a pending invalidation
+ * the pending invalidations must be flushed.</p>
+ * <p>The object is not thread safe. It is only used by the fanotify
+ * polling thread.</p>
+ */
+class InvalidationCoalescer {
+public:
+    /**
+     * @brief File was closed after writing.
+     */
+    static const unsigned int CLOSE_WRITE = 1;
+    /**
+     * @brief File was modified.
+     */
+    static const unsigned int MODIFY = 2;
+
+    InvalidationCoalescer(ScanCache *, const long window);
+    unsigned int add(const struct stat *, const unsigned int);
+    void flush();
+    void flushExpired();
+    unsigned long long getDuplicates();
+    unsigned long long getInvalidations();
+    long getTimeout();
+    int isPending(const struct stat *);
+    virtual ~InvalidationCoalescer();
+private:
+    /**
+     * @brief Cache to be invalidated.
+     */
+    ScanCache *cache;
+    /**
+     * @brief Time window in milliseconds.
+     */
+    long window;
+    /**
+     * @brief Pending invalidations with the event types received.
+     */
+    std::map<FileId, unsigned int> pending;
+    /**
+     * @brief Time when the first pending invalidation was received.
+     */
+    struct timespec first;
+    /**
+     * @brief Number of invalidations applied to the cache.
+     */
+    unsigned long long invalidations;
+    /**
+     * @brief Number of duplicate invalidations dropped.
+     */
+    unsigned long long duplicates;
+
+    long elapsed();
+
+    // Do not allow copying.
+    InvalidationCoalescer(const InvalidationCoalescer&);
+};
+
+#endif	/* INVALIDATIONCOALESCER_H */
+
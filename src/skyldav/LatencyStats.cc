@@ -0,0 +1,524 @@
+/*
+ * File:   LatencyStats.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file LatencyStats.cc
+ * @brief Latency histograms of the stages of answering a file access.
+ */
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+#include "LatencyStats.h"
+#include "Messaging.h"
+#include "MetricsExporter.h"
+
+/**
+ * @brief Names of the stages.
+ */
+static const char *stageNames[LatencyStats::STAGES] = {
+    "read", "fstat", "cache", "enqueue", "queue", "exclude", "scan",
+    "response", "total"
+};
+
+/**
+ * @brief Creates empty statistics.
+ */
+LatencyStats::LatencyStats() {
+    pthread_key_create(&key, releaseRecorder);
+    pthread_mutex_init(&mutex, NULL);
+}
+
+/**
+ * @brief Gets the bucket of a value.
+ *
+ * Values below SKYLD_LATENCY_SUB_BUCKETS have a bucket each. Above, each
+ * power of two is split into SKYLD_LATENCY_SUB_BUCKETS / 2 buckets.
+ *
+ * @param value value in nanoseconds
+ * @return index of the bucket
+ */
+unsigned int LatencyStats::bucket(unsigned long long value) {
+    const unsigned int half = SKYLD_LATENCY_SUB_BUCKETS / 2;
+    unsigned int shift;
+    unsigned int index;
+
+    if (value < SKYLD_LATENCY_SUB_BUCKETS) {
+        return value;
+    }
+    // Keep the five most significant bits.
+    shift = 63 - __builtin_clzll(value) - 4;
+    index = shift * half + (unsigned int) (value >> shift);
+    if (index >= SKYLD_LATENCY_BUCKETS) {
+        index = SKYLD_LATENCY_BUCKETS - 1;
+    }
+    return index;
+}
+
+/**
+ * @brief Gets the highest value of a bucket.
+ *
+ * @param index index of the bucket
+ * @return value in nanoseconds
+ */
+unsigned long long LatencyStats::bucketValue(const unsigned int index) {
+    const unsigned int half = SKYLD_LATENCY_SUB_BUCKETS / 2;
+    unsigned int shift;
+    unsigned long long sub;
+
+    if (index < SKYLD_LATENCY_SUB_BUCKETS) {
+        return index;
+    }
+    shift = index / half - 1;
+    sub = index - shift * half;
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * @brief Gets the devices of all mounts with recorded values.
+ *
+ * @param devs receives the devices
+ */
+void LatencyStats::getDevices(std::vector<dev_t> &devs) {
+    std::vector<Recorder *>::iterator it;
+    unsigned int i;
+
+    pthread_mutex_lock(&mutex);
+    for (it = recorders.begin(); it != recorders.end(); ++it) {
+        for (i = 0; i < SKYLD_LATENCY_MOUNTS; i++) {
+            dev_t dev = __atomic_load_n(&(*it)->devs[i], __ATOMIC_ACQUIRE);
+
+            if (dev == 0) {
+                break;
+            }
+            if (std::find(devs.begin(), devs.end(), dev) == devs.end()) {
+                devs.push_back(dev);
+            }
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Gets the mount point and the file system type of a device.
+ *
+ * @param dev device
+ * @param mountPoint receives the mount point, or the device number if not
+ * mounted
+ * @param fsType receives the file system type, empty if not mounted
+ */
+void LatencyStats::getMount(const dev_t dev, std::string &mountPoint,
+                            std::string &fsType) {
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    std::stringstream name;
+    std::string line;
+
+    // e.g. "36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 ..."
+    while (std::getline(mountinfo, line)) {
+        std::istringstream fields(line);
+        std::string id;
+        std::string parent;
+        std::string device;
+        std::string root;
+        std::string field;
+        unsigned int devMajor;
+        unsigned int devMinor;
+
+        fields >> id >> parent >> device >> root >> mountPoint;
+        if (sscanf(device.c_str(), "%u:%u", &devMajor, &devMinor) == 2
+                && makedev(devMajor, devMinor) == dev) {
+            // The optional fields end with a separator.
+            while (fields >> field && field != "-") {
+            }
+            fields >> fsType;
+            return;
+        }
+    }
+    name << major(dev) << ":" << minor(dev);
+    mountPoint = name.str();
+    fsType = "";
+}
+
+/**
+ * @brief Gets the recorder of the current thread.
+ *
+ * A recorder released by an exited thread is reused, else a new recorder
+ * is added.
+ *
+ * @return recorder
+ */
+LatencyStats::Recorder *LatencyStats::getRecorder() {
+    std::vector<Recorder *>::iterator it;
+    Recorder *r;
+
+    r = (Recorder *) pthread_getspecific(key);
+    if (r != NULL) {
+        return r;
+    }
+    pthread_mutex_lock(&mutex);
+    for (it = recorders.begin(); it != recorders.end(); ++it) {
+        int expected = 0;
+
+        if (__atomic_compare_exchange_n(&(*it)->owned, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            r = *it;
+            break;
+        }
+    }
+    if (r == NULL) {
+        r = (Recorder *) calloc(1, sizeof (Recorder));
+        if (r != NULL) {
+            r->owned = 1;
+            recorders.push_back(r);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    if (r != NULL) {
+        pthread_setspecific(key, r);
+    }
+    return r;
+}
+
+/**
+ * @brief Gets the lines of a report.
+ *
+ * @param lines receives the lines
+ * @param perMount add the stages per mount
+ */
+void LatencyStats::getReport(std::vector<std::string> &lines,
+                             const int perMount) {
+    std::vector<dev_t> devs;
+    std::vector<dev_t>::iterator dev;
+    unsigned int stage;
+
+    devs.push_back(0);
+    if (perMount) {
+        getDevices(devs);
+    }
+    for (dev = devs.begin(); dev != devs.end(); ++dev) {
+        std::string mountPoint;
+        std::string fsType;
+
+        if (*dev) {
+            getMount(*dev, mountPoint, fsType);
+        }
+        for (stage = 0; stage < STAGES; stage++) {
+            struct Summary s;
+            std::stringstream msg;
+
+            getSummary((enum Stage) stage, *dev, &s);
+            if (s.count == 0) {
+                continue;
+            }
+            msg << "Latency of " << stageNames[stage];
+            if (*dev) {
+                msg << " on " << mountPoint;
+            }
+            msg << ": " << s.count << " events, p50 " << std::fixed
+                << std::setprecision(3) << s.p50 / 1000000.
+                << " ms, p99 " << s.p99 / 1000000.
+                << " ms, p99.9 " << s.p999 / 1000000.
+                << " ms, max " << s.max / 1000000. << " ms.";
+            lines.push_back(msg.str());
+        }
+    }
+}
+
+/**
+ * @brief Gets the name of a stage.
+ *
+ * @param stage stage
+ * @return name
+ */
+const char *LatencyStats::getStageName(const enum Stage stage) {
+    return stageNames[stage];
+}
+
+/**
+ * @brief Gets the percentiles of a stage.
+ *
+ * @param stage stage
+ * @param dev device of the mount, 0 = all mounts
+ * @param summary receives the percentiles
+ */
+void LatencyStats::getSummary(const enum Stage stage, const dev_t dev,
+                              struct Summary *summary) {
+    struct Histogram *h;
+
+    h = (struct Histogram *) calloc(1, sizeof (struct Histogram));
+    if (h == NULL) {
+        memset(summary, 0, sizeof (struct Summary));
+        return;
+    }
+    merge(stage, dev, h);
+    summarize(h, summary);
+    free(h);
+}
+
+/**
+ * @brief Writes a report to the log.
+ *
+ * @param perMount add the stages per mount
+ */
+void LatencyStats::log(const int perMount) {
+    std::vector<std::string> lines;
+    std::vector<std::string>::iterator it;
+
+    getReport(lines, perMount);
+    for (it = lines.begin(); it != lines.end(); ++it) {
+        Messaging::message(Messaging::INFORMATION, *it);
+    }
+}
+
+/**
+ * @brief Merges the histograms of all threads.
+ *
+ * The histograms are read while the threads keep recording. A merged
+ * histogram may thus miss the latest values.
+ *
+ * @param stage stage
+ * @param dev device of the mount, 0 = all mounts
+ * @param h receives the merged histogram
+ */
+void LatencyStats::merge(const enum Stage stage, const dev_t dev,
+                         struct Histogram *h) {
+    std::vector<Recorder *>::iterator it;
+    unsigned int i;
+    unsigned int j;
+
+    pthread_mutex_lock(&mutex);
+    for (it = recorders.begin(); it != recorders.end(); ++it) {
+        for (i = 0; i <= SKYLD_LATENCY_MOUNTS; i++) {
+            struct Histogram *src = &(*it)->histograms[i][stage];
+            unsigned long long max;
+
+            if (dev != 0 && (i == SKYLD_LATENCY_MOUNTS
+                             || __atomic_load_n(&(*it)->devs[i],
+                                                __ATOMIC_ACQUIRE) != dev)) {
+                continue;
+            }
+            for (j = 0; j < SKYLD_LATENCY_BUCKETS; j++) {
+                h->counts[j] += __atomic_load_n(&src->counts[j],
+                                                __ATOMIC_RELAXED);
+            }
+            max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+            if (max > h->max) {
+                h->max = max;
+            }
+            h->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Records the duration of a stage.
+ *
+ * Only the current thread writes to its histograms. The counters are
+ * updated without locked instructions. The threads merging them read
+ * them atomically.
+ *
+ * @param stage stage
+ * @param dev device of the file, 0 if not known
+ * @param start start of the stage (CLOCK_MONOTONIC)
+ * @param end end of the stage (CLOCK_MONOTONIC)
+ */
+void LatencyStats::record(const enum Stage stage, const dev_t dev,
+                          const struct timespec *start,
+                          const struct timespec *end) {
+    Recorder *r;
+    struct Histogram *h;
+    long long duration;
+    unsigned int i = SKYLD_LATENCY_MOUNTS;
+    unsigned int index;
+
+    r = getRecorder();
+    if (r == NULL) {
+        return;
+    }
+    duration = (end->tv_sec - start->tv_sec) * 1000000000LL
+               + end->tv_nsec - start->tv_nsec;
+    if (duration < 0) {
+        duration = 0;
+    }
+    if (dev != 0) {
+        for (i = 0; i < SKYLD_LATENCY_MOUNTS; i++) {
+            if (r->devs[i] == dev) {
+                break;
+            }
+            if (r->devs[i] == 0) {
+                // The histograms of the slot are still zero.
+                __atomic_store_n(&r->devs[i], dev, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+    }
+    h = &r->histograms[i][stage];
+    index = bucket(duration);
+    __atomic_store_n(&h->counts[index], h->counts[index] + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, h->sum + duration, __ATOMIC_RELAXED);
+    if ((unsigned long long) duration > h->max) {
+        __atomic_store_n(&h->max, duration, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Releases the recorder of an exiting thread for reuse.
+ *
+ * The recorded values are kept.
+ *
+ * @param obj recorder
+ */
+void LatencyStats::releaseRecorder(void *obj) {
+    __atomic_store_n(&((Recorder *) obj)->owned, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Computes the percentiles of a histogram.
+ *
+ * A percentile is reported as the highest value of its bucket, but not
+ * above the maximum.
+ *
+ * @param h histogram
+ * @param summary receives the percentiles
+ */
+void LatencyStats::summarize(const struct Histogram *h,
+                             struct Summary *summary) {
+    const double quantiles[3] = {.5, .99, .999};
+    unsigned long long *values[3] = {
+        &summary->p50, &summary->p99, &summary->p999
+    };
+    unsigned long long seen = 0;
+    unsigned int i;
+    unsigned int q = 0;
+
+    summary->count = 0;
+    for (i = 0; i < SKYLD_LATENCY_BUCKETS; i++) {
+        summary->count += h->counts[i];
+    }
+    summary->max = h->max;
+    summary->p50 = summary->p99 = summary->p999 = 0;
+    for (i = 0; i < SKYLD_LATENCY_BUCKETS && q < 3; i++) {
+        seen += h->counts[i];
+        while (q < 3 && summary->count
+                && seen >= quantiles[q] * summary->count) {
+            *values[q] = bucketValue(i) < h->max ? bucketValue(i) : h->max;
+            q++;
+        }
+    }
+}
+
+/**
+ * @brief Writes a histogram in the Prometheus text format.
+ *
+ * @param out output stream
+ * @param stage stage
+ * @param dev device of the mount, 0 = all mounts
+ * @param labels labels identifying the histogram
+ */
+void LatencyStats::writeHistogram(std::ostream &out, const enum Stage stage,
+                                  const dev_t dev,
+                                  const std::string &labels) {
+    static const double bounds[] = {
+        .00001, .00005, .0001, .0005, .001, .005, .01, .05, .1, .5, 1, 5
+    };
+    const char *name = "skyldav_stage_duration_seconds";
+    struct Histogram *h;
+    unsigned long long count = 0;
+    unsigned int i;
+    unsigned int j = 0;
+
+    h = (struct Histogram *) calloc(1, sizeof (struct Histogram));
+    if (h == NULL) {
+        return;
+    }
+    merge(stage, dev, h);
+    for (i = 0; i < sizeof (bounds) / sizeof (bounds[0]); i++) {
+        // Add the buckets completely below the bound.
+        while (j < SKYLD_LATENCY_BUCKETS
+                && bucketValue(j) <= bounds[i] * 1000000000.) {
+            count += h->counts[j++];
+        }
+        out << name << "_bucket{" << labels << ",le=\"" << bounds[i]
+            << "\"} " << count << "\n";
+    }
+    while (j < SKYLD_LATENCY_BUCKETS) {
+        count += h->counts[j++];
+    }
+    out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << count
+        << "\n";
+    out << name << "_sum{" << labels << "} " << h->sum / 1000000000.
+        << "\n";
+    out << name << "_count{" << labels << "} " << count << "\n";
+    free(h);
+}
+
+/**
+ * @brief Writes the histograms in the Prometheus text format.
+ *
+ * Reading fanotify is not attributed to a mount. The other stages are
+ * written per mount.
+ *
+ * @param out output stream
+ */
+void LatencyStats::writeMetrics(std::ostream &out) {
+    std::vector<dev_t> devs;
+    std::vector<dev_t>::iterator dev;
+    unsigned int stage;
+
+    out << "# HELP skyldav_stage_duration_seconds Duration of the stages of "
+        "answering file accesses.\n"
+        "# TYPE skyldav_stage_duration_seconds histogram\n";
+    writeHistogram(out, READ, 0, "stage=\"read\"");
+    getDevices(devs);
+    for (dev = devs.begin(); dev != devs.end(); ++dev) {
+        std::string mountPoint;
+        std::string fsType;
+
+        getMount(*dev, mountPoint, fsType);
+        for (stage = READ + 1; stage < STAGES; stage++) {
+            std::stringstream labels;
+
+            labels << "stage=\"" << stageNames[stage] << "\",mount=\""
+                   << MetricsExporter::escape(mountPoint) << "\",fstype=\""
+                   << MetricsExporter::escape(fsType) << "\"";
+            writeHistogram(out, (enum Stage) stage, *dev, labels.str());
+        }
+    }
+}
+
+/**
+ * @brief Deletes the statistics.
+ *
+ * No thread may record any longer.
+ */
+LatencyStats::~LatencyStats() {
+    std::vector<Recorder *>::iterator it;
+
+    // Exiting threads shall no longer release their recorders.
+    pthread_key_delete(key);
+    for (it = recorders.begin(); it != recorders.end(); ++it) {
+        free(*it);
+    }
+    pthread_mutex_destroy(&mutex);
+}
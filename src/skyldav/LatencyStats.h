@@ -0,0 +1,214 @@
+/*
+ * File:   LatencyStats.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file LatencyStats.h
+ * @brief Latency histograms of the stages of answering a file access.
+ */
+#ifndef LATENCYSTATS_H
+#define	LATENCYSTATS_H
+
+#include <ostream>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+#include <time.h>
+#include <vector>
+
+/**
+ * @brief Number of buckets below the first power of two split into
+ * sub-buckets. Values are recorded with a precision of 1/16 of their power
+ * of two.
+ */
+#define SKYLD_LATENCY_SUB_BUCKETS 32
+
+/**
+ * @brief Number of buckets, covering values up to 2^41 ns (36 min).
+ */
+#define SKYLD_LATENCY_BUCKETS 608
+
+/**
+ * @brief Number of mounts tracked separately per thread. Further mounts are
+ * counted as other.
+ */
+#define SKYLD_LATENCY_MOUNTS 8
+
+/**
+ * @brief Latency histograms of the stages of answering a file access.
+ *
+ * The durations are recorded into log-linear (HDR) histograms per stage and
+ * per mount. Each thread records into its own histograms without locking,
+ * so recording does not slow down the threads answering file accesses. A
+ * report merges the histograms of all threads. The histograms of an exited
+ * thread are kept and reused by the next new thread.
+ */
+class LatencyStats {
+public:
+
+    /**
+     * @brief Stage of answering a file access.
+     */
+    enum Stage {
+        /**
+         * @brief Reading events from fanotify.
+         */
+        READ = 0,
+        /**
+         * @brief Getting the status of the file.
+         */
+        FSTAT,
+        /**
+         * @brief Looking up the file in the scan cache.
+         */
+        CACHE,
+        /**
+         * @brief Queueing the file for scanning.
+         */
+        ENQUEUE,
+        /**
+         * @brief Waiting in the queue until a scanning thread takes the
+         * file.
+         */
+        QUEUE,
+        /**
+         * @brief Checking the exclude paths.
+         */
+        EXCLUDE,
+        /**
+         * @brief Scanning the file.
+         */
+        SCAN,
+        /**
+         * @brief Writing the response to fanotify.
+         */
+        RESPONSE,
+        /**
+         * @brief From reading the event to writing the response.
+         */
+        TOTAL,
+        /**
+         * @brief Number of stages.
+         */
+        STAGES
+    };
+
+    /**
+     * @brief Summary of a histogram.
+     */
+    struct Summary {
+        /**
+         * @brief Number of values.
+         */
+        unsigned long long count;
+        /**
+         * @brief Median in nanoseconds.
+         */
+        unsigned long long p50;
+        /**
+         * @brief 99th percentile in nanoseconds.
+         */
+        unsigned long long p99;
+        /**
+         * @brief 99.9th percentile in nanoseconds.
+         */
+        unsigned long long p999;
+        /**
+         * @brief Maximum in nanoseconds.
+         */
+        unsigned long long max;
+    };
+
+    LatencyStats();
+    static void getMount(const dev_t dev, std::string &mountPoint,
+                         std::string &fsType);
+    void getReport(std::vector<std::string> &lines, const int perMount);
+    static const char *getStageName(const enum Stage);
+    void getSummary(const enum Stage, const dev_t dev,
+                    struct Summary *summary);
+    void log(const int perMount);
+    void record(const enum Stage, const dev_t dev,
+                const struct timespec *start, const struct timespec *end);
+    void writeMetrics(std::ostream &out);
+    virtual ~LatencyStats();
+private:
+
+    /**
+     * @brief Histogram of durations.
+     */
+    struct Histogram {
+        /**
+         * @brief Number of values per bucket.
+         */
+        unsigned long long counts[SKYLD_LATENCY_BUCKETS];
+        /**
+         * @brief Maximum value in nanoseconds.
+         */
+        unsigned long long max;
+        /**
+         * @brief Sum of the values in nanoseconds.
+         */
+        unsigned long long sum;
+    };
+
+    /**
+     * @brief Histograms of one thread.
+     */
+    struct Recorder {
+        /**
+         * @brief The recorder is used by a thread.
+         */
+        int owned;
+        /**
+         * @brief Devices of the mounts, 0 for unused slots.
+         */
+        dev_t devs[SKYLD_LATENCY_MOUNTS];
+        /**
+         * @brief Histograms per mount and stage. The last row counts other
+         * and unknown mounts.
+         */
+        struct Histogram histograms[SKYLD_LATENCY_MOUNTS + 1][STAGES];
+    };
+
+    /**
+     * @brief Key of the recorder of the current thread.
+     */
+    pthread_key_t key;
+    /**
+     * @brief Recorders of all threads.
+     */
+    std::vector<Recorder *> recorders;
+    /**
+     * @brief Mutex for accessing recorders.
+     */
+    pthread_mutex_t mutex;
+
+    static unsigned int bucket(unsigned long long value);
+    static unsigned long long bucketValue(const unsigned int index);
+    void getDevices(std::vector<dev_t> &);
+    Recorder *getRecorder();
+    static void releaseRecorder(void *);
+    void merge(const enum Stage, const dev_t dev, struct Histogram *);
+    static void summarize(const struct Histogram *, struct Summary *);
+    void writeHistogram(std::ostream &out, const enum Stage, const dev_t dev,
+                        const std::string &labels);
+
+    // Do not allow copying.
+    LatencyStats(const LatencyStats&);
+};
+
+#endif	/* LATENCYSTATS_H */
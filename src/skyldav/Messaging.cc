@@ -22,15 +22,20 @@
  * @brief Send messages.
  */
 
+#include <algorithm>
 #include <errno.h>
+#include <fcntl.h>
 #include <iostream>
 #include <malloc.h>
 #include <libgen.h>
+#include <poll.h>
+#include <signal.h>
 #include <sstream>
 #include <string>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include "config.h"
 #include "skyldav.h"
 #include "Messaging.h"
@@ -40,6 +45,16 @@
  */
 Messaging *Messaging::singleton = NULL;
 
+/**
+ * @brief Mutex for creating and deleting the singleton.
+ */
+pthread_mutex_t Messaging::mutexSingleton = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Control for registering the fork and exit handlers once.
+ */
+static pthread_once_t onceMessaging = PTHREAD_ONCE_INIT;
+
 /**
  * @brief Creates the singleton.
  */
@@ -47,6 +62,8 @@ Messaging::Messaging() {
     char *path;
     char *filename;
     mode_t mask;
+    sigset_t set;
+    sigset_t oldset;
 
     // Filter debug messages by default.
     messageLevel = INFORMATION;
@@ -78,6 +95,82 @@ Messaging::Messaging() {
 
     // Reset umask.
     umask(mask);
+
+    // Start the writer. Signals are left to the other threads.
+    rings = NULL;
+    sequence = 0;
+    dropped = 0;
+    wakeup = 0;
+    stopping = 0;
+    async = 0;
+    pthread_mutex_init(&mutexOutput, NULL);
+    pthread_key_create(&ringKey, releaseRing);
+    if (pipe2(wakePipe, O_CLOEXEC | O_NONBLOCK)) {
+        std::cerr << "Failure to create pipe for logging." << std::endl;
+        wakePipe[0] = -1;
+        wakePipe[1] = -1;
+        return;
+    }
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &oldset);
+    if (pthread_create(&thread, NULL, writer, this)) {
+        std::cerr << "Failure to create logging thread." << std::endl;
+    } else {
+        pthread_setname_np(thread, "skyldav-l");
+        async = 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+}
+
+/**
+ * @brief Switches a forked child process to direct output.
+ *
+ * The writer thread does not exist in the child. Messages queued by the
+ * parent are left to the parent.
+ */
+void Messaging::atFork() {
+    pthread_mutex_init(&mutexSingleton, NULL);
+    if (singleton != NULL) {
+        pthread_mutex_init(&singleton->mutexOutput, NULL);
+        singleton->async = 0;
+    }
+}
+
+/**
+ * @brief Writes the queued messages of all rings.
+ *
+ * Must be called with mutexOutput locked.
+ */
+void Messaging::drain() {
+    std::vector<Entry> batch;
+    unsigned long long lost;
+    Ring *ring;
+
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring;
+            ring = ring->next) {
+        unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        unsigned int tail = ring->tail;
+
+        for (; tail != head; tail++) {
+            batch.push_back(ring->entries[tail % SKYLD_MESSAGING_RING]);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    std::sort(batch.begin(), batch.end(), isEarlier);
+    lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+    if (lost) {
+        std::stringstream msg;
+        Entry entry;
+
+        msg << lost << " messages were dropped.";
+        entry.seq = 0;
+        entry.level = ERROR;
+        entry.text = msg.str();
+        batch.push_back(entry);
+    }
+    if (!batch.empty()) {
+        output(batch);
+    }
 }
 
 /**
@@ -88,93 +181,326 @@ Messaging::Messaging() {
 void Messaging::error(const std::string &label) {
     std::stringstream text;
     char errbuf[256];
-    text << label << ": " << strerror_r(errno, errbuf, sizeof(errbuf));
+    int err = errno;
+
+    if (!isEnabled(ERROR)) {
+        return;
+    }
+    text << label << ": " << strerror_r(err, errbuf, sizeof(errbuf));
     message(ERROR, text.str());
 }
 
+/**
+ * @brief Gets the ring buffer of the current thread.
+ *
+ * A ring released by an exited thread is reused, else a new ring is added
+ * to the list of all rings.
+ *
+ * @return ring buffer
+ */
+Messaging::Ring *Messaging::getRing() {
+    Ring *ring;
+
+    ring = (Ring *) pthread_getspecific(ringKey);
+    if (ring != NULL) {
+        return ring;
+    }
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring;
+            ring = ring->next) {
+        int expected = 0;
+
+        if (__atomic_compare_exchange_n(&ring->owned, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (ring == NULL) {
+        ring = new Ring();
+        ring->owned = 1;
+        ring->head = 0;
+        ring->tail = 0;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(ringKey, ring);
+    return ring;
+}
+
+/**
+ * @brief Registers the fork and exit handlers.
+ *
+ * Messages still queued when the process exits are written.
+ */
+void Messaging::init() {
+    pthread_atfork(NULL, NULL, atFork);
+    atexit(teardown);
+}
+
+/**
+ * @brief Checks if messages of a level are output.
+ *
+ * Callers may use this to avoid formatting messages that are dropped.
+ *
+ * @param level message priority
+ * @return 1 if messages of the level are output
+ */
+int Messaging::isEnabled(const enum Level level) {
+    return level >= __atomic_load_n(&getSingleton()->messageLevel,
+                                    __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Compares the sequence numbers of two messages.
+ *
+ * @param a first message
+ * @param b second message
+ * @return a was sent before b
+ */
+bool Messaging::isEarlier(const Entry &a, const Entry &b) {
+    return a.seq < b.seq;
+}
+
 /**
  * @brief Sends message.
  *
+ * The message is queued for the writer thread. The caller only waits for
+ * the output if the ring of the thread is full and the message is a
+ * warning or an error.
+ *
  * @param level message priority
  * @param message message text
  */
 void Messaging::message(const enum Level level, const std::string &message) {
-    std::string type;
+    Messaging *m;
+    Ring *ring;
+    unsigned int head;
 
-    getSingleton();
-    if (level < singleton->messageLevel) {
+    m = getSingleton();
+    if (level < __atomic_load_n(&m->messageLevel, __ATOMIC_RELAXED)) {
         return;
     }
-    switch (level) {
-        case ERROR:
-            type = "E";
-            syslog(LOG_ERR, "%s", message.c_str());
-            std::cerr << message << std::endl;
-            break;
-        case WARNING:
-            type = "W";
-            syslog(LOG_WARNING, "%s", message.c_str());
-            std::cerr << message << std::endl;
-            break;
-        case INFORMATION:
-            type = "I";
-            syslog(LOG_INFO, "%s", message.c_str());
-            std::cout << message << std::endl;
-            break;
-        case DEBUG:
-            type = "D";
-            syslog(LOG_DEBUG, "%s", message.c_str());
-            std::cout << message << std::endl;
+    if (!m->async) {
+        std::vector<Entry> batch(1);
+
+        batch[0].seq = 0;
+        batch[0].level = level;
+        batch[0].text = message;
+        pthread_mutex_lock(&m->mutexOutput);
+        m->output(batch);
+        pthread_mutex_unlock(&m->mutexOutput);
+        return;
+    }
+    ring = m->getRing();
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+            >= SKYLD_MESSAGING_RING) {
+        if (level < WARNING) {
+            __atomic_add_fetch(&m->dropped, 1, __ATOMIC_RELAXED);
             return;
-        default:
-            type = " ";
-            syslog(LOG_NOTICE, "%s", message.c_str());
-            std::cout << message << std::endl;
-            break;
+        }
+        // Do not lose warnings and errors. Writing the queued messages
+        // empties the ring.
+        pthread_mutex_lock(&m->mutexOutput);
+        m->drain();
+        pthread_mutex_unlock(&m->mutexOutput);
+    }
+    Entry &entry = ring->entries[head % SKYLD_MESSAGING_RING];
+    entry.seq = __atomic_fetch_add(&m->sequence, 1, __ATOMIC_RELAXED);
+    entry.level = level;
+    entry.text = message;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    // Wake up the writer unless it has been signaled already.
+    if (!__atomic_exchange_n(&m->wakeup, 1, __ATOMIC_ACQ_REL)) {
+        if (write(m->wakePipe[1], "", 1) == -1) {
+            // The pipe is full, so the writer will wake up anyway.
+        }
+    }
+}
+
+/**
+ * @brief Writes messages to the system log, the log file, and the console.
+ *
+ * @param batch messages in the order they were sent
+ */
+void Messaging::output(const std::vector<Entry> &batch) {
+    std::vector<Entry>::const_iterator pos;
+    std::string out;
+    std::string err;
+    std::string log;
+
+    for (pos = batch.begin(); pos != batch.end(); ++pos) {
+        const char *type;
+        std::string *console;
+        int priority;
+
+        switch (pos->level) {
+            case ERROR:
+                type = "E";
+                priority = LOG_ERR;
+                console = &err;
+                break;
+            case WARNING:
+                type = "W";
+                priority = LOG_WARNING;
+                console = &err;
+                break;
+            case INFORMATION:
+                type = "I";
+                priority = LOG_INFO;
+                console = &out;
+                break;
+            case DEBUG:
+                // Debug messages are not written to the log file.
+                type = NULL;
+                priority = LOG_DEBUG;
+                console = &out;
+                break;
+            default:
+                type = " ";
+                priority = LOG_NOTICE;
+                console = &out;
+                break;
+        }
+        syslog(priority, "%s", pos->text.c_str());
+        *console += pos->text;
+        *console += "\n";
+        if (type != NULL) {
+            log += type;
+            log += pos->text;
+            log += "\n";
+        }
+    }
+    if (!out.empty()) {
+        std::cout << out << std::flush;
     }
-    if (singleton->logfs.is_open()) {
+    if (!err.empty()) {
+        std::cerr << err << std::flush;
+    }
+    if (!log.empty() && logfs.is_open()) {
         try {
-            singleton->logfs << type << message << std::endl;
+            logfs << log << std::flush;
         } catch (class std::ios_base::failure ex) {
             std::cerr << "Failure to write to logfile." << std::endl;
         }
     }
 }
 
+/**
+ * @brief Releases the ring buffer of an exiting thread for reuse.
+ *
+ * @param obj ring buffer
+ */
+void Messaging::releaseRing(void *obj) {
+    __atomic_store_n(&((Ring *) obj)->owned, 0, __ATOMIC_RELEASE);
+}
+
 /**
  * @brief Sets message level.
  *
  * @param level message level
  */
 void Messaging::setLevel(const enum Level level) {
-    getSingleton();
-    singleton->messageLevel = level;
+    __atomic_store_n(&getSingleton()->messageLevel, level, __ATOMIC_RELAXED);
 }
 
 /**
  * @brief Retrieves the messaging singleton.
  */
 Messaging *Messaging::getSingleton() {
-    if (singleton == NULL) {
-        singleton = new Messaging();
+    Messaging *m;
+
+    m = __atomic_load_n(&singleton, __ATOMIC_ACQUIRE);
+    if (m == NULL) {
+        pthread_once(&onceMessaging, init);
+        pthread_mutex_lock(&mutexSingleton);
+        if (singleton == NULL) {
+            __atomic_store_n(&singleton, new Messaging(), __ATOMIC_RELEASE);
+        }
+        m = singleton;
+        pthread_mutex_unlock(&mutexSingleton);
     }
-    return singleton;
+    return m;
 }
 
 /**
  * @brief Deletes the singleton.
+ *
+ * Queued messages are written before.
  */
 void Messaging::teardown() {
-    if (singleton != NULL) {
-        delete singleton;
-        singleton = NULL;
+    Messaging *m;
+
+    pthread_mutex_lock(&mutexSingleton);
+    m = singleton;
+    __atomic_store_n(&singleton, (Messaging *) NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mutexSingleton);
+    if (m != NULL) {
+        delete m;
+    }
+}
+
+/**
+ * @brief Writes queued messages until the singleton is deleted.
+ *
+ * @param obj messaging singleton
+ * @return return value
+ */
+void *Messaging::writer(void *obj) {
+    Messaging *m = (Messaging *) obj;
+    struct pollfd pfd;
+    char buf[64];
+
+    pfd.fd = m->wakePipe[0];
+    pfd.events = POLLIN;
+    for (;;) {
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+            break;
+        }
+        while (read(m->wakePipe[0], buf, sizeof (buf)) > 0) {
+        }
+        // Reset the signal before reading the rings so that no message
+        // is missed.
+        __atomic_exchange_n(&m->wakeup, 0, __ATOMIC_ACQ_REL);
+        pthread_mutex_lock(&m->mutexOutput);
+        m->drain();
+        pthread_mutex_unlock(&m->mutexOutput);
+        if (__atomic_load_n(&m->stopping, __ATOMIC_ACQUIRE)) {
+            break;
+        }
     }
+    return NULL;
 }
 
 /**
  * @brief Deletes singleton.
  */
 Messaging::~Messaging() {
+    Ring *ring;
+
+    if (async) {
+        __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+        if (write(wakePipe[1], "", 1) == -1) {
+            // The pipe is full, so the writer will wake up anyway.
+        }
+        pthread_join(thread, NULL);
+        pthread_mutex_lock(&mutexOutput);
+        drain();
+        pthread_mutex_unlock(&mutexOutput);
+    }
+    if (wakePipe[0] != -1) {
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+    }
+    pthread_key_delete(ringKey);
+    pthread_mutex_destroy(&mutexOutput);
+    while (rings != NULL) {
+        ring = rings;
+        rings = ring->next;
+        delete ring;
+    }
     closelog();
     try {
         logfs.close();
@@ -23,14 +23,29 @@
  */
 
 #include <fstream>
+#include <pthread.h>
 #include <string>
 #include <syslog.h>
+#include <vector>
 
 #ifndef MESSAGING_H
 #define	MESSAGING_H
 
+/**
+ * @brief Number of messages each thread may queue for the writer.
+ */
+#define SKYLD_MESSAGING_RING 256
+
 /**
  * @brief Outputs messages to system and application log and to the console.
+ *
+ * Each thread queues its messages in a ring buffer of its own without
+ * taking a lock. A writer thread collects the messages of all rings in the
+ * order they were sent and outputs them in batches. If a ring is full,
+ * debug and information messages are dropped and the number of dropped
+ * messages is reported. For warnings and errors the sending thread writes
+ * the queued messages itself. In a process forked while the writer was
+ * running, messages are output directly.
  */
 class Messaging {
 public:
@@ -58,16 +73,111 @@ public:
 
     static void setLevel(const enum Level);
     static void error(const std::string&);
+    static int isEnabled(const enum Level);
     static void message(const enum Level, const std::string&);
     static void teardown();
 private:
+    /**
+     * @brief Queued message.
+     */
+    struct Entry {
+        /**
+         * @brief Sequence number defining the output order.
+         */
+        unsigned long long seq;
+        /**
+         * @brief Message priority.
+         */
+        enum Level level;
+        /**
+         * @brief Message text.
+         */
+        std::string text;
+    };
+
+    /**
+     * @brief Ring buffer written by a single thread.
+     */
+    struct Ring {
+        /**
+         * @brief Next ring in the list of all rings.
+         */
+        Ring *next;
+        /**
+         * @brief The ring is used by a thread.
+         */
+        int owned;
+        /**
+         * @brief Number of messages queued, only changed by the owner.
+         */
+        unsigned int head;
+        /**
+         * @brief Number of messages output, only changed by the writer.
+         */
+        unsigned int tail;
+        /**
+         * @brief Queued messages.
+         */
+        Entry entries[SKYLD_MESSAGING_RING];
+    };
+
     static Messaging *singleton;
+    static pthread_mutex_t mutexSingleton;
+    /**
+     * @brief Mutex for writing messages.
+     */
+    pthread_mutex_t mutexOutput;
     std::fstream logfs;
     enum Level messageLevel;
+    /**
+     * @brief Messages are queued for the writer thread, else output
+     * directly.
+     */
+    int async;
+    /**
+     * @brief List of all rings.
+     */
+    Ring *rings;
+    /**
+     * @brief Key for the ring of the current thread.
+     */
+    pthread_key_t ringKey;
+    /**
+     * @brief Next sequence number.
+     */
+    unsigned long long sequence;
+    /**
+     * @brief Number of messages dropped because a ring was full.
+     */
+    unsigned long long dropped;
+    /**
+     * @brief The writer has been signaled.
+     */
+    int wakeup;
+    /**
+     * @brief The writer shall stop.
+     */
+    int stopping;
+    /**
+     * @brief Pipe to wake up the writer.
+     */
+    int wakePipe[2];
+    /**
+     * @brief Writer thread.
+     */
+    pthread_t thread;
 
     Messaging();
     ~Messaging();
+    static void atFork();
+    static void init();
     static Messaging *getSingleton();
+    static bool isEarlier(const Entry &, const Entry &);
+    static void releaseRing(void *);
+    static void *writer(void *);
+    Ring *getRing();
+    void drain();
+    void output(const std::vector<Entry> &);
 };
 
 #endif	/* MESSAGING_H */
@@ -0,0 +1,326 @@
+/*
+ * File:   MetricsExporter.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file MetricsExporter.cc
+ * @brief Exports metrics in the Prometheus text format.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "MetricsExporter.h"
+#include "Messaging.h"
+
+/**
+ * @brief Creates the exporter and starts serving the metrics.
+ *
+ * @param socketPath path of the UNIX socket, empty if not served
+ * @param filePath path of the metrics file, empty if not written
+ * @param renderer function rendering the metrics
+ * @param context context passed to the renderer
+ */
+MetricsExporter::MetricsExporter(const std::string &socketPath,
+                                 const std::string &filePath,
+                                 Renderer renderer, void *context) {
+    this->socketPath = socketPath;
+    this->filePath = filePath;
+    this->renderer = renderer;
+    this->context = context;
+    listenFd = -1;
+
+    if (!socketPath.empty() && openSocket()) {
+        throw FAILURE;
+    }
+    if (pipe2(stopPipe, O_CLOEXEC | O_NONBLOCK)) {
+        Messaging::error("MetricsExporter, pipe2");
+        if (listenFd != -1) {
+            close(listenFd);
+            unlink(socketPath.c_str());
+        }
+        throw FAILURE;
+    }
+    if (pthread_create(&thread, NULL, run, this)) {
+        Messaging::error("MetricsExporter, pthread_create");
+        close(stopPipe[0]);
+        close(stopPipe[1]);
+        if (listenFd != -1) {
+            close(listenFd);
+            unlink(socketPath.c_str());
+        }
+        throw FAILURE;
+    }
+    pthread_setname_np(thread, "skyldav-m");
+}
+
+/**
+ * @brief Answers a client of the socket.
+ *
+ * @param fd connection
+ */
+void MetricsExporter::answer(const int fd) {
+    std::stringstream out;
+    std::string response;
+    struct pollfd pfd;
+    char request[1024];
+    ssize_t len = 0;
+    size_t pos;
+
+    // Read the request if the client sends one.
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while ((size_t) len < sizeof (request) - 1
+            && poll(&pfd, 1, SKYLD_METRICS_TIMEOUT) == 1) {
+        ssize_t ret;
+
+        ret = read(fd, request + len, sizeof (request) - 1 - len);
+        if (ret <= 0) {
+            break;
+        }
+        len += ret;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+            break;
+        }
+    }
+    // Print counters as integers.
+    out.precision(15);
+    renderer(context, out);
+    response = out.str();
+    if (len >= 4 && !strncmp(request, "GET ", 4)) {
+        std::stringstream header;
+
+        header << "HTTP/1.0 200 OK\r\n"
+               << "Content-Type: text/plain; version=0.0.4\r\n"
+               << "Content-Length: " << response.size() << "\r\n\r\n";
+        response = header.str() + response;
+    }
+    for (pos = 0; pos < response.size();) {
+        ssize_t ret;
+
+        ret = send(fd, response.data() + pos, response.size() - pos,
+                   MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        pos += ret;
+    }
+}
+
+/**
+ * @brief Escapes the value of a label.
+ *
+ * @param value value
+ * @return escaped value
+ */
+std::string MetricsExporter::escape(const std::string &value) {
+    std::string ret;
+    std::string::const_iterator it;
+
+    for (it = value.begin(); it != value.end(); ++it) {
+        if (*it == '\\' || *it == '"') {
+            ret += '\\';
+            ret += *it;
+        } else if (*it == '\n') {
+            ret += "\\n";
+        } else {
+            ret += *it;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Opens the listening socket.
+ *
+ * A socket left over from a previous run is replaced.
+ *
+ * @return success = 0
+ */
+int MetricsExporter::openSocket() {
+    struct sockaddr_un addr;
+
+    if (socketPath.size() >= sizeof (addr.sun_path)) {
+        Messaging::message(Messaging::ERROR,
+                           "Metrics socket path '" + socketPath
+                           + "' is too long.");
+        return 1;
+    }
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd == -1) {
+        Messaging::error("socket");
+        return 1;
+    }
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath.c_str());
+    unlink(socketPath.c_str());
+    if (bind(listenFd, (struct sockaddr *) &addr, sizeof (addr))
+            || listen(listenFd, 16)) {
+        Messaging::error("Cannot listen on metrics socket '" + socketPath
+                         + "'");
+        close(listenFd);
+        listenFd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Serves the socket and rewrites the file until stopped.
+ *
+ * @param obj metrics exporter
+ * @return return value
+ */
+void *MetricsExporter::run(void *obj) {
+    MetricsExporter *me = (MetricsExporter *) obj;
+    struct pollfd fds[2];
+    nfds_t nfds = 1;
+    struct timespec now;
+    struct timespec next;
+
+    fds[0].fd = me->stopPipe[0];
+    fds[0].events = POLLIN;
+    if (me->listenFd != -1) {
+        fds[1].fd = me->listenFd;
+        fds[1].events = POLLIN;
+        nfds = 2;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (;;) {
+        int timeout = -1;
+        int ret;
+
+        if (!me->filePath.empty()) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec
+                                             && now.tv_nsec >= next.tv_nsec)) {
+                me->writeFile();
+                next = now;
+                next.tv_sec += SKYLD_METRICS_INTERVAL / 1000;
+            }
+            timeout = (next.tv_sec - now.tv_sec) * 1000
+                      + (next.tv_nsec - now.tv_nsec) / 1000000 + 1;
+        }
+        ret = poll(fds, nfds, timeout);
+        if (ret == -1 && errno != EINTR) {
+            Messaging::error("MetricsExporter, poll");
+            break;
+        }
+        if (ret <= 0) {
+            continue;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        if (nfds == 2 && (fds[1].revents & POLLIN)) {
+            int fd;
+
+            fd = accept4(me->listenFd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd != -1) {
+                me->answer(fd);
+                close(fd);
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Writes a metric without labels in the Prometheus text format.
+ *
+ * @param out output stream
+ * @param name name of the metric
+ * @param type counter or gauge
+ * @param help description
+ * @param value value
+ */
+void MetricsExporter::writeMetric(std::ostream &out, const char *name,
+                                  const char *type, const char *help,
+                                  const double value) {
+    out << "# HELP " << name << " " << help << "\n"
+        << "# TYPE " << name << " " << type << "\n"
+        << name << " " << value << "\n";
+}
+
+/**
+ * @brief Writes the metrics file.
+ *
+ * The file is replaced atomically, so that readers never see a partial
+ * file.
+ */
+void MetricsExporter::writeFile() {
+    std::stringstream out;
+    std::string data;
+    std::string tmpname = filePath + ".tmp";
+    int fd;
+    int ret = 0;
+
+    // Print counters as integers.
+    out.precision(15);
+    renderer(context, out);
+    data = out.str();
+    fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+              S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        ret = 1;
+    } else {
+        if (write(fd, data.data(), data.size()) != (ssize_t) data.size()) {
+            ret = 1;
+        }
+        if (close(fd)) {
+            ret = 1;
+        }
+    }
+    if (ret == 0 && rename(tmpname.c_str(), filePath.c_str())) {
+        ret = 1;
+    }
+    if (ret) {
+        Messaging::error("Cannot write metrics file '" + filePath + "'");
+        unlink(tmpname.c_str());
+    }
+}
+
+/**
+ * @brief Stops the exporter.
+ *
+ * The socket is removed. The metrics file is kept, so that a scrape while
+ * the daemon restarts does not fail.
+ */
+MetricsExporter::~MetricsExporter() {
+    if (write(stopPipe[1], "", 1) != 1) {
+        Messaging::error("Cannot stop metrics exporter");
+    }
+    pthread_join(thread, NULL);
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+    if (listenFd != -1) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+    }
+}
@@ -0,0 +1,118 @@
+/*
+ * File:   MetricsExporter.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file MetricsExporter.h
+ * @brief Exports metrics in the Prometheus text format.
+ */
+#ifndef METRICSEXPORTER_H
+#define	METRICSEXPORTER_H
+
+#include <ostream>
+#include <pthread.h>
+#include <string>
+
+/**
+ * @brief Interval in milliseconds between rewrites of the metrics file.
+ */
+#define SKYLD_METRICS_INTERVAL 10000
+
+/**
+ * @brief Time in milliseconds to wait for the request of a client.
+ */
+#define SKYLD_METRICS_TIMEOUT 100
+
+/**
+ * @brief Exports metrics in the Prometheus text format.
+ *
+ * The metrics are served on a UNIX socket and/or written periodically to a
+ * file for the textfile collector of node_exporter. A client connecting to
+ * the socket receives the metrics and the connection is closed. If the
+ * client sends an HTTP GET request, an HTTP response is returned, so that
+ * the socket can be scraped through a proxy.
+ *
+ * The metrics are rendered by a callback in the thread of the exporter.
+ */
+class MetricsExporter {
+public:
+
+    /**
+     * @brief Exception status.
+     */
+    enum Status {
+        /**
+         * @brief The exporter cannot be started.
+         */
+        FAILURE = 1
+    };
+
+    /**
+     * @brief Function rendering the metrics.
+     *
+     * @param context context passed to the constructor
+     * @param out receives the metrics
+     */
+    typedef void (*Renderer)(void *context, std::ostream &out);
+
+    MetricsExporter(const std::string &socketPath,
+                    const std::string &filePath, Renderer, void *context);
+    static std::string escape(const std::string &value);
+    static void writeMetric(std::ostream &out, const char *name,
+                            const char *type, const char *help,
+                            const double value);
+    ~MetricsExporter();
+private:
+    /**
+     * @brief Path of the UNIX socket, empty if not served.
+     */
+    std::string socketPath;
+    /**
+     * @brief Path of the metrics file, empty if not written.
+     */
+    std::string filePath;
+    /**
+     * @brief Function rendering the metrics.
+     */
+    Renderer renderer;
+    /**
+     * @brief Context of the renderer.
+     */
+    void *context;
+    /**
+     * @brief Listening socket, -1 if not served.
+     */
+    int listenFd;
+    /**
+     * @brief Pipe for stopping the thread.
+     */
+    int stopPipe[2];
+    /**
+     * @brief Exporting thread.
+     */
+    pthread_t thread;
+
+    void answer(const int fd);
+    int openSocket();
+    static void *run(void *);
+    void writeFile();
+
+    // Do not allow copying.
+    MetricsExporter(const MetricsExporter&);
+};
+
+#endif	/* METRICSEXPORTER_H */
@@ -0,0 +1,115 @@
+/*
+ * File:   MissTracker.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file MissTracker.cc
+ * @brief Track cache misses per directory.
+ */
+#include "MissTracker.h"
+
+/**
+ * @brief Maximum number of directories tracked before expired entries are
+ * removed.
+ */
+#define SKYLD_MISSTRACKER_MAX 1024
+
+/**
+ * @brief Creates a tracker for cache misses.
+ *
+ * @param t number of misses to report a directory
+ * @param w time window in seconds
+ * @param c minimum time in seconds between two reports of a directory
+ */
+MissTracker::MissTracker(const unsigned int t, const time_t w,
+                         const time_t c) {
+    threshold = t;
+    window = w;
+    cooldown = c;
+    pthread_mutex_init(&mutex, NULL);
+}
+
+/**
+ * @brief Records a cache miss.
+ *
+ * @param dir directory of the file
+ * @return 1 if the directory shall be prefetched
+ */
+int MissTracker::add(const std::string &dir) {
+    std::map<std::string, Entry>::iterator it;
+    struct timespec now;
+    int ret = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&mutex);
+    it = dirs.find(dir);
+    if (it == dirs.end()) {
+        Entry entry;
+
+        if (dirs.size() >= SKYLD_MISSTRACKER_MAX) {
+            expire(now.tv_sec);
+        }
+        entry.count = 0;
+        entry.start = now.tv_sec;
+        entry.reported = 0;
+        it = dirs.insert(std::make_pair(dir, entry)).first;
+    }
+    if (now.tv_sec - it->second.start > window) {
+        // Start a new window.
+        it->second.count = 0;
+        it->second.start = now.tv_sec;
+    }
+    it->second.count++;
+    if (it->second.count >= threshold
+            && (it->second.reported == 0
+                || now.tv_sec - it->second.reported > cooldown)) {
+        it->second.reported = now.tv_sec;
+        it->second.count = 0;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&mutex);
+    return ret;
+}
+
+/**
+ * @brief Removes directories which are neither in their time window nor in
+ * their cool down period.
+ *
+ * The mutex must be held by the caller.
+ * @param now current time
+ */
+void MissTracker::expire(const time_t now) {
+    std::map<std::string, Entry>::iterator it;
+
+    for (it = dirs.begin(); it != dirs.end();) {
+        if (now - it->second.start > window
+                && now - it->second.reported > cooldown) {
+            dirs.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * @brief Deletes the tracker.
+ */
+MissTracker::~MissTracker() {
+    pthread_mutex_destroy(&mutex);
+}
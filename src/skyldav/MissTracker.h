@@ -0,0 +1,94 @@
+/*
+ * File:   MissTracker.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file MissTracker.h
+ * @brief Track cache misses per directory.
+ */
+#ifndef MISSTRACKER_H
+#define	MISSTRACKER_H
+
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <time.h>
+
+/**
+ * @brief Tracks cache misses per directory.
+ *
+ * <p>Applications loading modules (Python imports, Java class paths,
+ * node_modules) open many files of the same directory in quick succession.
+ * When the number of cache misses in a directory reaches the threshold
+ * within the time window, the directory is reported once for speculative
+ * scanning. It is not reported again before the cool down period has
+ * elapsed.</p>
+ */
+class MissTracker {
+public:
+    MissTracker(const unsigned int threshold, const time_t window,
+                const time_t cooldown);
+    int add(const std::string &dir);
+    virtual ~MissTracker();
+private:
+    /**
+     * @brief Cache misses in a directory.
+     */
+    struct Entry {
+        /**
+         * @brief Number of misses in the current window.
+         */
+        unsigned int count;
+        /**
+         * @brief Start of the current window.
+         */
+        time_t start;
+        /**
+         * @brief Time when the directory was reported, 0 if never.
+         */
+        time_t reported;
+    };
+    /**
+     * @brief Cache misses per directory.
+     */
+    std::map<std::string, Entry> dirs;
+    /**
+     * @brief Mutex for accessing the directories.
+     */
+    pthread_mutex_t mutex;
+    /**
+     * @brief Number of misses to report a directory.
+     */
+    unsigned int threshold;
+    /**
+     * @brief Time window in seconds.
+     */
+    time_t window;
+    /**
+     * @brief Minimum time in seconds between two reports of a directory.
+     */
+    time_t cooldown;
+
+    void expire(const time_t now);
+
+    // Do not allow copying.
+    MissTracker(const MissTracker&);
+};
+
+#endif	/* MISSTRACKER_H */
+
@@ -0,0 +1,364 @@
+/*
+ * File:   OnDemandScan.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file OnDemandScan.cc
+ * @brief Scans directory trees for viruses.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iomanip>
+#include <limits.h>
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "Messaging.h"
+#include "OnDemandScan.h"
+
+/**
+ * @brief Size of the buffer for reading directory entries.
+ */
+#define SKYLD_DENTS_BUFSIZE 0x8000
+
+/**
+ * @brief Directory entry as returned by getdents64().
+ */
+struct linux_dirent64 {
+    /**
+     * @brief Inode number.
+     */
+    uint64_t d_ino;
+    /**
+     * @brief Offset to the next entry.
+     */
+    int64_t d_off;
+    /**
+     * @brief Length of this entry.
+     */
+    unsigned short d_reclen;
+    /**
+     * @brief File type.
+     */
+    unsigned char d_type;
+    /**
+     * @brief File name.
+     */
+    char d_name[];
+};
+
+/**
+ * @brief Creates an on demand scanner.
+ *
+ * @param env environment
+ * @param vs virus scanner
+ */
+OnDemandScan::OnDemandScan(Environment *env, VirusScan *vs) {
+    e = env;
+    virusScan = vs;
+    pending = 0;
+    directories = 0;
+    files = 0;
+    bytes = 0;
+    cached = 0;
+    infected = 0;
+    errors = 0;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tp = new ThreadPool(e->getNumberOfThreads(), work);
+}
+
+/**
+ * @brief Adds a file or directory tree to be scanned.
+ *
+ * @param path path of file or directory
+ */
+void OnDemandScan::add(const char *path) {
+    char *absolute;
+    struct stat statbuf;
+
+    absolute = realpath(path, NULL);
+    if (absolute == NULL || stat(absolute, &statbuf)) {
+        Messaging::error(std::string("Cannot access '") + path + "'");
+        count(&errors, 1);
+        free(absolute);
+        return;
+    }
+    if (S_ISDIR(statbuf.st_mode)) {
+        queue(DIRECTORY, absolute);
+    } else if (S_ISREG(statbuf.st_mode)) {
+        queue(FILE, absolute);
+    }
+    free(absolute);
+}
+
+/**
+ * @brief Increments a counter.
+ *
+ * @param counter counter
+ * @param n increment
+ */
+void OnDemandScan::count(unsigned long long *counter, unsigned long long n) {
+    pthread_mutex_lock(&mutex);
+    *counter += n;
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Queues a work item.
+ *
+ * Directories are only read when no file is waiting to be scanned. This keeps
+ * the work list short.
+ *
+ * @param type type of the work item
+ * @param path absolute path
+ */
+void OnDemandScan::queue(const enum TaskType type, const std::string &path) {
+    struct Task *task;
+
+    if (e->isExcluded(type == DIRECTORY ? path + "/" : path)) {
+        return;
+    }
+    task = (struct Task *) malloc(sizeof (struct Task));
+    if (task == NULL) {
+        Messaging::message(Messaging::ERROR, "Out of memory");
+        count(&errors, 1);
+        return;
+    }
+    task->path = strdup(path.c_str());
+    if (task->path == NULL) {
+        Messaging::message(Messaging::ERROR, "Out of memory");
+        count(&errors, 1);
+        free(task);
+        return;
+    }
+    task->ods = this;
+    task->type = type;
+    pthread_mutex_lock(&mutex);
+    pending++;
+    pthread_mutex_unlock(&mutex);
+    tp->add((void *) task,
+            type == DIRECTORY ? ThreadPool::IDLE : ThreadPool::DEMAND);
+}
+
+/**
+ * @brief Reads a directory and queues its entries.
+ *
+ * Symbolic links are not followed.
+ *
+ * @param path absolute path of the directory
+ */
+void OnDemandScan::readDirectory(const char *path) {
+    int fd;
+    long n;
+    char buf[SKYLD_DENTS_BUFSIZE];
+    std::string prefix;
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        Messaging::error(std::string("Cannot open directory '") + path + "'");
+        count(&errors, 1);
+        return;
+    }
+    prefix = path;
+    if (*prefix.rbegin() != '/') {
+        prefix += "/";
+    }
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof (buf))) > 0) {
+        long pos;
+
+        for (pos = 0; pos < n;) {
+            struct linux_dirent64 *entry;
+            unsigned char type;
+
+            entry = (struct linux_dirent64 *) (buf + pos);
+            pos += entry->d_reclen;
+            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+                continue;
+            }
+            type = entry->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat statbuf;
+
+                if (fstatat(fd, entry->d_name, &statbuf,
+                            AT_SYMLINK_NOFOLLOW)) {
+                    continue;
+                }
+                if (S_ISDIR(statbuf.st_mode)) {
+                    type = DT_DIR;
+                } else if (S_ISREG(statbuf.st_mode)) {
+                    type = DT_REG;
+                }
+            }
+            if (type == DT_DIR) {
+                queue(DIRECTORY, prefix + entry->d_name);
+            } else if (type == DT_REG) {
+                queue(FILE, prefix + entry->d_name);
+            }
+        }
+    }
+    if (n < 0) {
+        Messaging::error(std::string("Cannot read directory '") + path + "'");
+        count(&errors, 1);
+    }
+    close(fd);
+    count(&directories, 1);
+}
+
+/**
+ * @brief Scans a file unless a valid verdict is cached.
+ *
+ * @param path absolute path of the file
+ */
+void OnDemandScan::scanFile(const char *path) {
+    int fd;
+    int flags = O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_NONBLOCK | O_CLOEXEC;
+    struct stat statbuf;
+    int response;
+
+    // Do not change the access time of files owned by others if possible.
+    fd = open(path, flags | O_NOATIME);
+    if (fd == -1 && errno == EPERM) {
+        fd = open(path, flags);
+    }
+    if (fd == -1) {
+        Messaging::error(std::string("Cannot open file '") + path + "'");
+        count(&errors, 1);
+        return;
+    }
+    if (fstat(fd, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+        close(fd);
+        return;
+    }
+    response = e->getScanCache()->get(&statbuf);
+    if (response == (int) ScanCache::CACHE_MISS) {
+        switch (virusScan->scan(fd)) {
+            case VirusScan::SCANVIRUS:
+                response = FAN_DENY;
+                break;
+            case VirusScan::SCANSKIPPED:
+                // No database loaded or the scan failed.
+                count(&errors, 1);
+                close(fd);
+                return;
+            default:
+                response = FAN_ALLOW;
+        }
+        e->getScanCache()->add(&statbuf, response);
+        pthread_mutex_lock(&mutex);
+        files++;
+        bytes += statbuf.st_size;
+        pthread_mutex_unlock(&mutex);
+    } else {
+        count(&cached, 1);
+        if (response == FAN_DENY) {
+            std::stringstream msg;
+            msg << "Virus detected in file \"" << path
+                << "\" (cached verdict).";
+            Messaging::message(Messaging::ERROR, msg.str());
+        }
+    }
+    if (response == FAN_DENY) {
+        count(&infected, 1);
+    }
+    close(fd);
+}
+
+/**
+ * @brief Waits until all files have been scanned and reports the statistics.
+ *
+ * @return CLEAN, VIRUS or ERROR
+ */
+enum OnDemandScan::Status OnDemandScan::wait() {
+    struct timespec now;
+    double seconds;
+    std::stringstream msg;
+
+    pthread_mutex_lock(&mutex);
+    while (pending) {
+        pthread_cond_wait(&cond, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    seconds = (now.tv_sec - start.tv_sec)
+              + 1e-9 * (now.tv_nsec - start.tv_nsec);
+    if (seconds <= 0) {
+        seconds = 1e-9;
+    }
+    msg << std::fixed << std::setprecision(1)
+        << "Scanned " << files << " files ("
+        << bytes / 1048576. << " MB) in " << seconds << " s, "
+        << files / seconds << " files/s, "
+        << bytes / 1048576. / seconds << " MB/s." << std::endl
+        << "Directories " << directories
+        << ", cached verdicts " << cached
+        << ", infected files " << infected
+        << ", errors " << errors << ".";
+    Messaging::message(Messaging::INFORMATION, msg.str());
+
+    if (infected) {
+        return VIRUS;
+    } else if (errors) {
+        return ERROR;
+    }
+    return CLEAN;
+}
+
+/**
+ * @brief Processes a work item.
+ *
+ * @param workItem work item
+ * @return NULL
+ */
+void *OnDemandScan::work(void *workItem) {
+    struct Task *task = (struct Task *) workItem;
+    OnDemandScan *ods = task->ods;
+
+    if (task->type == DIRECTORY) {
+        ods->readDirectory(task->path);
+    } else {
+        ods->scanFile(task->path);
+    }
+    free(task->path);
+    free(task);
+
+    pthread_mutex_lock(&ods->mutex);
+    ods->pending--;
+    if (ods->pending == 0) {
+        pthread_cond_broadcast(&ods->cond);
+    }
+    pthread_mutex_unlock(&ods->mutex);
+    return NULL;
+}
+
+/**
+ * @brief Deletes the on demand scanner.
+ */
+OnDemandScan::~OnDemandScan() {
+    delete tp;
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
@@ -0,0 +1,160 @@
+/*
+ * File:   OnDemandScan.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file OnDemandScan.h
+ * @brief Scans directory trees for viruses.
+ */
+#ifndef ONDEMANDSCAN_H
+#define	ONDEMANDSCAN_H
+
+#include <pthread.h>
+#include <string>
+#include <time.h>
+#include "Environment.h"
+#include "ThreadPool.h"
+#include "VirusScan.h"
+
+/**
+ * @brief Scans directory trees for viruses.
+ *
+ * Directories and files are processed by a thread pool. Directories are read
+ * with getdents64() in large batches. Files with a valid verdict in the scan
+ * cache are not scanned again, new verdicts are added to the cache.
+ */
+class OnDemandScan {
+public:
+    /**
+     * @brief Result of the scan.
+     */
+    enum Status {
+        /**
+         * @brief No virus found.
+         */
+        CLEAN = 0,
+        /**
+         * @brief A virus was found.
+         */
+        VIRUS = 1,
+        /**
+         * @brief An error occured.
+         */
+        ERROR = 2
+    };
+
+    OnDemandScan(Environment *, VirusScan *);
+    void add(const char *path);
+    enum Status wait();
+    virtual ~OnDemandScan();
+private:
+    /**
+     * @brief Type of a work item.
+     */
+    enum TaskType {
+        /**
+         * @brief Read a directory.
+         */
+        DIRECTORY = 0,
+        /**
+         * @brief Scan a file.
+         */
+        FILE = 1
+    };
+
+    /**
+     * @brief Work item.
+     */
+    struct Task {
+        /**
+         * @brief Scanner.
+         */
+        OnDemandScan *ods;
+        /**
+         * @brief Type of the work item.
+         */
+        enum TaskType type;
+        /**
+         * @brief Absolute path.
+         */
+        char *path;
+    };
+
+    /**
+     * @brief Environment.
+     */
+    Environment *e;
+    /**
+     * @brief Virus scanner.
+     */
+    VirusScan *virusScan;
+    /**
+     * @brief Thread pool.
+     */
+    ThreadPool *tp;
+    /**
+     * @brief Mutex for the counters.
+     */
+    pthread_mutex_t mutex;
+    /**
+     * @brief Signals that all work items have been completed.
+     */
+    pthread_cond_t cond;
+    /**
+     * @brief Number of work items not yet completed.
+     */
+    unsigned long pending;
+    /**
+     * @brief Number of directories read.
+     */
+    unsigned long long directories;
+    /**
+     * @brief Number of files scanned.
+     */
+    unsigned long long files;
+    /**
+     * @brief Number of bytes scanned.
+     */
+    unsigned long long bytes;
+    /**
+     * @brief Number of files with a valid verdict in the cache.
+     */
+    unsigned long long cached;
+    /**
+     * @brief Number of infected files.
+     */
+    unsigned long long infected;
+    /**
+     * @brief Number of files or directories that could not be read.
+     */
+    unsigned long long errors;
+    /**
+     * @brief Start time.
+     */
+    struct timespec start;
+
+    void count(unsigned long long *counter, unsigned long long n);
+    void queue(const enum TaskType type, const std::string &path);
+    void readDirectory(const char *path);
+    void scanFile(const char *path);
+    static void *work(void *);
+
+    // Do not allow copying.
+    OnDemandScan(const OnDemandScan&);
+};
+
+#endif	/* ONDEMANDSCAN_H */
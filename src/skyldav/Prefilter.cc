@@ -0,0 +1,329 @@
+/*
+ * File:   Prefilter.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Prefilter.cc
+ * @brief Classifies files by their leading bytes before scanning.
+ */
+#include <iomanip>
+#include <sstream>
+#include <string.h>
+#include "Messaging.h"
+#include "Prefilter.h"
+
+/**
+ * @brief Magic bytes identifying a file class.
+ */
+struct Magic {
+    /**
+     * @brief Offset of the magic bytes in the file.
+     */
+    size_t offset;
+    /**
+     * @brief Magic bytes.
+     */
+    const char *bytes;
+    /**
+     * @brief Number of magic bytes.
+     */
+    size_t len;
+    /**
+     * @brief File class.
+     */
+    enum Prefilter::Class cls;
+};
+
+/**
+ * @brief Defines a table entry from a string literal.
+ */
+#define SKYLD_MAGIC(offset, bytes, cls) \
+    {offset, bytes, sizeof (bytes) - 1, Prefilter::cls}
+
+/**
+ * @brief Table of magic bytes.
+ *
+ * Formats able to carry code are listed first, so that they win if a file
+ * matches several entries.
+ */
+static const struct Magic magics[] = {
+    SKYLD_MAGIC(0, "\x7f" "ELF", EXECUTABLE),
+    SKYLD_MAGIC(0, "MZ", EXECUTABLE),
+    SKYLD_MAGIC(0, "#!", EXECUTABLE),
+    SKYLD_MAGIC(0, "\xca\xfe\xba\xbe", EXECUTABLE),
+    SKYLD_MAGIC(0, "\xcf\xfa\xed\xfe", EXECUTABLE),
+    SKYLD_MAGIC(0, "\xce\xfa\xed\xfe", EXECUTABLE),
+    SKYLD_MAGIC(0, "dex\n", EXECUTABLE),
+    SKYLD_MAGIC(0, "%PDF", DOCUMENT),
+    SKYLD_MAGIC(0, "\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1", DOCUMENT),
+    SKYLD_MAGIC(0, "{\\rtf", DOCUMENT),
+    SKYLD_MAGIC(0, "PK\x03\x04", ARCHIVE),
+    SKYLD_MAGIC(0, "\x1f\x8b", ARCHIVE),
+    SKYLD_MAGIC(0, "BZh", ARCHIVE),
+    SKYLD_MAGIC(0, "\xfd" "7zXZ\x00", ARCHIVE),
+    SKYLD_MAGIC(0, "7z\xbc\xaf\x27\x1c", ARCHIVE),
+    SKYLD_MAGIC(0, "Rar!\x1a\x07", ARCHIVE),
+    SKYLD_MAGIC(0, "\x28\xb5\x2f\xfd", ARCHIVE),
+    SKYLD_MAGIC(0, "MSCF", ARCHIVE),
+    SKYLD_MAGIC(257, "ustar", ARCHIVE),
+    SKYLD_MAGIC(0, "\x89PNG\r\n\x1a\n", MEDIA),
+    SKYLD_MAGIC(0, "\xff\xd8\xff", MEDIA),
+    SKYLD_MAGIC(0, "GIF8", MEDIA),
+    SKYLD_MAGIC(0, "II*\x00", MEDIA),
+    SKYLD_MAGIC(0, "MM\x00*", MEDIA),
+    SKYLD_MAGIC(0, "ID3", MEDIA),
+    SKYLD_MAGIC(0, "OggS", MEDIA),
+    SKYLD_MAGIC(0, "fLaC", MEDIA),
+    SKYLD_MAGIC(0, "\x1a\x45\xdf\xa3", MEDIA),
+    SKYLD_MAGIC(4, "ftyp", MEDIA),
+    SKYLD_MAGIC(8, "WAVE", MEDIA),
+    SKYLD_MAGIC(8, "AVI ", MEDIA),
+    SKYLD_MAGIC(8, "WEBP", MEDIA),
+    SKYLD_MAGIC(0, "\x00\x01\x00\x00\x00", FONT),
+    SKYLD_MAGIC(0, "OTTO", FONT),
+    SKYLD_MAGIC(0, "ttcf", FONT),
+    SKYLD_MAGIC(0, "wOFF", FONT),
+    SKYLD_MAGIC(0, "wOF2", FONT),
+    SKYLD_MAGIC(0, "SQLite format 3\x00", DATA),
+    SKYLD_MAGIC(0, "\x89HDF\r\n\x1a\n", DATA),
+    SKYLD_MAGIC(0, "PAR1", DATA),
+    {0, NULL, 0, Prefilter::UNKNOWN}
+};
+
+/**
+ * @brief Names of the classes used in the configuration file.
+ */
+static const char *classNames[] = {
+    "unknown",
+    "media",
+    "font",
+    "data",
+    "archive",
+    "document",
+    "executable"
+};
+
+/**
+ * @brief Creates a prefilter scanning all classes fully.
+ *
+ * @param sp scan profiles
+ */
+Prefilter::Prefilter(ScanProfiles *sp) {
+    int i;
+
+    scanProfiles = sp;
+    for (i = 0; i < CLASSES; i++) {
+        actions[i] = FULL;
+        profiles[i] = NULL;
+        partial[i] = 0;
+    }
+    partialClasses = 0;
+    memset(stats, 0, sizeof (stats));
+    fullBytes = 0;
+    fullTime = 0;
+    pthread_mutex_init(&mutex, NULL);
+}
+
+/**
+ * @brief Determines the class of a file.
+ *
+ * @param head leading bytes of the file
+ * @param len number of bytes
+ * @return class
+ */
+enum Prefilter::Class Prefilter::classify(const char *head,
+                                          const size_t len) {
+    const struct Magic *m;
+
+    for (m = magics; m->bytes; m++) {
+        if (m->offset + m->len <= len
+                && !memcmp(head + m->offset, m->bytes, m->len)) {
+            return m->cls;
+        }
+    }
+    return UNKNOWN;
+}
+
+/**
+ * @brief Counts a classified file.
+ *
+ * The time saved is estimated from the throughput of full scans.
+ *
+ * @param cls class
+ * @param action action taken
+ * @param size file size
+ * @param nanoseconds scan time
+ */
+void Prefilter::count(const enum Class cls, const enum Action action,
+                      const off_t size, const long long nanoseconds) {
+    pthread_mutex_lock(&mutex);
+    stats[cls].files[action]++;
+    if (action == FULL) {
+        fullBytes += size;
+        fullTime += nanoseconds;
+    } else if (fullBytes) {
+        long long estimate;
+
+        estimate = (long long) ((double) fullTime * size / fullBytes);
+        if (estimate > nanoseconds) {
+            stats[cls].saved += estimate - nanoseconds;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Gets the handling of a class.
+ *
+ * @param cls class
+ * @param profile receives the profile for action FAST, else NULL
+ * @return action
+ */
+enum Prefilter::Action Prefilter::getAction(const enum Class cls,
+                                            ScanProfile **profile) {
+    *profile = profiles[cls];
+    return actions[cls];
+}
+
+/**
+ * @brief Gets the name of a class.
+ *
+ * @param cls class
+ * @return name
+ */
+const char *Prefilter::getClassName(const enum Class cls) {
+    return classNames[cls];
+}
+
+/**
+ * @brief Converts the name of a class.
+ *
+ * @param name name
+ * @param cls receives the class
+ * @return success = 0
+ */
+int Prefilter::getClass(const std::string &name, enum Class *cls) {
+    int i;
+
+    for (i = 0; i < CLASSES; i++) {
+        if (name == classNames[i]) {
+            *cls = (enum Class) i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Checks if large files of a class may be scanned partially.
+ *
+ * @param cls class
+ * @return 1 if no classes are restricted or the class is allowed
+ */
+int Prefilter::isPartial(const enum Class cls) {
+    return partialClasses == 0 || partial[cls];
+}
+
+/**
+ * @brief Allows large files of a class to be scanned partially.
+ *
+ * Once a class is set, files of other classes are always scanned fully.
+ *
+ * @param name name of the class
+ * @return success = 0
+ */
+int Prefilter::setPartial(const char *name) {
+    enum Class cls;
+
+    if (getClass(name, &cls)) {
+        return 1;
+    }
+    if (!partial[cls]) {
+        partial[cls] = 1;
+        partialClasses++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets the profile for scanning a class.
+ *
+ * @param definition class and name of a defined profile separated by a
+ * colon, e.g. "media:light"
+ * @return success = 0
+ */
+int Prefilter::setProfile(const char *definition) {
+    std::string def = definition;
+    size_t pos;
+    enum Class cls;
+    ScanProfile *profile;
+
+    pos = def.find(':');
+    if (pos == std::string::npos || getClass(def.substr(0, pos), &cls)) {
+        return 1;
+    }
+    profile = scanProfiles->get(def.substr(pos + 1));
+    if (profile == NULL) {
+        return 1;
+    }
+    actions[cls] = FAST;
+    profiles[cls] = profile;
+    return 0;
+}
+
+/**
+ * @brief Sets a class not to be scanned.
+ *
+ * @param name name of the class
+ * @return success = 0
+ */
+int Prefilter::setSkip(const char *name) {
+    enum Class cls;
+
+    if (getClass(name, &cls)) {
+        return 1;
+    }
+    actions[cls] = SKIP;
+    profiles[cls] = NULL;
+    return 0;
+}
+
+/**
+ * @brief Reports the counters and deletes the prefilter.
+ */
+Prefilter::~Prefilter() {
+    int i;
+
+    for (i = 0; i < CLASSES; i++) {
+        std::stringstream msg;
+        struct Statistics *s = &stats[i];
+
+        if (s->files[FULL] + s->files[FAST] + s->files[SKIP] == 0) {
+            continue;
+        }
+        msg << "File class " << classNames[i] << ": full scans "
+            << s->files[FULL] << ", fast scans " << s->files[FAST]
+            << ", skipped " << s->files[SKIP];
+        if (s->saved) {
+            msg << ", estimated time saved " << std::fixed
+                << std::setprecision(1) << s->saved / 1000000000. << " s";
+        }
+        msg << ".";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+    pthread_mutex_destroy(&mutex);
+}
@@ -0,0 +1,175 @@
+/*
+ * File:   Prefilter.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Prefilter.h
+ * @brief Classifies files by their leading bytes before scanning.
+ */
+#ifndef PREFILTER_H
+#define	PREFILTER_H
+
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+#include "ScanProfiles.h"
+
+/**
+ * @brief Number of leading bytes read for classifying a file.
+ */
+#define SKYLD_PREFILTER_HEAD 4096
+
+/**
+ * @brief Classifies files by their leading bytes before scanning.
+ *
+ * The class of a file is determined with a built-in table of magic bytes.
+ * Per class the administrator may choose to scan with a cheaper profile or
+ * to skip scanning. All other files are scanned fully. The number of files
+ * and the estimated scan time saved are counted per class.
+ *
+ * Policies must be set before the first file is classified.
+ */
+class Prefilter {
+public:
+
+    /**
+     * @brief File class.
+     */
+    enum Class {
+        /**
+         * @brief No magic bytes matched.
+         */
+        UNKNOWN = 0,
+        /**
+         * @brief Images, audio and video.
+         */
+        MEDIA,
+        /**
+         * @brief Fonts.
+         */
+        FONT,
+        /**
+         * @brief Databases and other data files.
+         */
+        DATA,
+        /**
+         * @brief Archives and compressed files.
+         */
+        ARCHIVE,
+        /**
+         * @brief Documents which may contain macros or scripts.
+         */
+        DOCUMENT,
+        /**
+         * @brief Executables and scripts.
+         */
+        EXECUTABLE,
+        /**
+         * @brief Number of classes.
+         */
+        CLASSES
+    };
+
+    /**
+     * @brief Handling of a file class.
+     */
+    enum Action {
+        /**
+         * @brief Scan with the profile selected by the rules.
+         */
+        FULL = 0,
+        /**
+         * @brief Scan with the profile configured for the class.
+         */
+        FAST = 1,
+        /**
+         * @brief Do not scan.
+         */
+        SKIP = 2
+    };
+
+    Prefilter(ScanProfiles *);
+    static enum Class classify(const char *head, const size_t len);
+    void count(const enum Class, const enum Action, const off_t size,
+               const long long nanoseconds);
+    enum Action getAction(const enum Class, ScanProfile **profile);
+    static const char *getClassName(const enum Class);
+    int isPartial(const enum Class);
+    int setPartial(const char *name);
+    int setProfile(const char *definition);
+    int setSkip(const char *name);
+    virtual ~Prefilter();
+private:
+
+    /**
+     * @brief Counters of a file class.
+     */
+    struct Statistics {
+        /**
+         * @brief Number of files per action.
+         */
+        unsigned long long files[3];
+        /**
+         * @brief Estimated time saved in nanoseconds.
+         */
+        long long saved;
+    };
+
+    /**
+     * @brief Scan profiles.
+     */
+    ScanProfiles *scanProfiles;
+    /**
+     * @brief Action per class.
+     */
+    enum Action actions[CLASSES];
+    /**
+     * @brief Profile per class for action FAST.
+     */
+    ScanProfile *profiles[CLASSES];
+    /**
+     * @brief Large files of the class may be scanned partially.
+     */
+    int partial[CLASSES];
+    /**
+     * @brief Number of classes which may be scanned partially, 0 = all.
+     */
+    int partialClasses;
+    /**
+     * @brief Counters per class.
+     */
+    struct Statistics stats[CLASSES];
+    /**
+     * @brief Bytes scanned fully, for estimating the time saved.
+     */
+    unsigned long long fullBytes;
+    /**
+     * @brief Time spent on full scans in nanoseconds.
+     */
+    long long fullTime;
+    /**
+     * @brief Mutex for the counters.
+     */
+    pthread_mutex_t mutex;
+
+    static int getClass(const std::string &, enum Class *);
+
+    // Do not allow copying.
+    Prefilter(const Prefilter&);
+};
+
+#endif	/* PREFILTER_H */
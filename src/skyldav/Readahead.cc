@@ -0,0 +1,229 @@
+/*
+ * File:   Readahead.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Readahead.cc
+ * @brief Starts reading queued files ahead of their scan.
+ */
+#include <fcntl.h>
+#include <iomanip>
+#include <sstream>
+#include <string.h>
+#include <unistd.h>
+#include "Messaging.h"
+#include "Readahead.h"
+
+/**
+ * @brief Maximum number of requests waiting for the helper thread.
+ */
+#define SKYLD_READAHEAD_QUEUE 64
+
+/**
+ * @brief Creates the readahead budget and starts the helper thread.
+ *
+ * @param perFile maximum number of bytes read ahead per file, 0 = disabled
+ * @param total maximum number of bytes read ahead for queued files
+ */
+Readahead::Readahead(const unsigned long long perFile,
+                     const unsigned long long total) {
+    this->perFile = perFile;
+    this->total = total;
+    inFlight = 0;
+    bytes = 0;
+    memset(latency, 0, sizeof (latency));
+    started = 0;
+    stopping = 0;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    if (perFile == 0) {
+        return;
+    }
+    if (pthread_create(&thread, NULL, run, this)) {
+        Messaging::message(Messaging::ERROR,
+                           "Cannot create thread for readahead.");
+        return;
+    }
+    started = 1;
+    pthread_setname_np(thread, "skyldav-r");
+}
+
+/**
+ * @brief Calculates the time between two points in time.
+ *
+ * @param from start
+ * @param to end
+ * @return time in nanoseconds
+ */
+static long long elapsed(const struct timespec *from,
+                         const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000LL
+           + to->tv_nsec - from->tv_nsec;
+}
+
+/**
+ * @brief Counts the latency of a scanned file.
+ *
+ * All times are measured with CLOCK_MONOTONIC.
+ *
+ * @param bytes number of bytes read ahead as returned by start()
+ * @param queued time when the file was queued
+ * @param dequeued time when the file was taken from the queue
+ * @param start start of the scan
+ * @param end end of the scan
+ */
+void Readahead::count(const size_t bytes, const struct timespec *queued,
+                      const struct timespec *dequeued,
+                      const struct timespec *start,
+                      const struct timespec *end) {
+    struct Latency *l = &latency[bytes ? 1 : 0];
+
+    pthread_mutex_lock(&mutex);
+    l->files++;
+    l->waitTime += elapsed(queued, dequeued);
+    l->scanTime += elapsed(start, end);
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Releases the budget of a file leaving the queue.
+ *
+ * @param bytes number of bytes read ahead as returned by start()
+ */
+void Readahead::release(const size_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    inFlight -= bytes;
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Reads files ahead on behalf of the fanotify thread.
+ *
+ * @param obj readahead budget
+ * @return NULL
+ */
+void *Readahead::run(void *obj) {
+    Readahead *ra = (Readahead *) obj;
+
+    pthread_mutex_lock(&ra->mutex);
+    for (;;) {
+        struct Request req;
+
+        while (!ra->stopping && ra->requests.empty()) {
+            pthread_cond_wait(&ra->cond, &ra->mutex);
+        }
+        if (ra->stopping) {
+            break;
+        }
+        req = ra->requests.front();
+        ra->requests.pop_front();
+        pthread_mutex_unlock(&ra->mutex);
+        if (readahead(req.fd, 0, req.bytes)) {
+            // readahead() is not supported by all file systems.
+            posix_fadvise(req.fd, 0, req.bytes, POSIX_FADV_WILLNEED);
+        }
+        close(req.fd);
+        pthread_mutex_lock(&ra->mutex);
+    }
+    pthread_mutex_unlock(&ra->mutex);
+    return NULL;
+}
+
+/**
+ * @brief Starts reading a queued file ahead.
+ *
+ * The call only hands the file to the helper thread and does not wait for
+ * the reads to be submitted.
+ *
+ * @param fd file descriptor
+ * @param size size of the file
+ * @return number of bytes read ahead, to be passed to release()
+ */
+size_t Readahead::start(const int fd, const off_t size) {
+    unsigned long long n = size;
+    struct Request req;
+
+    if (!started || size <= 0) {
+        return 0;
+    }
+    if (n > perFile) {
+        n = perFile;
+    }
+    pthread_mutex_lock(&mutex);
+    if (inFlight + n > total || requests.size() >= SKYLD_READAHEAD_QUEUE) {
+        pthread_mutex_unlock(&mutex);
+        return 0;
+    }
+    // The scan closes the file descriptor, possibly before the helper
+    // thread uses it.
+    req.fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (req.fd == -1) {
+        pthread_mutex_unlock(&mutex);
+        return 0;
+    }
+    req.bytes = n;
+    requests.push_back(req);
+    inFlight += n;
+    bytes += n;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    return n;
+}
+
+/**
+ * @brief Reports the latencies and deletes the readahead budget.
+ */
+Readahead::~Readahead() {
+    const char *label[] = {"without", "with"};
+    std::deque<struct Request>::iterator pos;
+    int i;
+
+    if (started) {
+        pthread_mutex_lock(&mutex);
+        stopping = 1;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+        pthread_join(thread, NULL);
+    }
+    for (pos = requests.begin(); pos != requests.end(); ++pos) {
+        close(pos->fd);
+    }
+
+    for (i = 0; i < 2; i++) {
+        std::stringstream msg;
+        struct Latency *l = &latency[i];
+
+        if (l->files == 0) {
+            continue;
+        }
+        msg << "Files scanned " << label[i] << " readahead " << l->files
+            << ", average queue wait " << std::fixed << std::setprecision(2)
+            << l->waitTime / 1000000. / l->files << " ms, average scan time "
+            << l->scanTime / 1000000. / l->files << " ms.";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+    if (bytes) {
+        std::stringstream msg;
+        msg << "Read ahead " << bytes / 1048576 << " MiB.";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
@@ -0,0 +1,142 @@
+/*
+ * File:   Readahead.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Readahead.h
+ * @brief Starts reading queued files ahead of their scan.
+ */
+#ifndef READAHEAD_H
+#define	READAHEAD_H
+
+#include <deque>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/**
+ * @brief Starts reading queued files ahead of their scan.
+ *
+ * When a file is queued for scanning, the kernel is asked to read it into
+ * the page cache, so that reading from storage overlaps with waiting in the
+ * queue. The number of bytes read ahead is limited per file and in total
+ * for files queued but not yet scanned.
+ *
+ * readahead() blocks until the reads have been submitted, so it is called
+ * by a helper thread on a duplicate of the file descriptor. Requests are
+ * dropped when the helper thread falls behind.
+ *
+ * The time spent waiting in the queue and scanning is counted separately
+ * for files read ahead and files not read ahead.
+ */
+class Readahead {
+public:
+    Readahead(const unsigned long long perFile,
+              const unsigned long long total);
+    void count(const size_t bytes, const struct timespec *queued,
+               const struct timespec *dequeued, const struct timespec *start,
+               const struct timespec *end);
+    void release(const size_t bytes);
+    size_t start(const int fd, const off_t size);
+    virtual ~Readahead();
+private:
+
+    /**
+     * @brief Latency counters.
+     */
+    struct Latency {
+        /**
+         * @brief Number of files.
+         */
+        unsigned long long files;
+        /**
+         * @brief Sum of the times waited in the queue in nanoseconds.
+         */
+        long long waitTime;
+        /**
+         * @brief Sum of the scan times in nanoseconds.
+         */
+        long long scanTime;
+    };
+
+    /**
+     * @brief Request for the helper thread.
+     */
+    struct Request {
+        /**
+         * @brief Duplicate of the file descriptor.
+         */
+        int fd;
+        /**
+         * @brief Number of bytes to read ahead.
+         */
+        size_t bytes;
+    };
+
+    /**
+     * @brief Maximum number of bytes read ahead per file.
+     */
+    unsigned long long perFile;
+    /**
+     * @brief Maximum number of bytes read ahead for queued files.
+     */
+    unsigned long long total;
+    /**
+     * @brief Number of bytes read ahead for queued files.
+     */
+    unsigned long long inFlight;
+    /**
+     * @brief Total number of bytes read ahead.
+     */
+    unsigned long long bytes;
+    /**
+     * @brief Latencies of files without and with readahead.
+     */
+    struct Latency latency[2];
+    /**
+     * @brief Requests waiting for the helper thread.
+     */
+    std::deque<struct Request> requests;
+    /**
+     * @brief Helper thread.
+     */
+    pthread_t thread;
+    /**
+     * @brief The helper thread has been created.
+     */
+    int started;
+    /**
+     * @brief The helper thread shall exit.
+     */
+    int stopping;
+    /**
+     * @brief Mutex for the counters and the requests.
+     */
+    pthread_mutex_t mutex;
+    /**
+     * @brief Signals new requests and stopping.
+     */
+    pthread_cond_t cond;
+
+    static void *run(void *);
+
+    // Do not allow copying.
+    Readahead(const Readahead&);
+};
+
+#endif	/* READAHEAD_H */
@@ -21,12 +21,148 @@
  * @file ScanCache.h
  * @brief Cache for virus scanning results.
  */
+#include <errno.h>
 #include <iostream>
 #include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/sysmacros.h>
 #include <time.h>
+#include <unistd.h>
 #include "Messaging.h"
 #include "ScanCache.h"
 
+/**
+ * @brief Identifies a cache file.
+ */
+#define SKYLD_CACHE_MAGIC "SKYLDAVC"
+
+/**
+ * @brief Version of the cache file format.
+ */
+#define SKYLD_CACHE_FORMAT 2
+
+/**
+ * @brief Header of a cache file.
+ */
+struct CacheFileHeader {
+    /**
+     * @brief SKYLD_CACHE_MAGIC.
+     */
+    char magic[8];
+    /**
+     * @brief SKYLD_CACHE_FORMAT.
+     */
+    uint32_t format;
+    /**
+     * @brief Version of the virus database used for scanning.
+     */
+    uint32_t dbVersion;
+    /**
+     * @brief Number of records following the header.
+     */
+    uint64_t count;
+};
+
+/**
+ * @brief Scan result as stored in a cache file.
+ */
+struct CacheFileRecord {
+    /**
+     * @brief ID of device containing file.
+     */
+    uint64_t dev;
+    /**
+     * @brief Inode number.
+     */
+    uint64_t ino;
+    /**
+     * @brief Time of last modification.
+     */
+    int64_t mtime;
+    /**
+     * @brief Time of last status change, seconds.
+     */
+    int64_t ctime;
+    /**
+     * @brief File size.
+     */
+    uint64_t size;
+    /**
+     * @brief Time of last status change, nanoseconds.
+     */
+    uint32_t ctimeNsec;
+    /**
+     * @brief Result of scan.
+     */
+    uint32_t response;
+};
+
+/**
+ * @brief Checks if a scan result still applies to a file.
+ *
+ * Users can reset the modification time with utimensat() but not the time
+ * of the last status change.
+ *
+ * @param scr scan result
+ * @param stat file status as returned by fstat()
+ * @return 1 if the file is unchanged
+ */
+static int isCurrent(const ScanResult *scr, const struct stat *stat) {
+    return scr->mtime == stat->st_mtime
+            && scr->ctime.tv_sec == stat->st_ctim.tv_sec
+            && scr->ctime.tv_nsec == stat->st_ctim.tv_nsec
+            && scr->size == stat->st_size;
+}
+
+/**
+ * @brief Gets the devices of file systems whose inode numbers do not
+ * identify a file after a remount or reboot.
+ *
+ * @param devs receives the device IDs
+ */
+static void getVolatileDevices(std::set<dev_t> &devs) {
+    static const char *types[] = {
+        "devtmpfs", "overlay", "ramfs", "tmpfs", NULL
+    };
+    FILE *file;
+    char *line = NULL;
+    size_t len = 0;
+
+    file = fopen("/proc/self/mountinfo", "re");
+    if (file == NULL) {
+        return;
+    }
+    while (getline(&line, &len, file) != -1) {
+        unsigned int major;
+        unsigned int minor;
+        char type[64];
+        const char *sep;
+        int i;
+
+        // Fields: id parent major:minor ... - type source options
+        sep = strstr(line, " - ");
+        if (sep == NULL
+                || 2 != sscanf(line, "%*d %*d %u:%u", &major, &minor)
+                || 1 != sscanf(sep + 3, "%63s", type)) {
+            continue;
+        }
+        for (i = 0; types[i] != NULL; i++) {
+            if (!strcmp(type, types[i])) {
+                break;
+            }
+        }
+        if (types[i] != NULL || !strncmp(type, "fuse", 4)) {
+            devs.insert(makedev(major, minor));
+        }
+    }
+    free(line);
+    fclose(file);
+}
+
 /**
  * Creates cache for virus scan results.
  * @param env environment
@@ -36,6 +172,10 @@ ScanCache::ScanCache(Environment *env) {
     s = new std::set<ScanResult *, ScanResultComperator>();
     hits = 0;
     misses = 0;
+    evictions = 0;
+    entries = 0;
+    speculativeAdds = 0;
+    speculativeHits = 0;
     // Initialize mutex.
     pthread_mutex_init(&mutex, NULL);
     // Initialize the double linked list of scan results.
@@ -46,11 +186,15 @@ ScanCache::ScanCache(Environment *env) {
  * @brief Adds scan result to cache.
  * @param stat File status as returned by fstat()
  * @param response Response to be used for fanotify (FAN_ALLOW, FAN_DENY)
+ * @param speculative the scan was not requested by a client
+ * @param provisional the result of a partial scan
  */
-void ScanCache::add(const struct stat *stat, const unsigned int response) {
+void ScanCache::add(const struct stat *stat, const unsigned int response,
+                    const int speculative, const int provisional) {
     std::set<ScanResult *, ScanResultComperator>::iterator it;
     std::pair < std::set<ScanResult *, ScanResultComperator>::iterator, bool> pair;
     unsigned int cacheMaxSize = e->getCacheMaxSize();
+    unsigned int evicted = 0;
 
     if (0 == cacheMaxSize) {
         return;
@@ -60,7 +204,11 @@ void ScanCache::add(const struct stat *stat, const unsigned int response) {
     scr->dev = stat->st_dev;
     scr->ino = stat->st_ino;
     scr->mtime = stat->st_mtime;
+    scr->ctime = stat->st_ctim;
+    scr->size = stat->st_size;
     scr->response = response;
+    scr->speculative = speculative;
+    scr->provisional = provisional;
     gmtime(&(scr->age));
 
     pthread_mutex_lock(&mutex);
@@ -71,7 +219,8 @@ void ScanCache::add(const struct stat *stat, const unsigned int response) {
         (*it)->right->left = (*it)->left;
         delete *it;
         s->erase(it);
-    } else while (s->size() >= cacheMaxSize) {
+    } else while (s->size() >= cacheMaxSize
+                   && evicted < SKYLD_CACHE_SHRINK_STEP) {
             // Cache size too big. Get last element.
             it = s->find(root.left);
             if (it != s->end()) {
@@ -80,12 +229,17 @@ void ScanCache::add(const struct stat *stat, const unsigned int response) {
                 (*it)->right->left = (*it)->left;
                 delete *it;
                 s->erase(it);
+                __atomic_add_fetch(&evictions, 1, __ATOMIC_RELAXED);
+                evicted++;
             } else {
                 break;
             }
         }
     pair = s->insert(scr);
     if (pair.second) {
+        if (speculative) {
+            speculativeAdds++;
+        }
         // Successful insertion. Introduce leftmost in linked list.
         root.right->left = scr;
         scr->right = root.right;
@@ -95,6 +249,7 @@ void ScanCache::add(const struct stat *stat, const unsigned int response) {
         // element already existed
         delete scr;
     }
+    __atomic_store_n(&entries, s->size(), __ATOMIC_RELAXED);
     pthread_mutex_unlock(&mutex);
 }
 
@@ -112,9 +267,40 @@ void ScanCache::clear() {
     root.left = &root;
     root.right = &root;
     Messaging::message(Messaging::DEBUG, "Cache cleared.");
+    __atomic_store_n(&entries, s->size(), __ATOMIC_RELAXED);
     pthread_mutex_unlock(&mutex);
 }
 
+/**
+ * @brief Removes the entries of a device from the cache.
+ *
+ * The entries of other devices are kept.
+ * @param dev device ID
+ * @return number of entries removed
+ */
+size_t ScanCache::clear(const dev_t dev) {
+    std::set<ScanResult *, ScanResultComperator>::iterator it;
+    ScanResult scr;
+    size_t count = 0;
+
+    scr.dev = dev;
+    scr.ino = 0;
+    pthread_mutex_lock(&mutex);
+    // The set is ordered by device and inode.
+    it = s->lower_bound(&scr);
+    while (it != s->end() && (*it)->dev == dev) {
+        // Remove from linked list and delete.
+        (*it)->left->right = (*it)->right;
+        (*it)->right->left = (*it)->left;
+        delete *it;
+        s->erase(it++);
+        count++;
+    }
+    __atomic_store_n(&entries, s->size(), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mutex);
+    return count;
+}
+
 /**
  * @brief Adds scan result to cache.
  * @param stat file status as returned by fstat()
@@ -132,11 +318,11 @@ int ScanCache::get(const struct stat *stat) {
     delete scr;
     if (it == s->end()) {
         ret = CACHE_MISS;
-        misses++;
+        __atomic_add_fetch(&misses, 1, __ATOMIC_RELAXED);
     } else {
         scr = *it;
-        // Check modification time.
-        if (scr->mtime == stat->st_mtime) {
+        // Check modification and status change time.
+        if (isCurrent(scr, stat)) {
             // Element is valid. Remove it from linked list.
             scr->left->right = scr->right;
             scr->right->left = scr->left;
@@ -146,7 +332,12 @@ int ScanCache::get(const struct stat *stat) {
             scr->left = &root;
             root.right = scr;
             ret = scr->response;
-            hits++;
+            __atomic_add_fetch(&hits, 1, __ATOMIC_RELAXED);
+            if (scr->speculative) {
+                // First request for a speculatively scanned file.
+                scr->speculative = 0;
+                speculativeHits++;
+            }
         } else {
             // Remove outdated element from linked list and delete it.
             (*it)->left->right = (*it)->right;
@@ -154,13 +345,142 @@ int ScanCache::get(const struct stat *stat) {
             delete *it;
             s->erase(it);
             ret = CACHE_MISS;
-            misses++;
+            __atomic_add_fetch(&misses, 1, __ATOMIC_RELAXED);
         }
     }
+    __atomic_store_n(&entries, s->size(), __ATOMIC_RELAXED);
     pthread_mutex_unlock(&mutex);
     return ret;
 }
 
+/**
+ * @brief Gets the number of entries removed to make room for new ones.
+ *
+ * @return number of evictions
+ */
+unsigned long long ScanCache::getEvictions() {
+    return __atomic_load_n(&evictions, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Gets the number of entries in the cache.
+ *
+ * @return number of entries
+ */
+size_t ScanCache::getSize() {
+    return __atomic_load_n(&entries, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Gets the number of cache hits and misses.
+ *
+ * The counters are read without locking the cache.
+ *
+ * @param h receives the number of cache hits
+ * @param m receives the number of cache misses
+ */
+void ScanCache::getStatistics(unsigned long long *h, unsigned long long *m) {
+    *h = __atomic_load_n(&hits, __ATOMIC_RELAXED);
+    *m = __atomic_load_n(&misses, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Checks if a valid scan result is cached.
+ *
+ * Neither the statistics nor the order of the entries are changed.
+ * @param stat file status as returned by fstat()
+ * @return 1 if cached
+ */
+int ScanCache::isCached(const struct stat *stat) {
+    int ret = 0;
+    std::set<ScanResult *, ScanResultComperator>::iterator it;
+    ScanResult scr;
+
+    scr.dev = stat->st_dev;
+    scr.ino = stat->st_ino;
+
+    pthread_mutex_lock(&mutex);
+    it = s->find(&scr);
+    if (it != s->end() && isCurrent(*it, stat)) {
+        ret = 1;
+    }
+    pthread_mutex_unlock(&mutex);
+    return ret;
+}
+
+/**
+ * @brief Loads scan results from a file written by save().
+ *
+ * The file is ignored if it was written for another virus database version.
+ * Entries of file systems without persistent inode numbers are skipped. The
+ * loaded entries are added as most recently used.
+ * @param filename cache file
+ * @param dbVersion version of the virus database in use
+ * @return number of entries loaded, -1 on error
+ */
+int ScanCache::load(const char *filename, const unsigned int dbVersion) {
+    FILE *file;
+    struct CacheFileHeader header;
+    struct CacheFileRecord record;
+    struct stat statbuf;
+    std::set<dev_t> volatileDevs;
+    uint64_t i;
+    int ret = 0;
+
+    file = fopen(filename, "re");
+    if (file == NULL) {
+        if (errno != ENOENT) {
+            Messaging::error(std::string("Cannot open cache file '")
+                             + filename + "'");
+            return -1;
+        }
+        return 0;
+    }
+    if (1 != fread(&header, sizeof (header), 1, file)
+            || memcmp(header.magic, SKYLD_CACHE_MAGIC, sizeof (header.magic))
+            || header.format != SKYLD_CACHE_FORMAT) {
+        std::stringstream msg;
+        msg << "Invalid cache file '" << filename << "'.";
+        Messaging::message(Messaging::WARNING, msg.str());
+        fclose(file);
+        return -1;
+    }
+    if (header.dbVersion != dbVersion) {
+        std::stringstream msg;
+        msg << "Cache file '" << filename << "' ignored, database version "
+            << header.dbVersion << " is outdated.";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+        fclose(file);
+        return 0;
+    }
+    getVolatileDevices(volatileDevs);
+    memset(&statbuf, 0, sizeof (statbuf));
+    for (i = 0; i < header.count; i++) {
+        if (1 != fread(&record, sizeof (record), 1, file)) {
+            break;
+        }
+        if (volatileDevs.count(record.dev)) {
+            continue;
+        }
+        statbuf.st_dev = record.dev;
+        statbuf.st_ino = record.ino;
+        statbuf.st_mtime = record.mtime;
+        statbuf.st_ctim.tv_sec = record.ctime;
+        statbuf.st_ctim.tv_nsec = record.ctimeNsec;
+        statbuf.st_size = record.size;
+        add(&statbuf, record.response);
+        ret++;
+    }
+    fclose(file);
+    {
+        std::stringstream msg;
+        msg << "Loaded " << ret << " entries from cache file '"
+            << filename << "'.";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+    return ret;
+}
+
 /**
  * @brief Remove scan result from cache.
  * @param stat file status as returned by fstat()
@@ -180,14 +500,136 @@ void ScanCache::remove(const struct stat *stat) {
         delete *it;
         s->erase(it);
     }
+    __atomic_store_n(&entries, s->size(), __ATOMIC_RELAXED);
     pthread_mutex_unlock(&mutex);
     delete scr;
 }
 
+/**
+ * @brief Remove scan results for multiple files from cache.
+ *
+ * The cache mutex is acquired only once for all files.
+ * @param ids device IDs and inode numbers of the files
+ */
+void ScanCache::remove(const std::vector<FileId> &ids) {
+    std::set<ScanResult *, ScanResultComperator>::iterator it;
+    std::vector<FileId>::const_iterator pos;
+    ScanResult scr;
+
+    pthread_mutex_lock(&mutex);
+    for (pos = ids.begin(); pos != ids.end(); ++pos) {
+        scr.dev = pos->first;
+        scr.ino = pos->second;
+        it = s->find(&scr);
+        if (it != s->end()) {
+            // Remove from linked list and delete.
+            (*it)->left->right = (*it)->right;
+            (*it)->right->left = (*it)->left;
+            delete *it;
+            s->erase(it);
+        }
+    }
+    __atomic_store_n(&entries, s->size(), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Saves the scan results to a file.
+ *
+ * The file is replaced atomically. The entries are written from least to
+ * most recently used, so that load() restores the LRU order. Results of
+ * partial scans and of files on file systems without persistent inode
+ * numbers, e.g. tmpfs, are not saved.
+ * @param filename cache file
+ * @param dbVersion version of the virus database used for scanning
+ * @return success = 0
+ */
+int ScanCache::save(const char *filename, const unsigned int dbVersion) {
+    std::vector<CacheFileRecord> records;
+    std::vector<CacheFileRecord>::iterator pos;
+    struct CacheFileHeader header;
+    std::set<dev_t> volatileDevs;
+    std::string tmpname;
+    ScanResult *scr;
+    FILE *file;
+    int ret = 0;
+
+    getVolatileDevices(volatileDevs);
+    pthread_mutex_lock(&mutex);
+    records.reserve(s->size());
+    for (scr = root.left; scr != &root; scr = scr->left) {
+        CacheFileRecord record;
+
+        if (scr->provisional) {
+            // The full scan has not completed.
+            continue;
+        }
+        if (volatileDevs.count(scr->dev)) {
+            // Inode numbers may be reused after a reboot.
+            continue;
+        }
+        memset(&record, 0, sizeof (record));
+        record.dev = scr->dev;
+        record.ino = scr->ino;
+        record.mtime = scr->mtime;
+        record.ctime = scr->ctime.tv_sec;
+        record.ctimeNsec = scr->ctime.tv_nsec;
+        record.size = scr->size;
+        record.response = scr->response;
+        records.push_back(record);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    tmpname = std::string(filename) + ".tmp";
+    file = fopen(tmpname.c_str(), "we");
+    if (file == NULL) {
+        Messaging::error("Cannot create cache file '" + tmpname + "'");
+        return 1;
+    }
+    memset(&header, 0, sizeof (header));
+    memcpy(header.magic, SKYLD_CACHE_MAGIC, sizeof (header.magic));
+    header.format = SKYLD_CACHE_FORMAT;
+    header.dbVersion = dbVersion;
+    header.count = records.size();
+    if (1 != fwrite(&header, sizeof (header), 1, file)) {
+        ret = 1;
+    }
+    for (pos = records.begin(); ret == 0 && pos != records.end(); ++pos) {
+        if (1 != fwrite(&*pos, sizeof (CacheFileRecord), 1, file)) {
+            ret = 1;
+        }
+    }
+    if (fflush(file) || fsync(fileno(file))) {
+        ret = 1;
+    }
+    if (fclose(file)) {
+        ret = 1;
+    }
+    if (ret == 0 && rename(tmpname.c_str(), filename)) {
+        ret = 1;
+    }
+    if (ret) {
+        Messaging::error(std::string("Cannot write cache file '")
+                         + filename + "'");
+        unlink(tmpname.c_str());
+    } else {
+        std::stringstream msg;
+        msg << "Saved " << records.size() << " entries to cache file '"
+            << filename << "'.";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+    return ret;
+}
+
 ScanCache::~ScanCache() {
     std::stringstream msg;
     msg << "Cache size " << s->size() <<
         ", cache hits " << hits << ", cache misses " << misses << ".";
+    if (speculativeAdds) {
+        msg << " Prefetched entries " << speculativeAdds
+            << ", hits on prefetched entries " << speculativeHits
+            << " (" << (100 * speculativeHits / speculativeAdds) << " %).";
+    }
     clear();
     delete s;
     pthread_mutex_destroy(&mutex);
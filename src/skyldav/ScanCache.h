@@ -28,10 +28,24 @@
 #include <set>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <utility>
+#include <vector>
 #include "Environment.h"
 
 class Environment;
 
+/**
+ * @brief Maximum number of entries evicted when adding a single entry.
+ *
+ * After the maximum cache size has been reduced the cache shrinks gradually.
+ */
+#define SKYLD_CACHE_SHRINK_STEP 8
+
+/**
+ * @brief Identifies a file by device ID and inode number.
+ */
+typedef std::pair<dev_t, ino_t> FileId;
+
 /**
  * @brief Result of scanning a file for viruses.
  */
@@ -49,6 +63,14 @@ public:
      * @brief Time of last modification.
      */
     time_t mtime; /* time of last modification */
+    /**
+     * @brief Time of last status change, cannot be set by users.
+     */
+    struct timespec ctime;
+    /**
+     * @brief File size.
+     */
+    off_t size;
     /**
      * @brief Result of scan.
      */
@@ -57,6 +79,15 @@ public:
      * @brief Time when this record entered the cache.
      */
     time_t age;
+    /**
+     * @brief Result of a speculative scan not yet requested by a client.
+     */
+    int speculative;
+    /**
+     * @brief Result of a partial scan, to be replaced by the result of the
+     * full scan.
+     */
+    int provisional;
     /**
      * @brief Left neighbour in double linked list.
      */
@@ -102,7 +133,8 @@ public:
  * <p>The linked list is used for implementing a LRU (least recently used)
  * strategy. Accessed entries are brought to the  * left end of the double
  * linked list. When the cache exceeds its maximum size the rightmost element is
- * eliminated.</p>
+ * eliminated. If the maximum size is reduced, at most SKYLD_CACHE_SHRINK_STEP
+ * elements are eliminated per added element.</p>
  * <p> The set is used to find a scan result in O(log(n)) time.</p>
  */
 class ScanCache {
@@ -112,10 +144,19 @@ public:
      */
     static const unsigned int CACHE_MISS = 0xfffd;
     ScanCache(Environment *);
-    void add(const struct stat *, const unsigned int);
+    void add(const struct stat *, const unsigned int,
+             const int speculative = 0, const int provisional = 0);
     void clear();
+    size_t clear(const dev_t);
     int get(const struct stat *);
+    unsigned long long getEvictions();
+    size_t getSize();
+    void getStatistics(unsigned long long *, unsigned long long *);
+    int isCached(const struct stat *);
+    int load(const char *, const unsigned int);
     void remove(const struct stat *);
+    void remove(const std::vector<FileId> &);
+    int save(const char *, const unsigned int);
     virtual ~ScanCache();
 private:
     /**
@@ -138,6 +179,22 @@ private:
      * @brief Number of cache hits.
      */
     unsigned long long hits;
+    /**
+     * @brief Number of entries removed to make room for new ones.
+     */
+    unsigned long long evictions;
+    /**
+     * @brief Number of entries, readable without locking.
+     */
+    size_t entries;
+    /**
+     * @brief Number of results of speculative scans added.
+     */
+    unsigned long long speculativeAdds;
+    /**
+     * @brief Number of cache hits on results of speculative scans.
+     */
+    unsigned long long speculativeHits;
     /**
      * @brief Root for double linked list.
      */
@@ -0,0 +1,445 @@
+/*
+ * File:   ScanEngine.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScanEngine.cc
+ * @brief Engine scanning files with a reloadable database.
+ */
+#include <fstream>
+#include <iomanip>
+#include <malloc.h>
+#include <sched.h>
+#include <sstream>
+#include <string.h>
+#include <time.h>
+#include "Messaging.h"
+#include "ScanEngine.h"
+
+/**
+ * @brief Reads a memory size of the process from /proc/self/status.
+ *
+ * @param field field name, e.g. "VmRSS:"
+ * @return size in KiB, 0 if unknown
+ */
+static unsigned long memoryKiB(const char *field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    unsigned long ret = 0;
+
+    while (std::getline(status, line)) {
+        if (0 == line.compare(0, strlen(field), field)) {
+            std::istringstream(line.substr(strlen(field))) >> ret;
+            break;
+        }
+    }
+    return ret;
+}
+
+/**
+ * @brief Resets the peak resident set size of the process.
+ */
+static void resetPeakRss() {
+    std::ofstream clearRefs("/proc/self/clear_refs");
+
+    clearRefs << "5" << std::endl;
+}
+
+/**
+ * @brief Creates an engine without database.
+ *
+ * @param n name used in messages
+ */
+ScanEngine::ScanEngine(const std::string &n) {
+    name = n;
+    current = NULL;
+    currentVersion = 0;
+    epoch = 0;
+    readers[0] = 0;
+    readers[1] = 0;
+    loads = 0;
+    failures = 0;
+    paused = 0;
+    releaseHandler = NULL;
+    releaseContext = NULL;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_mutex_init(&mutexReplace, NULL);
+    pthread_cond_init(&cond, NULL);
+}
+
+/**
+ * @brief Gets a reference to the current database.
+ *
+ * The reference must be returned with release(). No lock is taken unless
+ * the database is replaced in place, in which case the call waits.
+ *
+ * @return reference, NULL if no database is loaded
+ */
+struct ScanEngine::Reference *ScanEngine::acquire() {
+    struct Reference *ret;
+    int idx;
+
+    for (;;) {
+        // The reference count is increased before replace() may drop the
+        // reference held by the engine.
+        idx = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST) & 1;
+        __atomic_add_fetch(&readers[idx], 1, __ATOMIC_SEQ_CST);
+        ret = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+        if (ret) {
+            __atomic_add_fetch(&ret->refCount, 1, __ATOMIC_SEQ_CST);
+        }
+        __atomic_sub_fetch(&readers[idx], 1, __ATOMIC_SEQ_CST);
+        if (ret || !__atomic_load_n(&paused, __ATOMIC_SEQ_CST)) {
+            return ret;
+        }
+        pthread_mutex_lock(&mutex);
+        while (paused) {
+            pthread_cond_wait(&cond, &mutex);
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+/**
+ * @brief Gets the name of the engine.
+ *
+ * @return name
+ */
+const std::string &ScanEngine::getName() {
+    return name;
+}
+
+/**
+ * @brief Gets the number of databases that could not be loaded.
+ *
+ * @return number of failures
+ */
+unsigned long long ScanEngine::getFailures() {
+    return __atomic_load_n(&failures, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Gets the number of databases loaded, including reloads.
+ *
+ * @return number of loads
+ */
+unsigned long long ScanEngine::getLoads() {
+    return __atomic_load_n(&loads, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Gets the version of the database in use.
+ *
+ * The version is read without locking, so scans are not delayed.
+ *
+ * @return version, 0 if unknown or no database is loaded
+ */
+unsigned int ScanEngine::getVersion() {
+    return __atomic_load_n(&currentVersion, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Checks if a database is loaded.
+ *
+ * @return 1 if loaded
+ */
+int ScanEngine::isLoaded() {
+    return __atomic_load_n(&current, __ATOMIC_SEQ_CST) != NULL;
+}
+
+/**
+ * @brief Loads the database.
+ *
+ * @return success = 0
+ */
+int ScanEngine::load() {
+    try {
+        publish(create());
+    } catch (Status &e) {
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Makes a database the current one.
+ *
+ * New scans use the new database immediately. The previous database is
+ * destroyed when the last scan using it has completed.
+ *
+ * @param db database
+ */
+void ScanEngine::publish(void *db) {
+    struct Reference *ref;
+    struct Reference *old;
+
+    ref = new Reference();
+    ref->db = db;
+    // The reference held while the database is the current one.
+    ref->refCount = 1;
+
+    // Determining the version may take a while, e.g. for hashing.
+    old = replace(ref, version(db));
+    __atomic_add_fetch(&loads, 1, __ATOMIC_RELAXED);
+
+    if (old) {
+        release(old);
+    }
+}
+
+/**
+ * @brief Replaces the current database reference.
+ *
+ * The pointer is exchanged atomically. Before returning, the call waits
+ * until all threads that may have read the previous reference in acquire()
+ * have increased its reference count. So the caller may release the
+ * reference held by the engine.
+ *
+ * @param ref new reference, NULL to make the engine unavailable
+ * @param v version of the new database, 0 if none
+ * @return previous reference, NULL if none
+ */
+struct ScanEngine::Reference *ScanEngine::replace(struct Reference *ref,
+        unsigned int v) {
+    struct Reference *old;
+    int i;
+
+    // Concurrent replacements could switch the epoch such that a parity is
+    // not waited for.
+    pthread_mutex_lock(&mutexReplace);
+    old = __atomic_exchange_n(&current, ref, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&currentVersion, v, __ATOMIC_RELAXED);
+    // Switch the epoch twice, so that readers which read the epoch before
+    // the first switch but registered after it are waited for, too.
+    for (i = 0; i < 2; i++) {
+        int idx;
+
+        idx = __atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST) & 1;
+        while (__atomic_load_n(&readers[idx], __ATOMIC_SEQ_CST)) {
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&mutexReplace);
+    return old;
+}
+
+/**
+ * @brief Destroys the databases released by scans.
+ *
+ * Called by the thread updating the databases after the release handler has
+ * been invoked.
+ */
+void ScanEngine::collect() {
+    std::vector<struct Reference *> refs;
+    std::vector<struct Reference *>::iterator pos;
+
+    pthread_mutex_lock(&mutex);
+    refs.swap(released);
+    pthread_mutex_unlock(&mutex);
+    for (pos = refs.begin(); pos != refs.end(); ++pos) {
+        destroyReference(*pos);
+    }
+}
+
+/**
+ * @brief Destroys a database and returns its memory to the system.
+ *
+ * @param ref reference without users
+ */
+void ScanEngine::destroyReference(struct Reference *ref) {
+    destroy(ref->db);
+    delete ref;
+    malloc_trim(0);
+}
+
+/**
+ * @brief Decreases the reference count of a database.
+ *
+ * The database is destroyed when the last reference is released. If the
+ * last reference is released by a scan and a release handler is set, the
+ * database is queued for collect() instead, so that the scan is not delayed.
+ * The mutex is only taken for the last reference or while the database is
+ * replaced in place.
+ *
+ * @param ref reference obtained with acquire()
+ * @param defer the caller is scanning a file
+ */
+void ScanEngine::release(struct Reference *ref, const int defer) {
+    ReleaseHandler handler = NULL;
+    void *context = NULL;
+    int refCount;
+
+    refCount = __atomic_sub_fetch(&ref->refCount, 1, __ATOMIC_SEQ_CST);
+    if (refCount != 0 && !__atomic_load_n(&paused, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    if (paused) {
+        // An in place reload waits for the running scans.
+        pthread_cond_broadcast(&cond);
+    }
+    if (refCount == 0 && defer && releaseHandler != NULL) {
+        released.push_back(ref);
+        handler = releaseHandler;
+        context = releaseContext;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (handler != NULL) {
+        handler(context);
+    } else if (refCount == 0) {
+        destroyReference(ref);
+    }
+}
+
+/**
+ * @brief Loads the database again if its source has changed.
+ *
+ * The duration and the resident set size before, at the peak of, and after
+ * the reload are logged.
+ *
+ * @param inPlace destroy the old database before creating the new one
+ * @return 1 if an updated database is in use
+ */
+int ScanEngine::reload(const int inPlace) {
+    struct timespec start;
+    struct timespec end;
+    unsigned long rssBefore;
+    std::stringstream msg;
+
+    if (!changed() && isLoaded()) {
+        return 0;
+    }
+    Messaging::message(Messaging::INFORMATION,
+                       name + " database update detected.");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rssBefore = memoryKiB("VmRSS:");
+    resetPeakRss();
+    if (inPlace) {
+        reloadInPlace();
+    } else if (load()) {
+        return 0;
+    }
+    if (!isLoaded()) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    msg << "Using updated " << name << " database. Reload took "
+        << std::fixed << std::setprecision(1)
+        << (end.tv_sec - start.tv_sec)
+        + (end.tv_nsec - start.tv_nsec) / 1000000000.
+        << " s, RSS before " << rssBefore / 1024
+        << " MiB, peak " << memoryKiB("VmHWM:") / 1024
+        << " MiB, after " << memoryKiB("VmRSS:") / 1024 << " MiB.";
+    Messaging::message(Messaging::INFORMATION, msg.str());
+    return 1;
+}
+
+/**
+ * @brief Replaces the database in place.
+ *
+ * Scanning is paused until the old database has been destroyed and the new
+ * one has been created. So only one database is held in memory. If the new
+ * database cannot be created the engine is unavailable until the next
+ * successful reload.
+ */
+void ScanEngine::reloadInPlace() {
+    struct Reference *old;
+
+    __atomic_store_n(&paused, 1, __ATOMIC_SEQ_CST);
+    old = replace(NULL, 0);
+
+    if (old) {
+        // Wait for the running scans.
+        pthread_mutex_lock(&mutex);
+        while (__atomic_load_n(&old->refCount, __ATOMIC_SEQ_CST) > 1) {
+            pthread_cond_wait(&cond, &mutex);
+        }
+        pthread_mutex_unlock(&mutex);
+        release(old);
+    }
+    if (load()) {
+        Messaging::message(Messaging::ERROR,
+                           "No " + name + " database loaded.");
+    }
+
+    pthread_mutex_lock(&mutex);
+    __atomic_store_n(&paused, 0, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Scans a file with the current database.
+ *
+ * @param job file to be scanned
+ * @param virname receives the name of the virus found
+ * @return verdict
+ */
+int ScanEngine::scan(const struct ScanJob *job, std::string &virname) {
+    struct Reference *ref;
+    int ret;
+
+    ref = acquire();
+    if (ref == NULL) {
+        return UNAVAILABLE;
+    }
+    ret = scanWith(ref->db, job, virname);
+    release(ref, 1);
+    return ret;
+}
+
+/**
+ * @brief Sets the function called when a database released by a scan is
+ * ready to be destroyed by collect().
+ *
+ * @param handler release handler, NULL to destroy in the scanning thread
+ * @param context context passed to the handler
+ */
+void ScanEngine::setReleaseHandler(ReleaseHandler handler, void *context) {
+    pthread_mutex_lock(&mutex);
+    releaseHandler = handler;
+    releaseContext = context;
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Releases the current database.
+ *
+ * The engine is unavailable until the database is loaded again. Databases
+ * waiting for collect() are destroyed. Must be called by the destructor of
+ * the derived class.
+ */
+void ScanEngine::unload() {
+    struct Reference *old;
+
+    old = replace(NULL, 0);
+    if (old) {
+        release(old);
+    }
+    collect();
+}
+
+/**
+ * @brief Deletes the engine.
+ */
+ScanEngine::~ScanEngine() {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutexReplace);
+    pthread_mutex_destroy(&mutex);
+}
@@ -0,0 +1,226 @@
+/*
+ * File:   ScanEngine.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScanEngine.h
+ * @brief Engine scanning files with a reloadable database.
+ */
+#ifndef SCANENGINE_H
+#define	SCANENGINE_H
+
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include "FileMap.h"
+#include "ScanProfile.h"
+
+/**
+ * @brief File to be scanned.
+ */
+struct ScanJob {
+    /**
+     * @brief File descriptor.
+     */
+    int fd;
+    /**
+     * @brief Content of the file, NULL if it has to be read via fd.
+     */
+    const char *data;
+    /**
+     * @brief Size of the file.
+     */
+    off_t size;
+    /**
+     * @brief Memory mapping providing the content, NULL if not mapped.
+     */
+    FileMap *map;
+    /**
+     * @brief Scan profile.
+     */
+    ScanProfile *profile;
+    /**
+     * @brief Only the head and the tail of the file shall be scanned.
+     */
+    int partial;
+};
+
+/**
+ * @brief Engine scanning files with a reloadable database.
+ *
+ * The base class manages the database: it is loaded, replaced when its
+ * source changes, and destroyed when the last scan using it has completed.
+ * Derived classes implement creating, destroying, and scanning with a
+ * database.
+ */
+class ScanEngine {
+public:
+
+    /**
+     * @brief Exception status.
+     */
+    enum Status {
+        /**
+         * @brief The database cannot be created.
+         */
+        FAILURE = 1
+    };
+
+    /**
+     * @brief Result of a scan.
+     */
+    enum Verdict {
+        /**
+         * @brief The file is clean.
+         */
+        CLEAN = 0,
+        /**
+         * @brief The file is infected.
+         */
+        VIRUS = 1,
+        /**
+         * @brief The engine cannot judge the file.
+         */
+        NONE = 2,
+        /**
+         * @brief No database is loaded.
+         */
+        UNAVAILABLE = 3,
+        /**
+         * @brief The scan failed, e.g. a scan worker crashed or timed out.
+         * The file shall be scanned again on its next access.
+         */
+        FAILED = 4
+    };
+
+    /**
+     * @brief Function called when a database is ready to be destroyed.
+     */
+    typedef void (*ReleaseHandler)(void *context);
+
+    ScanEngine(const std::string &name);
+    void collect();
+    virtual void getDirectories(std::vector<std::string> &) = 0;
+    unsigned long long getFailures();
+    unsigned long long getLoads();
+    const std::string &getName();
+    unsigned int getVersion();
+    int isLoaded();
+    int load();
+    int reload(const int inPlace);
+    int scan(const struct ScanJob *, std::string &virname);
+    void setReleaseHandler(ReleaseHandler, void *context);
+    void unload();
+    virtual ~ScanEngine();
+protected:
+    virtual int changed() = 0;
+    virtual void *create() = 0;
+    virtual void destroy(void *db) = 0;
+    virtual int scanWith(void *db, const struct ScanJob *,
+                         std::string &virname) = 0;
+    virtual unsigned int version(void *db) = 0;
+private:
+    /**
+     * @brief Database with reference count.
+     */
+    struct Reference {
+        /**
+         * @brief Database.
+         */
+        void *db;
+        /**
+         * @brief Number of users, including the engine while the database
+         * is the current one.
+         */
+        int refCount;
+    };
+
+    /**
+     * @brief Name used in messages.
+     */
+    std::string name;
+    /**
+     * @brief Current database, exchanged atomically.
+     */
+    struct Reference *current;
+    /**
+     * @brief Version of the current database, 0 if none.
+     */
+    unsigned int currentVersion;
+    /**
+     * @brief Number of databases loaded.
+     */
+    unsigned long long loads;
+    /**
+     * @brief Number of databases that could not be loaded.
+     */
+    unsigned long long failures;
+    /**
+     * @brief Epoch of the database reference, incremented twice per
+     * replacement.
+     */
+    unsigned int epoch;
+    /**
+     * @brief Number of threads reading the database reference, per parity
+     * of the epoch.
+     */
+    int readers[2];
+    /**
+     * @brief Mutex for the pause, the released databases, and the release
+     * handler.
+     */
+    pthread_mutex_t mutex;
+    /**
+     * @brief Mutex serializing replacements of the database reference.
+     */
+    pthread_mutex_t mutexReplace;
+    /**
+     * @brief Signals released references and the end of a pause.
+     */
+    pthread_cond_t cond;
+    /**
+     * @brief Scanning is paused for replacing the database in place.
+     */
+    int paused;
+    /**
+     * @brief Databases released by the last scan using them, to be
+     * destroyed by collect().
+     */
+    std::vector<struct Reference *> released;
+    /**
+     * @brief Function called when a database has been added to released,
+     * NULL to destroy databases in the scanning thread.
+     */
+    ReleaseHandler releaseHandler;
+    /**
+     * @brief Context passed to the release handler.
+     */
+    void *releaseContext;
+
+    struct Reference *acquire();
+    void destroyReference(struct Reference *);
+    void publish(void *db);
+    void release(struct Reference *, const int defer = 0);
+    void reloadInPlace();
+    struct Reference *replace(struct Reference *, unsigned int v);
+
+    // Do not allow copying.
+    ScanEngine(const ScanEngine&);
+};
+
+#endif	/* SCANENGINE_H */
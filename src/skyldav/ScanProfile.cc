@@ -0,0 +1,164 @@
+/*
+ * File:   ScanProfile.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScanProfile.cc
+ * @brief Options for scanning a class of files.
+ */
+#include <clamav.h>
+#include <sstream>
+#include <string.h>
+#include "ScanProfile.h"
+
+/**
+ * @brief File formats that can be parsed.
+ */
+static const struct {
+    /**
+     * @brief Name used in the configuration file.
+     */
+    const char *name;
+    /**
+     * @brief CL_SCAN_PARSE_* flag.
+     */
+    unsigned int flag;
+} formats[] = {
+    {"archive", CL_SCAN_PARSE_ARCHIVE},
+    {"elf", CL_SCAN_PARSE_ELF},
+    {"html", CL_SCAN_PARSE_HTML},
+    {"hwp3", CL_SCAN_PARSE_HWP3},
+    {"mail", CL_SCAN_PARSE_MAIL},
+    {"ole2", CL_SCAN_PARSE_OLE2},
+    {"pdf", CL_SCAN_PARSE_PDF},
+    {"pe", CL_SCAN_PARSE_PE},
+    {"swf", CL_SCAN_PARSE_SWF},
+    {"xmldocs", CL_SCAN_PARSE_XMLDOCS},
+    {"all", ~0U},
+    {"none", 0U},
+    {NULL, 0U}
+};
+
+/**
+ * @brief Creates a scan profile.
+ *
+ * @param n name
+ * @param p file formats to parse, CL_SCAN_PARSE_* flags
+ */
+ScanProfile::ScanProfile(const std::string &n, const unsigned int p) {
+    name = n;
+    parse = p;
+    files = 0;
+    limitsExceeded = 0;
+    pthread_mutex_init(&mutex, NULL);
+}
+
+/**
+ * @brief Counts a scanned file.
+ *
+ * @param exceeded 1 if scan limits were exceeded
+ */
+void ScanProfile::count(const int exceeded) {
+    pthread_mutex_lock(&mutex);
+    files++;
+    if (exceeded) {
+        limitsExceeded++;
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Gets the name of the profile.
+ *
+ * @return name
+ */
+const std::string &ScanProfile::getName() {
+    return name;
+}
+
+/**
+ * @brief Gets the file formats to parse.
+ *
+ * @return CL_SCAN_PARSE_* flags
+ */
+unsigned int ScanProfile::getParseOptions() {
+    return parse;
+}
+
+/**
+ * @brief Gets the counters of the profile.
+ *
+ * @param f receives the number of files scanned
+ * @param exceeded receives the number of files exceeding scan limits
+ */
+void ScanProfile::getStatistics(unsigned long long *f,
+                                unsigned long long *exceeded) {
+    pthread_mutex_lock(&mutex);
+    *f = files;
+    *exceeded = limitsExceeded;
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Converts a list of file formats to CL_SCAN_PARSE_* flags.
+ *
+ * The formats are separated by '+', e.g. "pe+elf+ole2". "all" and "none"
+ * are accepted, too.
+ *
+ * @param list list of file formats
+ * @param p receives the flags
+ * @return success = 0
+ */
+int ScanProfile::parseOptions(const char *list, unsigned int *p) {
+    std::stringstream ss(list);
+    std::string item;
+
+    *p = 0;
+    if (*list == '\0') {
+        return 1;
+    }
+    while (std::getline(ss, item, '+')) {
+        int i;
+
+        for (i = 0; formats[i].name; i++) {
+            if (item == formats[i].name) {
+                *p |= formats[i].flag;
+                break;
+            }
+        }
+        if (formats[i].name == NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets the file formats to parse.
+ *
+ * @param p CL_SCAN_PARSE_* flags
+ */
+void ScanProfile::setParseOptions(const unsigned int p) {
+    parse = p;
+}
+
+/**
+ * @brief Deletes the profile.
+ */
+ScanProfile::~ScanProfile() {
+    pthread_mutex_destroy(&mutex);
+}
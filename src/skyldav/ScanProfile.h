@@ -0,0 +1,72 @@
+/*
+ * File:   ScanProfile.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScanProfile.h
+ * @brief Options for scanning a class of files.
+ */
+#ifndef SCANPROFILE_H
+#define	SCANPROFILE_H
+
+#include <pthread.h>
+#include <string>
+
+/**
+ * @brief Options for scanning a class of files.
+ *
+ * A profile defines which file formats are parsed by the virus scanner and
+ * counts the files scanned with it.
+ */
+class ScanProfile {
+public:
+    ScanProfile(const std::string &name, const unsigned int parse);
+    void count(const int limitsExceeded);
+    const std::string &getName();
+    unsigned int getParseOptions();
+    void getStatistics(unsigned long long *files,
+                       unsigned long long *limitsExceeded);
+    static int parseOptions(const char *, unsigned int *parse);
+    void setParseOptions(const unsigned int parse);
+    virtual ~ScanProfile();
+private:
+    /**
+     * @brief Name of the profile.
+     */
+    std::string name;
+    /**
+     * @brief File formats to parse, CL_SCAN_PARSE_* flags.
+     */
+    unsigned int parse;
+    /**
+     * @brief Number of files scanned.
+     */
+    unsigned long long files;
+    /**
+     * @brief Number of files for which scan limits were exceeded.
+     */
+    unsigned long long limitsExceeded;
+    /**
+     * @brief Mutex for the counters.
+     */
+    pthread_mutex_t mutex;
+
+    // Do not allow copying.
+    ScanProfile(const ScanProfile&);
+};
+
+#endif	/* SCANPROFILE_H */
@@ -0,0 +1,285 @@
+/*
+ * File:   ScanProfiles.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScanProfiles.cc
+ * @brief Selects the scan profile for a file.
+ */
+#include <ctype.h>
+#include <limits.h>
+#include <sstream>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Messaging.h"
+#include "ScanProfiles.h"
+
+/**
+ * @brief Maximum number of leading bytes matched by a rule.
+ */
+#define SKYLD_MAGIC_MAX 64
+
+/**
+ * @brief Creates the profile "default" parsing all file formats.
+ */
+ScanProfiles::ScanProfiles() {
+    defaultProfile = new ScanProfile("default", ~0U);
+    profiles["default"] = defaultProfile;
+    magicLength = 0;
+    needPath = 0;
+    needSize = 0;
+}
+
+/**
+ * @brief Defines a profile.
+ *
+ * The definition consists of the name and the file formats to parse
+ * separated by a colon, e.g. "light:pe+elf". A profile defined before is
+ * replaced.
+ *
+ * @param definition profile definition
+ * @return success = 0
+ */
+int ScanProfiles::addProfile(const char *definition) {
+    std::string def = definition;
+    std::string name;
+    size_t pos;
+    unsigned int parse;
+    std::map<std::string, ScanProfile *>::iterator it;
+
+    pos = def.find(':');
+    if (pos == 0 || pos == std::string::npos) {
+        return 1;
+    }
+    name = def.substr(0, pos);
+    if (ScanProfile::parseOptions(def.c_str() + pos + 1, &parse)) {
+        return 1;
+    }
+    it = profiles.find(name);
+    if (it == profiles.end()) {
+        profiles[name] = new ScanProfile(name, parse);
+    } else {
+        it->second->setParseOptions(parse);
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds a rule for selecting a profile.
+ *
+ * The rule consists of the name of a defined profile followed by the
+ * conditions, all separated by colons, e.g.
+ * "light:mount=/srv/media:size=1048576:magic=1f8b". Conditions are
+ *
+ * - mount=PATH, files below the mount point,
+ * - size=N, files of at least N bytes,
+ * - magic=HEX, files starting with the given bytes (at most 64).
+ *
+ * @param definition rule
+ * @return success = 0
+ */
+int ScanProfiles::addRule(const char *definition) {
+    std::stringstream ss(definition);
+    std::string item;
+    std::map<std::string, ScanProfile *>::iterator it;
+    Rule rule;
+
+    if (!std::getline(ss, item, ':')) {
+        return 1;
+    }
+    it = profiles.find(item);
+    if (it == profiles.end()) {
+        return 1;
+    }
+    rule.profile = it->second;
+    rule.minSize = 0;
+    while (std::getline(ss, item, ':')) {
+        size_t pos;
+        std::string key;
+        std::string value;
+
+        pos = item.find('=');
+        if (pos == std::string::npos) {
+            return 1;
+        }
+        key = item.substr(0, pos);
+        value = item.substr(pos + 1);
+        if (key == "mount" && !value.empty() && value[0] == '/') {
+            if (*value.rbegin() != '/') {
+                value += "/";
+            }
+            rule.mount = value;
+        } else if (key == "size") {
+            std::stringstream vs(value);
+            long long size;
+
+            vs >> size;
+            if (vs.fail() || !vs.eof() || size < 0) {
+                return 1;
+            }
+            rule.minSize = (off_t) size;
+        } else if (key == "magic") {
+            if (parseMagic(value, rule.magic)) {
+                return 1;
+            }
+        } else {
+            return 1;
+        }
+    }
+    if (rule.magic.size() > magicLength) {
+        magicLength = rule.magic.size();
+    }
+    if (!rule.mount.empty()) {
+        needPath = 1;
+    }
+    if (rule.minSize > 0) {
+        needSize = 1;
+    }
+    rules.push_back(rule);
+    return 0;
+}
+
+/**
+ * @brief Gets a profile by name.
+ *
+ * @param name name of the profile
+ * @return profile, NULL if not defined
+ */
+ScanProfile *ScanProfiles::get(const std::string &name) {
+    std::map<std::string, ScanProfile *>::iterator it;
+
+    it = profiles.find(name);
+    if (it == profiles.end()) {
+        return NULL;
+    }
+    return it->second;
+}
+
+/**
+ * @brief Gets the profile used if no rule matches.
+ *
+ * @return default profile
+ */
+ScanProfile *ScanProfiles::getDefault() {
+    return defaultProfile;
+}
+
+/**
+ * @brief Converts hexadecimal digits to bytes.
+ *
+ * @param hex hexadecimal digits, e.g. "1f8b"
+ * @param bytes receives the bytes
+ * @return success = 0
+ */
+int ScanProfiles::parseMagic(const std::string &hex, std::string &bytes) {
+    size_t i;
+
+    if (hex.empty() || hex.size() % 2 || hex.size() > 2 * SKYLD_MAGIC_MAX) {
+        return 1;
+    }
+    bytes.clear();
+    for (i = 0; i < hex.size(); i += 2) {
+        unsigned int byte;
+
+        if (sscanf(hex.c_str() + i, "%2x", &byte) != 1
+                || !isxdigit(hex[i]) || !isxdigit(hex[i + 1])) {
+            return 1;
+        }
+        bytes += (char) byte;
+    }
+    return 0;
+}
+
+/**
+ * @brief Selects the profile for a file.
+ *
+ * Only the properties of the file needed by the rules are determined.
+ *
+ * @param fd file descriptor
+ * @return profile
+ */
+ScanProfile *ScanProfiles::select(const int fd) {
+    std::vector<Rule>::iterator rule;
+    std::string path;
+    std::string head;
+    struct stat statbuf;
+
+    if (rules.empty()) {
+        return defaultProfile;
+    }
+    if (needPath) {
+        char link[32];
+        char buf[PATH_MAX + 1];
+        ssize_t len;
+
+        snprintf(link, sizeof (link), "/proc/self/fd/%d", fd);
+        len = readlink(link, buf, sizeof (buf) - 1);
+        if (len > 0) {
+            path.assign(buf, len);
+        }
+    }
+    if (needSize && fstat(fd, &statbuf)) {
+        statbuf.st_size = 0;
+    }
+    if (magicLength) {
+        char buf[SKYLD_MAGIC_MAX];
+        ssize_t len;
+
+        len = pread(fd, buf, magicLength, 0);
+        if (len > 0) {
+            head.assign(buf, len);
+        }
+    }
+    for (rule = rules.begin(); rule != rules.end(); ++rule) {
+        if (!rule->mount.empty()
+                && path.compare(0, rule->mount.size(), rule->mount)) {
+            continue;
+        }
+        if (rule->minSize > 0 && statbuf.st_size < rule->minSize) {
+            continue;
+        }
+        if (!rule->magic.empty()
+                && head.compare(0, rule->magic.size(), rule->magic)) {
+            continue;
+        }
+        return rule->profile;
+    }
+    return defaultProfile;
+}
+
+/**
+ * @brief Reports the statistics of the profiles used and deletes them.
+ */
+ScanProfiles::~ScanProfiles() {
+    std::map<std::string, ScanProfile *>::iterator it;
+
+    for (it = profiles.begin(); it != profiles.end(); ++it) {
+        unsigned long long files;
+        unsigned long long limitsExceeded;
+
+        it->second->getStatistics(&files, &limitsExceeded);
+        if (files) {
+            std::stringstream msg;
+            msg << "Scan profile " << it->first << ": files scanned "
+                << files << ", scan limits exceeded " << limitsExceeded
+                << ".";
+            Messaging::message(Messaging::INFORMATION, msg.str());
+        }
+        delete it->second;
+    }
+}
@@ -0,0 +1,106 @@
+/*
+ * File:   ScanProfiles.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScanProfiles.h
+ * @brief Selects the scan profile for a file.
+ */
+#ifndef SCANPROFILES_H
+#define	SCANPROFILES_H
+
+#include <map>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include "ScanProfile.h"
+
+/**
+ * @brief Selects the scan profile for a file.
+ *
+ * Profiles are selected by rules checked in the order in which they were
+ * added. A rule matches files below a mount point, files of a minimum size
+ * and files starting with given bytes. The first matching rule determines
+ * the profile. If no rule matches, the profile "default" is used, which
+ * parses all file formats unless redefined.
+ *
+ * Profiles and rules must be added before the first file is scanned.
+ */
+class ScanProfiles {
+public:
+    ScanProfiles();
+    int addProfile(const char *definition);
+    int addRule(const char *definition);
+    ScanProfile *get(const std::string &name);
+    ScanProfile *getDefault();
+    ScanProfile *select(const int fd);
+    virtual ~ScanProfiles();
+private:
+    /**
+     * @brief Rule selecting a profile.
+     */
+    struct Rule {
+        /**
+         * @brief Profile used for matching files.
+         */
+        ScanProfile *profile;
+        /**
+         * @brief Mount point with trailing separator, empty = any.
+         */
+        std::string mount;
+        /**
+         * @brief Minimum file size, 0 = any.
+         */
+        off_t minSize;
+        /**
+         * @brief Leading bytes of the file, empty = any.
+         */
+        std::string magic;
+    };
+
+    /**
+     * @brief Profiles by name.
+     */
+    std::map<std::string, ScanProfile *> profiles;
+    /**
+     * @brief Rules in the order of checking.
+     */
+    std::vector<Rule> rules;
+    /**
+     * @brief Profile used if no rule matches.
+     */
+    ScanProfile *defaultProfile;
+    /**
+     * @brief Number of leading bytes needed for checking the rules.
+     */
+    size_t magicLength;
+    /**
+     * @brief A rule depends on the path of the file.
+     */
+    int needPath;
+    /**
+     * @brief A rule depends on the size of the file.
+     */
+    int needSize;
+
+    static int parseMagic(const std::string &, std::string &);
+
+    // Do not allow copying.
+    ScanProfiles(const ScanProfiles&);
+};
+
+#endif	/* SCANPROFILES_H */
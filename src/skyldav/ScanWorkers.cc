@@ -0,0 +1,536 @@
+/*
+ * File:   ScanWorkers.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScanWorkers.cc
+ * @brief Scans files in separate processes.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <iomanip>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "Messaging.h"
+#include "ScanWorkers.h"
+
+std::set<pid_t> ScanWorkers::pids;
+
+pthread_mutex_t ScanWorkers::mutexPids = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Starts the template process and the workers.
+ *
+ * The database used by the scan function must be complete, as the
+ * processes see the memory of the daemon as of this call.
+ *
+ * @param env environment
+ * @param fn function scanning a file in a worker
+ * @param ctx context of the scan function
+ */
+ScanWorkers::ScanWorkers(Environment *env, ScanFunction fn, void *ctx) {
+    int sv[2];
+    unsigned int i;
+    std::stringstream msg;
+
+    function = fn;
+    context = ctx;
+    count = env->getScanWorkers();
+    timeout = env->getScanWorkerTimeout() * 1000;
+    slots = (struct Slot *) mmap(NULL, count * sizeof (struct Slot),
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        Messaging::error("mmap");
+        throw FAILURE;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+        Messaging::error("socketpair");
+        munmap(slots, count * sizeof (struct Slot));
+        throw FAILURE;
+    }
+    templatePid = fork();
+    if (templatePid == -1) {
+        Messaging::error("Cannot fork");
+        close(sv[0]);
+        close(sv[1]);
+        munmap(slots, count * sizeof (struct Slot));
+        throw FAILURE;
+    }
+    if (templatePid == 0) {
+        control = sv[1];
+        runTemplate();
+    }
+    close(sv[1]);
+    control = sv[0];
+    templateLost = 0;
+    pthread_mutex_init(&mutexControl, NULL);
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+
+    for (i = 0; i < count; i++) {
+        Worker *w = new Worker();
+
+        w->pid = 0;
+        w->fd = -1;
+        w->index = i;
+        spawn(w);
+        workers.push_back(w);
+        idle.push_back(w);
+    }
+    msg << "Started " << count << " scan worker processes.";
+    Messaging::message(Messaging::DEBUG, msg.str());
+}
+
+/**
+ * @brief Takes an idle worker, waiting if all are busy.
+ *
+ * @return worker, NULL if no worker can be started
+ */
+ScanWorkers::Worker *ScanWorkers::acquire() {
+    Worker *w;
+
+    pthread_mutex_lock(&mutex);
+    while (idle.empty()) {
+        pthread_cond_wait(&cond, &mutex);
+    }
+    w = idle.back();
+    idle.pop_back();
+    pthread_mutex_unlock(&mutex);
+
+    if (w->fd == -1 && spawn(w)) {
+        release(w);
+        return NULL;
+    }
+    return w;
+}
+
+/**
+ * @brief Closes all inherited files.
+ *
+ * The template process must not keep the sockets of other pools or the
+ * fanotify file descriptor open.
+ *
+ * @param keep file descriptor to keep open
+ */
+void ScanWorkers::closeFiles(const int keep) {
+    DIR *dir;
+    struct dirent *entry;
+    long max;
+    int fd;
+
+    dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        max = sysconf(_SC_OPEN_MAX);
+        for (fd = STDERR_FILENO + 1; fd < max; fd++) {
+            if (fd != keep) {
+                close(fd);
+            }
+        }
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        fd = atoi(entry->d_name);
+        if (fd > STDERR_FILENO && fd != keep && fd != dirfd(dir)) {
+            close(fd);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Checks if a process is a scan worker.
+ *
+ * Files opened by the workers, e.g. temporary files, must not be scanned.
+ *
+ * @param pid process id
+ * @return 1 if the process is a scan worker
+ */
+int ScanWorkers::isWorker(const pid_t pid) {
+    int ret;
+
+    pthread_mutex_lock(&mutexPids);
+    ret = pids.find(pid) != pids.end();
+    pthread_mutex_unlock(&mutexPids);
+    return ret;
+}
+
+/**
+ * @brief Receives a message and a passed file descriptor.
+ *
+ * @param fd socket
+ * @param buf buffer for the message
+ * @param len length of the message
+ * @param passed receives the file descriptor, -1 if none was passed
+ * @return success = 0
+ */
+int ScanWorkers::receive(const int fd, void *buf, const size_t len,
+                         int *passed) {
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof (int))];
+    } control;
+    struct cmsghdr *cmsg;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof (msg));
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    do {
+        ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (ret == -1 && errno == EINTR);
+    *passed = -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (ret > 0 && cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET
+            && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(passed, CMSG_DATA(cmsg), sizeof (int));
+    }
+    return ret != (ssize_t) len;
+}
+
+/**
+ * @brief Returns a worker to the idle workers.
+ *
+ * @param w worker
+ */
+void ScanWorkers::release(Worker *w) {
+    pthread_mutex_lock(&mutex);
+    idle.push_back(w);
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Replaces a crashed or hanging worker.
+ *
+ * @param w worker
+ */
+void ScanWorkers::respawn(Worker *w) {
+    struct timespec start;
+    struct timespec end;
+    std::stringstream msg;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    terminate(w);
+    if (spawn(w)) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    msg << "Scan worker restarted in " << std::fixed << std::setprecision(1)
+        << (end.tv_sec - start.tv_sec) * 1000.
+        + (end.tv_nsec - start.tv_nsec) / 1000000. << " ms.";
+    Messaging::message(Messaging::INFORMATION, msg.str());
+}
+
+/**
+ * @brief Runs the template process.
+ *
+ * The template process forks a worker for each socket received over the
+ * control socket and returns its process id. It exits when the daemon
+ * closes the control socket.
+ */
+void ScanWorkers::runTemplate() {
+    sigset_t set;
+
+    closeFiles(control);
+    prctl(PR_SET_NAME, "skyldav-t");
+    // Reap the workers automatically.
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGUSR1, SIG_DFL);
+    sigemptyset(&set);
+    sigprocmask(SIG_SETMASK, &set, NULL);
+
+    while (1) {
+        unsigned int index;
+        pid_t pid;
+        int fd;
+
+        if (receive(control, &index, sizeof (index), &fd) || fd == -1
+                || index >= count) {
+            _exit(EXIT_SUCCESS);
+        }
+        pid = fork();
+        if (pid == 0) {
+            close(control);
+            runWorker(fd, &slots[index]);
+        }
+        close(fd);
+        if (send(control, &pid, sizeof (pid), MSG_NOSIGNAL)
+                != sizeof (pid)) {
+            _exit(EXIT_SUCCESS);
+        }
+    }
+}
+
+/**
+ * @brief Runs a worker process.
+ *
+ * The worker exits when the daemon closes the socket or the template
+ * process exits.
+ *
+ * @param fd socket receiving requests
+ * @param slot slot for the results
+ */
+void ScanWorkers::runWorker(const int fd, struct Slot *slot) {
+    prctl(PR_SET_NAME, "skyldav-w");
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() == 1) {
+        // The template process has already exited.
+        _exit(EXIT_SUCCESS);
+    }
+
+    while (1) {
+        struct Request req;
+        struct ScanJob job;
+        const char *name = NULL;
+        int file;
+
+        if (receive(fd, &req, sizeof (req), &file) || file == -1) {
+            _exit(EXIT_SUCCESS);
+        }
+        job.fd = file;
+        job.data = NULL;
+        job.size = req.size;
+        job.map = NULL;
+        job.profile = NULL;
+        job.partial = req.partial;
+        slot->result = function(context, &job, req.parseOptions, &name);
+        if (name != NULL) {
+            strncpy(slot->virname, name, SKYLD_WORKER_VIRNAME - 1);
+            slot->virname[SKYLD_WORKER_VIRNAME - 1] = '\0';
+        } else {
+            slot->virname[0] = '\0';
+        }
+        close(file);
+        // Signal completion.
+        if (send(fd, "", 1, MSG_NOSIGNAL) != 1) {
+            _exit(EXIT_SUCCESS);
+        }
+    }
+}
+
+/**
+ * @brief Scans a file in a worker.
+ *
+ * If the worker crashes or does not answer within the timeout, it is
+ * replaced and the failure is logged.
+ *
+ * @param job file to be scanned
+ * @param parseOptions parse options of the scan profile
+ * @param result receives the result of the scan function
+ * @param virname receives the name of the virus found
+ * @return outcome
+ */
+int ScanWorkers::scan(const struct ScanJob *job,
+                      const unsigned int parseOptions, int *result,
+                      std::string &virname) {
+    struct Request req;
+    struct pollfd pfd;
+    Worker *w;
+    char c;
+    int attempt;
+    int ret;
+
+    memset(&req, 0, sizeof (req));
+    req.size = job->size;
+    req.partial = job->partial;
+    req.parseOptions = parseOptions;
+
+    for (attempt = 0; attempt < 2; attempt++) {
+        w = acquire();
+        if (w == NULL) {
+            return NO_WORKER;
+        }
+        if (!sendWithFd(w->fd, &req, sizeof (req), job->fd)) {
+            break;
+        }
+        // The worker has exited while idle.
+        respawn(w);
+        release(w);
+    }
+    if (attempt == 2) {
+        return NO_WORKER;
+    }
+
+    pfd.fd = w->fd;
+    pfd.events = POLLIN;
+    do {
+        ret = poll(&pfd, 1, timeout);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == 1 && recv(w->fd, &c, 1, 0) == 1) {
+        *result = slots[w->index].result;
+        virname = slots[w->index].virname;
+        release(w);
+        return DONE;
+    }
+
+    do {
+        char path[PATH_MAX + 1];
+        char link[32];
+        ssize_t len;
+        std::stringstream msg;
+
+        snprintf(link, sizeof (link), "/proc/self/fd/%d", job->fd);
+        len = readlink(link, path, sizeof (path) - 1);
+        if (len < 0) {
+            len = 0;
+        }
+        path[len] = '\0';
+        msg << "Scan worker " << w->pid
+            << (ret == 0 ? " timed out" : " crashed")
+            << " scanning file \"" << path << "\".";
+        Messaging::message(Messaging::ERROR, msg.str());
+    } while (0);
+    respawn(w);
+    release(w);
+    return FAILED;
+}
+
+/**
+ * @brief Sends a message and passes a file descriptor.
+ *
+ * @param fd socket
+ * @param buf message
+ * @param len length of the message
+ * @param passed file descriptor to pass
+ * @return success = 0
+ */
+int ScanWorkers::sendWithFd(const int fd, const void *buf, const size_t len,
+                            const int passed) {
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof (int))];
+    } control;
+    struct cmsghdr *cmsg;
+    ssize_t ret;
+
+    memset(&msg, 0, sizeof (msg));
+    memset(&control, 0, sizeof (control));
+    iov.iov_base = (void *) buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof (int));
+    memcpy(CMSG_DATA(cmsg), &passed, sizeof (int));
+    do {
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (ret == -1 && errno == EINTR);
+    return ret != (ssize_t) len;
+}
+
+/**
+ * @brief Forks a worker from the template process.
+ *
+ * @param w worker
+ * @return success = 0
+ */
+int ScanWorkers::spawn(Worker *w) {
+    int sv[2];
+    pid_t pid;
+    int ok;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+        Messaging::error("socketpair");
+        return 1;
+    }
+    pthread_mutex_lock(&mutexControl);
+    ok = !templateLost
+         && !sendWithFd(control, &w->index, sizeof (w->index), sv[1])
+         && recv(control, &pid, sizeof (pid), 0) == sizeof (pid)
+         && pid > 0;
+    if (!ok && !templateLost) {
+        templateLost = 1;
+        Messaging::message(Messaging::ERROR,
+                           "Cannot start scan workers, scanning in process.");
+    }
+    pthread_mutex_unlock(&mutexControl);
+    close(sv[1]);
+    if (!ok) {
+        close(sv[0]);
+        return 1;
+    }
+    w->fd = sv[0];
+    w->pid = pid;
+    pthread_mutex_lock(&mutexPids);
+    pids.insert(pid);
+    pthread_mutex_unlock(&mutexPids);
+    return 0;
+}
+
+/**
+ * @brief Kills a worker.
+ *
+ * @param w worker
+ */
+void ScanWorkers::terminate(Worker *w) {
+    if (w->fd == -1) {
+        return;
+    }
+    kill(w->pid, SIGKILL);
+    close(w->fd);
+    w->fd = -1;
+    pthread_mutex_lock(&mutexPids);
+    pids.erase(w->pid);
+    pthread_mutex_unlock(&mutexPids);
+}
+
+/**
+ * @brief Stops the workers and the template process.
+ *
+ * No scan may be running.
+ */
+ScanWorkers::~ScanWorkers() {
+    std::vector<Worker *>::iterator it;
+
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        terminate(*it);
+        delete *it;
+    }
+    // The template process exits when the control socket is closed.
+    close(control);
+    waitpid(templatePid, NULL, 0);
+    munmap(slots, count * sizeof (struct Slot));
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+    pthread_mutex_destroy(&mutexControl);
+}
@@ -0,0 +1,230 @@
+/*
+ * File:   ScanWorkers.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file ScanWorkers.h
+ * @brief Scans files in separate processes.
+ */
+#ifndef SCANWORKERS_H
+#define	SCANWORKERS_H
+
+#include <pthread.h>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include "Environment.h"
+#include "ScanEngine.h"
+
+/**
+ * @brief Maximum length of a virus name returned by a worker.
+ */
+#define SKYLD_WORKER_VIRNAME 256
+
+/**
+ * @brief Scans files in separate processes.
+ *
+ * A template process is forked when the pool is created. It inherits the
+ * loaded database copy-on-write and forks the worker processes, so that all
+ * of them share the memory of the database. A worker receives the file
+ * descriptor of the file to be scanned over a socket and writes the result
+ * into its slot in a shared memory region.
+ *
+ * A worker that crashes or does not answer in time is killed and a new one
+ * is forked from the template. The scanning thread waiting for it gets no
+ * result, so a file crashing the scanner cannot take down the daemon.
+ */
+class ScanWorkers {
+public:
+
+    /**
+     * @brief Exception status.
+     */
+    enum Status {
+        /**
+         * @brief The workers cannot be started.
+         */
+        FAILURE = 1
+    };
+
+    /**
+     * @brief Outcome of passing a file to a worker.
+     */
+    enum Outcome {
+        /**
+         * @brief The worker has scanned the file.
+         */
+        DONE = 0,
+        /**
+         * @brief The worker crashed or timed out and was replaced.
+         */
+        FAILED = 1,
+        /**
+         * @brief No worker could be started, the file was not passed.
+         */
+        NO_WORKER = 2
+    };
+
+    /**
+     * @brief Function scanning a file in a worker.
+     *
+     * @param context context passed to the constructor
+     * @param job file to be scanned
+     * @param parseOptions parse options of the scan profile
+     * @param virname receives the name of the virus found
+     * @return result passed to the caller of scan()
+     */
+    typedef int (*ScanFunction)(void *context, const struct ScanJob *job,
+                                unsigned int parseOptions,
+                                const char **virname);
+
+    ScanWorkers(Environment *, ScanFunction, void *context);
+    static int isWorker(const pid_t);
+    int scan(const struct ScanJob *, const unsigned int parseOptions,
+             int *result, std::string &virname);
+    ~ScanWorkers();
+private:
+    /**
+     * @brief Request sent to a worker together with the file descriptor.
+     */
+    struct Request {
+        /**
+         * @brief Size of the file.
+         */
+        off_t size;
+        /**
+         * @brief Only the head and the tail of the file shall be scanned.
+         */
+        int partial;
+        /**
+         * @brief Parse options of the scan profile.
+         */
+        unsigned int parseOptions;
+    };
+
+    /**
+     * @brief Result of a worker in shared memory.
+     */
+    struct Slot {
+        /**
+         * @brief Result of the scan function.
+         */
+        int result;
+        /**
+         * @brief Name of the virus found, empty if none.
+         */
+        char virname[SKYLD_WORKER_VIRNAME];
+    };
+
+    /**
+     * @brief Worker process as seen by the daemon.
+     */
+    struct Worker {
+        /**
+         * @brief Process id.
+         */
+        pid_t pid;
+        /**
+         * @brief Socket for passing files, -1 if not running.
+         */
+        int fd;
+        /**
+         * @brief Index of the slot of the worker.
+         */
+        unsigned int index;
+    };
+
+    /**
+     * @brief Function scanning a file.
+     */
+    ScanFunction function;
+    /**
+     * @brief Context of the scan function.
+     */
+    void *context;
+    /**
+     * @brief Time in milliseconds to wait for a worker.
+     */
+    int timeout;
+    /**
+     * @brief Template process.
+     */
+    pid_t templatePid;
+    /**
+     * @brief Socket for requesting workers from the template process.
+     */
+    int control;
+    /**
+     * @brief Mutex for accessing the control socket and templateLost.
+     */
+    pthread_mutex_t mutexControl;
+    /**
+     * @brief The template process cannot fork workers any longer.
+     */
+    int templateLost;
+    /**
+     * @brief Results of the workers in shared memory.
+     */
+    struct Slot *slots;
+    /**
+     * @brief Number of workers.
+     */
+    unsigned int count;
+    /**
+     * @brief All workers.
+     */
+    std::vector<Worker *> workers;
+    /**
+     * @brief Workers not scanning.
+     */
+    std::vector<Worker *> idle;
+    /**
+     * @brief Mutex for accessing idle.
+     */
+    pthread_mutex_t mutex;
+    /**
+     * @brief Signals a worker becoming idle.
+     */
+    pthread_cond_t cond;
+    /**
+     * @brief Process ids of all workers.
+     */
+    static std::set<pid_t> pids;
+    /**
+     * @brief Mutex for accessing pids.
+     */
+    static pthread_mutex_t mutexPids;
+
+    Worker *acquire();
+    static void closeFiles(const int keep);
+    static int receive(const int fd, void *buf, const size_t len,
+                       int *passed);
+    void release(Worker *);
+    void respawn(Worker *);
+    void runTemplate();
+    void runWorker(const int fd, struct Slot *);
+    static int sendWithFd(const int fd, const void *buf, const size_t len,
+                          const int passed);
+    int spawn(Worker *);
+    void terminate(Worker *);
+
+    // Do not allow copying.
+    ScanWorkers(const ScanWorkers&);
+};
+
+#endif	/* SCANWORKERS_H */
@@ -0,0 +1,154 @@
+/*
+ * File:   Settings.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Settings.cc
+ * @brief Settings that can be changed while files are scanned.
+ */
+#include <algorithm>
+#include "Settings.h"
+
+/**
+ * @brief Creates settings with the default values.
+ */
+Settings::Settings() {
+    cacheMaxSize = 500000;
+    cleanCacheOnUpdate = 1;
+    nThreads = 4;
+}
+
+/**
+ * @brief Adds a path that shall not be scanned.
+ *
+ * @param path path
+ */
+void Settings::addExcludePath(const char *path) {
+    std::string val = path;
+    std::vector<std::string>::iterator pos;
+
+    if (0 == val.length() || *(val.rbegin()++) != '/') {
+        val += "/";
+    }
+    pos = std::lower_bound(excludePaths.begin(), excludePaths.end(), val);
+    if (pos == excludePaths.end() || *pos != val) {
+        excludePaths.insert(pos, val);
+    }
+}
+
+/**
+ * @brief Gets the maximum number of entries in the scan cache.
+ *
+ * @return maximum number of entries
+ */
+unsigned int Settings::getCacheMaxSize() const {
+    return cacheMaxSize;
+}
+
+/**
+ * @brief Gets the paths that shall not be scanned.
+ *
+ * @return sorted paths with trailing separator
+ */
+const std::vector<std::string> &Settings::getExcludePaths() const {
+    return excludePaths;
+}
+
+/**
+ * @brief Gets the number of threads used to call the virus scanner.
+ *
+ * @return number of threads
+ */
+int Settings::getNumberOfThreads() const {
+    return nThreads;
+}
+
+/**
+ * @brief Determines if cache shall be cleaned when the virus scanner
+ * receives a new pattern file.
+ *
+ * @return cache shall be cleaned on update
+ */
+int Settings::isCleanCacheOnUpdate() const {
+    return cleanCacheOnUpdate;
+}
+
+/**
+ * @brief Checks if a file is in an exclude path.
+ *
+ * @param path absolute file path, directories with trailing separator
+ * @return 1 if in exclude path
+ */
+int Settings::isExcluded(const std::string &path) const {
+    std::vector<std::string>::const_iterator pos;
+
+    for (pos = excludePaths.begin(); pos != excludePaths.end(); ++pos) {
+        if (0 == path.compare(0, pos->size(), *pos)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes a path that shall not be scanned.
+ *
+ * @param path path
+ * @return 1 if the path was removed, 0 if it was not an exclude path
+ */
+int Settings::removeExcludePath(const char *path) {
+    std::string val = path;
+    std::vector<std::string>::iterator pos;
+
+    if (0 == val.length() || *(val.rbegin()++) != '/') {
+        val += "/";
+    }
+    pos = std::lower_bound(excludePaths.begin(), excludePaths.end(), val);
+    if (pos == excludePaths.end() || *pos != val) {
+        return 0;
+    }
+    excludePaths.erase(pos);
+    return 1;
+}
+
+/**
+ * @brief Sets the maximum number of entries in the scan cache.
+ *
+ * @param size maximum number of entries
+ */
+void Settings::setCacheMaxSize(unsigned int size) {
+    cacheMaxSize = size;
+}
+
+/**
+ * @brief Sets if cache shall be cleaned when the virus scanner receives a
+ * new pattern file.
+ *
+ * @param value cache shall be cleaned on update
+ */
+void Settings::setCleanCacheOnUpdate(int value) {
+    cleanCacheOnUpdate = value;
+}
+
+/**
+ * @brief Sets the number of threads used to call the virus scanner.
+ *
+ * @param n number of threads
+ */
+void Settings::setNumberOfThreads(int n) {
+    nThreads = n;
+}
@@ -0,0 +1,72 @@
+/*
+ * File:   Settings.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Settings.h
+ * @brief Settings that can be changed while files are scanned.
+ */
+#ifndef SETTINGS_H
+#define	SETTINGS_H
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Settings that can be changed while files are scanned.
+ *
+ * Settings are read from the configuration file into a Settings object,
+ * which the environment publishes as a snapshot. A snapshot is never
+ * changed after it has been published by the environment. Changes create a new snapshot, so that threads reading the
+ * settings need no lock. The replaced snapshot is deleted once no thread
+ * reads it anymore.
+ */
+class Settings {
+public:
+    Settings();
+    void addExcludePath(const char *);
+    unsigned int getCacheMaxSize() const;
+    const std::vector<std::string> &getExcludePaths() const;
+    int getNumberOfThreads() const;
+    int isCleanCacheOnUpdate() const;
+    int isExcluded(const std::string &) const;
+    int removeExcludePath(const char *);
+    void setCacheMaxSize(unsigned int);
+    void setCleanCacheOnUpdate(int);
+    void setNumberOfThreads(int);
+private:
+
+    /**
+     * @brief Maximum number of entries in the scan cache.
+     */
+    unsigned int cacheMaxSize;
+    /**
+     * @brief Clean cache when the virus scanner receives a new pattern file.
+     */
+    int cleanCacheOnUpdate;
+    /**
+     * @brief Sorted paths to be excluded from scanning, with trailing
+     * separator.
+     */
+    std::vector<std::string> excludePaths;
+    /**
+     * @brief Number of threads used to call the virus scanner.
+     */
+    int nThreads;
+};
+
+#endif	/* SETTINGS_H */
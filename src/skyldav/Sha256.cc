@@ -0,0 +1,354 @@
+/*
+ * File:   Sha256.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Sha256.cc
+ * @brief Calculates SHA-256 digests.
+ */
+#include <string.h>
+#include "Sha256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SKYLD_SHA_NI 1
+#endif
+
+/**
+ * @brief Compresses blocks into the intermediate hash value.
+ */
+typedef void (*Compress)(uint32_t *state, const unsigned char *data,
+                         size_t blocks);
+
+/**
+ * @brief Round constants.
+ */
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/**
+ * @brief Rotates right.
+ */
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * @brief Compresses blocks with the portable implementation.
+ *
+ * @param state intermediate hash value
+ * @param data blocks
+ * @param blocks number of blocks
+ */
+static void compressPortable(uint32_t *state, const unsigned char *data,
+                             size_t blocks) {
+    for (; blocks; blocks--, data += 64) {
+        uint32_t w[64];
+        uint32_t a, b, c, d, e, f, g, h;
+        int i;
+
+        for (i = 0; i < 16; i++) {
+            w[i] = (uint32_t) data[4 * i] << 24
+                   | (uint32_t) data[4 * i + 1] << 16
+                   | (uint32_t) data[4 * i + 2] << 8
+                   | (uint32_t) data[4 * i + 3];
+        }
+        for (i = 16; i < 64; i++) {
+            uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18)
+                          ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19)
+                          ^ (w[i - 2] >> 10);
+
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+        f = state[5];
+        g = state[6];
+        h = state[7];
+        for (i = 0; i < 64; i++) {
+            uint32_t t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25))
+                          + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22))
+                          + ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SKYLD_SHA_NI
+
+/**
+ * @brief Compresses blocks with the x86 SHA instructions.
+ *
+ * The instructions work on the state arranged as ABEF and CDGH. Four
+ * rounds are calculated per iteration.
+ *
+ * @param state intermediate hash value
+ * @param data blocks
+ * @param blocks number of blocks
+ */
+__attribute__((target("sha,sse4.1")))
+static void compressShaNi(uint32_t *state, const unsigned char *data,
+                          size_t blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                        0x0405060700010203ULL);
+    __m128i state0;
+    __m128i state1;
+    __m128i tmp;
+
+    tmp = _mm_loadu_si128((const __m128i *) &state[0]);
+    state1 = _mm_loadu_si128((const __m128i *) &state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);
+    state1 = _mm_shuffle_epi32(state1, 0x1b);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (; blocks; blocks--, data += 64) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i w[4];
+        int i;
+
+        for (i = 0; i < 16; i++) {
+            __m128i msg;
+
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i *) (data + 16 * i)),
+                    mask);
+            } else {
+                // w[i - 4] is replaced by w[i].
+                msg = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                msg = _mm_add_epi32(msg, _mm_alignr_epi8(w[(i + 3) & 3],
+                                                         w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(msg, w[(i + 3) & 3]);
+            }
+            msg = _mm_add_epi32(w[i & 3],
+                                _mm_loadu_si128((const __m128i *) &k[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *) &state[0], state0);
+    _mm_storeu_si128((__m128i *) &state[4], state1);
+}
+
+/**
+ * @brief Checks if the processor supports the SHA instructions.
+ *
+ * @return 1 if supported
+ */
+static int hasShaNi() {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)
+            || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return 0;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ebx & bit_SHA) != 0;
+}
+
+#else
+
+/**
+ * @brief Checks if the processor supports the SHA instructions.
+ *
+ * @return 0
+ */
+static int hasShaNi() {
+    return 0;
+}
+
+#endif
+
+/**
+ * @brief Selects the fastest implementation available.
+ *
+ * @return compression function
+ */
+static Compress selectCompress() {
+#ifdef SKYLD_SHA_NI
+    if (hasShaNi()) {
+        return compressShaNi;
+    }
+#endif
+    return compressPortable;
+}
+
+/**
+ * @brief Compression function in use.
+ */
+static Compress compress = selectCompress();
+
+/**
+ * @brief Starts calculating a digest.
+ */
+Sha256::Sha256() {
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(state, init, sizeof (state));
+    used = 0;
+    length = 0;
+}
+
+/**
+ * @brief Completes the digest.
+ *
+ * @param digest receives SHA256_DIGEST_SIZE bytes
+ */
+void Sha256::final(unsigned char *digest) {
+    uint64_t bits = length * 8;
+    int i;
+
+    block[used++] = 0x80;
+    if (used > 56) {
+        memset(block + used, 0, 64 - used);
+        compress(state, block, 1);
+        used = 0;
+    }
+    memset(block + used, 0, 56 - used);
+    for (i = 0; i < 8; i++) {
+        block[63 - i] = (unsigned char) (bits >> (8 * i));
+    }
+    compress(state, block, 1);
+    for (i = 0; i < 8; i++) {
+        digest[4 * i] = (unsigned char) (state[i] >> 24);
+        digest[4 * i + 1] = (unsigned char) (state[i] >> 16);
+        digest[4 * i + 2] = (unsigned char) (state[i] >> 8);
+        digest[4 * i + 3] = (unsigned char) state[i];
+    }
+}
+
+/**
+ * @brief Adds data to the digest.
+ *
+ * Complete blocks are compressed directly from the data.
+ *
+ * @param data data
+ * @param len number of bytes
+ */
+void Sha256::update(const void *data, size_t len) {
+    const unsigned char *pos = (const unsigned char *) data;
+
+    length += len;
+    if (used) {
+        size_t n = 64 - used < len ? 64 - used : len;
+
+        memcpy(block + used, pos, n);
+        used += n;
+        pos += n;
+        len -= n;
+        if (used < 64) {
+            return;
+        }
+        compress(state, block, 1);
+        used = 0;
+    }
+    if (len >= 64) {
+        compress(state, pos, len / 64);
+        pos += len & ~(size_t) 63;
+        len &= 63;
+    }
+    memcpy(block, pos, len);
+    used = len;
+}
+
+/**
+ * @brief Calculates the digest of data.
+ *
+ * @param data data
+ * @param len number of bytes
+ * @param digest receives SHA256_DIGEST_SIZE bytes
+ */
+void Sha256::hash(const void *data, const size_t len,
+                  unsigned char *digest) {
+    Sha256 sha;
+
+    sha.update(data, len);
+    sha.final(digest);
+}
+
+/**
+ * @brief Checks if the SHA instructions are used.
+ *
+ * @return 1 if used
+ */
+int Sha256::isAccelerated() {
+    return compress != compressPortable;
+}
+
+/**
+ * @brief Enables or disables the use of the SHA instructions.
+ *
+ * They are only enabled if supported by the processor.
+ *
+ * @param enable 1 to enable
+ * @return 1 if the SHA instructions are used
+ */
+int Sha256::setAccelerated(const int enable) {
+    compress = enable ? selectCompress() : compressPortable;
+    return isAccelerated();
+}
@@ -0,0 +1,68 @@
+/*
+ * File:   Sha256.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file Sha256.h
+ * @brief Calculates SHA-256 digests.
+ */
+#ifndef SHA256_H
+#define	SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Size of a SHA-256 digest in bytes.
+ */
+#define SHA256_DIGEST_SIZE 32
+
+/**
+ * @brief Calculates SHA-256 digests.
+ *
+ * On x86 processors with the SHA extensions the blocks are compressed with
+ * the SHA instructions, else with a portable implementation.
+ */
+class Sha256 {
+public:
+    Sha256();
+    void final(unsigned char *digest);
+    void update(const void *data, size_t len);
+    static void hash(const void *data, const size_t len,
+                     unsigned char *digest);
+    static int isAccelerated();
+    static int setAccelerated(const int);
+private:
+    /**
+     * @brief Intermediate hash value.
+     */
+    uint32_t state[8];
+    /**
+     * @brief Incomplete block.
+     */
+    unsigned char block[64];
+    /**
+     * @brief Number of bytes in the incomplete block.
+     */
+    size_t used;
+    /**
+     * @brief Number of bytes hashed.
+     */
+    uint64_t length;
+};
+
+#endif	/* SHA256_H */
@@ -0,0 +1,195 @@
+/*
+ * File:   StatsSegment.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file StatsSegment.cc
+ * @brief Publishes live statistics in shared memory.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "Messaging.h"
+#include "StatsSegment.h"
+
+/**
+ * @brief Maximum number of attempts to read a consistent copy.
+ */
+#define SKYLD_STATS_RETRIES 1000
+
+/**
+ * @brief Creates the segment and starts publishing.
+ *
+ * An existing file is replaced, so that readers still mapping the segment
+ * of a previous run are not affected.
+ *
+ * @param path path of the segment, e.g. /dev/shm/skyldav.stats
+ * @param collector function collecting the values
+ * @param context context passed to the collector
+ */
+StatsSegment::StatsSegment(const std::string &path, Collector collector,
+                           void *context) {
+    int fd;
+    void *addr;
+
+    this->path = path;
+    this->collector = collector;
+    this->context = context;
+    stopping = 0;
+
+    unlink(path.c_str());
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+              S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        Messaging::error("Cannot create statistics segment '" + path + "'");
+        throw FAILURE;
+    }
+    if (ftruncate(fd, sizeof (struct StatsLayout))) {
+        Messaging::error("StatsSegment, ftruncate");
+        close(fd);
+        unlink(path.c_str());
+        throw FAILURE;
+    }
+    addr = mmap(NULL, sizeof (struct StatsLayout), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        Messaging::error("StatsSegment, mmap");
+        unlink(path.c_str());
+        throw FAILURE;
+    }
+    segment = (struct StatsLayout *) addr;
+    segment->layout = SKYLD_STATS_LAYOUT;
+    segment->pid = getpid();
+    segment->started = time(NULL);
+    strncpy(segment->version, VERSION, sizeof (segment->version) - 1);
+    publish();
+    // Readers check the magic number last.
+    __atomic_store_n(&segment->magic, SKYLD_STATS_MAGIC, __ATOMIC_RELEASE);
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    if (pthread_create(&thread, NULL, run, this)) {
+        Messaging::error("StatsSegment, pthread_create");
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+        munmap(segment, sizeof (struct StatsLayout));
+        unlink(path.c_str());
+        throw FAILURE;
+    }
+    pthread_setname_np(thread, "skyldav-s");
+}
+
+/**
+ * @brief Collects the values and writes them into the segment.
+ */
+void StatsSegment::publish() {
+    struct StatsValues values;
+    struct timespec now;
+    uint32_t sequence;
+
+    memset(&values, 0, sizeof (values));
+    collector(context, &values);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    sequence = segment->sequence;
+    __atomic_store_n(&segment->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    segment->values = values;
+    segment->updated = now.tv_sec * 1000000000LL + now.tv_nsec;
+    __atomic_store_n(&segment->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Copies a consistent snapshot of a segment.
+ *
+ * No system call is needed, so reading does not add load to the daemon.
+ *
+ * @param segment mapped segment
+ * @param copy receives the snapshot
+ * @return success = 0
+ */
+int StatsSegment::read(const struct StatsLayout *segment,
+                       struct StatsLayout *copy) {
+    unsigned int i;
+
+    if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE)
+            != SKYLD_STATS_MAGIC || segment->layout != SKYLD_STATS_LAYOUT) {
+        return 1;
+    }
+    for (i = 0; i < SKYLD_STATS_RETRIES; i++) {
+        uint32_t before;
+
+        before = __atomic_load_n(&segment->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(copy, segment, sizeof (struct StatsLayout));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&segment->sequence, __ATOMIC_RELAXED) == before) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Publishes the values until stopped.
+ *
+ * @param obj statistics segment
+ * @return return value
+ */
+void *StatsSegment::run(void *obj) {
+    StatsSegment *s = (StatsSegment *) obj;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&s->mutex);
+    while (!s->stopping) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += SKYLD_STATS_INTERVAL * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        if (pthread_cond_timedwait(&s->cond, &s->mutex, &deadline)
+                == ETIMEDOUT) {
+            pthread_mutex_unlock(&s->mutex);
+            s->publish();
+            pthread_mutex_lock(&s->mutex);
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+/**
+ * @brief Stops publishing and removes the segment.
+ */
+StatsSegment::~StatsSegment() {
+    pthread_mutex_lock(&mutex);
+    stopping = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+    munmap(segment, sizeof (struct StatsLayout));
+    unlink(path.c_str());
+}
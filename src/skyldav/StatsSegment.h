@@ -0,0 +1,225 @@
+/*
+ * File:   StatsSegment.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file StatsSegment.h
+ * @brief Publishes live statistics in shared memory.
+ */
+#ifndef STATSSEGMENT_H
+#define	STATSSEGMENT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+/**
+ * @brief Magic number of the statistics segment ("SKST").
+ */
+#define SKYLD_STATS_MAGIC 0x54534b53
+
+/**
+ * @brief Version of the layout of the statistics segment. It is increased
+ * whenever fields are changed.
+ */
+#define SKYLD_STATS_LAYOUT 1
+
+/**
+ * @brief Interval in milliseconds between updates of the statistics segment.
+ */
+#define SKYLD_STATS_INTERVAL 1000
+
+/**
+ * @brief Values published in the statistics segment.
+ *
+ * Counters are totals since the start. Readers derive rates from the
+ * difference of two snapshots.
+ */
+struct StatsValues {
+    /**
+     * @brief Permission events received.
+     */
+    uint64_t events;
+    /**
+     * @brief Files scanned.
+     */
+    uint64_t scans;
+    /**
+     * @brief Bytes of the files scanned.
+     */
+    uint64_t bytesScanned;
+    /**
+     * @brief Accesses denied.
+     */
+    uint64_t denies;
+    /**
+     * @brief Cache hits.
+     */
+    uint64_t cacheHits;
+    /**
+     * @brief Cache misses.
+     */
+    uint64_t cacheMisses;
+    /**
+     * @brief Entries removed from the cache to make room for new ones.
+     */
+    uint64_t cacheEvictions;
+    /**
+     * @brief Entries in the cache.
+     */
+    uint64_t cacheSize;
+    /**
+     * @brief Files waiting for a scanning thread.
+     */
+    uint32_t queueDepth;
+    /**
+     * @brief Speculative scans waiting for a scanning thread.
+     */
+    uint32_t idleQueueDepth;
+    /**
+     * @brief Scanning threads working.
+     */
+    uint32_t busyWorkers;
+    /**
+     * @brief Scanning threads.
+     */
+    uint32_t workers;
+    /**
+     * @brief Version of the virus databases, 0 if not loaded.
+     */
+    uint32_t dbVersion;
+    /**
+     * @brief Padding.
+     */
+    uint32_t reserved;
+};
+
+/**
+ * @brief Layout of the statistics segment.
+ *
+ * The writer increments sequence before and after updating the values. A
+ * reader retries while sequence is odd or has changed during the copy.
+ */
+struct StatsLayout {
+    /**
+     * @brief SKYLD_STATS_MAGIC.
+     */
+    uint32_t magic;
+    /**
+     * @brief SKYLD_STATS_LAYOUT.
+     */
+    uint32_t layout;
+    /**
+     * @brief Sequence number, odd while the values are updated.
+     */
+    uint32_t sequence;
+    /**
+     * @brief Process id of the daemon.
+     */
+    uint32_t pid;
+    /**
+     * @brief Start time of the daemon (seconds since the epoch).
+     */
+    int64_t started;
+    /**
+     * @brief Time of the last update (CLOCK_MONOTONIC, nanoseconds).
+     */
+    int64_t updated;
+    /**
+     * @brief Version of the daemon.
+     */
+    char version[32];
+    /**
+     * @brief Values.
+     */
+    struct StatsValues values;
+};
+
+/**
+ * @brief Publishes live statistics in a read-only shared memory segment.
+ *
+ * A thread collects the values periodically with a callback and writes them
+ * into a file mapped into memory, typically in /dev/shm. Monitoring tools
+ * map the file read-only and copy the values without any interaction with
+ * the daemon.
+ */
+class StatsSegment {
+public:
+
+    /**
+     * @brief Exception status.
+     */
+    enum Status {
+        /**
+         * @brief The segment cannot be created.
+         */
+        FAILURE = 1
+    };
+
+    /**
+     * @brief Function collecting the values to be published.
+     *
+     * @param context context passed to the constructor
+     * @param values receives the values
+     */
+    typedef void (*Collector)(void *context, struct StatsValues *values);
+
+    StatsSegment(const std::string &path, Collector, void *context);
+    static int read(const struct StatsLayout *, struct StatsLayout *copy);
+    ~StatsSegment();
+private:
+    /**
+     * @brief Path of the segment.
+     */
+    std::string path;
+    /**
+     * @brief Mapped segment.
+     */
+    struct StatsLayout *segment;
+    /**
+     * @brief Function collecting the values.
+     */
+    Collector collector;
+    /**
+     * @brief Context of the collector.
+     */
+    void *context;
+    /**
+     * @brief Publishing thread.
+     */
+    pthread_t thread;
+    /**
+     * @brief Request to stop the publishing thread.
+     */
+    int stopping;
+    /**
+     * @brief Mutex for accessing stopping.
+     */
+    pthread_mutex_t mutex;
+    /**
+     * @brief Signals the request to stop.
+     */
+    pthread_cond_t cond;
+
+    void publish();
+    static void *run(void *);
+
+    // Do not allow copying.
+    StatsSegment(const StatsSegment&);
+};
+
+#endif	/* STATSSEGMENT_H */
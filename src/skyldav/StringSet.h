@@ -59,6 +59,7 @@ public:
     void add(const char *value);
     using std::set<std::string *, StringComperator>::begin;
     using std::set<std::string *, StringComperator>::count;
+    using std::set<std::string *, StringComperator>::empty;
     using std::set<std::string *, StringComperator>::end;
     using std::set<std::string *, StringComperator>::find;
     int find(const char *value);
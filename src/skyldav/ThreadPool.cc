@@ -25,6 +25,11 @@
 #include <time.h>
 #include "ThreadPool.h"
 
+/**
+ * @brief Maximum number of QUICK items started while DEMAND items wait.
+ */
+#define SKYLD_QUICK_RATIO 4
+
 /**
  * @brief Creates a new thread pool.
  *
@@ -32,28 +37,23 @@
  * @param workRoutine routine that handles the individual units of work
  */
 ThreadPool::ThreadPool(int nThreads, void* (*workRoutine) (void *)) {
-    int i;
-    std::ostringstream name;
-
     thread_count = 0;
+    target = 0;
+    created = 0;
+    idle_busy = 0;
+    busy = 0;
+    quickRun = 0;
+    size = 0;
+    idleSize = 0;
     status = RUNNING;
     this->workRoutine = workRoutine;
     pthread_mutex_init(&mutexThread, NULL);
+    pthread_mutex_init(&mutexTarget, NULL);
     pthread_mutex_init(&mutexWorker, NULL);
     pthread_mutex_init(&mutexWorkItem, NULL);
     pthread_cond_init(&cond, NULL);
 
-    /* Limit the number of threads. */
-    if (nThreads > 256) {
-        nThreads = 256;
-    } else if (nThreads < 1) {
-        nThreads = 1;
-    }
-    for (i = 1; i <= nThreads; i++) {
-        name.str("");
-        name << "skyldav-" << i;
-        createThread(name.str().c_str());
-    }
+    setThreadCount(nThreads);
     return;
 }
 
@@ -61,12 +61,23 @@ ThreadPool::ThreadPool(int nThreads, void* (*workRoutine) (void *)) {
  * @brief Adds a work item to the work list.
  *
  * @param workItem work item
+ * @param priority DEMAND, QUICK or IDLE
  */
-void ThreadPool::add(void *workItem) {
+void ThreadPool::add(void *workItem, enum Priority priority) {
     pthread_mutex_lock(&mutexWorkItem);
-    worklist.push_back(workItem);
-    pthread_cond_signal(&cond);
+    if (priority == IDLE) {
+        idlelist.push_back(workItem);
+    } else if (priority == QUICK) {
+        quicklist.push_back(workItem);
+    } else {
+        worklist.push_back(workItem);
+    }
+    updateSizes();
     pthread_mutex_unlock(&mutexWorkItem);
+    // Signal while holding the mutex the workers wait on.
+    pthread_mutex_lock(&mutexWorker);
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutexWorker);
 }
 
 /**
@@ -106,40 +117,139 @@ void ThreadPool::exitThread(void *retval) {
     pthread_exit(retval);
 }
 
+/**
+ * @brief Gets the number of threads working on an item.
+ *
+ * @return number of busy threads
+ */
+int ThreadPool::getBusyCount() {
+    return __atomic_load_n(&busy, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Gets the number of threads that may work on IDLE items while
+ * DEMAND items are waiting.
+ *
+ * IDLE items cannot be preempted, so at most (n - 1) / 2 of n threads are
+ * used for them. With one or two threads this is 0, but one IDLE item is
+ * still started while no DEMAND item is waiting, see isIdleAllowed().
+ *
+ * @return maximum number of threads working on IDLE items under load
+ */
+int ThreadPool::getMaxIdle() {
+    return (__atomic_load_n(&thread_count, __ATOMIC_RELAXED) - 1) / 2;
+}
+
 /**
  * @brief Gets a work item.
  *
+ * Items with priority QUICK are served first, then items with priority
+ * DEMAND, then items with priority IDLE. After SKYLD_QUICK_RATIO QUICK
+ * items a waiting DEMAND item is served.
+ *
+ * QUICK items are reported as DEMAND.
+ *
+ * @param priority receives the priority of the work item
  * @return work item or NULL
  */
-void *ThreadPool::getWorkItem() {
+void *ThreadPool::getWorkItem(enum Priority *priority) {
     void *ret = NULL;
 
     if (pthread_mutex_lock(&mutexWorkItem)) {
         return NULL;
     }
-    if (worklist.size()) {
+    if (quicklist.size()
+            && (quickRun < SKYLD_QUICK_RATIO || worklist.empty())) {
+        ret = quicklist[0];
+        quicklist.pop_front();
+        quickRun++;
+        *priority = DEMAND;
+    } else if (worklist.size()) {
         ret = worklist[0];
         worklist.pop_front();
+        quickRun = 0;
+        *priority = DEMAND;
+    } else if (isIdleAllowed()) {
+        ret = idlelist[0];
+        idlelist.pop_front();
+        idle_busy++;
+        *priority = IDLE;
     }
+    updateSizes();
     pthread_mutex_unlock(&mutexWorkItem);
     return ret;
 }
 
 /**
- * @brief Gets size of worklist.
+ * @brief Gets size of the worklist for priority IDLE.
+ *
+ * The size is read without locking the worklists.
  *
- * @return size of worklist, -1 signals error
+ * @return size of worklist
+ */
+long ThreadPool::getIdleWorklistSize() {
+    return __atomic_load_n(&idleSize, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Gets size of worklists for priorities DEMAND and QUICK.
+ *
+ * The size is read without locking the worklists.
+ *
+ * @return size of worklist
  */
 long ThreadPool::getWorklistSize() {
-    long ret = -1;
-    if (pthread_mutex_lock(&mutexWorkItem)) {
-        return ret;
-    }
-    ret = worklist.size();
+    return __atomic_load_n(&size, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Checks if a work item can be started.
+ *
+ * @return 1 if a work item is available
+ */
+int ThreadPool::hasWork() {
+    int ret;
+
+    pthread_mutex_lock(&mutexWorkItem);
+    ret = worklist.size() || quicklist.size() || isIdleAllowed();
     pthread_mutex_unlock(&mutexWorkItem);
     return ret;
 }
 
+/**
+ * @brief Checks if there are more threads than requested.
+ *
+ * @return 1 if a thread shall exit
+ */
+int ThreadPool::isSurplus() {
+    int ret;
+
+    pthread_mutex_lock(&mutexThread);
+    ret = thread_count > target;
+    pthread_mutex_unlock(&mutexThread);
+    return ret;
+}
+
+/**
+ * @brief Checks if an IDLE item can be started.
+ *
+ * Up to getMaxIdle() IDLE items run at the same time. One IDLE item may
+ * run while no DEMAND or QUICK item is waiting. When the pool is stopping,
+ * all IDLE items are started.
+ *
+ * Must be called with mutexWorkItem locked.
+ *
+ * @return 1 if an IDLE item can be started
+ */
+int ThreadPool::isIdleAllowed() {
+    if (idlelist.empty()) {
+        return 0;
+    }
+    return idle_busy < getMaxIdle()
+           || (idle_busy == 0 && worklist.empty() && quicklist.empty())
+           || isStopping();
+}
+
 /**
  * @brief Is thread pool stopping.
  *
@@ -149,6 +259,90 @@ int ThreadPool::isStopping() const {
     return status == STOPPING;
 }
 
+/**
+ * @brief Signals that a work item with priority IDLE has been completed.
+ */
+void ThreadPool::releaseIdle() {
+    pthread_mutex_lock(&mutexWorkItem);
+    idle_busy--;
+    pthread_mutex_unlock(&mutexWorkItem);
+    // Another IDLE item may be started now.
+    pthread_mutex_lock(&mutexWorker);
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutexWorker);
+}
+
+/**
+ * @brief Lets the calling thread exit if there are more threads than
+ * requested.
+ *
+ * The thread is no longer counted if it shall exit, so that only as many
+ * threads exit as are surplus.
+ *
+ * @return 1 if the thread shall exit
+ */
+int ThreadPool::retire() {
+    int ret = 0;
+
+    pthread_mutex_lock(&mutexThread);
+    if (thread_count > target) {
+        thread_count--;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&mutexThread);
+    return ret;
+}
+
+/**
+ * @brief Changes the number of threads.
+ *
+ * Missing threads are created immediately. Surplus threads exit when they
+ * have completed their current work item. Queued work items are kept.
+ * Concurrent calls are serialised, so that the last call determines the
+ * number of threads.
+ *
+ * @param nThreads number of threads, limited to 1 to 256
+ * @return number of threads requested after limiting
+ */
+int ThreadPool::setThreadCount(int nThreads) {
+    std::ostringstream name;
+    int n;
+
+    /* Limit the number of threads. */
+    if (nThreads > 256) {
+        nThreads = 256;
+    } else if (nThreads < 1) {
+        nThreads = 1;
+    }
+    pthread_mutex_lock(&mutexTarget);
+    pthread_mutex_lock(&mutexThread);
+    target = nThreads;
+    n = thread_count;
+    pthread_mutex_unlock(&mutexThread);
+    for (; n < nThreads; n++) {
+        name.str("");
+        name << "skyldav-" << ++created;
+        createThread(name.str().c_str());
+    }
+    pthread_mutex_unlock(&mutexTarget);
+    // Wake up idle threads, so that surplus threads exit.
+    pthread_mutex_lock(&mutexWorker);
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutexWorker);
+    return nThreads;
+}
+
+/**
+ * @brief Publishes the sizes of the worklists.
+ *
+ * Must be called with mutexWorkItem locked.
+ */
+void ThreadPool::updateSizes() {
+    __atomic_store_n(&size, (long) (worklist.size() + quicklist.size()),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&idleSize, (long) idlelist.size(), __ATOMIC_RELAXED);
+}
+
 /**
  * @brief Working thread.
  *
@@ -162,16 +356,27 @@ void * ThreadPool::worker(void *threadPool) {
 
     for (;;) {
         void *workitem;
+        enum Priority priority = DEMAND;
         pthread_mutex_lock(&tp->mutexWorker);
-        while (!tp->isStopping() && tp->worklist.size() == 0) {
+        while (!tp->isStopping() && !tp->hasWork() && !tp->isSurplus()) {
             pthread_cond_wait(&tp->cond, &tp->mutexWorker);
         }
         pthread_mutex_unlock(&tp->mutexWorker);
-        workitem = tp->getWorkItem();
+        if (tp->retire()) {
+            // The number of threads has been reduced.
+            pthread_detach(pthread_self());
+            pthread_exit(NULL);
+        }
+        workitem = tp->getWorkItem(&priority);
         if (workitem != NULL) {
+            __atomic_add_fetch(&tp->busy, 1, __ATOMIC_RELAXED);
             if (tp->workRoutine) {
                 (*tp->workRoutine)(workitem);
             }
+            __atomic_sub_fetch(&tp->busy, 1, __ATOMIC_RELAXED);
+            if (priority == IDLE) {
+                tp->releaseIdle();
+            }
         } else if (tp->isStopping()) {
             break;
         }
@@ -205,6 +410,7 @@ ThreadPool::~ThreadPool() {
     pthread_cond_destroy(&cond);
     pthread_mutex_destroy(&mutexWorkItem);
     pthread_mutex_destroy(&mutexWorker);
+    pthread_mutex_destroy(&mutexTarget);
     pthread_mutex_destroy(&mutexThread);
     return;
 }
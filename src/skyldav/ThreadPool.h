@@ -31,6 +31,19 @@
  *
  * A number of threads is created to perform tasks. Tasks are stored in a queue.
  * When a thread becomes available it completes a new task from the queue.
+ *
+ * Tasks with priority IDLE are kept in a separate queue. They are only
+ * started when no task with priority DEMAND is waiting, and on at most
+ * (n - 1) / 2 of n threads, so that most threads are left for DEMAND tasks.
+ * One IDLE task may always run while no DEMAND task is waiting, so that
+ * IDLE tasks make progress with one or two threads.
+ * Tasks with priority QUICK are DEMAND tasks expected to complete quickly.
+ * They are kept in a separate queue and started before the other DEMAND
+ * tasks, but a DEMAND task is started after every four QUICK tasks, so that
+ * a stream of QUICK tasks cannot starve DEMAND tasks.
+ * When the pool is stopping all remaining tasks are completed.
+ * The number of threads can be changed while the pool is running. Surplus
+ * threads exit after completing their current task.
  */
 class ThreadPool {
 public:
@@ -39,23 +52,91 @@ public:
         STOPPING
     };
 
+    /**
+     * @brief Priority of a work item.
+     */
+    enum Priority {
+        /**
+         * @brief Work somebody is waiting for.
+         */
+        DEMAND = 0,
+        /**
+         * @brief Speculative work using spare capacity.
+         */
+        IDLE = 1,
+        /**
+         * @brief Short work somebody is waiting for.
+         */
+        QUICK = 2
+    };
+
     ThreadPool(int nThreads, void* (*workRoutine) (void *));
-    void add(void *workItem);
-    void *getWorkItem();
+    void add(void *workItem, enum Priority priority = DEMAND);
+    int getBusyCount();
+    int getMaxIdle();
+    void *getWorkItem(enum Priority *priority);
+    long getIdleWorklistSize();
     long getWorklistSize();
+    int setThreadCount(int nThreads);
     virtual ~ThreadPool();
 private:
     enum status status;
     int createThread(const char *);
     void exitThread(void *retval);
+    int hasWork();
+    int isIdleAllowed();
     int isStopping() const;
+    int isSurplus();
+    void releaseIdle();
+    int retire();
+    void updateSizes();
     pthread_cond_t cond;
     static void *worker (void *);
     pthread_mutex_t mutexThread;
+    /**
+     * @brief Mutex serialising changes of the number of threads.
+     */
+    pthread_mutex_t mutexTarget;
     pthread_mutex_t mutexWorker;
     pthread_mutex_t mutexWorkItem;
     int thread_count;
+    /**
+     * @brief Number of threads requested.
+     */
+    int target;
+    /**
+     * @brief Number of threads created, used for naming them.
+     */
+    int created;
+    /**
+     * @brief Number of threads working on IDLE items.
+     */
+    int idle_busy;
+    /**
+     * @brief Number of threads working on any item.
+     */
+    int busy;
+    /**
+     * @brief Number of QUICK items started since the last DEMAND item.
+     */
+    int quickRun;
+    /**
+     * @brief Size of worklist, readable without locking.
+     */
+    long size;
+    /**
+     * @brief Size of idlelist, readable without locking.
+     */
+    long idleSize;
     std::deque<void *> worklist;
+    /**
+     * @brief Work items with priority QUICK.
+     */
+    std::deque<void *> quicklist;
+    /**
+     * @brief Work items with priority IDLE.
+     */
+    std::deque<void *> idlelist;
     void* (*workRoutine) (void *);
 };
 
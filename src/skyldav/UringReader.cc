@@ -0,0 +1,366 @@
+/*
+ * File:   UringReader.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file UringReader.cc
+ * @brief Reads files into buffers with io_uring.
+ */
+#include "config.h"
+#include <errno.h>
+#include <iomanip>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include "Messaging.h"
+#include "UringReader.h"
+
+/**
+ * @brief Alignment of the buffers.
+ */
+#define SKYLD_URING_ALIGN 4096
+
+/**
+ * @brief Creates the reader and starts the completion thread.
+ *
+ * @param buffers maximum number of buffers, which is the maximum number of
+ * reads in flight
+ * @param bufferSize size of the buffers, larger files cannot be read
+ * @param callback callback for completely read files
+ */
+UringReader::UringReader(const unsigned int buffers, const size_t bufferSize,
+                         Callback callback) {
+#ifdef HAVE_LIBURING
+    char errbuf[256];
+    int ret;
+
+    this->bufferSize = bufferSize;
+    this->callback = callback;
+    maxBuffers = buffers;
+    allocated = 0;
+    inFlight = 0;
+    stopping = 0;
+    files = 0;
+    bytes = 0;
+    readTime = 0;
+    failures = 0;
+
+    ring = new struct io_uring;
+    // Each buffer has at most one read in flight.
+    ret = io_uring_queue_init(buffers + 1, ring, 0);
+    if (ret < 0) {
+        std::stringstream msg;
+        msg << "io_uring not available: "
+            << strerror_r(-ret, errbuf, sizeof (errbuf));
+        Messaging::message(Messaging::WARNING, msg.str());
+        delete ring;
+        throw FAILURE;
+    }
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    ret = pthread_create(&thread, NULL, run, (void *) this);
+    if (ret) {
+        std::stringstream msg;
+        msg << "Failure starting io_uring completion thread: "
+            << strerror_r(ret, errbuf, sizeof (errbuf));
+        Messaging::message(Messaging::ERROR, msg.str());
+        io_uring_queue_exit(ring);
+        delete ring;
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+        throw FAILURE;
+    }
+#else
+    Messaging::message(Messaging::WARNING,
+                       "Compiled without io_uring support.");
+    throw FAILURE;
+#endif
+}
+
+/**
+ * @brief Completes a read and passes the file to the callback.
+ *
+ * @param r read
+ * @param failed reading failed
+ */
+void UringReader::complete(struct Read *r, const int failed) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&mutex);
+    files++;
+    bytes += r->done;
+    readTime += (now.tv_sec - r->submitted.tv_sec) * 1000000000LL
+                + now.tv_nsec - r->submitted.tv_nsec;
+    if (failed) {
+        failures++;
+    }
+    pthread_mutex_unlock(&mutex);
+    if (failed) {
+        release(r->data);
+        callback(r->item, NULL, 0);
+    } else {
+        callback(r->item, r->data, r->done);
+    }
+    delete r;
+}
+
+/**
+ * @brief Returns a buffer to the pool.
+ *
+ * @param data buffer passed to the callback
+ */
+void UringReader::release(char *data) {
+    pthread_mutex_lock(&mutex);
+    freeBuffers.push_back(data);
+    startPending();
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief Completion thread.
+ *
+ * @param reader reader
+ * @return NULL
+ */
+void *UringReader::run(void *reader) {
+#ifdef HAVE_LIBURING
+    UringReader *ur = (UringReader *) reader;
+
+    for (;;) {
+        struct io_uring_cqe *cqe;
+        struct Read *r;
+        int res;
+        int ret;
+
+        ret = io_uring_wait_cqe(ur->ring, &cqe);
+        if (ret == -EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            char errbuf[256];
+            std::stringstream msg;
+            msg << "io_uring_wait_cqe: "
+                << strerror_r(-ret, errbuf, sizeof (errbuf));
+            Messaging::message(Messaging::ERROR, msg.str());
+            break;
+        }
+        r = (struct Read *) io_uring_cqe_get_data(cqe);
+        res = cqe->res;
+        io_uring_cqe_seen(ur->ring, cqe);
+        if (r == NULL) {
+            // Woken up for stopping.
+            break;
+        }
+        pthread_mutex_lock(&ur->mutex);
+        ur->inFlight--;
+        if (res > 0) {
+            r->done += res;
+            if (r->done < r->size && ur->startRead(r) == 0) {
+                // Continue a short read.
+                pthread_mutex_unlock(&ur->mutex);
+                continue;
+            }
+        }
+        pthread_mutex_unlock(&ur->mutex);
+        // res == 0 signals the end of a file truncated meanwhile.
+        ur->complete(r, res < 0 || (res > 0 && r->done < r->size));
+        pthread_mutex_lock(&ur->mutex);
+        if (ur->inFlight == 0) {
+            pthread_cond_broadcast(&ur->cond);
+        }
+        pthread_mutex_unlock(&ur->mutex);
+    }
+#endif
+    return NULL;
+}
+
+/**
+ * @brief Submits the read of the remaining part of a file.
+ *
+ * The caller must hold the mutex.
+ *
+ * @param r read
+ * @return success = 0
+ */
+int UringReader::startRead(struct Read *r) {
+#ifdef HAVE_LIBURING
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe(ring);
+    if (sqe == NULL) {
+        return 1;
+    }
+    io_uring_prep_read(sqe, r->fd, r->data + r->done, r->size - r->done,
+                       r->done);
+    io_uring_sqe_set_data(sqe, r);
+    if (io_uring_submit(ring) < 0) {
+        return 1;
+    }
+    inFlight++;
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * @brief Starts pending reads for which buffers are available.
+ *
+ * Pending reads which cannot be started are passed to the callback as
+ * failed. The caller must hold the mutex, which is released while calling
+ * the callback.
+ */
+void UringReader::startPending() {
+    while (!pending.empty()) {
+        struct Read *r = pending.front();
+
+        if (!freeBuffers.empty()) {
+            r->data = freeBuffers.back();
+            freeBuffers.pop_back();
+        } else if (allocated < maxBuffers) {
+            void *p;
+
+            if (posix_memalign(&p, SKYLD_URING_ALIGN, bufferSize)) {
+                r->data = NULL;
+            } else {
+                allocated++;
+                r->data = (char *) p;
+            }
+        } else {
+            break;
+        }
+        pending.pop_front();
+        if (r->data == NULL || startRead(r)) {
+            failures++;
+            if (r->data != NULL) {
+                freeBuffers.push_back(r->data);
+            }
+            pthread_mutex_unlock(&mutex);
+            callback(r->item, NULL, 0);
+            delete r;
+            pthread_mutex_lock(&mutex);
+        }
+    }
+}
+
+/**
+ * @brief Stops accepting files and waits for the reads in flight.
+ *
+ * Files waiting for a buffer are passed to the callback as failed, so that
+ * the scanning threads read them. Buffers may still be released after
+ * stopping.
+ */
+void UringReader::stop() {
+#ifdef HAVE_LIBURING
+    std::deque<struct Read *> cancelled;
+    struct io_uring_sqe *sqe;
+
+    pthread_mutex_lock(&mutex);
+    stopping = 1;
+    cancelled.swap(pending);
+    pthread_mutex_unlock(&mutex);
+    while (!cancelled.empty()) {
+        struct Read *r = cancelled.front();
+
+        cancelled.pop_front();
+        callback(r->item, NULL, 0);
+        delete r;
+    }
+    pthread_mutex_lock(&mutex);
+    while (inFlight) {
+        pthread_cond_wait(&cond, &mutex);
+    }
+    // Wake up the completion thread.
+    sqe = io_uring_get_sqe(ring);
+    if (sqe != NULL) {
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, NULL);
+        io_uring_submit(ring);
+    } else {
+        pthread_cancel(thread);
+    }
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+#endif
+}
+
+/**
+ * @brief Submits a file for reading.
+ *
+ * @param fd file descriptor, must stay open until the callback is called
+ * @param size size of the file
+ * @param item item passed to the callback
+ * @return 0 if submitted, 1 if the file has to be read by the caller
+ */
+int UringReader::submit(const int fd, const off_t size, void *item) {
+    struct Read *r;
+
+    if (size <= 0 || (unsigned long long) size > bufferSize) {
+        return 1;
+    }
+    r = new struct Read;
+    r->fd = fd;
+    r->size = size;
+    r->done = 0;
+    r->data = NULL;
+    r->item = item;
+    clock_gettime(CLOCK_MONOTONIC, &r->submitted);
+    pthread_mutex_lock(&mutex);
+    if (stopping) {
+        pthread_mutex_unlock(&mutex);
+        delete r;
+        return 1;
+    }
+    pending.push_back(r);
+    startPending();
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+/**
+ * @brief Reports the statistics and frees the buffers.
+ *
+ * All buffers must have been released.
+ */
+UringReader::~UringReader() {
+#ifdef HAVE_LIBURING
+    std::vector<char *>::iterator it;
+
+    if (!stopping) {
+        stop();
+    }
+    if (files) {
+        std::stringstream msg;
+        msg << "Files read with io_uring " << files << ", " << bytes / 1048576
+            << " MiB, average read time " << std::fixed
+            << std::setprecision(2) << readTime / 1000000. / files
+            << " ms, failures " << failures << ".";
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+    for (it = freeBuffers.begin(); it != freeBuffers.end(); ++it) {
+        free(*it);
+    }
+    io_uring_queue_exit(ring);
+    delete ring;
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+#endif
+}
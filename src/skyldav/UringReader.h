@@ -0,0 +1,182 @@
+/*
+ * File:   UringReader.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file UringReader.h
+ * @brief Reads files into buffers with io_uring.
+ */
+#ifndef URINGREADER_H
+#define	URINGREADER_H
+
+#include <deque>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include <vector>
+
+struct io_uring;
+
+/**
+ * @brief Reads files into buffers with io_uring.
+ *
+ * Files are read completely into buffers taken from a pool with many reads
+ * in flight. A completion thread passes each read file to a callback, which
+ * typically queues it for scanning. The buffer must be released after use.
+ * Files waiting for a free buffer are read in the order of submission.
+ *
+ * If io_uring is not available, the constructor throws FAILURE and files
+ * have to be read by the scanning threads.
+ */
+class UringReader {
+public:
+
+    /**
+     * @brief Status of the reader.
+     */
+    enum Status {
+        /**
+         * @brief io_uring is not available.
+         */
+        FAILURE = 1
+    };
+
+    /**
+     * @brief Callback for a completely read file.
+     *
+     * @param item item passed to submit()
+     * @param data content of the file, NULL if reading failed
+     * @param size size of the content
+     */
+    typedef void (*Callback)(void *item, char *data, size_t size);
+
+    UringReader(const unsigned int buffers, const size_t bufferSize,
+                Callback callback);
+    void release(char *data);
+    void stop();
+    int submit(const int fd, const off_t size, void *item);
+    virtual ~UringReader();
+private:
+
+    /**
+     * @brief Read of a file.
+     */
+    struct Read {
+        /**
+         * @brief File descriptor.
+         */
+        int fd;
+        /**
+         * @brief Size of the file.
+         */
+        size_t size;
+        /**
+         * @brief Number of bytes read.
+         */
+        size_t done;
+        /**
+         * @brief Buffer.
+         */
+        char *data;
+        /**
+         * @brief Item passed to the callback.
+         */
+        void *item;
+        /**
+         * @brief Time of submission (CLOCK_MONOTONIC).
+         */
+        struct timespec submitted;
+    };
+
+    /**
+     * @brief io_uring instance.
+     */
+    struct io_uring *ring;
+    /**
+     * @brief Size of the buffers.
+     */
+    size_t bufferSize;
+    /**
+     * @brief Maximum number of buffers.
+     */
+    unsigned int maxBuffers;
+    /**
+     * @brief Number of buffers allocated.
+     */
+    unsigned int allocated;
+    /**
+     * @brief Buffers not in use.
+     */
+    std::vector<char *> freeBuffers;
+    /**
+     * @brief Reads waiting for a free buffer.
+     */
+    std::deque<struct Read *> pending;
+    /**
+     * @brief Number of reads in flight.
+     */
+    unsigned int inFlight;
+    /**
+     * @brief The reader is stopping.
+     */
+    int stopping;
+    /**
+     * @brief Callback for completely read files.
+     */
+    Callback callback;
+    /**
+     * @brief Completion thread.
+     */
+    pthread_t thread;
+    /**
+     * @brief Mutex for the buffers, the pending reads and the submission
+     * queue.
+     */
+    pthread_mutex_t mutex;
+    /**
+     * @brief Signals the completion of all reads in flight.
+     */
+    pthread_cond_t cond;
+    /**
+     * @brief Number of files read.
+     */
+    unsigned long long files;
+    /**
+     * @brief Number of bytes read.
+     */
+    unsigned long long bytes;
+    /**
+     * @brief Sum of the times from submission to completion in
+     * nanoseconds.
+     */
+    long long readTime;
+    /**
+     * @brief Number of failed reads.
+     */
+    unsigned long long failures;
+
+    void complete(struct Read *, const int failed);
+    int startRead(struct Read *);
+    void startPending();
+    static void *run(void *);
+
+    // Do not allow copying.
+    UringReader(const UringReader&);
+};
+
+#endif	/* URINGREADER_H */
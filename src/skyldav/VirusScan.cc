@@ -22,142 +22,259 @@
  */
 #include <cstring>
 #include <ctime>
+#include <errno.h>
+#include <fcntl.h>
+#include <iomanip>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <sstream>
 #include <stdio.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <syslog.h>
 #include "unistd.h"
+#include "BlocklistEngine.h"
+#include "ClamavEngine.h"
 #include "VirusScan.h"
 #include "Messaging.h"
 
 /**
- * @brief Initializes virus scan engine.
+ * @brief Time in milliseconds without further changes of the database
+ * directory before the database is reloaded.
  */
-VirusScan::VirusScan(Environment * e) {
-    int ret;
+#define SKYLD_DB_DEBOUNCE 2000
+
+/**
+ * @brief Interval in milliseconds for checking the database directory if
+ * inotify is not available.
+ */
+#define SKYLD_DB_POLL 60000
+
+/**
+ * @brief Interval in milliseconds for checking the database directory in
+ * addition to inotify.
+ */
+#define SKYLD_DB_POLL_INOTIFY 600000
+
+/**
+ * @brief Minimum size of files scanned through a memory mapping. Smaller
+ * files are read more cheaply via the file descriptor.
+ */
+#define SKYLD_MMAP_MIN 1048576
+
+/**
+ * @brief Nice value of the update thread when reloading in the background.
+ */
+#define SKYLD_RELOAD_NICE 10
+
+/**
+ * @brief Prefix of the heuristic match reported when scan limits are
+ * exceeded.
+ */
+#define SKYLD_LIMITS_EXCEEDED "Heuristics.Limits.Exceeded"
+
+/**
+ * @brief Prefix of heuristic matches.
+ */
+#define SKYLD_HEURISTICS "Heuristics."
+
+/**
+ * @brief Initializes the scan engines.
+ *
+ * If blocklists are configured, the blocklist engine is chained in front
+ * of ClamAV. If a clamd socket is configured, files are scanned by clamd and
+ * the ClamAV database is only loaded while clamd is not available.
+ *
+ * @param e environment
+ * @param background load the databases in the update thread instead of
+ * waiting for them, see isReady()
+ */
+VirusScan::VirusScan(Environment * e, const int background) {
+    std::vector<ScanEngine *>::iterator it;
 
     env = e;
     status = RUNNING;
-    engineRefCount = 0;
-    pthread_mutex_init(&mutexEngine, NULL);
-    pthread_mutex_init(&mutexUpdate, NULL);
+    ready = 0;
+    pthread_mutex_init(&mutexReady, NULL);
+    pthread_cond_init(&condReady, NULL);
 
-    ret = cl_init(CL_INIT_DEFAULT);
-    if (ret != CL_SUCCESS) {
-        std::stringstream msg;
-        msg << "cl_init() error: " << cl_strerror(ret);
-        Messaging::message(Messaging::ERROR, msg.str());
+    try {
+        clamav = new ClamavEngine(env);
+    } catch (ScanEngine::Status& ex) {
         throw SCANERROR;
     }
+    if (!env->getHashBlocklists()->empty()) {
+        engines.push_back(new BlocklistEngine(env));
+    }
+    clamd = NULL;
+    failoverPending = 0;
+    if (!env->getClamdSocket().empty()) {
+        clamd = new ClamdEngine(env);
+        engines.push_back(clamd);
+    }
+    engines.push_back(clamav);
 
-    // Create virus scan engine.
-    engine = createEngine();
-    // Initialize monitoring of pattern update.
-    dbstat_clear();
+    // Load the databases.
+    if (!background) {
+        for (it = engines.begin(); it != engines.end(); ++it) {
+            if (*it == clamav && isClamdActive()) {
+                continue;
+            }
+            if ((*it)->load() && *it == clamav) {
+                deleteEngines();
+                throw SCANERROR;
+            }
+        }
+        ready = 1;
+    }
+    // Initialize monitoring of database updates.
+    inotifyFd = -1;
+    if (pipe2(stopPipe, O_CLOEXEC | O_NONBLOCK)) {
+        Messaging::error("Cannot create pipe");
+        deleteEngines();
+        throw SCANERROR;
+    }
+    watchDatabase();
+    // Databases are destroyed by the update thread, not by scans.
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        (*it)->setReleaseHandler(notifyRelease, this);
+    }
 
     if (createThread()) {
         Messaging::message(Messaging::ERROR, "Cannot create thread.");
-        cl_engine_free(engine);
+        deleteEngines();
         throw SCANERROR;
     }
 }
 
 /**
- * @brief Creates a new virus scan engine.
+ * @brief Checks if loading the virus database at startup has been completed.
  *
- * @return virus scan engine
+ * @return 1 if completed
  */
-struct cl_engine *VirusScan::createEngine() {
+int VirusScan::isReady() {
     int ret;
-    unsigned int sigs;
-    cl_engine *e;
-
-    Messaging::message(Messaging::DEBUG, "Loading virus database");
-    e = cl_engine_new();
-    if (e == NULL) {
-        Messaging::message(Messaging::ERROR,
-                           "Can't create new virus scan engine.");
-        throw SCANERROR;
+
+    pthread_mutex_lock(&mutexReady);
+    ret = ready;
+    pthread_mutex_unlock(&mutexReady);
+    return ret;
+}
+
+/**
+ * @brief Deletes the scan engines.
+ */
+void VirusScan::deleteEngines() {
+    std::vector<ScanEngine *>::iterator it;
+
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        delete *it;
     }
-    // sigs must be zero before calling cl_load.
-    sigs = 0;
-    ret = cl_load(cl_retdbdir(), e, &sigs, CL_DB_STDOPT);
-    if (ret != CL_SUCCESS) {
-        std::stringstream msg;
-        msg << "cl_retdbdir() error: " << cl_strerror(ret);
-        Messaging::message(Messaging::ERROR, msg.str());
-        cl_engine_free(e);
-        throw SCANERROR;
-    } else {
-        std::stringstream msg;
-        msg << sigs << "  signatures loaded";
-        Messaging::message(Messaging::DEBUG, msg.str());
+    engines.clear();
+}
+
+/**
+ * @brief Loads the ClamAV database because clamd is not available.
+ *
+ * Until the database is loaded, files are not scanned.
+ */
+void VirusScan::failover() {
+    if (!clamav->isLoaded()) {
+        Messaging::message(Messaging::WARNING,
+                           "clamd is not available, loading the ClamAV "
+                           "database.");
+        if (clamav->load()) {
+            Messaging::message(Messaging::ERROR,
+                               "No virus database loaded, files are not "
+                               "scanned.");
+        }
     }
-    if ((ret = cl_engine_compile(e)) != CL_SUCCESS) {
-        std::stringstream msg;
-        msg << "cl_engine_compile() error: " << cl_strerror(ret);
-        Messaging::message(Messaging::ERROR, msg.str());
-        cl_engine_free(e);
-        throw SCANERROR;
+    pthread_mutex_lock(&mutexReady);
+    failoverPending = 0;
+    pthread_mutex_unlock(&mutexReady);
+}
+
+/**
+ * @brief Checks if files are scanned by clamd instead of ClamAV.
+ *
+ * @return 1 if clamd is configured and answers
+ */
+int VirusScan::isClamdActive() {
+    if (clamd == NULL || !clamd->isAvailable()) {
+        return 0;
     }
-    do {
-        int err;
-        time_t db_time;
-        uint version;
-        std::stringstream msg;
-        char buffer[80];
-        struct tm *timeinfo;
-        version = (uint) cl_engine_get_num(e, CL_ENGINE_DB_VERSION, &err);
-        if (err != CL_SUCCESS) {
-            break;
-        }
-        db_time = (time_t) cl_engine_get_num(e, CL_ENGINE_DB_TIME, &err);
-        if (err != CL_SUCCESS) {
-            break;
-        }
-        timeinfo = gmtime(&db_time);
-        strftime(buffer, sizeof (buffer), "%F %T UTC", timeinfo);
-        msg << "ClamAV database version " << version << ", " << buffer;
-        Messaging::message(Messaging::INFORMATION, msg.str());
-    } while (0);
-    return e;
+    Messaging::message(Messaging::INFORMATION,
+                       "Files are scanned by clamd, the ClamAV database is "
+                       "not loaded.");
+    return 1;
 }
 
 /**
- * Destroys virus scan engine.
- * @param e virus scan engine
+ * @brief Loads the databases at startup in the update thread.
+ *
+ * Waiting threads are woken up even if loading fails. Files are then not
+ * scanned until an updated database can be loaded.
  */
-void VirusScan::destroyEngine(cl_engine * e) {
-    int ret;
-    ret = cl_engine_free(e);
-    if (ret != 0) {
+void VirusScan::loadEngines() {
+    std::vector<ScanEngine *>::iterator it;
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        if (*it == clamav && isClamdActive()) {
+            continue;
+        }
+        if ((*it)->load() && *it == clamav) {
+            Messaging::message(Messaging::ERROR,
+                               "No virus database loaded, files are not "
+                               "scanned.");
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_mutex_lock(&mutexReady);
+    ready = 1;
+    pthread_cond_broadcast(&condReady);
+    pthread_mutex_unlock(&mutexReady);
+
+    if (clamav->isLoaded()) {
         std::stringstream msg;
-        msg << "cl_engine_free() error: " << cl_strerror(ret);
-        Messaging::message(Messaging::ERROR, msg.str());
-        throw SCANERROR;
+        msg << "Virus database loaded in " << std::fixed
+            << std::setprecision(1) << (end.tv_sec - start.tv_sec)
+            + (end.tv_nsec - start.tv_nsec) / 1000000000. << " s.";
+        Messaging::message(Messaging::INFORMATION, msg.str());
     }
 }
 
 /**
- * @brief Gets reference to virus scan engine.
+ * @brief Gets the version of the databases in use.
  *
- * @return scan engine
+ * The versions of the databases are combined, so that a change of any of
+ * them invalidates a saved scan cache.
+ *
+ * @return database version, 0 if unknown
  */
-struct cl_engine * VirusScan::getEngine() {
-    struct cl_engine *ret = NULL;
-
-    // Wait for update to complete
-    pthread_mutex_lock(&mutexUpdate);
-    pthread_mutex_lock(&mutexEngine);
+unsigned int VirusScan::getDatabaseVersion() {
+    std::vector<ScanEngine *>::iterator it;
+    unsigned int version = 0;
 
-    ret = engine;
-    // Increase reference count.
-    engineRefCount++;
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        version ^= (*it)->getVersion();
+    }
+    return version;
+}
 
-    pthread_mutex_unlock(&mutexEngine);
-    pthread_mutex_unlock(&mutexUpdate);
-    return ret;
+/**
+ * @brief Gets the scan engines in the order of scanning.
+ *
+ * @return scan engines
+ */
+const std::vector<ScanEngine *> &VirusScan::getEngines() {
+    return engines;
 }
 
 /**
@@ -178,32 +295,23 @@ int VirusScan::createThread() {
 }
 
 /**
- * @brief Checks if database has changed.
- * @returned 0 = unchanged, 1 = changed
+ * @brief Classifies a match reported by a scan engine.
+ *
+ * Only the alert for exceeded scan limits is requested from ClamAV. Other
+ * heuristic alerts, e.g. reported by clamd, do not deny access.
+ *
+ * @param name name of the virus or of the heuristic match
+ * @return kind of match
  */
-int VirusScan::dbstat_check() {
-    int ret = 0;
-    if (cl_statchkdir(&dbstat) == 1) {
-        ret = 1;
-        cl_statfree(&dbstat);
-        cl_statinidir(cl_retdbdir(), &dbstat);
+enum VirusScan::Match VirusScan::classifyMatch(const std::string &name) {
+    if (!name.compare(0, strlen(SKYLD_LIMITS_EXCEEDED),
+                      SKYLD_LIMITS_EXCEEDED)) {
+        return MATCH_LIMITS;
     }
-    return ret;
-}
-
-/**
- * @brief Clears database status.
- */
-void VirusScan::dbstat_clear() {
-    memset(&dbstat, 0, sizeof (struct cl_stat));
-    cl_statinidir(cl_retdbdir(), &dbstat);
-}
-
-/**
- * @brief Frees database status.
- */
-void VirusScan::dbstat_free() {
-    cl_statfree(&dbstat);
+    if (!name.compare(0, strlen(SKYLD_HEURISTICS), SKYLD_HEURISTICS)) {
+        return MATCH_HEURISTIC;
+    }
+    return MATCH_VIRUS;
 }
 
 /**
@@ -228,129 +336,504 @@ void VirusScan::log_virus_found(const int fd, const char *virname) {
 }
 
 /**
- * Decreases the viurs engine reference count.
+ * @brief Writes a log entry for a heuristic match that is not acted upon.
+ *
+ * @param fd file descriptor
+ * @param name name of the heuristic match
  */
-void VirusScan::releaseEngine() {
-    pthread_mutex_lock(&mutexEngine);
-    engineRefCount--;
-    pthread_mutex_unlock(&mutexEngine);
+void VirusScan::log_heuristic(const int fd, const char *name) {
+    int path_len;
+    char path[PATH_MAX + 1];
+    std::stringstream msg;
+
+    snprintf(path, sizeof (path), "/proc/self/fd/%d", fd);
+    path_len = readlink(path, path, sizeof (path) - 1);
+    if (path_len < 0) {
+        path_len = 0;
+    }
+    path[path_len] = '\0';
+    msg << "Heuristic match \"" << name << "\" ignored for file \"" << path
+        << "\".";
+    Messaging::message(Messaging::INFORMATION, msg.str());
+}
+
+/**
+ * @brief Writes a debug log entry for a file exceeding the scan limits.
+ *
+ * @param fd file descriptor
+ * @param name name of the heuristic match
+ * @param profile scan profile
+ */
+void VirusScan::log_limits_exceeded(const int fd, const char *name,
+                                    ScanProfile *profile) {
+    int path_len;
+    char path[PATH_MAX + 1];
+    std::stringstream msg;
+
+    snprintf(path, sizeof (path), "/proc/self/fd/%d", fd);
+    path_len = readlink(path, path, sizeof (path) - 1);
+    if (path_len < 0) {
+        path_len = 0;
+    }
+    path[path_len] = '\0';
+    msg << "Scan limits exceeded for file \"" << path << "\" (" << name
+        << ", profile " << profile->getName() << ").";
+    Messaging::message(Messaging::DEBUG, msg.str());
 }
 
 /**
  * @brief Scans file for virus.
  *
- * @return success
+ * The file is classified by the prefilter first. Depending on the class it
+ * is skipped, scanned with the profile of the class, or scanned with the
+ * profile selected by the rules.
+ *
+ * If the content of the file is passed, it is classified and scanned from
+ * memory. With SCAN_IO mmap large files are mapped once and both classified
+ * and scanned from the mapping.
+ *
+ * If a partial scan is allowed and configured for the file, only the head
+ * and the tail of the file are scanned.
+ *
+ * @param fd file descriptor
+ * @param data content of the file, NULL to read the file here
+ * @param size size of the content
+ * @param partial a partial scan is allowed
+ * @return SCANOK, SCANVIRUS, SCANPARTIAL if only parts of the file were
+ * scanned, or SCANSKIPPED if no database is loaded or the scan failed
  */
-int VirusScan::scan(const int fd) {
+int VirusScan::scan(const int fd, const char *data, const size_t size,
+                    const int partial) {
     int success = SCANOK;
-    int ret;
-    const char *virname;
-    struct cl_scan_options options = {
-        .parse = ~0U,
-    };
+    int ret = ScanEngine::NONE;
+    int unavailable = 0;
+    std::string virname;
+    std::vector<ScanEngine *>::iterator it;
+    ScanProfile *profile;
+    int limitsExceeded = 0;
+    char buf[SKYLD_PREFILTER_HEAD];
+    const char *head = buf;
+    ssize_t len;
+    struct stat statbuf;
+    enum Prefilter::Class cls;
+    enum Prefilter::Action action;
+    struct timespec start;
+    struct timespec end;
+    FileMap *map = NULL;
+    struct ScanJob job;
+
+    if (data != NULL) {
+        statbuf.st_size = size;
+    } else if (fstat(fd, &statbuf)) {
+        statbuf.st_size = 0;
+    }
+    if (data == NULL && env->getScanIo() == Environment::SCAN_IO_MMAP
+            && statbuf.st_size >= SKYLD_MMAP_MIN) {
+        try {
+            map = new FileMap(fd, statbuf.st_size);
+            data = map->getData();
+        } catch (FileMap::Status e) {
+            map = NULL;
+        }
+    }
+
+    // Classify the file by its leading bytes.
+    if (data != NULL) {
+        head = data;
+        len = statbuf.st_size < (off_t) sizeof (buf)
+              ? statbuf.st_size : sizeof (buf);
+    } else {
+        len = pread(fd, buf, sizeof (buf), 0);
+    }
+    cls = Prefilter::classify(head, len > 0 ? len : 0);
+    action = env->getPrefilter()->getAction(cls, &profile);
+    if (action == Prefilter::SKIP) {
+        env->getPrefilter()->count(cls, action, statbuf.st_size, 0);
+        delete map;
+        return SCANOK;
+    }
+    if (profile == NULL) {
+        profile = env->getScanProfiles()->select(fd);
+    }
+    job.fd = fd;
+    job.data = data;
+    job.size = statbuf.st_size;
+    job.map = map;
+    job.profile = profile;
+    job.partial = partial && isPartial(fd, cls, statbuf.st_size);
 
-    ret = cl_scandesc(fd, NULL, &virname, NULL, getEngine(), &options);
+    // The first engine giving a verdict decides.
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        ret = (*it)->scan(&job, virname);
+        if (ret == ScanEngine::UNAVAILABLE) {
+            unavailable = 1;
+            if (*it == clamav && clamd != NULL) {
+                // clamd has failed and ClamAV is on standby.
+                requestFailover();
+            }
+        } else if (ret != ScanEngine::NONE) {
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    delete map;
     switch (ret) {
-        case CL_CLEAN:
+        case ScanEngine::CLEAN:
             success = SCANOK;
             break;
-        case CL_VIRUS:
-            log_virus_found(fd, virname);
-            success = SCANVIRUS;
+        case ScanEngine::VIRUS:
+            switch (classifyMatch(virname)) {
+                case MATCH_LIMITS:
+                    // The part of the file scanned is clean.
+                    limitsExceeded = 1;
+                    log_limits_exceeded(fd, virname.c_str(), profile);
+                    success = SCANOK;
+                    break;
+                case MATCH_HEURISTIC:
+                    log_heuristic(fd, virname.c_str());
+                    success = SCANOK;
+                    break;
+                default:
+                    log_virus_found(fd, virname.c_str());
+                    success = SCANVIRUS;
+            }
             break;
+        case ScanEngine::FAILED:
+            // Scan the file again on its next access.
+            return SCANSKIPPED;
         default:
-            std::stringstream msg;
-            msg << "cl_scandesc() error: " << cl_strerror(ret);
-            Messaging::message(Messaging::ERROR, msg.str());
+            if (unavailable) {
+                // A database is not loaded yet or loading failed.
+                return SCANSKIPPED;
+            }
             success = SCANOK;
             break;
     }
-    releaseEngine();
+    if (job.partial && success == SCANOK) {
+        success = SCANPARTIAL;
+    }
+    profile->count(limitsExceeded);
+    env->getPrefilter()->count(cls, action, statbuf.st_size,
+                               (end.tv_sec - start.tv_sec) * 1000000000LL
+                               + end.tv_nsec - start.tv_nsec);
     return success;
 }
 
+/**
+ * @brief Checks if a file may be scanned partially.
+ *
+ * @param fd file descriptor
+ * @param cls class of the file
+ * @param size size of the file
+ * @return 1 if a partial scan is configured for the file
+ */
+int VirusScan::isPartial(const int fd, const enum Prefilter::Class cls,
+                         const off_t size) {
+    unsigned long long minSize = env->getPartialScanSize();
+    StringSet *paths = env->getPartialScanPaths();
+
+    if (minSize == 0 || (unsigned long long) size < minSize
+            || (unsigned long long) size <= 2 * env->getPartialScanBytes()
+            || !env->getPrefilter()->isPartial(cls)) {
+        return 0;
+    }
+    if (paths->begin() != paths->end()) {
+        char link[32];
+        char buf[PATH_MAX + 1];
+        ssize_t len;
+
+        snprintf(link, sizeof (link), "/proc/self/fd/%d", fd);
+        len = readlink(link, buf, sizeof (buf) - 1);
+        if (len <= 0 || !env->isPartialScanPath(std::string(buf, len))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Loads the databases again which have changed.
+ *
+ * If any database has been updated, the scan cache is cleared if
+ * configured.
+ *
+ * The ClamAV database loaded after a failure of clamd is unloaded when
+ * clamd is available again. While on standby it is not reloaded.
+ */
+void VirusScan::reload() {
+    std::vector<ScanEngine *>::iterator it;
+    int updated = 0;
+
+    if (clamd != NULL && clamav->isLoaded() && isClamdActive()) {
+        clamav->unload();
+    }
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        if (*it == clamav && clamd != NULL && !clamav->isLoaded()) {
+            continue;
+        }
+        if ((*it)->reload(env->isReloadInPlace())) {
+            updated = 1;
+        }
+    }
+    if (updated && env->isCleanCacheOnUpdate()) {
+        env->getScanCache()->clear();
+    }
+}
+
+/**
+ * @brief Requests the update thread to load the ClamAV database.
+ *
+ * The request is only sent once until it has been served.
+ */
+void VirusScan::requestFailover() {
+    pthread_mutex_lock(&mutexReady);
+    if (!failoverPending) {
+        failoverPending = 1;
+        if (write(stopPipe[1], "f", 1) != 1) {
+            Messaging::error("Cannot wake up update thread");
+        }
+    }
+    pthread_mutex_unlock(&mutexReady);
+}
+
+/**
+ * @brief Requests the update thread to destroy the databases released by
+ * scans.
+ *
+ * @param virusScan virus scanner
+ */
+void VirusScan::notifyRelease(void *virusScan) {
+    VirusScan *vs = static_cast<VirusScan *> (virusScan);
+
+    if (write(vs->stopPipe[1], "g", 1) != 1) {
+        Messaging::error("Cannot wake up update thread");
+    }
+}
+
+/**
+ * @brief Requests the update thread to load the databases which have
+ * changed without waiting for the poll interval.
+ */
+void VirusScan::requestReload() {
+    if (write(stopPipe[1], "r", 1) != 1) {
+        Messaging::error("Cannot wake up update thread");
+    }
+}
+
 /**
  * @brief Thread to update engine.
  *
- * @param threadPool thread pool
+ * Changes of the database directory are signaled by inotify. As updates
+ * consist of several files the database is reloaded only after the
+ * directory has not changed for SKYLD_DB_DEBOUNCE ms. The directory is
+ * additionally polled in case inotify misses changes, e.g. on network file
+ * systems.
+ *
+ * The thread is woken up via the stop pipe for stopping, for loading the
+ * ClamAV database when clamd fails, for checking the databases on request,
+ * and for destroying databases released by the last scan using them.
+ *
+ * @param virusScan virus scanner
  * @return return value
  */
 void * VirusScan::updater(void *virusScan) {
-    int count = 0;
-    cl_engine *e;
-    struct timespec interval = {
-        1,
-        0
-    };
-    struct timespec interval2 = {
-        0,
-        100000
-    };
     VirusScan *vs;
+    struct pollfd fds[2];
+    nfds_t nfds = 1;
+    struct timespec now;
+    struct timespec lastCheck;
+    struct timespec lastChange;
+    int changed = 0;
+    long pollInterval;
 
     vs = static_cast<VirusScan *> (virusScan);
 
-    for (;;) {
-        if (vs->status == STOPPING) {
+    if (!vs->ready) {
+        // Load the databases at startup with normal priority.
+        vs->loadEngines();
+    }
+    if (!vs->env->isReloadInPlace()) {
+        // Load new engines without slowing down scanning.
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), SKYLD_RELOAD_NICE);
+    }
+
+    fds[0].fd = vs->stopPipe[0];
+    fds[0].events = POLLIN;
+    if (vs->inotifyFd != -1) {
+        fds[1].fd = vs->inotifyFd;
+        fds[1].events = POLLIN;
+        nfds = 2;
+        pollInterval = SKYLD_DB_POLL_INOTIFY;
+    } else {
+        pollInterval = SKYLD_DB_POLL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &lastCheck);
+
+    while (vs->status == RUNNING) {
+        long timeout;
+        long elapsed;
+        int ret;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (changed) {
+            elapsed = (now.tv_sec - lastChange.tv_sec) * 1000
+                      + (now.tv_nsec - lastChange.tv_nsec) / 1000000;
+            timeout = SKYLD_DB_DEBOUNCE - elapsed;
+        } else {
+            elapsed = (now.tv_sec - lastCheck.tv_sec) * 1000
+                      + (now.tv_nsec - lastCheck.tv_nsec) / 1000000;
+            timeout = pollInterval - elapsed;
+        }
+        if (timeout < 0) {
+            timeout = 0;
+        }
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+        ret = poll(fds, nfds, (int) timeout);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Messaging::error("Polling database directory failed");
             break;
         }
-        nanosleep(&interval, NULL);
-        count++;
-        // Every minute check for virus database updates
-        if (count >= 60) {
-            if (vs->dbstat_check()) {
-                Messaging::message(Messaging::INFORMATION,
-                                   "ClamAV database update detected.");
-                try {
-                    // Create the new engine.
-                    e = vs->createEngine();
-                    // Stop scanning.
-                    pthread_mutex_lock(&(vs->mutexUpdate));
-                    // Wait for all running scans to be finished.
-                    for (;;) {
-                        pthread_mutex_lock(&(vs->mutexEngine));
-                        if (vs->engineRefCount == 0) {
-                            break;
-                        }
-                        pthread_mutex_unlock(&(vs->mutexEngine));
-                        nanosleep(&interval2, NULL);
-                    }
-                    // Destroy the old engine
-                    vs->destroyEngine(vs->engine);
-                    vs->engine = e;
-                    if (vs->env->isCleanCacheOnUpdate()) {
-                        vs->env->getScanCache()->clear();
-                    }
-                    pthread_mutex_unlock(&(vs->mutexEngine));
-                    Messaging::message(Messaging::INFORMATION,
-                                       "Using updated ClamAV database.");
-                } catch (Status& e) {
+        if (fds[0].revents) {
+            char buf[16];
+            ssize_t len;
+            int reload = 0;
+            int failover = 0;
+            int garbage = 0;
+
+            while ((len = read(vs->stopPipe[0], buf, sizeof (buf))) > 0) {
+                reload |= memchr(buf, 'r', len) != NULL;
+                failover |= memchr(buf, 'f', len) != NULL;
+                garbage |= memchr(buf, 'g', len) != NULL;
+            }
+            if (garbage) {
+                std::vector<ScanEngine *>::iterator it;
+
+                for (it = vs->engines.begin(); it != vs->engines.end();
+                        ++it) {
+                    (*it)->collect();
                 }
-                // Allow scanning.
-                pthread_mutex_unlock(&(vs->mutexUpdate));
             }
+            if (vs->status != RUNNING) {
+                // Stop requested.
+                break;
+            }
+            if (failover) {
+                vs->failover();
+            }
+            if (reload) {
+                changed = 0;
+                clock_gettime(CLOCK_MONOTONIC, &lastCheck);
+                vs->reload();
+            }
+            continue;
+        }
+        if (nfds > 1 && fds[1].revents) {
+            char buf[4096]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+
+            // Drain the events. They are only used as a trigger.
+            while (read(vs->inotifyFd, buf, sizeof (buf)) > 0) {
+            }
+            changed = 1;
+            clock_gettime(CLOCK_MONOTONIC, &lastChange);
+            continue;
+        }
+        if (ret == 0) {
+            // Debounce period or poll interval elapsed.
+            changed = 0;
+            clock_gettime(CLOCK_MONOTONIC, &lastCheck);
+            vs->reload();
         }
     }
     vs->status = STOPPED;
     return NULL;
 }
 
+/**
+ * @brief Waits until loading the virus database at startup has been
+ * completed.
+ *
+ * @param deadline absolute time (CLOCK_REALTIME) up to which to wait,
+ * NULL = no limit
+ * @return 1 if completed
+ */
+int VirusScan::waitReady(const struct timespec *deadline) {
+    int ret;
+
+    pthread_mutex_lock(&mutexReady);
+    while (!ready) {
+        if (deadline == NULL) {
+            pthread_cond_wait(&condReady, &mutexReady);
+        } else if (pthread_cond_timedwait(&condReady, &mutexReady,
+                                          deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    ret = ready;
+    pthread_mutex_unlock(&mutexReady);
+    return ret;
+}
+
+/**
+ * @brief Watches the database directories of all engines with inotify.
+ *
+ * If a directory cannot be watched, all directories are polled.
+ *
+ * @return success = 0
+ */
+int VirusScan::watchDatabase() {
+    std::vector<std::string> dirs;
+    std::vector<std::string>::iterator dir;
+    std::vector<ScanEngine *>::iterator it;
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd == -1) {
+        Messaging::error("inotify_init1");
+        return 1;
+    }
+    for (it = engines.begin(); it != engines.end(); ++it) {
+        (*it)->getDirectories(dirs);
+    }
+    for (dir = dirs.begin(); dir != dirs.end(); ++dir) {
+        if (inotify_add_watch(inotifyFd, dir->c_str(),
+                              IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)
+                == -1) {
+            std::stringstream msg;
+            char errbuf[256];
+            msg << "Cannot watch '" << *dir << "', polling instead: "
+                << strerror_r(errno, errbuf, sizeof (errbuf));
+            Messaging::message(Messaging::WARNING, msg.str());
+            close(inotifyFd);
+            inotifyFd = -1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /**
  * @brief Deletes the virus scanner.
  */
 VirusScan::~VirusScan() {
-    struct timespec interval = {
-        0,
-        1000000
-    };
-
     status = STOPPING;
-    do {
-        nanosleep(&interval, NULL);
-    } while (status == STOPPING);
-
-    destroyEngine(engine);
-    pthread_mutex_destroy(&mutexUpdate);
-    pthread_mutex_destroy(&mutexEngine);
-    dbstat_free();
+    // Wake up the update thread.
+    if (write(stopPipe[1], "", 1) != 1) {
+        Messaging::error("Cannot stop update thread");
+    }
+    pthread_join(updateThread, NULL);
+    if (inotifyFd != -1) {
+        close(inotifyFd);
+    }
+    // The engines may still signal released databases via the pipe.
+    deleteEngines();
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+
+    pthread_cond_destroy(&condReady);
+    pthread_mutex_destroy(&mutexReady);
 }
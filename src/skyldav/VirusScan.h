@@ -23,9 +23,12 @@
 #ifndef VIRUSSCAN_H
 #define	VIRUSSCAN_H
 
-#include <clamav.h>
 #include <pthread.h>
+#include <vector>
+#include "ClamdEngine.h"
 #include "Environment.h"
+#include "ScanEngine.h"
+#include "ScanProfile.h"
 
 #ifdef	__cplusplus
 extern "C" {
@@ -33,6 +36,9 @@ extern "C" {
 
 /**
  * @brief Scans files for viruses.
+ *
+ * Files are passed to a chain of scan engines. The first engine giving a
+ * verdict decides.
  */
 
 class VirusScan {
@@ -53,7 +59,36 @@ public:
         /**
          * @brief A virus was found.
          */
-        SCANVIRUS = 1
+        SCANVIRUS = 1,
+        /**
+         * @brief The file was not scanned as no virus database is loaded,
+         * or the scan failed. The result must not be cached.
+         */
+        SCANSKIPPED = 2,
+        /**
+         * @brief No virus was found in the parts of the file scanned. The
+         * file must be scanned fully.
+         */
+        SCANPARTIAL = 3
+    };
+
+    /**
+     * @brief Kind of a match reported by a scan engine.
+     */
+    enum Match {
+        /**
+         * @brief A virus signature matched. Access is denied.
+         */
+        MATCH_VIRUS = 0,
+        /**
+         * @brief Scan limits were exceeded. The part scanned is clean.
+         */
+        MATCH_LIMITS = 1,
+        /**
+         * @brief Another heuristic alert. It is logged, but access is
+         * allowed.
+         */
+        MATCH_HEURISTIC = 2
     };
 
     enum RunStatus {
@@ -62,8 +97,15 @@ public:
         STOPPED,
     };
 
-    VirusScan(Environment *);
-    int scan(const int fd);
+    VirusScan(Environment *, const int background = 0);
+    static enum Match classifyMatch(const std::string &name);
+    unsigned int getDatabaseVersion();
+    const std::vector<ScanEngine *> &getEngines();
+    int isReady();
+    void requestReload();
+    int scan(const int fd, const char *data = NULL, const size_t size = 0,
+             const int partial = 0);
+    int waitReady(const struct timespec *deadline);
     ~VirusScan();
 private:
     /**
@@ -71,21 +113,34 @@ private:
      */
     Environment * env;
     /**
-     * @brief Struture indicating if database has changed.
+     * @brief Scan engines in the order of scanning.
      */
-    struct cl_stat dbstat;
+    std::vector<ScanEngine *> engines;
     /**
-     * @brief Reference to virus scan engine.
+     * @brief ClamAV engine, the last one in engines.
      */
-    struct cl_engine *engine;
+    ScanEngine *clamav;
     /**
-     * @brief Mutex for accessing the engine.
+     * @brief clamd engine in front of ClamAV, NULL if not configured.
      */
-    pthread_mutex_t mutexEngine;
+    ClamdEngine *clamd;
     /**
-     * @brief Mutex for accessing the engine.
+     * @brief Loading the ClamAV database has been requested because clamd
+     * is not available.
      */
-    pthread_mutex_t mutexUpdate;
+    int failoverPending;
+    /**
+     * @brief Mutex for accessing the ready flag and failoverPending.
+     */
+    pthread_mutex_t mutexReady;
+    /**
+     * @brief Signals the completion of loading the databases at startup.
+     */
+    pthread_cond_t condReady;
+    /**
+     * @brief Loading the databases at startup has been completed.
+     */
+    int ready;
     /**
      * Run status
      */
@@ -95,19 +150,30 @@ private:
      */
     pthread_t updateThread;
     /**
-     * @brief Reference count of virus scan enginge.
+     * @brief Inotify file descriptor watching the database directories,
+     * -1 if not available.
+     */
+    int inotifyFd;
+    /**
+     * @brief Pipe for waking up the update thread when stopping.
      */
-    int engineRefCount;
+    int stopPipe[2];
 
-    struct cl_engine *createEngine();
     int createThread();
-    void dbstat_clear();
-    int dbstat_check();
-    void dbstat_free();
-    void destroyEngine(cl_engine *);
-    struct cl_engine *getEngine();
-    void releaseEngine();
+    void deleteEngines();
+    void failover();
+    int isClamdActive();
+    int isPartial(const int fd, const enum Prefilter::Class,
+                  const off_t size);
+    void loadEngines();
+    void log_heuristic(const int fd, const char *name);
+    void log_limits_exceeded(const int fd, const char *name,
+                             ScanProfile *profile);
     void log_virus_found(const int fd, const char *virname);
+    void reload();
+    void requestFailover();
+    int watchDatabase();
+    static void notifyRelease(void *);
     static void *updater(void *);
 };
 #ifdef	__cplusplus
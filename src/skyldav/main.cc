@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <iostream>
+#include <pthread.h>
 #include <signal.h>
 #include <sstream>
 #include <stdio.h>
@@ -35,29 +36,29 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
 #include "conf.h"
 #include "config.h"
+#include "ControlSocket.h"
 #include "Environment.h"
 #include "FanotifyPolling.h"
 #include "Messaging.h"
+#include "OnDemandScan.h"
 #include "skyldav.h"
 #include "StringSet.h"
 
 /**
- * @brief Callback function for reading configuration file.
+ * @brief Parses a configuration entry that can be changed while files are
+ * scanned.
  *
  * @param key key value
  * @param value parameter value
- * @return success
+ * @param s settings to be changed
+ * @return success = 0, failure = 1, -1 if the key is not such a setting
  */
-static int configurationCallback(const char *key, const char *value, void *info) {
-    Environment *e = static_cast<Environment *> (info);
+static int parseSetting(const char *key, const char *value, Settings *s) {
     int ret = 0;
 
-    if (e == NULL) {
-        throw 0;
-    }
-
     if (!strcmp(key, "CACHE_MAX_SIZE")) {
         unsigned int cacheMaxSize;
 
@@ -66,46 +67,307 @@ static int configurationCallback(const char *key, const char *value, void *info)
         if (ss.fail()) {
             ret = 1;
         }
-        e->setCacheMaxSize(cacheMaxSize);
+        s->setCacheMaxSize(cacheMaxSize);
     } else if (!strcmp(key, "CLEAN_CACHE_ON_UPDATE")) {
-        int cleanCacheOnUpdate = 1;
-
         if (!strcmp(value, "yes")) {
-            e->setCleanCacheOnUpdate(1);
+            s->setCleanCacheOnUpdate(1);
         } else if (!strcmp(value, "no")) {
-            e->setCleanCacheOnUpdate(0);
+            s->setCleanCacheOnUpdate(0);
         } else {
             fprintf(stderr, "illegal value '%s' for CLEAN_CACHE_ON_UPDATE \n",
                 value);
         }
     } else if (!strcmp(key, "EXCLUDE_PATH")) {
-        std::string val = value;
-        // Append missing trailing path separator.
-        if (0 == val.length() || *(val.rbegin()++) != '/') {
-            val += "/";
+        s->addExcludePath(value);
+    } else if (!strcmp(key, "THREADS")) {
+        int nThread;
+
+        std::stringstream ss(value);
+        ss >> nThread;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        s->setNumberOfThreads(nThread);
+    } else {
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Callback function for reading configuration file.
+ *
+ * @param key key value
+ * @param value parameter value
+ * @return success
+ */
+static int configurationCallback(const char *key, const char *value, void *info) {
+    Environment *e = static_cast<Environment *> (info);
+    Settings s;
+    int ret = 0;
+
+    if (e == NULL) {
+        throw 0;
+    }
+
+    e->getSettings(s);
+    ret = parseSetting(key, value, &s);
+    if (ret != -1) {
+        e->setSettings(s);
+        return ret;
+    }
+    ret = 0;
+
+    if (!strcmp(key, "CACHE_FILE")) {
+        e->setCacheFile(value);
+    } else if (!strcmp(key, "CLAMD_CONNECTIONS")) {
+        unsigned int clamdConnections;
+
+        std::stringstream ss(value);
+        ss >> clamdConnections;
+        if (ss.fail() || clamdConnections == 0) {
+            ret = 1;
+        } else {
+            e->setClamdConnections(clamdConnections);
         }
-        e->getExcludePaths()->add(val.c_str());
+    } else if (!strcmp(key, "CLAMD_SOCKET")) {
+        e->setClamdSocket(value);
+    } else if (!strcmp(key, "CONTROL_SOCKET")) {
+        e->setControlSocket(value);
+    } else if (!strcmp(key, "ENGINE_RELOAD")) {
+        if (!strcmp(value, "background")) {
+            e->setReloadInPlace(0);
+        } else if (!strcmp(value, "inplace")) {
+            e->setReloadInPlace(1);
+        } else {
+            ret = 1;
+        }
+    } else if (!strcmp(key, "HASH_BLOCKLIST")) {
+        e->getHashBlocklists()->add(value);
+    } else if (!strcmp(key, "HOT_FILES")) {
+        e->setHotFiles(value);
+    } else if (!strcmp(key, "HOT_FILES_COUNT")) {
+        unsigned int hotFilesCount;
+
+        std::stringstream ss(value);
+        ss >> hotFilesCount;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        e->setHotFilesCount(hotFilesCount);
     } else if (!strcmp(key, "LOCAL_FS")) {
         e->getLocalFileSystems()->add(value);
+    } else if (!strcmp(key, "MAX_FILESIZE")) {
+        unsigned long long maxFileSize;
+
+        std::stringstream ss(value);
+        ss >> maxFileSize;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        e->setMaxFileSize(maxFileSize);
+    } else if (!strcmp(key, "MAX_RECURSION")) {
+        unsigned int maxRecursion;
+
+        std::stringstream ss(value);
+        ss >> maxRecursion;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        e->setMaxRecursion(maxRecursion);
+    } else if (!strcmp(key, "MAX_SCANSIZE")) {
+        unsigned long long maxScanSize;
+
+        std::stringstream ss(value);
+        ss >> maxScanSize;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        e->setMaxScanSize(maxScanSize);
+    } else if (!strcmp(key, "MAX_SCANTIME")) {
+        unsigned int maxScanTime;
+
+        std::stringstream ss(value);
+        ss >> maxScanTime;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        e->setMaxScanTime(maxScanTime);
+    } else if (!strcmp(key, "METRICS_FILE")) {
+        e->setMetricsFile(value);
+    } else if (!strcmp(key, "METRICS_SOCKET")) {
+        e->setMetricsSocket(value);
     } else if (!strcmp(key, "NOMARK_FS")) {
         e->getNoMarkFileSystems()->add(value);
     } else if (!strcmp(key, "NOMARK_MNT")) {
         e->getNoMarkMounts()->add(value);
-    } else if (!strcmp(key, "THREADS")) {
-        int nThread;
+    } else if (!strcmp(key, "PARTIAL_SCAN_BYTES")) {
+        unsigned long long partialScanBytes;
 
         std::stringstream ss(value);
-        ss >> nThread;
+        ss >> partialScanBytes;
+        if (ss.fail() || partialScanBytes == 0) {
+            ret = 1;
+        }
+        e->setPartialScanBytes(partialScanBytes);
+    } else if (!strcmp(key, "PARTIAL_SCAN_CLASS")) {
+        ret = e->getPrefilter()->setPartial(value);
+    } else if (!strcmp(key, "PARTIAL_SCAN_PATH")) {
+        std::string val = value;
+        // Append missing trailing path separator.
+        if (0 == val.length() || *(val.rbegin()++) != '/') {
+            val += "/";
+        }
+        e->getPartialScanPaths()->add(val.c_str());
+    } else if (!strcmp(key, "PARTIAL_SCAN_SIZE")) {
+        unsigned long long partialScanSize;
+
+        std::stringstream ss(value);
+        ss >> partialScanSize;
         if (ss.fail()) {
             ret = 1;
         }
-        e->setNumberOfThreads(nThread);
+        e->setPartialScanSize(partialScanSize);
+    } else if (!strcmp(key, "PREFETCH_LIBRARIES")) {
+        if (!strcmp(value, "yes")) {
+            e->setPrefetchLibraries(1);
+        } else if (!strcmp(value, "no")) {
+            e->setPrefetchLibraries(0);
+        } else {
+            ret = 1;
+        }
+    } else if (!strcmp(key, "PREFETCH_SIBLINGS")) {
+        unsigned int prefetchSiblings;
+
+        std::stringstream ss(value);
+        ss >> prefetchSiblings;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        e->setPrefetchSiblings(prefetchSiblings);
+    } else if (!strcmp(key, "READAHEAD_FILE")) {
+        unsigned long long readaheadFile;
+
+        std::stringstream ss(value);
+        ss >> readaheadFile;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        e->setReadaheadFile(readaheadFile);
+    } else if (!strcmp(key, "READAHEAD_TOTAL")) {
+        unsigned long long readaheadTotal;
+
+        std::stringstream ss(value);
+        ss >> readaheadTotal;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        e->setReadaheadTotal(readaheadTotal);
+    } else if (!strcmp(key, "SCAN_IO")) {
+        if (!strcmp(value, "read")) {
+            e->setScanIo(Environment::SCAN_IO_READ);
+        } else if (!strcmp(value, "mmap")) {
+            e->setScanIo(Environment::SCAN_IO_MMAP);
+        } else if (!strcmp(value, "uring")) {
+            e->setScanIo(Environment::SCAN_IO_URING);
+        } else {
+            ret = 1;
+        }
+    } else if (!strcmp(key, "SCAN_PROFILE")) {
+        ret = e->getScanProfiles()->addProfile(value);
+    } else if (!strcmp(key, "SCAN_PROFILE_CLASS")) {
+        ret = e->getPrefilter()->setProfile(value);
+    } else if (!strcmp(key, "SCAN_PROFILE_RULE")) {
+        ret = e->getScanProfiles()->addRule(value);
+    } else if (!strcmp(key, "SCAN_SKIP_CLASS")) {
+        ret = e->getPrefilter()->setSkip(value);
+    } else if (!strcmp(key, "SCAN_WORKERS")) {
+        unsigned int scanWorkers;
+
+        std::stringstream ss(value);
+        ss >> scanWorkers;
+        if (ss.fail()) {
+            ret = 1;
+        } else {
+            e->setScanWorkers(scanWorkers);
+        }
+    } else if (!strcmp(key, "SCAN_WORKER_TIMEOUT")) {
+        unsigned int scanWorkerTimeout;
+
+        std::stringstream ss(value);
+        ss >> scanWorkerTimeout;
+        if (ss.fail() || scanWorkerTimeout == 0) {
+            ret = 1;
+        } else {
+            e->setScanWorkerTimeout(scanWorkerTimeout);
+        }
+    } else if (!strcmp(key, "STARTUP_BLOCK_TIMEOUT")) {
+        unsigned int startupBlockTimeout;
+
+        std::stringstream ss(value);
+        ss >> startupBlockTimeout;
+        if (ss.fail()) {
+            ret = 1;
+        }
+        e->setStartupBlockTimeout(startupBlockTimeout);
+    } else if (!strcmp(key, "STARTUP_POLICY")) {
+        if (!strcmp(value, "wait")) {
+            e->setStartupPolicy(Environment::STARTUP_WAIT);
+        } else if (!strcmp(value, "allow")) {
+            e->setStartupPolicy(Environment::STARTUP_ALLOW);
+        } else if (!strcmp(value, "block")) {
+            e->setStartupPolicy(Environment::STARTUP_BLOCK);
+        } else {
+            ret = 1;
+        }
+    } else if (!strcmp(key, "STATS_FILE")) {
+        e->setStatsFile(value);
+    } else if (!strcmp(key, "URING_BUFFERS")) {
+        unsigned int uringBuffers;
+
+        std::stringstream ss(value);
+        ss >> uringBuffers;
+        if (ss.fail() || uringBuffers == 0) {
+            ret = 1;
+        }
+        e->setUringBuffers(uringBuffers);
+    } else if (!strcmp(key, "URING_BUFFER_SIZE")) {
+        unsigned long long uringBufferSize;
+
+        std::stringstream ss(value);
+        ss >> uringBufferSize;
+        if (ss.fail() || uringBufferSize == 0) {
+            ret = 1;
+        }
+        e->setUringBufferSize(uringBufferSize);
+    } else if (!strcmp(key, "WARM_PATHS")) {
+        e->getWarmPaths()->add(value);
     } else {
         ret = 1;
     }
     return ret;
 }
 
+/**
+ * @brief Callback function for reading the settings that can be changed
+ * while files are scanned from the configuration file.
+ *
+ * Other entries are skipped.
+ *
+ * @param key key value
+ * @param value parameter value
+ * @param info settings
+ * @return success
+ */
+static int settingsCallback(const char *key, const char *value, void *info) {
+    Settings *s = static_cast<Settings *> (info);
+
+    if (parseSetting(key, value, s) == 1) {
+        return 1;
+    }
+    return 0;
+}
+
 /**
  * @brief Handles signal.
  *
@@ -121,6 +383,317 @@ static void hdl(int sig) {
     if (sig == SIGUSR1) {
         fprintf(stderr, "Main received SIGUSR1\n");
     }
+    if (sig == SIGHUP) {
+        fprintf(stderr, "Main received SIGHUP\n");
+    }
+}
+
+/**
+ * @brief Context of the control commands.
+ */
+struct Control {
+    /**
+     * @brief Environment.
+     */
+    Environment *e;
+    /**
+     * @brief Fanotify polling object.
+     */
+    FanotifyPolling *fp;
+    /**
+     * @brief Absolute path of the configuration file.
+     */
+    char *cfile;
+};
+
+/**
+ * @brief Gets the default number of threads.
+ *
+ * @return number of available CPUs, at least 1
+ */
+static int defaultThreads() {
+    int nThread;
+
+    nThread = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nThread < 1) {
+        // Use at least one thread.
+        nThread = 1;
+    }
+    return nThread;
+}
+
+/**
+ * @brief Executes the command cache.
+ *
+ * @param ctl control context
+ * @param args words of the command
+ * @param out receives the output
+ * @return success = 0
+ */
+static int commandCache(struct Control *ctl,
+                        const std::vector<std::string> &args,
+                        std::ostream &out) {
+    ScanCache *cache = ctl->e->getScanCache();
+
+    if (args.size() == 2 && args[1] == "flush") {
+        cache->clear();
+        out << "Cache flushed.\n";
+        return 0;
+    }
+    if (args.size() == 3 && args[1] == "flush") {
+        struct stat statbuf;
+
+        if (stat(args[2].c_str(), &statbuf)) {
+            out << "Cannot access '" << args[2] << "'.\n";
+            return 1;
+        }
+        out << cache->clear(statbuf.st_dev) << " entries removed.\n";
+        return 0;
+    }
+    if ((args.size() == 2 || args.size() == 3) && args[1] == "dump") {
+        std::string filename;
+
+        filename = args.size() == 3 ? args[2] : ctl->e->getCacheFile();
+        if (filename.empty()) {
+            out << "No cache file configured.\n";
+            return 1;
+        }
+        if (ctl->fp->saveCache(filename.c_str())) {
+            out << "Cannot write cache file '" << filename << "'.\n";
+            return 1;
+        }
+        out << cache->getSize() << " entries saved to '" << filename
+            << "'.\n";
+        return 0;
+    }
+    out << "Usage: cache flush [PATH] | cache dump [FILE]\n";
+    return 1;
+}
+
+/**
+ * @brief Executes the command exclude.
+ *
+ * @param ctl control context
+ * @param args words of the command
+ * @param out receives the output
+ * @return success = 0
+ */
+static int commandExclude(struct Control *ctl,
+                          const std::vector<std::string> &args,
+                          std::ostream &out) {
+    if (args.size() == 2 && args[1] == "list") {
+        std::vector<std::string> paths;
+        std::vector<std::string>::iterator pos;
+
+        ctl->e->getExcludePaths(paths);
+        for (pos = paths.begin(); pos != paths.end(); ++pos) {
+            out << *pos << "\n";
+        }
+        return 0;
+    }
+    if (args.size() == 3 && args[1] == "add") {
+        if (args[2][0] != '/') {
+            out << "The path must be absolute.\n";
+            return 1;
+        }
+        ctl->e->addExcludePath(args[2].c_str());
+        out << "Path excluded.\n";
+        return 0;
+    }
+    if (args.size() == 3 && args[1] == "remove") {
+        if (!ctl->e->removeExcludePath(args[2].c_str())) {
+            out << "Path not excluded.\n";
+            return 1;
+        }
+        out << "Path no longer excluded.\n";
+        return 0;
+    }
+    out << "Usage: exclude add PATH | exclude remove PATH | exclude list\n";
+    return 1;
+}
+
+/**
+ * @brief Executes the command stats.
+ *
+ * @param ctl control context
+ * @param out receives the output
+ * @return success = 0
+ */
+static int commandStats(struct Control *ctl, std::ostream &out) {
+    struct StatsValues v;
+    std::vector<std::string> lines;
+    std::vector<std::string>::iterator pos;
+
+    ctl->fp->getStatistics(&v);
+    out << "Events " << v.events << "\n"
+        << "Scans " << v.scans << "\n"
+        << "Bytes scanned " << v.bytesScanned << "\n"
+        << "Denied " << v.denies << "\n"
+        << "Cache hits " << v.cacheHits << "\n"
+        << "Cache misses " << v.cacheMisses << "\n"
+        << "Cache evictions " << v.cacheEvictions << "\n"
+        << "Cache entries " << v.cacheSize << "\n"
+        << "Queue " << v.queueDepth << "\n"
+        << "Speculative queue " << v.idleQueueDepth << "\n"
+        << "Busy threads " << v.busyWorkers << "\n"
+        << "Threads " << v.workers << "\n"
+        << "Database version " << v.dbVersion << "\n";
+    ctl->fp->getLatencyStats()->getReport(lines, 1);
+    for (pos = lines.begin(); pos != lines.end(); ++pos) {
+        out << *pos << "\n";
+    }
+    return 0;
+}
+
+/**
+ * @brief Executes the command threads.
+ *
+ * @param ctl control context
+ * @param args words of the command
+ * @param out receives the output
+ * @return success = 0
+ */
+static int commandThreads(struct Control *ctl,
+                          const std::vector<std::string> &args,
+                          std::ostream &out) {
+    int nThread;
+
+    if (args.size() == 1) {
+        out << ctl->e->getNumberOfThreads() << "\n";
+        return 0;
+    }
+    if (args.size() == 3 && args[1] == "set") {
+        std::stringstream ss(args[2]);
+
+        ss >> nThread;
+        if (ss.fail() || !ss.eof() || nThread < 1) {
+            out << "Invalid number of threads '" << args[2] << "'.\n";
+            return 1;
+        }
+        out << "Using " << ctl->fp->setNumberOfThreads(nThread)
+            << " threads.\n";
+        return 0;
+    }
+    out << "Usage: threads [set N]\n";
+    return 1;
+}
+
+/**
+ * @brief Reads the configuration file again and applies the settings that
+ * can be changed while running.
+ *
+ * These are CACHE_MAX_SIZE, CLEAN_CACHE_ON_UPDATE, EXCLUDE_PATH, and
+ * THREADS. They are published as one snapshot. Other entries are skipped;
+ * their changes take effect after a restart.
+ *
+ * @param ctl control context
+ * @param out receives the output
+ * @return success = 0
+ */
+static int reloadConfiguration(struct Control *ctl, std::ostream &out) {
+    Settings s;
+
+    s.setNumberOfThreads(defaultThreads());
+    if (parseConfigurationFile(ctl->cfile, settingsCallback, (void *) &s)) {
+        out << "Cannot read configuration file '" << ctl->cfile << "'.\n";
+        return 1;
+    }
+    ctl->e->setSettings(s);
+    out << s.getExcludePaths().size() << " exclude paths, cache size "
+        << s.getCacheMaxSize() << ", using "
+        << ctl->fp->setNumberOfThreads(s.getNumberOfThreads())
+        << " threads.\n";
+    return 0;
+}
+
+/**
+ * @brief Executes a command received on the control socket.
+ *
+ * @param obj control context
+ * @param args words of the command
+ * @param out receives the output
+ * @return success = 0
+ */
+static int handleCommand(void *obj, const std::vector<std::string> &args,
+                         std::ostream &out) {
+    struct Control *ctl = (struct Control *) obj;
+    const std::string &cmd = args[0];
+
+    if (cmd == "cache") {
+        return commandCache(ctl, args, out);
+    } else if (cmd == "exclude") {
+        return commandExclude(ctl, args, out);
+    } else if (cmd == "reload-config" && args.size() == 1) {
+        return reloadConfiguration(ctl, out);
+    } else if (cmd == "reload-db" && args.size() == 1) {
+        ctl->fp->requestDatabaseReload();
+        out << "Checking the databases for updates.\n";
+        return 0;
+    } else if (cmd == "stats" && args.size() == 1) {
+        return commandStats(ctl, out);
+    } else if (cmd == "threads") {
+        return commandThreads(ctl, args, out);
+    } else if (cmd == "trace" && args.size() == 2
+               && (args[1] == "on" || args[1] == "off")) {
+        ctl->fp->setTrace(args[1] == "on");
+        out << "Tracing switched " << args[1] << ".\n";
+        return 0;
+    }
+    out << "Unknown command '" << cmd << "'.\n";
+    return 1;
+}
+
+/**
+ * @brief Request to stop the thread handling signals.
+ */
+static volatile int stopSignals = 0;
+
+/**
+ * @brief Handles the signals SIGHUP and SIGUSR1.
+ *
+ * The signals are blocked in all threads and consumed here. SIGHUP reloads
+ * the configuration file, SIGUSR1 writes the latency statistics to the log.
+ *
+ * @param obj control context
+ * @return return value
+ */
+static void *handleSignals(void *obj) {
+    struct Control *ctl = (struct Control *) obj;
+    sigset_t set;
+    int sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGUSR1);
+    for (;;) {
+        if (sigwait(&set, &sig)) {
+            Messaging::error("handleSignals, sigwait");
+            break;
+        }
+        if (stopSignals) {
+            break;
+        }
+        if (sig == SIGHUP) {
+            std::stringstream out;
+            std::string msg;
+            int ret;
+
+            ret = reloadConfiguration(ctl, out);
+            msg = out.str();
+            if (!msg.empty() && *msg.rbegin() == '\n') {
+                msg.erase(msg.size() - 1);
+            }
+            if (ret) {
+                Messaging::message(Messaging::ERROR, msg);
+            } else {
+                Messaging::message(Messaging::INFORMATION,
+                                   "Configuration reloaded, " + msg);
+            }
+        } else {
+            ctl->fp->getLatencyStats()->log(1);
+        }
+    }
+    return NULL;
 }
 
 /**
@@ -259,6 +832,49 @@ static void daemonize(Environment *e) {
     };
 }
 
+/**
+ * @brief Scans files and directory trees and exits.
+ *
+ * @param e environment
+ * @param paths files and directories to scan
+ * @return 0 = no virus found, 1 = virus found, 2 = error
+ */
+static int scan(Environment *e, std::vector<char *> &paths) {
+    VirusScan *virusScan;
+    OnDemandScan *ods;
+    std::vector<char *>::iterator pos;
+    enum OnDemandScan::Status ret;
+
+    try {
+        virusScan = new VirusScan(e);
+    } catch (VirusScan::Status ex) {
+        Messaging::message(Messaging::ERROR, "Loading database failed.");
+        return OnDemandScan::ERROR;
+    }
+    if (!e->getCacheFile().empty()) {
+        e->getScanCache()->load(e->getCacheFile().c_str(),
+                                virusScan->getDatabaseVersion());
+    }
+    ods = new OnDemandScan(e, virusScan);
+    for (pos = paths.begin(); pos != paths.end(); ++pos) {
+        ods->add(*pos);
+    }
+    ret = ods->wait();
+    delete ods;
+    // Make the results available to the on access scanner.
+    if (!e->getCacheFile().empty()) {
+        e->getScanCache()->save(e->getCacheFile().c_str(),
+                                virusScan->getDatabaseVersion());
+    }
+    try {
+        delete virusScan;
+    } catch (VirusScan::Status ex) {
+        Messaging::message(Messaging::ERROR,
+                           "Failure unloading virus scanner");
+    }
+    return ret;
+}
+
 /**
  * @brief Main.
  *
@@ -283,19 +899,27 @@ int main(int argc, char *argv[]) {
     char *cfile = (char *) CONF_FILE;
     // Fanotify polling object
     FanotifyPolling *fp;
+    // thread reporting latencies
+    pthread_t sigThread;
+    // control socket
+    ControlSocket *cs = NULL;
+    // context of the control commands
+    struct Control ctl;
+    // absolute path of the configuration file
+    char *cpath;
     // Message level
     int messageLevel = Messaging::INFORMATION;
     // Number of threads
     int nThread;
+    // Scan the given paths and exit
+    int shallscan = 0;
+    // Paths to scan
+    std::vector<char *> paths;
 
     e = new Environment();
 
     // Set the number of threads to the number of available CPUs.
-    nThread = sysconf(_SC_NPROCESSORS_ONLN);
-    if (nThread < 1) {
-        // Use at least one thread.
-        nThread = 1;
-    }
+    nThread = defaultThreads();
     e->setNumberOfThreads(nThread);
 
     // Analyze command line options.
@@ -305,6 +929,9 @@ int main(int argc, char *argv[]) {
         opt = argv[i];
         if (*opt == '-') {
             opt++;
+        } else if (shallscan) {
+            paths.push_back(opt);
+            continue;
         } else {
             help();
         }
@@ -338,6 +965,10 @@ int main(int argc, char *argv[]) {
                     help();
                 }
                 break;
+            case 's':
+                // scan paths
+                shallscan = 1;
+                break;
             case 'v':
                 // version
                 version();
@@ -361,11 +992,35 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    // Scan files without monitoring.
+    if (shallscan) {
+        int ret;
+
+        if (paths.empty()) {
+            help();
+        }
+        Messaging::setLevel((Messaging::Level) messageLevel);
+        ret = scan(e, paths);
+        delete e;
+        Messaging::teardown();
+        return ret;
+    }
+
     // Check authorization.
     authcheck(e);
 
+    // The configuration file is read again after changing the directory.
+    cpath = realpath(cfile, NULL);
+    if (cpath == NULL) {
+        perror("realpath");
+        delete e;
+        return EXIT_FAILURE;
+    }
+
     // Daemonize if requested.
     if (shalldaemonize) {
+        // The thread writing messages does not survive fork().
+        Messaging::teardown();
         daemonize(e);
         daemonized = 1;
     }
@@ -381,6 +1036,7 @@ int main(int argc, char *argv[]) {
 
     // Block signals.
     sigemptyset(&blockset);
+    sigaddset(&blockset, SIGHUP);
     sigaddset(&blockset, SIGUSR1);
     if (sigprocmask(SIG_BLOCK, &blockset, NULL) == -1) {
         Messaging::error("main, pthread_sigmask");
@@ -393,7 +1049,8 @@ int main(int argc, char *argv[]) {
     act.sa_flags = 0;
     if (sigaction(SIGTERM, &act, NULL)
             || sigaction(SIGINT, &act, NULL)
-            || sigaction(SIGUSR1, &act, NULL)) {
+            || sigaction(SIGUSR1, &act, NULL)
+            || sigaction(SIGHUP, &act, NULL)) {
         Messaging::error("main, sigaction");
         return EXIT_FAILURE;
     }
@@ -403,10 +1060,32 @@ int main(int argc, char *argv[]) {
     } catch (FanotifyPolling::Status ex) {
         Messaging::message(Messaging::ERROR,
                            "Failure starting fanotify listener.");
+        free(cpath);
+        delete e;
+        return EXIT_FAILURE;
+    }
+
+    ctl.e = e;
+    ctl.fp = fp;
+    ctl.cfile = cpath;
+    if (pthread_create(&sigThread, NULL, handleSignals, (void *) &ctl)) {
+        Messaging::error("main, pthread_create");
+        delete fp;
+        free(cpath);
         delete e;
         return EXIT_FAILURE;
     }
 
+    if (!e->getControlSocket().empty()) {
+        try {
+            cs = new ControlSocket(e->getControlSocket(), handleCommand,
+                                   &ctl);
+        } catch (ControlSocket::Status ex) {
+            Messaging::message(Messaging::WARNING,
+                               "Control commands are not accepted.");
+        }
+    }
+
     Messaging::message(Messaging::INFORMATION, "On access scanning started.");
     if (daemonized) {
         pause();
@@ -415,11 +1094,20 @@ int main(int argc, char *argv[]) {
         getchar();
     }
 
+    if (cs) {
+        delete cs;
+    }
+
+    stopSignals = 1;
+    pthread_kill(sigThread, SIGUSR1);
+    pthread_join(sigThread, NULL);
+
     try {
         delete fp;
     } catch (FanotifyPolling::Status e) {
     }
     Messaging::message(Messaging::INFORMATION, "On access scanning stopped.");
+    free(cpath);
     delete e;
     Messaging::teardown();
     printf("done\n");
@@ -33,6 +33,7 @@ const char *CONF_FILE = "/etc/skyldav.conf";
 
 const char *HELP_TEXT =
     "Usage: skyldav [OPTION]\n"
+    "  or:  skyldav [OPTION] -s PATH...\n"
     "On access virus scanner.\n\n"
     "  -c <configfile>  path to config file\n"
     "  -d               daemonize\n"
@@ -42,6 +43,7 @@ const char *HELP_TEXT =
     "                     2 - Information, default\n"
     "                     3 - Warning\n"
     "                     4 - Error\n"
+    "  -s <path>...     scan files and directories and exit\n"
     "  -v               version\n\n"
     "Licensed under the Apache License, Version 2.0.\n"
     "Report errors to\n"
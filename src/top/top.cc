@@ -0,0 +1,328 @@
+/*
+ * File:   top.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file top.cc
+ * @brief Live monitor for Skyld AV.
+ *
+ * The statistics segment published by the daemon is mapped read-only. Each
+ * update copies it from memory, so watching a host does not add load to
+ * the daemon.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "StatsSegment.h"
+#include "top.h"
+
+/**
+ * @brief Number of update intervals after which the values are considered
+ * stale.
+ */
+#define STALE_INTERVALS 5
+
+/**
+ * @brief Request to stop.
+ */
+static volatile sig_atomic_t stopping = 0;
+
+/**
+ * @brief Handles SIGINT and SIGTERM.
+ */
+static void hdl(int) {
+    stopping = 1;
+}
+
+/**
+ * @brief Prints help message and exits.
+ */
+static void help() {
+    printf("%s", HELP_TEXT);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Shows version information and exits.
+ */
+static void version() {
+    printf("Skyld AV, version %s\n", VERSION);
+    printf("%s", VERSION_TEXT);
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Maps the statistics segment.
+ *
+ * A file smaller than the segment is not mapped, as reading beyond its end
+ * would raise SIGBUS.
+ *
+ * @param filename statistics file
+ * @return mapped segment, NULL on failure
+ */
+static const struct StatsLayout *attach(const char *filename) {
+    int fd;
+    void *addr;
+    struct stat statbuf;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &statbuf) || !S_ISREG(statbuf.st_mode)
+            || statbuf.st_size < (off_t) sizeof (struct StatsLayout)) {
+        close(fd);
+        return NULL;
+    }
+    addr = mmap(NULL, sizeof (struct StatsLayout), PROT_READ, MAP_SHARED,
+                fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    return (const struct StatsLayout *) addr;
+}
+
+/**
+ * @brief Unmaps the statistics segment.
+ *
+ * @param segment mapped segment
+ */
+static void detach(const struct StatsLayout *segment) {
+    munmap((void *) segment, sizeof (struct StatsLayout));
+}
+
+/**
+ * @brief Gets the rate of a counter.
+ *
+ * @param now current value
+ * @param before previous value
+ * @param seconds time between the values
+ * @return rate per second
+ */
+static double rate(uint64_t now, uint64_t before, double seconds) {
+    if (seconds <= 0 || now < before) {
+        return 0;
+    }
+    return (now - before) / seconds;
+}
+
+/**
+ * @brief Prints a line in batch mode.
+ *
+ * @param s current snapshot
+ * @param p previous snapshot
+ * @param seconds time between the snapshots
+ */
+static void printLine(const struct StatsLayout *s,
+                      const struct StatsLayout *p, double seconds) {
+    const struct StatsValues *v = &s->values;
+    const struct StatsValues *o = &p->values;
+
+    printf("events/s %.1f scans/s %.1f MiB/s %.2f denies %llu "
+           "hits/s %.1f misses/s %.1f evictions/s %.1f cache %llu "
+           "queue %u idle %u busy %u/%u db %u\n",
+           rate(v->events, o->events, seconds),
+           rate(v->scans, o->scans, seconds),
+           rate(v->bytesScanned, o->bytesScanned, seconds) / 1048576.,
+           (unsigned long long) v->denies,
+           rate(v->cacheHits, o->cacheHits, seconds),
+           rate(v->cacheMisses, o->cacheMisses, seconds),
+           rate(v->cacheEvictions, o->cacheEvictions, seconds),
+           (unsigned long long) v->cacheSize, v->queueDepth,
+           v->idleQueueDepth, v->busyWorkers, v->workers, v->dbVersion);
+    fflush(stdout);
+}
+
+/**
+ * @brief Prints the screen in interactive mode.
+ *
+ * @param s current snapshot
+ * @param p previous snapshot
+ * @param seconds time between the snapshots
+ * @param stale the daemon has not updated the values recently
+ */
+static void printScreen(const struct StatsLayout *s,
+                        const struct StatsLayout *p, double seconds,
+                        int stale) {
+    const struct StatsValues *v = &s->values;
+    const struct StatsValues *o = &p->values;
+    uint64_t lookups;
+    long up;
+
+    lookups = v->cacheHits + v->cacheMisses;
+    up = time(NULL) - s->started;
+    // Clear the screen.
+    printf("\033[H\033[2J");
+    printf("Skyld AV %.*s, pid %u, up %ld:%02ld:%02ld, database version %u%s"
+           "\n\n", (int) sizeof (s->version), s->version, s->pid, up / 3600,
+           up / 60 % 60, up % 60, v->dbVersion, stale ? ", NOT UPDATING" : "");
+    printf("Events      %10.1f/s  total %llu\n",
+           rate(v->events, o->events, seconds),
+           (unsigned long long) v->events);
+    printf("Scans       %10.1f/s  total %llu, %.2f MiB/s\n",
+           rate(v->scans, o->scans, seconds), (unsigned long long) v->scans,
+           rate(v->bytesScanned, o->bytesScanned, seconds) / 1048576.);
+    printf("Denied      %10.1f/s  total %llu\n",
+           rate(v->denies, o->denies, seconds),
+           (unsigned long long) v->denies);
+    printf("Cache hits  %10.1f/s  %.1f %% of all lookups\n",
+           rate(v->cacheHits, o->cacheHits, seconds),
+           lookups ? 100. * v->cacheHits / lookups : 0.);
+    printf("Cache misses%10.1f/s\n",
+           rate(v->cacheMisses, o->cacheMisses, seconds));
+    printf("Evictions   %10.1f/s  %llu entries cached\n",
+           rate(v->cacheEvictions, o->cacheEvictions, seconds),
+           (unsigned long long) v->cacheSize);
+    printf("Queue       %10u    %u speculative\n", v->queueDepth,
+           v->idleQueueDepth);
+    printf("Workers     %10u    of %u busy\n", v->busyWorkers, v->workers);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    const char *filename = STATS_FILE;
+    const struct StatsLayout *segment = NULL;
+    struct StatsLayout current;
+    struct StatsLayout latest;
+    struct StatsLayout previous;
+    struct sigaction act;
+    struct timespec delay;
+    double interval = 1;
+    long count = -1;
+    int batch = 0;
+    int first = 1;
+    int i;
+
+    // Analyze command line options.
+    for (i = 1; i < argc; i++) {
+        char *opt;
+
+        opt = argv[i];
+        if (*opt == '-') {
+            opt++;
+        } else {
+            help();
+        }
+        if (*opt == '-') {
+            opt++;
+        }
+        switch (*opt) {
+            case 'b':
+                batch = 1;
+                break;
+            case 'd':
+                if (++i >= argc) {
+                    help();
+                }
+                interval = atof(argv[i]);
+                if (interval <= 0) {
+                    help();
+                }
+                break;
+            case 'f':
+                if (++i >= argc) {
+                    help();
+                }
+                filename = argv[i];
+                break;
+            case 'n':
+                if (++i >= argc) {
+                    help();
+                }
+                count = atol(argv[i]);
+                if (count <= 0) {
+                    help();
+                }
+                break;
+            case 'v':
+                version();
+                break;
+            default:
+                help();
+        }
+    }
+
+    act.sa_handler = hdl;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+    if (sigaction(SIGINT, &act, NULL) || sigaction(SIGTERM, &act, NULL)) {
+        perror("sigaction");
+        return EXIT_FAILURE;
+    }
+
+    delay.tv_sec = (time_t) interval;
+    delay.tv_nsec = (long) ((interval - delay.tv_sec) * 1000000000.);
+    while (!stopping && count) {
+        struct timespec now;
+        double seconds;
+        int stale;
+
+        if (segment == NULL) {
+            segment = attach(filename);
+        }
+        if (segment == NULL || StatsSegment::read(segment, &current)) {
+            if (first) {
+                fprintf(stderr, "Cannot read statistics file '%s'.\n",
+                        filename);
+                return EXIT_FAILURE;
+            }
+        } else {
+            if (first || current.pid != latest.pid) {
+                // Rates are shown from the second update on.
+                previous = latest = current;
+            } else if (current.updated != latest.updated) {
+                previous = latest;
+                latest = current;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            stale = now.tv_sec * 1000000000LL + now.tv_nsec - latest.updated
+                    > STALE_INTERVALS * SKYLD_STATS_INTERVAL * 1000000LL;
+            seconds = (latest.updated - previous.updated) / 1000000000.;
+            if (!batch) {
+                printScreen(&latest, &previous, seconds, stale);
+            } else if (!first) {
+                printLine(&latest, &previous, seconds);
+            }
+            if (stale) {
+                // The daemon may have been restarted with a new segment.
+                detach(segment);
+                segment = NULL;
+            }
+            first = 0;
+        }
+        if (count > 0) {
+            count--;
+        }
+        if (count) {
+            nanosleep(&delay, NULL);
+        }
+    }
+    if (segment) {
+        detach(segment);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+/*
+ * File:   top.h
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/**
+ * @file top.h
+ * @brief Live monitor for Skyld AV.
+ */
+
+#ifndef TOP_H
+#define	TOP_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+const char *STATS_FILE = "/dev/shm/skyldav.stats";
+
+const char *HELP_TEXT =
+    "Usage: skyldav-top [OPTION]\n"
+    "Live monitor for Skyld AV on access virus scanner.\n\n"
+    "  -b               batch mode, print one line per update\n"
+    "  -d <seconds>     delay between updates, default 1\n"
+    "  -f <file>        statistics file, default /dev/shm/skyldav.stats\n"
+    "  -h               help\n"
+    "  -n <n>           number of updates, default unlimited\n"
+    "  -v               version\n\n"
+    "Licensed under the Apache License, Version 2.0.\n"
+    "Report errors to\n"
+    "Heinrich Schuchardt <xypron.glpk@gmx.de>\n";
+
+const char *VERSION_TEXT =
+    "Live monitor for Skyld AV on access virus scanner.\n\n"
+    "Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>\n\n"
+    "Licensed under the Apache License, Version 2.0 (the\n"
+    "\"License\"); you may not use this file except in compliance\n"
+    "with the License. You may obtain a copy of the License at\n\n"
+    "    http://www.apache.org/licenses/LICENSE-2.0\n\n"
+    "Unless required by applicable law or agreed to in writing,\n"
+    "software distributed under the License is distributed on an\n"
+    "\"AS IS\" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,\n"
+    "either express or implied. See the License for the specific\n"
+    "language governing permissions and limitations under the\n"
+    "License.\n";
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* TOP_H */
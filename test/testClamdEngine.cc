@@ -0,0 +1,310 @@
+/*
+ * File:   testClamdEngine.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * A stand-in for clamd serves the socket. It reports files containing
+ * MARKER as infected.
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+#include "ClamdEngine.h"
+#include "Environment.h"
+#include "Messaging.h"
+
+#define MARKER "SKYLDAV-TEST-MARKER"
+#define SOCKET "testClamdEngine.sock"
+#define THREADS 4
+#define SCANS 50
+
+static int listenFd;
+static std::vector<int> clients;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static ClamdEngine *engine;
+static int cleanFd;
+static int virusFd;
+static int errors;
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+static int readCommand(int fd, std::string &cmd) {
+    char c;
+
+    cmd.clear();
+    while (recv(fd, &c, 1, 0) == 1) {
+        if (c == '\0') {
+            return 0;
+        }
+        cmd += c;
+    }
+    return 1;
+}
+
+static int receiveFd(int fd) {
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof (int))];
+    } control;
+    struct cmsghdr *cmsg;
+    char dummy;
+    int ret = -1;
+
+    memset(&msg, 0, sizeof (msg));
+    iov.iov_base = &dummy;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof (control.buf);
+    if (recvmsg(fd, &msg, 0) != 1) {
+        return -1;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(&ret, CMSG_DATA(cmsg), sizeof (int));
+    }
+    return ret;
+}
+
+static std::string verdict(const std::string &name, const std::string &data) {
+    if (data.find(MARKER) != std::string::npos) {
+        return name + ": Test.Marker FOUND";
+    }
+    return name + ": OK";
+}
+
+static void *serve(void *arg) {
+    int fd = (int) (long) arg;
+    unsigned long id = 0;
+    int session = 0;
+    std::string cmd;
+
+    while (!readCommand(fd, cmd)) {
+        std::string reply;
+        char prefix[32];
+
+        if (cmd == "zIDSESSION") {
+            session = 1;
+            continue;
+        } else if (cmd == "zEND") {
+            break;
+        } else if (cmd == "zPING") {
+            reply = "PONG";
+        } else if (cmd == "zVERSION") {
+            reply = "ClamAV 1.0.0/12345/Sat Jan  1 00:00:00 2022";
+        } else if (cmd == "zFILDES") {
+            std::string data;
+            char buf[4096];
+            ssize_t len;
+            off_t pos = 0;
+            int file;
+
+            file = receiveFd(fd);
+            while ((len = pread(file, buf, sizeof (buf), pos)) > 0) {
+                data.append(buf, len);
+                pos += len;
+            }
+            close(file);
+            reply = verdict("fd[10]", data);
+        } else if (cmd == "zINSTREAM") {
+            std::string data;
+            uint32_t size;
+
+            while (recv(fd, &size, sizeof (size), MSG_WAITALL) == 4
+                    && (size = ntohl(size)) != 0) {
+                std::string chunk(size, '\0');
+
+                recv(fd, &chunk[0], size, MSG_WAITALL);
+                data += chunk;
+            }
+            reply = verdict("stream", data);
+        } else {
+            reply = "UNKNOWN COMMAND";
+        }
+        if (session) {
+            snprintf(prefix, sizeof (prefix), "%lu: ", ++id);
+            reply = prefix + reply;
+        }
+        send(fd, reply.c_str(), reply.size() + 1, MSG_NOSIGNAL);
+        if (!session) {
+            break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *server(void *arg) {
+    int fd;
+
+    while ((fd = accept(listenFd, NULL, NULL)) != -1) {
+        pthread_t thread;
+
+        pthread_mutex_lock(&mutex);
+        clients.push_back(fd);
+        pthread_mutex_unlock(&mutex);
+        pthread_create(&thread, NULL, serve, (void *) (long) fd);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static void stopServer(pthread_t thread) {
+    std::vector<int>::iterator it;
+
+    shutdown(listenFd, SHUT_RDWR);
+    pthread_join(thread, NULL);
+    close(listenFd);
+    unlink(SOCKET);
+    pthread_mutex_lock(&mutex);
+    for (it = clients.begin(); it != clients.end(); ++it) {
+        shutdown(*it, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+static int scanFile(int fd, int partial, std::string &virname) {
+    struct ScanJob job;
+
+    job.fd = fd;
+    job.data = NULL;
+    job.size = lseek(fd, 0, SEEK_END);
+    job.map = NULL;
+    job.profile = NULL;
+    job.partial = partial;
+    return engine->scan(&job, virname);
+}
+
+static void *scanner(void *arg) {
+    int i;
+
+    // The requests of all threads share one session.
+    for (i = 0; i < SCANS; i++) {
+        std::string virname;
+
+        if (scanFile(cleanFd, 0, virname) != ScanEngine::CLEAN
+                || scanFile(virusFd, 0, virname) != ScanEngine::VIRUS) {
+            pthread_mutex_lock(&mutex);
+            errors++;
+            pthread_mutex_unlock(&mutex);
+        }
+    }
+    return NULL;
+}
+
+static int createFile(const char *name, const std::string &content) {
+    int fd;
+
+    fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1 || write(fd, content.c_str(), content.size())
+            != (ssize_t) content.size()) {
+        printf("Cannot create %s.\n", name);
+        throw EXIT_FAILURE;
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    struct sockaddr_un addr;
+    pthread_t serverThread;
+    pthread_t threads[THREADS];
+    Environment *e;
+    std::string virname;
+    int i;
+
+    unlink(SOCKET);
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SOCKET);
+    if (bind(listenFd, (struct sockaddr *) &addr, sizeof (addr))
+            || listen(listenFd, 16)) {
+        printf("Cannot listen on %s.\n", SOCKET);
+        return EXIT_FAILURE;
+    }
+    pthread_create(&serverThread, NULL, server, NULL);
+
+    e = new Environment();
+    e->setClamdSocket(SOCKET);
+    e->setClamdConnections(1);
+    e->setPartialScanBytes(16);
+
+    try {
+        cleanFd = createFile("testClamdEngine.clean",
+                             std::string(100, 'x'));
+        virusFd = createFile("testClamdEngine.virus",
+                             std::string(50, 'x') + MARKER
+                             + std::string(50, 'x'));
+        engine = new ClamdEngine(e);
+        checkEqual(engine->isAvailable(), 1, "Available");
+        checkEqual(engine->load(), 0, "Load");
+        checkEqual(engine->getVersion(), 12345, "Version");
+
+        checkEqual(scanFile(cleanFd, 0, virname), ScanEngine::CLEAN,
+                   "Clean file");
+        checkEqual(scanFile(virusFd, 0, virname), ScanEngine::VIRUS,
+                   "Infected file");
+        checkEqual(virname == "Test.Marker", 1, "Virus name");
+        // The marker is neither in the head nor in the tail.
+        checkEqual(scanFile(virusFd, 1, virname), ScanEngine::CLEAN,
+                   "Partial scan");
+
+        for (i = 0; i < THREADS; i++) {
+            pthread_create(&threads[i], NULL, scanner, NULL);
+        }
+        for (i = 0; i < THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        checkEqual(errors, 0, "Concurrent scans");
+
+        stopServer(serverThread);
+        checkEqual(scanFile(cleanFd, 0, virname), ScanEngine::UNAVAILABLE,
+                   "Server stopped");
+        checkEqual(engine->isAvailable(), 0, "Not available");
+        delete engine;
+    } catch (int ex) {
+        ret = ex;
+    }
+
+    close(cleanFd);
+    close(virusFd);
+    remove("testClamdEngine.clean");
+    remove("testClamdEngine.virus");
+    delete e;
+    Messaging::teardown();
+    return ret;
+}
@@ -0,0 +1,130 @@
+/*
+ * File:   testControlSocket.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ControlSocket.h"
+#include "Messaging.h"
+
+#define SOCKET "testControlSocket.sock"
+
+static void checkEqual(const std::string &actual, const std::string &expected,
+                       const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%s', expected '%s'.\n", lbl, actual.c_str(),
+               expected.c_str());
+        throw EXIT_FAILURE;
+    }
+}
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+                       const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+/*
+ * Echoes the arguments of the command echo, fails otherwise.
+ */
+static int handle(void *context, const std::vector<std::string> &args,
+                  std::ostream &out) {
+    std::vector<std::string>::const_iterator pos;
+
+    (*(unsigned int *) context)++;
+    if (args[0] != "echo") {
+        out << "Unknown command.\n";
+        return 1;
+    }
+    for (pos = args.begin() + 1; pos != args.end(); ++pos) {
+        out << *pos << "\n";
+    }
+    return 0;
+}
+
+/*
+ * Sends a command to the socket and returns the answer.
+ */
+static std::string command(const char *cmd) {
+    struct sockaddr_un addr;
+    std::string response;
+    char buf[1024];
+    ssize_t len;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SOCKET);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof (addr))) {
+        close(fd);
+        printf("Cannot connect to %s.\n", SOCKET);
+        throw EXIT_FAILURE;
+    }
+    send(fd, cmd, strlen(cmd), MSG_NOSIGNAL);
+    while ((len = read(fd, buf, sizeof (buf))) > 0) {
+        response.append(buf, len);
+    }
+    close(fd);
+    return response;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    ControlSocket *cs = NULL;
+    std::vector<std::string> args;
+    struct stat statbuf;
+    unsigned int calls = 0;
+
+    try {
+        ControlSocket::split("  cache\tflush  /tmp ", args);
+        checkEqual(args.size(), 3, "Split");
+        checkEqual(args[2], "/tmp", "Split last word");
+
+        cs = new ControlSocket(SOCKET, handle, &calls);
+        checkEqual(stat(SOCKET, &statbuf), 0, "Socket created");
+        checkEqual(statbuf.st_mode & 0777, 0600, "Socket mode");
+
+        checkEqual(command("echo a  b\n"), "OK\na\nb\n", "Command");
+        checkEqual(command("echo c"), "OK\nc\n", "Command without newline");
+        checkEqual(command("unknown\n"), "ERROR\nUnknown command.\n",
+                   "Failing command");
+        checkEqual(command("\n"), "ERROR\nNo command given.\n",
+                   "Empty command");
+        checkEqual(calls, 3, "Handler calls");
+
+        delete cs;
+        cs = NULL;
+        checkEqual(access(SOCKET, F_OK), -1, "Socket removed");
+    } catch (int ex) {
+        ret = ex;
+    }
+    if (cs) {
+        delete cs;
+    }
+    Messaging::teardown();
+    return ret;
+}
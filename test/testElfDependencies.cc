@@ -0,0 +1,84 @@
+/* 
+ * File:   testElfDependencies.cc
+ * 
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "ElfDependencies.h"
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    ElfDependencies *d;
+    std::vector<int> fds;
+    std::vector<int>::iterator pos;
+    int fd;
+    int libc = 0;
+
+    d = new ElfDependencies();
+
+    try {
+        // This test program needs the C library.
+        fd = open("/proc/self/exe", O_RDONLY);
+        checkEqual(fd >= 0, 1, "Open executable");
+        checkEqual(d->getDependencies(fd, "", 1, fds), 0, "Executable");
+        close(fd);
+        checkEqual(fds.size() > 0, 1, "Number of libraries");
+        for (pos = fds.begin(); pos != fds.end(); ++pos) {
+            char link[32];
+            char path[PATH_MAX + 1];
+            int len;
+
+            snprintf(link, sizeof (link), "/proc/self/fd/%d", *pos);
+            len = readlink(link, path, sizeof (path) - 1);
+            if (len > 0) {
+                path[len] = '\0';
+                if (strstr(path, "/libc.so")) {
+                    libc = 1;
+                }
+            }
+            close(*pos);
+        }
+        checkEqual(libc, 1, "C library found");
+
+        // Files that are not ELF files are ignored.
+        fds.clear();
+        fd = open("/proc/self/cmdline", O_RDONLY);
+        checkEqual(d->getDependencies(fd, "", 0, fds), 1, "Not ELF");
+        checkEqual(fds.size(), 0, "Libraries of non ELF file");
+        close(fd);
+    } catch (int ex) {
+        ret = ex;
+    }
+
+    delete d;
+    return ret;
+}
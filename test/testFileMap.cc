@@ -0,0 +1,74 @@
+/*
+ * File:   testFileMap.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "FileMap.h"
+#include "Messaging.h"
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    const char *name = "testFileMap.dat";
+    long pageSize = sysconf(_SC_PAGESIZE);
+    char *buf;
+    FileMap *map;
+    int fd;
+
+    buf = (char *) malloc(3 * pageSize);
+    memset(buf, 'x', 3 * pageSize);
+    fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1 || write(fd, buf, 3 * pageSize) != 3 * pageSize) {
+        printf("Cannot create %s.\n", name);
+        return EXIT_FAILURE;
+    }
+
+    try {
+        map = new FileMap(fd, 3 * pageSize);
+        checkEqual(map->getSize(), 3 * pageSize, "Size");
+        checkEqual(map->getData()[2 * pageSize], 'x', "Content");
+        checkEqual(map->isTruncated(), 0, "Not truncated");
+        if (ftruncate(fd, pageSize)) {
+            throw EXIT_FAILURE;
+        }
+        checkEqual(map->getData()[0], 'x', "Content before end");
+        checkEqual(map->getData()[2 * pageSize], 0, "Content after end");
+        checkEqual(map->isTruncated(), 1, "Truncated");
+        delete map;
+    } catch (int ex) {
+        ret = ex;
+    }
+
+    close(fd);
+    remove(name);
+    free(buf);
+    Messaging::teardown();
+    return ret;
+}
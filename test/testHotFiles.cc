@@ -0,0 +1,107 @@
+/* 
+ * File:   testHotFiles.cc
+ * 
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "HotFiles.h"
+#include "Messaging.h"
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+static void checkEqual(const std::string &actual, const std::string &expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%s', expected '%s'.\n", lbl, actual.c_str(),
+                expected.c_str());
+        throw EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    const char *names[] = {"testHotFiles.a", "testHotFiles.b",
+        "testHotFiles.c"};
+    // Number of opens per file.
+    const int opens[] = {3, 5, 1};
+    std::string paths[3];
+    struct stat statbuf[3];
+    char cwd[PATH_MAX];
+    HotFiles *h;
+    std::vector<std::string> loaded;
+    int i;
+    int j;
+
+    Messaging::setLevel(Messaging::DEBUG);
+    if (getcwd(cwd, sizeof (cwd)) == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < 3; i++) {
+        FILE *f;
+
+        paths[i] = std::string(cwd) + "/" + names[i];
+        f = fopen(paths[i].c_str(), "w");
+        fprintf(f, "%d\n", i);
+        fclose(f);
+        stat(paths[i].c_str(), &statbuf[i]);
+    }
+
+    try {
+        // Keep the two most often opened files.
+        h = new HotFiles(2);
+        for (j = 0; j < 5; j++) {
+            for (i = 0; i < 3; i++) {
+                if (j < opens[i] && h->add(&statbuf[i])) {
+                    h->setPath(&statbuf[i], paths[i]);
+                }
+            }
+        }
+        checkEqual(h->save("testHotFiles.tmp"), 0, "Save list");
+        delete h;
+
+        h = new HotFiles(2);
+        checkEqual(h->load("testHotFiles.tmp", loaded), 2, "Load list");
+        checkEqual(loaded[0], paths[1], "Most often opened file");
+        checkEqual(loaded[1], paths[0], "Second most often opened file");
+
+        // Counts of loaded files are kept.
+        checkEqual(h->add(&statbuf[2]), 0, "Rarely opened file");
+        delete h;
+    } catch (int ex) {
+        ret = ex;
+    }
+
+    remove("testHotFiles.tmp");
+    for (i = 0; i < 3; i++) {
+        remove(paths[i].c_str());
+    }
+    Messaging::teardown();
+    return ret;
+}
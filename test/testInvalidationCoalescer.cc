@@ -0,0 +1,115 @@
+/* 
+ * File:   testInvalidationCoalescer.cc
+ * 
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#include <malloc.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "Environment.h"
+#include "InvalidationCoalescer.h"
+#include "Messaging.h"
+#include "ScanCache.h"
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    ScanCache *c;
+    Environment *e;
+    InvalidationCoalescer *ic;
+    struct stat *stat;
+    struct timespec interval = {
+        0,
+        20000000
+    };
+
+    stat = (struct stat *) malloc(sizeof (struct stat));
+
+    Messaging::setLevel(Messaging::DEBUG);
+    e = new Environment();
+    c = e->getScanCache();
+    ic = new InvalidationCoalescer(c, 10);
+
+    try {
+        stat->st_dev = 13;
+        stat->st_ino = 100;
+        stat->st_mtime = 1000;
+
+        checkEqual(ic->getTimeout(), (unsigned int) -1, "Timeout when empty");
+
+        // Invalidations are deferred.
+        c->add(stat, 1);
+        checkEqual(ic->add(stat, InvalidationCoalescer::MODIFY), 0,
+                "First invalidation");
+        checkEqual(ic->isPending(stat), 1, "Pending after add");
+        checkEqual(c->get(stat), 1, "Cache entry before flush");
+
+        // Duplicates are dropped.
+        checkEqual(ic->add(stat, InvalidationCoalescer::MODIFY),
+                InvalidationCoalescer::MODIFY, "Duplicate modify");
+        checkEqual(ic->add(stat, InvalidationCoalescer::CLOSE_WRITE),
+                InvalidationCoalescer::MODIFY, "Close after modify");
+        checkEqual(ic->add(stat, InvalidationCoalescer::MODIFY),
+                InvalidationCoalescer::MODIFY
+                | InvalidationCoalescer::CLOSE_WRITE, "Modify after close");
+        checkEqual(ic->getDuplicates(), 3, "Duplicates");
+
+        stat->st_ino = 101;
+        c->add(stat, 1);
+        checkEqual(ic->add(stat, InvalidationCoalescer::CLOSE_WRITE), 0,
+                "Other inode");
+        checkEqual(ic->getDuplicates(), 3, "Duplicates other inode");
+
+        // Expired invalidations are applied in one batch.
+        ic->flushExpired();
+        checkEqual(c->get(stat), 1, "Cache entry within window");
+        nanosleep(&interval, NULL);
+        checkEqual(ic->getTimeout(), 0, "Timeout after window");
+        ic->flushExpired();
+        checkEqual(ic->isPending(stat), 0, "Pending after flush");
+        checkEqual(c->get(stat), ScanCache::CACHE_MISS, "Cache after flush");
+        stat->st_ino = 100;
+        checkEqual(c->get(stat), ScanCache::CACHE_MISS, "Cache after flush");
+        checkEqual(ic->getInvalidations(), 2, "Invalidations");
+
+        // An explicit flush applies invalidations immediately.
+        c->add(stat, 2);
+        ic->add(stat, InvalidationCoalescer::CLOSE_WRITE);
+        ic->flush();
+        checkEqual(c->get(stat), ScanCache::CACHE_MISS, "Explicit flush");
+        checkEqual(ic->add(stat, InvalidationCoalescer::MODIFY), 0,
+                "Invalidation after flush");
+    } catch (int ex) {
+        ret = ex;
+    }
+
+    delete ic;
+    delete e;
+    free(stat);
+    Messaging::teardown();
+    return ret;
+}
@@ -0,0 +1,114 @@
+/*
+ * File:   testLatencyStats.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "LatencyStats.h"
+#include "Messaging.h"
+
+static void checkEqual(const unsigned long long actual,
+                       const unsigned long long expected, const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%llu', expected '%llu'.\n", lbl, actual,
+               expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+/*
+ * Checks that a percentile is within the precision of the histogram.
+ */
+static void checkNear(const unsigned long long actual,
+                      const unsigned long long expected, const char *lbl) {
+    if (actual < expected || actual > expected + expected / 16) {
+        printf("%s: actual '%llu', expected '%llu'.\n", lbl, actual,
+               expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+/*
+ * Records the durations 1 us .. 1000 us for mount 1.
+ */
+static void *recordAll(void *obj) {
+    LatencyStats *stats = (LatencyStats *) obj;
+    struct timespec start = {0, 0};
+    struct timespec end = {0, 0};
+    int i;
+
+    for (i = 1; i <= 1000; i++) {
+        end.tv_nsec = i * 1000;
+        stats->record(LatencyStats::SCAN, 1, &start, &end);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    LatencyStats *stats;
+    struct LatencyStats::Summary s;
+    struct timespec start = {10, 0};
+    struct timespec end = {12, 500000000};
+    std::vector<std::string> lines;
+    pthread_t thread;
+    int i;
+
+    stats = new LatencyStats();
+    try {
+        recordAll(stats);
+        // The second thread reuses the recorder of the first one.
+        for (i = 0; i < 2; i++) {
+            if (pthread_create(&thread, NULL, recordAll, stats)) {
+                printf("Cannot create thread.\n");
+                throw EXIT_FAILURE;
+            }
+            pthread_join(thread, NULL);
+        }
+        stats->record(LatencyStats::SCAN, 2, &start, &end);
+
+        stats->getSummary(LatencyStats::SCAN, 1, &s);
+        checkEqual(s.count, 3000, "Count of mount");
+        checkEqual(s.max, 1000000, "Maximum of mount");
+        checkNear(s.p50, 500000, "Median of mount");
+        checkNear(s.p99, 990000, "p99 of mount");
+        checkNear(s.p999, 999000, "p99.9 of mount");
+
+        stats->getSummary(LatencyStats::SCAN, 0, &s);
+        checkEqual(s.count, 3001, "Count");
+        checkEqual(s.max, 2500000000ULL, "Maximum");
+        checkNear(s.p50, 500000, "Median");
+
+        stats->getSummary(LatencyStats::READ, 0, &s);
+        checkEqual(s.count, 0, "Count of empty stage");
+
+        stats->getReport(lines, 0);
+        checkEqual(lines.size(), 1, "Lines of report");
+        lines.clear();
+        stats->getReport(lines, 1);
+        checkEqual(lines.size(), 3, "Lines of report per mount");
+    } catch (int ex) {
+        ret = ex;
+    }
+    delete stats;
+    Messaging::teardown();
+    return ret;
+}
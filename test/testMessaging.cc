@@ -0,0 +1,142 @@
+/*
+ * File:   testMessaging.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <fcntl.h>
+#include <fstream>
+#include <pthread.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include "Messaging.h"
+
+/*
+ * Rings of exited threads are reused. The messages fit into one ring, so
+ * none is dropped.
+ */
+#define THREADS 4
+#define MESSAGES (SKYLD_MESSAGING_RING / THREADS)
+/*
+ * Warnings exceeding the ring are not dropped either.
+ */
+#define WARNINGS (2 * SKYLD_MESSAGING_RING)
+#define OUTFILE "testMessaging.tmp"
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+                       const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+/*
+ * Sends numbered messages.
+ */
+static void *sendMessages(void *obj) {
+    long id = (long) obj;
+    int i;
+
+    for (i = 0; i < MESSAGES; i++) {
+        std::stringstream msg;
+
+        msg << id << " " << i;
+        Messaging::message(Messaging::INFORMATION, msg.str());
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    pthread_t threads[THREADS];
+    int next[THREADS + 1] = {0};
+    unsigned int lines = 0;
+    unsigned int ordered = 0;
+    std::ifstream in;
+    std::string line;
+    int saved;
+    int savedErr;
+    int fd;
+    long i;
+
+    try {
+        Messaging::setLevel(Messaging::INFORMATION);
+        checkEqual(Messaging::isEnabled(Messaging::DEBUG), 0,
+                   "Debug disabled");
+        checkEqual(Messaging::isEnabled(Messaging::WARNING), 1,
+                   "Warning enabled");
+
+        // Capture the console output.
+        fflush(stdout);
+        fflush(stderr);
+        saved = dup(STDOUT_FILENO);
+        savedErr = dup(STDERR_FILENO);
+        fd = open(OUTFILE, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+
+        Messaging::message(Messaging::DEBUG, "filtered");
+        for (i = 0; i < THREADS; i++) {
+            pthread_create(&threads[i], NULL, sendMessages, (void *) i);
+        }
+        for (i = 0; i < THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        for (i = 0; i < WARNINGS; i++) {
+            std::stringstream msg;
+
+            msg << THREADS << " " << i;
+            Messaging::message(Messaging::WARNING, msg.str());
+        }
+        // Deleting the singleton writes all queued messages.
+        Messaging::teardown();
+
+        fflush(stdout);
+        fflush(stderr);
+        dup2(saved, STDOUT_FILENO);
+        dup2(savedErr, STDERR_FILENO);
+        close(saved);
+        close(savedErr);
+
+        in.open(OUTFILE);
+        while (std::getline(in, line)) {
+            std::stringstream msg(line);
+            int id = -1;
+            int n = -1;
+
+            msg >> id >> n;
+            lines++;
+            if (id >= 0 && id <= THREADS && n == next[id]) {
+                next[id]++;
+                ordered++;
+            }
+        }
+        in.close();
+        remove(OUTFILE);
+        checkEqual(lines, THREADS * MESSAGES + WARNINGS, "Messages written");
+        checkEqual(ordered, THREADS * MESSAGES + WARNINGS,
+                   "Messages in order");
+    } catch (int ex) {
+        ret = ex;
+    }
+    Messaging::teardown();
+    return ret;
+}
@@ -0,0 +1,141 @@
+/*
+ * File:   testMetricsExporter.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Messaging.h"
+#include "MetricsExporter.h"
+
+#define SOCKET "testMetricsExporter.sock"
+#define METRICS "testMetricsExporter.prom"
+
+static void checkEqual(const std::string &actual, const std::string &expected,
+                       const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%s', expected '%s'.\n", lbl, actual.c_str(),
+               expected.c_str());
+        throw EXIT_FAILURE;
+    }
+}
+
+static void checkEqual(const unsigned long long actual,
+                       const unsigned long long expected, const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%llu', expected '%llu'.\n", lbl, actual,
+               expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+static void render(void *context, std::ostream &out) {
+    MetricsExporter::writeMetric(out, "test_events_total", "counter",
+                                 "Events.", 1234567890123ULL);
+}
+
+/*
+ * Connects to the socket, sends the request and returns the response.
+ */
+static std::string fetch(const char *request) {
+    struct sockaddr_un addr;
+    std::string response;
+    char buf[1024];
+    ssize_t len;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SOCKET);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof (addr))) {
+        close(fd);
+        printf("Cannot connect to %s.\n", SOCKET);
+        throw EXIT_FAILURE;
+    }
+    if (*request) {
+        send(fd, request, strlen(request), MSG_NOSIGNAL);
+    }
+    while ((len = read(fd, buf, sizeof (buf))) > 0) {
+        response.append(buf, len);
+    }
+    close(fd);
+    return response;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    const std::string expected =
+        "# HELP test_events_total Events.\n"
+        "# TYPE test_events_total counter\n"
+        "test_events_total 1234567890123\n";
+    MetricsExporter *me = NULL;
+    std::string response;
+    FILE *file;
+    char buf[1024];
+    size_t len;
+    int i;
+
+    try {
+        checkEqual(MetricsExporter::escape("/a\"b\\c\nd"),
+                   "/a\\\"b\\\\c\\nd", "Escape");
+
+        unlink(METRICS);
+        me = new MetricsExporter(SOCKET, METRICS, render, NULL);
+
+        // Without a request the metrics are sent after a timeout.
+        checkEqual(fetch(""), expected, "Plain");
+        checkEqual(fetch("\n\n"), expected, "Empty request");
+
+        response = fetch("GET /metrics HTTP/1.0\r\n\r\n");
+        checkEqual(response.compare(0, 17, "HTTP/1.0 200 OK\r\n"), 0,
+                   "HTTP status");
+        checkEqual(response.size() > expected.size(), 1, "HTTP header");
+        checkEqual(response.substr(response.size() - expected.size()),
+                   expected, "HTTP body");
+
+        // The file is written at start.
+        for (i = 0; i < 40 && access(METRICS, F_OK); i++) {
+            usleep(100000);
+        }
+        file = fopen(METRICS, "r");
+        if (file == NULL) {
+            printf("Cannot open %s.\n", METRICS);
+            throw EXIT_FAILURE;
+        }
+        len = fread(buf, 1, sizeof (buf), file);
+        fclose(file);
+        checkEqual(std::string(buf, len), expected, "File");
+
+        delete me;
+        me = NULL;
+        checkEqual(access(SOCKET, F_OK), -1, "Socket removed");
+        unlink(METRICS);
+    } catch (int ex) {
+        ret = ex;
+    }
+    if (me) {
+        delete me;
+    }
+    Messaging::teardown();
+    return ret;
+}
@@ -0,0 +1,93 @@
+/*
+ * File:   testPrefilter.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "Messaging.h"
+#include "Prefilter.h"
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+static void checkEqual(const std::string &actual, const std::string &expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%s', expected '%s'.\n", lbl, actual.c_str(),
+                expected.c_str());
+        throw EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    char tar[512];
+    ScanProfiles *sp;
+    Prefilter *p;
+    ScanProfile *profile;
+
+    Messaging::setLevel(Messaging::DEBUG);
+    memset(tar, 0, sizeof (tar));
+    memcpy(tar + 257, "ustar", 5);
+
+    try {
+        checkEqual(Prefilter::classify("\x89PNG\r\n\x1a\n....", 12),
+                Prefilter::MEDIA, "PNG");
+        checkEqual(Prefilter::classify("\x7f" "ELF\x02\x01", 6),
+                Prefilter::EXECUTABLE, "ELF");
+        checkEqual(Prefilter::classify(tar, sizeof (tar)), Prefilter::ARCHIVE,
+                "Tar");
+        checkEqual(Prefilter::classify(tar, 260), Prefilter::UNKNOWN,
+                "Truncated tar");
+        checkEqual(Prefilter::classify("", 0), Prefilter::UNKNOWN, "Empty");
+        checkEqual(Prefilter::getClassName(Prefilter::FONT), "font",
+                "Class name");
+
+        sp = new ScanProfiles();
+        sp->addProfile("light:pe");
+        p = new Prefilter(sp);
+        checkEqual(p->setSkip("media"), 0, "Skip media");
+        checkEqual(p->setSkip("movies"), 1, "Unknown class");
+        checkEqual(p->setProfile("archive:heavy"), 1, "Undefined profile");
+        checkEqual(p->setProfile("archive:light"), 0, "Profile for archives");
+        checkEqual(p->getAction(Prefilter::MEDIA, &profile), Prefilter::SKIP,
+                "Media skipped");
+        checkEqual(p->getAction(Prefilter::ARCHIVE, &profile),
+                Prefilter::FAST, "Archives fast");
+        checkEqual(profile->getName(), "light", "Archive profile");
+        checkEqual(p->getAction(Prefilter::UNKNOWN, &profile),
+                Prefilter::FULL, "Unknown full");
+        p->count(Prefilter::UNKNOWN, Prefilter::FULL, 1000, 1000000);
+        p->count(Prefilter::MEDIA, Prefilter::SKIP, 1000, 0);
+        delete p;
+        delete sp;
+    } catch (int ex) {
+        ret = ex;
+    }
+
+    Messaging::teardown();
+    return ret;
+}
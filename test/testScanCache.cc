@@ -113,6 +113,10 @@ int main(int argc, char *argv[]) {
         e->setCacheMaxSize(50);
         stat->st_dev = 2;
         stat->st_mtime = 100;
+        stat->st_ino = 101;
+        c->add(stat, 3);
+        checkEqual(c->getSize(), 500 - SKYLD_CACHE_SHRINK_STEP + 1,
+                   "Gradual cache resize");
 
         for (stat->st_ino = 100; stat->st_ino > 0; stat->st_ino--) {
             c->add(stat, 3);
@@ -123,8 +127,32 @@ int main(int argc, char *argv[]) {
             }
         }
         checkEqual(stat->st_ino, 51, "Cache resize");
-        
-        
+
+        // Check that the cache survives saving and loading.
+        stat->st_dev = 3;
+        stat->st_ino = 7;
+        stat->st_mtime = 200;
+        c->add(stat, 4);
+        checkEqual(c->save("testScanCache.tmp", 42), 0, "Save cache");
+        c->clear();
+        checkEqual(c->load("testScanCache.tmp", 41), 0,
+                "Load outdated cache");
+        checkEqual(c->get(stat), ScanCache::CACHE_MISS,
+                "Search after loading outdated cache");
+        checkEqual(c->load("testScanCache.tmp", 42), 50, "Load cache");
+        checkEqual(c->get(stat), 4, "Search after loading cache");
+        remove("testScanCache.tmp");
+
+        // Check that flushing a device keeps the other devices.
+        checkEqual(c->clear(2), 49, "Flush device");
+        checkEqual(c->getSize(), 1, "Size after flushing device");
+        checkEqual(c->get(stat), 4, "Search after flushing other device");
+
+        // Check that resetting the modification time is detected.
+        stat->st_ctim.tv_nsec = (stat->st_ctim.tv_nsec + 1) % 1000000000;
+        checkEqual(c->get(stat), ScanCache::CACHE_MISS,
+                "Search after status change");
+
     } catch (int ex) {
         ret = ex;
     }
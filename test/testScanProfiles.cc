@@ -0,0 +1,99 @@
+/*
+ * File:   testScanProfiles.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#include <clamav.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include "Messaging.h"
+#include "ScanProfiles.h"
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+static void checkEqual(const std::string &actual, const std::string &expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%s', expected '%s'.\n", lbl, actual.c_str(),
+                expected.c_str());
+        throw EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    const char *names[] = {"testScanProfiles.gz", "testScanProfiles.big",
+        "testScanProfiles.txt"};
+    const char *contents[] = {"\x1f\x8b\x08", "0123456789abcdef", "text"};
+    std::string rule;
+    char cwd[PATH_MAX];
+    ScanProfiles *p;
+    int fd[3];
+    int i;
+
+    Messaging::setLevel(Messaging::DEBUG);
+    if (getcwd(cwd, sizeof (cwd)) == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < 3; i++) {
+        FILE *f;
+
+        f = fopen(names[i], "w");
+        fputs(contents[i], f);
+        fclose(f);
+        fd[i] = open(names[i], O_RDONLY);
+    }
+
+    try {
+        p = new ScanProfiles();
+        checkEqual(p->addProfile("light:pe+elf"), 0, "Add profile");
+        checkEqual(p->addProfile("archive:archive"), 0, "Add profile");
+        checkEqual(p->addProfile("broken:exe"), 1, "Unknown file format");
+        checkEqual(p->addRule("missing:size=1"), 1, "Undefined profile");
+        checkEqual(p->addRule("light:magic=1f8"), 1, "Odd number of digits");
+        checkEqual(p->addRule("archive:magic=1f8b"), 0, "Add magic rule");
+        rule = std::string("light:mount=") + cwd + ":size=10";
+        checkEqual(p->addRule(rule.c_str()), 0, "Add mount rule");
+
+        checkEqual(p->select(fd[0])->getName(), "archive", "Magic");
+        checkEqual(p->select(fd[0])->getParseOptions(), CL_SCAN_PARSE_ARCHIVE,
+                "Parse options");
+        checkEqual(p->select(fd[1])->getName(), "light", "Mount and size");
+        checkEqual(p->select(fd[2])->getName(), "default", "No rule");
+        delete p;
+    } catch (int ex) {
+        ret = ex;
+    }
+
+    for (i = 0; i < 3; i++) {
+        close(fd[i]);
+        remove(names[i]);
+    }
+    Messaging::teardown();
+    return ret;
+}
@@ -0,0 +1,143 @@
+/*
+ * File:   testScanWorkers.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include "Environment.h"
+#include "Messaging.h"
+#include "ScanWorkers.h"
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+/*
+ * Returns the first byte of the file. Crashes on 'c' and hangs on 'h'.
+ */
+static int scanFunction(void *context, const struct ScanJob *job,
+                        unsigned int parseOptions, const char **virname) {
+    char c = 0;
+
+    if (pread(job->fd, &c, 1, 0) != 1) {
+        return -1;
+    }
+    if (c == 'c') {
+        abort();
+    }
+    if (c == 'h') {
+        sleep(100);
+    }
+    if (c == 'v') {
+        *virname = (const char *) context;
+    }
+    return c + parseOptions;
+}
+
+static int createFile(const char *name, const char *content) {
+    int fd;
+
+    fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1 || write(fd, content, strlen(content))
+            != (ssize_t) strlen(content)) {
+        printf("Cannot create %s.\n", name);
+        throw EXIT_FAILURE;
+    }
+    return fd;
+}
+
+static int scan(ScanWorkers *w, int fd, int *result, std::string &virname) {
+    struct ScanJob job;
+
+    job.fd = fd;
+    job.data = NULL;
+    job.size = 1;
+    job.map = NULL;
+    job.profile = NULL;
+    job.partial = 0;
+    *result = 0;
+    return w->scan(&job, 1, result, virname);
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    const char *names[] = {
+        "testScanWorkers.a", "testScanWorkers.v", "testScanWorkers.c",
+        "testScanWorkers.h"
+    };
+    int fd[4] = {-1, -1, -1, -1};
+    Environment *e;
+    ScanWorkers *w;
+    std::string virname;
+    int result;
+    int i;
+
+    e = new Environment();
+    e->setScanWorkers(2);
+    e->setScanWorkerTimeout(1);
+
+    try {
+        fd[0] = createFile(names[0], "a");
+        fd[1] = createFile(names[1], "v");
+        fd[2] = createFile(names[2], "c");
+        fd[3] = createFile(names[3], "h");
+        w = new ScanWorkers(e, scanFunction, (void *) "Test.Virus");
+
+        checkEqual(scan(w, fd[0], &result, virname), ScanWorkers::DONE,
+                   "Scanned");
+        checkEqual(result, 'a' + 1, "Result");
+        checkEqual(virname.empty(), 1, "No virus name");
+        checkEqual(scan(w, fd[1], &result, virname), ScanWorkers::DONE,
+                   "Scanned virus");
+        checkEqual(virname == "Test.Virus", 1, "Virus name");
+
+        // The workers are replaced.
+        for (i = 0; i < 3; i++) {
+            checkEqual(scan(w, fd[2], &result, virname), ScanWorkers::FAILED,
+                       "Crash");
+        }
+        checkEqual(scan(w, fd[3], &result, virname), ScanWorkers::FAILED,
+                   "Timeout");
+        for (i = 0; i < 4; i++) {
+            checkEqual(scan(w, fd[0], &result, virname), ScanWorkers::DONE,
+                       "Scanned after restart");
+            checkEqual(result, 'a' + 1, "Result after restart");
+        }
+        delete w;
+    } catch (int ex) {
+        ret = ex;
+    }
+
+    for (i = 0; i < 4; i++) {
+        if (fd[i] != -1) {
+            close(fd[i]);
+        }
+        remove(names[i]);
+    }
+    delete e;
+    Messaging::teardown();
+    return ret;
+}
@@ -0,0 +1,95 @@
+/*
+ * File:   testSha256.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "Sha256.h"
+
+static void checkEqual(const std::string &actual, const char *expected,
+        const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%s', expected '%s'.\n", lbl, actual.c_str(),
+                expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+static std::string hex(const unsigned char *digest) {
+    char buf[2 * SHA256_DIGEST_SIZE + 1];
+    int i;
+
+    for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        sprintf(buf + 2 * i, "%02x", digest[i]);
+    }
+    return buf;
+}
+
+static void checkVectors() {
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    std::string million(1000000, 'a');
+    Sha256 sha;
+    size_t i;
+
+    Sha256::hash("", 0, digest);
+    checkEqual(hex(digest),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            "Empty");
+    Sha256::hash("abc", 3, digest);
+    checkEqual(hex(digest),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            "abc");
+    Sha256::hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56,
+            digest);
+    checkEqual(hex(digest),
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            "Two blocks");
+    Sha256::hash(million.data(), million.size(), digest);
+    checkEqual(hex(digest),
+            "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            "Million");
+    // Feed the data in pieces not aligned to blocks.
+    for (i = 0; i < million.size(); i += 999) {
+        sha.update(million.data() + i,
+                i + 999 < million.size() ? 999 : million.size() - i);
+    }
+    sha.final(digest);
+    checkEqual(hex(digest),
+            "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            "Million in pieces");
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+
+    try {
+        if (Sha256::setAccelerated(1)) {
+            printf("Testing SHA instructions.\n");
+            checkVectors();
+        }
+        Sha256::setAccelerated(0);
+        printf("Testing portable implementation.\n");
+        checkVectors();
+    } catch (int ex) {
+        ret = ex;
+    }
+    return ret;
+}
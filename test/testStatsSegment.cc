@@ -0,0 +1,103 @@
+/*
+ * File:   testStatsSegment.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "Messaging.h"
+#include "StatsSegment.h"
+
+static void checkEqual(const unsigned long long actual,
+                       const unsigned long long expected, const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%llu', expected '%llu'.\n", lbl, actual,
+               expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+/*
+ * Publishes consistent values: each field equals the number of calls.
+ */
+static void collect(void *context, struct StatsValues *values) {
+    unsigned int *calls = (unsigned int *) context;
+
+    (*calls)++;
+    values->events = *calls;
+    values->scans = *calls;
+    values->queueDepth = *calls;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+    const char *filename = "testStatsSegment.stats";
+    StatsSegment *s = NULL;
+    struct StatsLayout *segment = NULL;
+    struct StatsLayout copy;
+    unsigned int calls = 0;
+    int fd;
+    int i;
+
+    try {
+        s = new StatsSegment(filename, collect, &calls);
+        fd = open(filename, O_RDONLY);
+        if (fd == -1) {
+            printf("Cannot open %s.\n", filename);
+            throw EXIT_FAILURE;
+        }
+        segment = (struct StatsLayout *) mmap(NULL, sizeof (copy), PROT_READ,
+                                              MAP_SHARED, fd, 0);
+        close(fd);
+        if (segment == MAP_FAILED) {
+            segment = NULL;
+            printf("Cannot map %s.\n", filename);
+            throw EXIT_FAILURE;
+        }
+        checkEqual(StatsSegment::read(segment, &copy), 0, "Read");
+        checkEqual(copy.pid, getpid(), "Process id");
+        checkEqual(copy.values.events, 1, "Published at start");
+        checkEqual(copy.sequence & 1, 0, "Sequence even");
+
+        // Wait for the next update.
+        for (i = 0; i < 40 && copy.values.events < 2; i++) {
+            usleep(100000);
+            checkEqual(StatsSegment::read(segment, &copy), 0, "Read again");
+        }
+        checkEqual(copy.values.events >= 2, 1, "Updated");
+        checkEqual(copy.values.scans, copy.values.events, "Consistent");
+        checkEqual(copy.values.queueDepth, copy.values.events,
+                   "Consistent queue depth");
+
+        delete s;
+        s = NULL;
+        checkEqual(access(filename, F_OK), -1, "Removed");
+    } catch (int ex) {
+        ret = ex;
+    }
+    if (segment) {
+        munmap(segment, sizeof (copy));
+    }
+    if (s) {
+        delete s;
+    }
+    Messaging::teardown();
+    return ret;
+}
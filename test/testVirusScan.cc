@@ -0,0 +1,52 @@
+/*
+ * File:   testVirusScan.cc
+ *
+ * Copyright 2016 Heinrich Schuchardt <xypron.glpk@gmx.de>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "Messaging.h"
+#include "VirusScan.h"
+
+static void checkEqual(const unsigned int actual, const unsigned int expected,
+                       const char *lbl) {
+    if (actual != expected) {
+        printf("%s: actual '%u', expected '%u'.\n", lbl, actual, expected);
+        throw EXIT_FAILURE;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_SUCCESS;
+
+    try {
+        checkEqual(VirusScan::classifyMatch("Eicar-Signature"),
+                   VirusScan::MATCH_VIRUS, "Virus");
+        checkEqual(VirusScan::classifyMatch(
+                       "Heuristics.Limits.Exceeded.MaxFileSize"),
+                   VirusScan::MATCH_LIMITS, "Limits exceeded");
+        // Heuristic alerts other than exceeded limits do not deny access.
+        checkEqual(VirusScan::classifyMatch("Heuristics.Encrypted.Zip"),
+                   VirusScan::MATCH_HEURISTIC, "Heuristic alert");
+        checkEqual(VirusScan::classifyMatch("Heuristics"),
+                   VirusScan::MATCH_VIRUS, "Incomplete prefix");
+    } catch (int ex) {
+        ret = ex;
+    }
+    Messaging::teardown();
+    return ret;
+}